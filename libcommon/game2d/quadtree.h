@@ -0,0 +1,927 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_COMMON_GAME2D_QUADTREE_H
+#define SCOTT_COMMON_GAME2D_QUADTREE_H
+
+#include <game2d/point.h>
+#include <game2d/rect.h>
+#include <common/assert.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * A point quadtree that maps positions inside of a fixed rectangle to
+ * values of type T.
+ *
+ * Nodes live in one contiguous pool and refer to each other by uint32
+ * index instead of by pointer. The four children of a node are always
+ * allocated together as one block, laid out in Morton (Z) order: top left,
+ * top right, bottom left, bottom right. Descending the tree is then just a
+ * matter of reading two bits of the position at each level. compact()
+ * rewrites the pool so that blocks are also in depth first Morton order,
+ * which keeps nodes that are near each other in space near each other in
+ * memory.
+ *
+ * Items are stored in a pool of their own and are identified by a stable
+ * ItemId handle. A leaf splits once it holds more than leafCapacity items,
+ * and a subtree is collapsed back into a single leaf once it has fewer
+ * than half that many. Moving an item within the cell of its leaf is a
+ * single write.
+ *
+ * Positions, rectangle and radius queries are all inclusive of their edges
+ * to match Rect::contains.
+ */
+template<typename T>
+class QuadTree
+{
+public:
+    typedef uint32_t ItemId;
+    static const ItemId NO_ITEM = 0xFFFFFFFFu;
+
+    /**
+     * Results for one query in a batch, as a range of the results array
+     */
+    struct QueryRange
+    {
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    /**
+     * Create an empty quadtree covering the given bounds
+     *
+     * \param  bounds        Area the quadtree covers. Width and height must be
+     *                       below 2^31
+     * \param  leafCapacity  Items a leaf holds before it is split
+     * \param  maxDepth      Deepest a leaf may be, regardless of capacity
+     */
+    QuadTree( const Rect& bounds,
+              unsigned int leafCapacity = 16,
+              unsigned int maxDepth = 16 )
+        : mNodes(),
+          mItems(),
+          mValues(),
+          mLeft( bounds.left() ),
+          mTop( bounds.top() ),
+          mWidth( bounds.width() ),
+          mHeight( bounds.height() ),
+          mLevels( 0 ),
+          mLeafCapacity( std::max( leafCapacity, 1u ) ),
+          mMaxDepth( 0 ),
+          mFreeItem( NONE ),
+          mFreeBlock( NONE ),
+          mFreeBlockCount( 0 ),
+          mSize( 0 )
+    {
+        ASSERT( mWidth < 0x80000000u && mHeight < 0x80000000u );
+
+        // Cells are square and a power of two wide. Bounds include their
+        // right and bottom edge, so the root is one bigger than the bounds
+        uint32_t extent = std::max( mWidth, mHeight );
+
+        while ( ( static_cast<uint64_t>( 1 ) << mLevels ) <= extent )
+        {
+            mLevels += 1;
+        }
+
+        mMaxDepth = std::min( maxDepth, mLevels );
+        clear();
+    }
+
+    /**
+     * Removes every item from the quadtree
+     */
+    void clear()
+    {
+        Node root = { NONE, NONE, 0, 0 };
+
+        mNodes.assign( 1, root );
+        mItems.clear();
+        mValues.clear();
+
+        mFreeItem       = NONE;
+        mFreeBlock      = NONE;
+        mFreeBlockCount = 0;
+        mSize           = 0;
+    }
+
+    /**
+     * Adds an item to the quadtree
+     *
+     * \return  Handle to the new item, or NO_ITEM if the position is
+     *          outside of the quadtree's bounds
+     */
+    ItemId insert( const Point& position, const T& value )
+    {
+        if (! inBounds( position ) )
+        {
+            return NO_ITEM;
+        }
+
+        ItemId id = allocateItem( value );
+
+        mItems[id].x = position.x() - mLeft;
+        mItems[id].y = position.y() - mTop;
+
+        insertItem( id );
+        mSize += 1;
+
+        return id;
+    }
+
+    /**
+     * Removes an item from the quadtree. Its handle may be reused by a
+     * later insert
+     */
+    void remove( ItemId id )
+    {
+        ASSERT( isValid( id ) );
+
+        removeItem( id );
+        freeItem( id );
+
+        mSize -= 1;
+    }
+
+    /**
+     * Moves an item to a new position
+     *
+     * \return  False if the new position is outside of the quadtree's
+     *          bounds, in which case the item stays where it was
+     */
+    bool move( ItemId id, const Point& position )
+    {
+        ASSERT( isValid( id ) );
+
+        if (! inBounds( position ) )
+        {
+            return false;
+        }
+
+        Item& item = mItems[id];
+        uint32_t x = position.x() - mLeft;
+        uint32_t y = position.y() - mTop;
+
+        // Most moves are small, and stay inside of the item's leaf
+        uint32_t shift = mLevels - mNodes[item.node].depth;
+
+        if ( ( x >> shift ) == ( item.x >> shift ) &&
+             ( y >> shift ) == ( item.y >> shift ) )
+        {
+            item.x = x;
+            item.y = y;
+            return true;
+        }
+
+        removeItem( id );
+
+        mItems[id].x = x;
+        mItems[id].y = y;
+
+        insertItem( id );
+        return true;
+    }
+
+    /**
+     * Checks if a handle refers to an item in the quadtree
+     */
+    bool isValid( ItemId id ) const
+    {
+        return ( id < mItems.size() && mItems[id].node != NONE );
+    }
+
+    Point position( ItemId id ) const
+    {
+        ASSERT( isValid( id ) );
+        return Point( mItems[id].x + mLeft, mItems[id].y + mTop );
+    }
+
+    const T& value( ItemId id ) const
+    {
+        ASSERT( isValid( id ) );
+        return mValues[id];
+    }
+
+    T& value( ItemId id )
+    {
+        ASSERT( isValid( id ) );
+        return mValues[id];
+    }
+
+    /**
+     * Number of items in the quadtree
+     */
+    std::size_t size() const
+    {
+        return mSize;
+    }
+
+    /**
+     * Number of nodes in use, including the root
+     */
+    std::size_t nodeCount() const
+    {
+        return mNodes.size() - mFreeBlockCount * 4;
+    }
+
+    Rect bounds() const
+    {
+        return Rect( mLeft, mTop, mWidth, mHeight );
+    }
+
+    /**
+     * Finds every item inside of a rectangle, and appends their handles
+     * to results
+     */
+    void queryRect( const Rect& area, std::vector<ItemId>& results ) const
+    {
+        // Clip the query to the bounds, in local coordinates
+        int64_t x0 = static_cast<int64_t>( area.left() )   - mLeft;
+        int64_t y0 = static_cast<int64_t>( area.top() )    - mTop;
+        int64_t x1 = static_cast<int64_t>( area.right() )  - mLeft;
+        int64_t y1 = static_cast<int64_t>( area.bottom() ) - mTop;
+
+        if ( x1 < 0 || y1 < 0 || x0 > mWidth || y0 > mHeight )
+        {
+            return;
+        }
+
+        RectQuery query = { static_cast<uint32_t>( std::max<int64_t>( x0, 0 ) ),
+                            static_cast<uint32_t>( std::max<int64_t>( y0, 0 ) ),
+                            static_cast<uint32_t>( std::min<int64_t>( x1, mWidth ) ),
+                            static_cast<uint32_t>( std::min<int64_t>( y1, mHeight ) ) };
+
+        search( query, results );
+    }
+
+    /**
+     * Finds every item within radius of a point, and appends their handles
+     * to results
+     */
+    void queryRadius( const Point& center,
+                      unsigned int radius,
+                      std::vector<ItemId>& results ) const
+    {
+        RadiusQuery query = { static_cast<int64_t>( center.x() ) - mLeft,
+                              static_cast<int64_t>( center.y() ) - mTop,
+                              static_cast<uint64_t>( radius ) * radius };
+
+        search( query, results );
+    }
+
+    /**
+     * Runs a batch of rectangle queries. Results for all of the queries are
+     * appended to one array, and ranges[i] says where the results for
+     * areas[i] are.
+     *
+     * The queries are run in Morton order of their centers rather than in
+     * the order given, so that queries near each other run one after the
+     * other and find the nodes they need still in the cache.
+     */
+    void queryRects( const std::vector<Rect>& areas,
+                     std::vector<ItemId>& results,
+                     std::vector<QueryRange>& ranges ) const
+    {
+        std::vector<std::pair<uint64_t, uint32_t> > order( areas.size() );
+
+        for ( std::size_t i = 0; i < areas.size(); ++i )
+        {
+            order[i].first  = mortonCode( areas[i].left() + areas[i].width() / 2,
+                                          areas[i].top() + areas[i].height() / 2 );
+            order[i].second = static_cast<uint32_t>( i );
+        }
+
+        std::sort( order.begin(), order.end() );
+        ranges.resize( areas.size() );
+
+        for ( std::size_t i = 0; i < order.size(); ++i )
+        {
+            QueryRange& range = ranges[order[i].second];
+
+            range.begin = static_cast<uint32_t>( results.size() );
+            queryRect( areas[order[i].second], results );
+            range.end   = static_cast<uint32_t>( results.size() );
+        }
+    }
+
+    /**
+     * Runs a batch of radius queries that share the same radius, in the
+     * same way as queryRects
+     */
+    void queryRadii( const std::vector<Point>& centers,
+                     unsigned int radius,
+                     std::vector<ItemId>& results,
+                     std::vector<QueryRange>& ranges ) const
+    {
+        std::vector<std::pair<uint64_t, uint32_t> > order( centers.size() );
+
+        for ( std::size_t i = 0; i < centers.size(); ++i )
+        {
+            order[i].first  = mortonCode( centers[i].x(), centers[i].y() );
+            order[i].second = static_cast<uint32_t>( i );
+        }
+
+        std::sort( order.begin(), order.end() );
+        ranges.resize( centers.size() );
+
+        for ( std::size_t i = 0; i < order.size(); ++i )
+        {
+            QueryRange& range = ranges[order[i].second];
+
+            range.begin = static_cast<uint32_t>( results.size() );
+            queryRadius( centers[order[i].second], radius, results );
+            range.end   = static_cast<uint32_t>( results.size() );
+        }
+    }
+
+    /**
+     * Finds the item closest to a point
+     *
+     * \return  Handle of the closest item, or NO_ITEM if the quadtree is
+     *          empty. Ties are broken arbitrarily
+     */
+    ItemId nearest( const Point& position ) const
+    {
+        int64_t px = static_cast<int64_t>( position.x() ) - mLeft;
+        int64_t py = static_cast<int64_t>( position.y() ) - mTop;
+
+        ItemId best         = NO_ITEM;
+        uint64_t bestDist   = ~static_cast<uint64_t>( 0 );
+        Visit stack[MAX_STACK];
+        std::size_t top     = 0;
+
+        Visit root = { 0, 0, 0 };
+        stack[top++] = root;
+
+        while ( top > 0 )
+        {
+            Visit visit  = stack[--top];
+            const Node& node = mNodes[visit.node];
+            uint32_t size    = cellSize( node.depth );
+
+            if ( node.count == 0 ||
+                 boxDistance( px, py, visit.x, visit.y, size ) >= bestDist )
+            {
+                continue;
+            }
+
+            if ( node.firstChild == NONE )
+            {
+                for ( uint32_t id = node.firstItem; id != NONE; id = mItems[id].next )
+                {
+                    uint64_t dist = pointDistance( px, py, mItems[id].x, mItems[id].y );
+
+                    if ( dist < bestDist )
+                    {
+                        best     = id;
+                        bestDist = dist;
+                    }
+                }
+
+                continue;
+            }
+
+            // Push the furthest child first so the nearest is searched
+            // first, which tightens bestDist as early as possible
+            uint32_t half = size / 2;
+            std::pair<uint64_t, uint32_t> children[4];
+
+            for ( uint32_t i = 0; i < 4; ++i )
+            {
+                children[i].first  = boxDistance( px, py,
+                                                  visit.x + ( i & 1 ) * half,
+                                                  visit.y + ( i >> 1 ) * half,
+                                                  half );
+                children[i].second = i;
+            }
+
+            std::sort( children, children + 4 );
+
+            for ( int i = 3; i >= 0; --i )
+            {
+                uint32_t c = children[i].second;
+                Visit child = { node.firstChild + c,
+                                visit.x + ( c & 1 ) * half,
+                                visit.y + ( c >> 1 ) * half };
+
+                stack[top++] = child;
+            }
+        }
+
+        return best;
+    }
+
+    /**
+     * Rewrites the node pool so that child blocks are stored in depth
+     * first Morton order, and frees unused blocks. Item handles are not
+     * affected. Worth calling after a lot of items have been inserted or
+     * moved.
+     */
+    void compact()
+    {
+        std::vector<Node> nodes;
+        nodes.reserve( nodeCount() );
+        nodes.push_back( mNodes[0] );
+
+        compactSubtree( 0, 0, nodes );
+
+        mNodes.swap( nodes );
+        mFreeBlock      = NONE;
+        mFreeBlockCount = 0;
+    }
+
+private:
+    static const uint32_t NONE = 0xFFFFFFFFu;
+
+    // A node's children are four consecutive nodes starting at firstChild,
+    // or NONE for a leaf. Leaves keep a doubly linked list of their items
+    // starting at firstItem. count is the number of items in the whole
+    // subtree. Free blocks chain together through firstItem.
+    struct Node
+    {
+        uint32_t firstChild;
+        uint32_t firstItem;
+        uint32_t count;
+        uint32_t depth;
+    };
+
+    // Position is relative to the top left of the bounds. node is the leaf
+    // holding the item, or NONE if the item is free. Free items chain
+    // together through next.
+    struct Item
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t node;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    struct Visit
+    {
+        uint32_t node;
+        uint32_t x;
+        uint32_t y;
+    };
+
+    struct RectQuery
+    {
+        uint32_t x0, y0, x1, y1;
+
+        bool overlaps( uint32_t x, uint32_t y, uint32_t size ) const
+        {
+            return ( x <= x1 && y <= y1 && x + ( size - 1 ) >= x0 && y + ( size - 1 ) >= y0 );
+        }
+
+        bool covers( uint32_t x, uint32_t y, uint32_t size ) const
+        {
+            return ( x >= x0 && y >= y0 && x + ( size - 1 ) <= x1 && y + ( size - 1 ) <= y1 );
+        }
+
+        bool contains( uint32_t x, uint32_t y ) const
+        {
+            return ( x >= x0 && x <= x1 && y >= y0 && y <= y1 );
+        }
+    };
+
+    struct RadiusQuery
+    {
+        int64_t x, y;
+        uint64_t radius2;
+
+        bool overlaps( uint32_t cx, uint32_t cy, uint32_t size ) const
+        {
+            return ( boxDistance( x, y, cx, cy, size ) <= radius2 );
+        }
+
+        bool covers( uint32_t cx, uint32_t cy, uint32_t size ) const
+        {
+            int64_t dx = std::max( x - cx, static_cast<int64_t>( cx ) + size - 1 - x );
+            int64_t dy = std::max( y - cy, static_cast<int64_t>( cy ) + size - 1 - y );
+
+            return ( static_cast<uint64_t>( dx * dx + dy * dy ) <= radius2 );
+        }
+
+        bool contains( uint32_t px, uint32_t py ) const
+        {
+            return ( pointDistance( x, y, px, py ) <= radius2 );
+        }
+    };
+
+    // Each level of the tree leaves at most three siblings on the stack
+    static const std::size_t MAX_STACK = 4 * 33;
+
+    bool inBounds( const Point& position ) const
+    {
+        return ( position.x() >= mLeft && position.x() - mLeft <= mWidth &&
+                 position.y() >= mTop  && position.y() - mTop  <= mHeight );
+    }
+
+    uint32_t cellSize( uint32_t depth ) const
+    {
+        return static_cast<uint32_t>( static_cast<uint64_t>( 1 ) << ( mLevels - depth ) );
+    }
+
+    uint32_t childIndex( uint32_t x, uint32_t y, uint32_t depth ) const
+    {
+        uint32_t shift = mLevels - 1 - depth;
+        return ( ( ( y >> shift ) & 1 ) << 1 ) | ( ( x >> shift ) & 1 );
+    }
+
+    static uint64_t pointDistance( int64_t px, int64_t py, uint32_t x, uint32_t y )
+    {
+        int64_t dx = px - x;
+        int64_t dy = py - y;
+
+        return static_cast<uint64_t>( dx * dx + dy * dy );
+    }
+
+    // Squared distance from a point to the nearest point of a cell
+    static uint64_t boxDistance( int64_t px, int64_t py,
+                                 uint32_t x, uint32_t y, uint32_t size )
+    {
+        int64_t dx = std::max<int64_t>( 0, std::max<int64_t>( x - px, px - ( static_cast<int64_t>( x ) + size - 1 ) ) );
+        int64_t dy = std::max<int64_t>( 0, std::max<int64_t>( y - py, py - ( static_cast<int64_t>( y ) + size - 1 ) ) );
+
+        return static_cast<uint64_t>( dx * dx + dy * dy );
+    }
+
+    // Interleaves the bits of a position in world coordinates, clamped to
+    // the bounds, into its position along the Z curve
+    uint64_t mortonCode( uint32_t x, uint32_t y ) const
+    {
+        uint64_t lx = std::min( x - std::min( x, mLeft ), mWidth );
+        uint64_t ly = std::min( y - std::min( y, mTop ),  mHeight );
+
+        return spreadBits( lx ) | ( spreadBits( ly ) << 1 );
+    }
+
+    static uint64_t spreadBits( uint64_t v )
+    {
+        v = ( v | ( v << 16 ) ) & 0x0000FFFF0000FFFFull;
+        v = ( v | ( v << 8 ) )  & 0x00FF00FF00FF00FFull;
+        v = ( v | ( v << 4 ) )  & 0x0F0F0F0F0F0F0F0Full;
+        v = ( v | ( v << 2 ) )  & 0x3333333333333333ull;
+        v = ( v | ( v << 1 ) )  & 0x5555555555555555ull;
+
+        return v;
+    }
+
+    template<typename Query>
+    void search( const Query& query, std::vector<ItemId>& results ) const
+    {
+        Visit stack[MAX_STACK];
+        std::size_t top = 0;
+
+        Visit root = { 0, 0, 0 };
+        stack[top++] = root;
+
+        while ( top > 0 )
+        {
+            Visit visit      = stack[--top];
+            const Node& node = mNodes[visit.node];
+            uint32_t size    = cellSize( node.depth );
+
+            if ( node.count == 0 || ! query.overlaps( visit.x, visit.y, size ) )
+            {
+                continue;
+            }
+
+            if ( query.covers( visit.x, visit.y, size ) )
+            {
+                appendSubtree( visit.node, results );
+            }
+            else if ( node.firstChild == NONE )
+            {
+                for ( uint32_t id = node.firstItem; id != NONE; id = mItems[id].next )
+                {
+                    if ( query.contains( mItems[id].x, mItems[id].y ) )
+                    {
+                        results.push_back( id );
+                    }
+                }
+            }
+            else
+            {
+                uint32_t half = size / 2;
+
+                for ( uint32_t i = 0; i < 4; ++i )
+                {
+                    Visit child = { node.firstChild + i,
+                                    visit.x + ( i & 1 ) * half,
+                                    visit.y + ( i >> 1 ) * half };
+
+                    stack[top++] = child;
+                }
+            }
+        }
+    }
+
+    void appendSubtree( uint32_t index, std::vector<ItemId>& results ) const
+    {
+        const Node& node = mNodes[index];
+
+        if ( node.firstChild == NONE )
+        {
+            for ( uint32_t id = node.firstItem; id != NONE; id = mItems[id].next )
+            {
+                results.push_back( id );
+            }
+        }
+        else
+        {
+            for ( uint32_t i = 0; i < 4; ++i )
+            {
+                if ( mNodes[node.firstChild + i].count > 0 )
+                {
+                    appendSubtree( node.firstChild + i, results );
+                }
+            }
+        }
+    }
+
+    void insertItem( ItemId id )
+    {
+        uint32_t x    = mItems[id].x;
+        uint32_t y    = mItems[id].y;
+        uint32_t node = 0;
+
+        while ( true )
+        {
+            Node& current = mNodes[node];
+            current.count += 1;
+
+            if ( current.firstChild == NONE )
+            {
+                linkItem( node, id );
+
+                if ( current.count > mLeafCapacity && current.depth < mMaxDepth )
+                {
+                    split( node );
+                }
+
+                return;
+            }
+
+            node = current.firstChild + childIndex( x, y, current.depth );
+        }
+    }
+
+    void removeItem( ItemId id )
+    {
+        uint32_t x        = mItems[id].x;
+        uint32_t y        = mItems[id].y;
+        uint32_t node     = 0;
+        uint32_t collapse = NONE;
+
+        unlinkItem( id );
+
+        // Walk down to the item's leaf taking it out of every count on the
+        // way, and remember the highest node small enough to collapse
+        while ( true )
+        {
+            Node& current = mNodes[node];
+            current.count -= 1;
+
+            if ( current.firstChild == NONE )
+            {
+                break;
+            }
+
+            if ( collapse == NONE && current.count <= mLeafCapacity / 2 )
+            {
+                collapse = node;
+            }
+
+            node = current.firstChild + childIndex( x, y, current.depth );
+        }
+
+        if ( collapse != NONE )
+        {
+            uint32_t block = mNodes[collapse].firstChild;
+
+            mNodes[collapse].firstChild = NONE;
+            mNodes[collapse].firstItem  = NONE;
+
+            gatherItems( block, collapse );
+        }
+    }
+
+    void split( uint32_t node )
+    {
+        uint32_t depth = mNodes[node].depth;
+        uint32_t block = allocateBlock( depth + 1 );
+        uint32_t id    = mNodes[node].firstItem;
+
+        mNodes[node].firstChild = block;
+        mNodes[node].firstItem  = NONE;
+
+        while ( id != NONE )
+        {
+            uint32_t next  = mItems[id].next;
+            uint32_t child = block + childIndex( mItems[id].x, mItems[id].y, depth );
+
+            mNodes[child].count += 1;
+            linkItem( child, id );
+
+            id = next;
+        }
+
+        // Everything may have landed in the same child
+        for ( uint32_t i = 0; i < 4; ++i )
+        {
+            if ( mNodes[block + i].count > mLeafCapacity && depth + 1 < mMaxDepth )
+            {
+                split( block + i );
+            }
+        }
+    }
+
+    // Moves every item under a block of children into a leaf, and frees
+    // the blocks
+    void gatherItems( uint32_t block, uint32_t leaf )
+    {
+        for ( uint32_t i = 0; i < 4; ++i )
+        {
+            const Node& child = mNodes[block + i];
+
+            if ( child.firstChild != NONE )
+            {
+                gatherItems( child.firstChild, leaf );
+            }
+            else
+            {
+                uint32_t id = child.firstItem;
+
+                while ( id != NONE )
+                {
+                    uint32_t next = mItems[id].next;
+                    linkItem( leaf, id );
+                    id = next;
+                }
+            }
+        }
+
+        mNodes[block].firstChild = NONE;
+        mNodes[block].firstItem  = mFreeBlock;
+        mFreeBlock               = block;
+        mFreeBlockCount         += 1;
+    }
+
+    void compactSubtree( uint32_t oldIndex, uint32_t newIndex, std::vector<Node>& nodes )
+    {
+        const Node old = mNodes[oldIndex];
+
+        if ( old.firstChild == NONE )
+        {
+            for ( uint32_t id = old.firstItem; id != NONE; id = mItems[id].next )
+            {
+                mItems[id].node = newIndex;
+            }
+
+            return;
+        }
+
+        uint32_t block = static_cast<uint32_t>( nodes.size() );
+
+        for ( uint32_t i = 0; i < 4; ++i )
+        {
+            nodes.push_back( mNodes[old.firstChild + i] );
+        }
+
+        nodes[newIndex].firstChild = block;
+
+        for ( uint32_t i = 0; i < 4; ++i )
+        {
+            compactSubtree( old.firstChild + i, block + i, nodes );
+        }
+    }
+
+    uint32_t allocateBlock( uint32_t depth )
+    {
+        uint32_t block = mFreeBlock;
+
+        if ( block != NONE )
+        {
+            mFreeBlock       = mNodes[block].firstItem;
+            mFreeBlockCount -= 1;
+        }
+        else
+        {
+            block = static_cast<uint32_t>( mNodes.size() );
+            mNodes.resize( mNodes.size() + 4 );
+        }
+
+        for ( uint32_t i = 0; i < 4; ++i )
+        {
+            Node child = { NONE, NONE, 0, depth };
+            mNodes[block + i] = child;
+        }
+
+        return block;
+    }
+
+    ItemId allocateItem( const T& value )
+    {
+        ItemId id = mFreeItem;
+
+        if ( id != NONE )
+        {
+            mFreeItem   = mItems[id].next;
+            mValues[id] = value;
+        }
+        else
+        {
+            id = static_cast<ItemId>( mItems.size() );
+
+            mItems.push_back( Item() );
+            mValues.push_back( value );
+        }
+
+        return id;
+    }
+
+    void freeItem( ItemId id )
+    {
+        mItems[id].node = NONE;
+        mItems[id].next = mFreeItem;
+        mFreeItem       = id;
+    }
+
+    void linkItem( uint32_t node, ItemId id )
+    {
+        Item& item = mItems[id];
+
+        item.node = node;
+        item.prev = NONE;
+        item.next = mNodes[node].firstItem;
+
+        if ( item.next != NONE )
+        {
+            mItems[item.next].prev = id;
+        }
+
+        mNodes[node].firstItem = id;
+    }
+
+    void unlinkItem( ItemId id )
+    {
+        Item& item = mItems[id];
+
+        if ( item.prev != NONE )
+        {
+            mItems[item.prev].next = item.next;
+        }
+        else
+        {
+            mNodes[item.node].firstItem = item.next;
+        }
+
+        if ( item.next != NONE )
+        {
+            mItems[item.next].prev = item.prev;
+        }
+    }
+
+private:
+    std::vector<Node> mNodes;
+    std::vector<Item> mItems;
+    std::vector<T> mValues;
+    uint32_t mLeft;
+    uint32_t mTop;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mLevels;           // log2 of the root cell's size
+    uint32_t mLeafCapacity;
+    uint32_t mMaxDepth;
+    uint32_t mFreeItem;
+    uint32_t mFreeBlock;
+    uint32_t mFreeBlockCount;
+    std::size_t mSize;
+};
+
+template<typename T>
+const typename QuadTree<T>::ItemId QuadTree<T>::NO_ITEM;
+
+template<typename T>
+const uint32_t QuadTree<T>::NONE;
+
+template<typename T>
+const std::size_t QuadTree<T>::MAX_STACK;
+
+#endif
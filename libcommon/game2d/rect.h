@@ -158,20 +158,21 @@ public:
 
     bool contains( const Point& point ) const
     {
-        Point pt = point - mTopLeft;
-
-        return ( pt.x() >= 0.0f && pt.x() <= mSize.x() &&
-                 pt.y() >= 0.0f && pt.y() <= mSize.y() );
+        // Compared directly, since Point subtraction clamps at zero
+        return ( point.x() >= left() && point.x() <= right() &&
+                 point.y() >= top() && point.y() <= bottom() );
     }
 
-    bool contains( const Rect& /*rect*/ ) const
+    bool contains( const Rect& rect ) const
     {
-        return false;
+        return ( rect.left() >= left() && rect.right() <= right() &&
+                 rect.top() >= top() && rect.bottom() <= bottom() );
     }
 
-    bool intersects( const Rect& /*rect*/ ) const
+    bool intersects( const Rect& rect ) const
     {
-        return false;
+        return ( rect.left() <= right() && left() <= rect.right() &&
+                 rect.top() <= bottom() && top() <= rect.bottom() );
     }
 
 private:
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "game2d/spatialhashgrid.h"
+#include <common/assert.h>
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace
+{
+    // Buckets used when the grid picks its own size, per object
+    const std::size_t BUCKETS_PER_OBJECT = 2;
+    const std::size_t MIN_BUCKETS        = 16;
+
+    // Below this many entries per thread, threads cost more than they save
+    const std::size_t MIN_ENTRIES_PER_THREAD = 4096;
+
+    uint32_t nextPowerOfTwo( std::size_t value )
+    {
+        uint32_t result = 1;
+
+        while ( result < value && result < 0x80000000u )
+        {
+            result <<= 1;
+        }
+
+        return result;
+    }
+}
+
+/**
+ * Create an empty grid
+ *
+ * \param  cellSize     Width and height of a cell, must not be zero
+ * \param  bucketCount  Buckets the cells are hashed into, rounded up to a
+ *                      power of two. Zero lets rebuild() pick a count from
+ *                      the number of objects every tick
+ */
+SpatialHashGrid::SpatialHashGrid( unsigned int cellSize, unsigned int bucketCount )
+    : mCellSize( cellSize ),
+      mFixedBucketCount( bucketCount > 0 ? nextPowerOfTwo( bucketCount ) : 0 ),
+      mBucketMask( 0 ),
+      mObjectCount( 0 ),
+      mEntries(),
+      mBucketStart()
+{
+    ASSERT( cellSize > 0 );
+    clear();
+}
+
+/**
+ * Replaces the contents of the grid with the given rectangles. Each
+ * rectangle is identified by its index in the vector
+ */
+void SpatialHashGrid::rebuild( const std::vector<Rect>& objects )
+{
+    uint32_t buckets = mFixedBucketCount;
+
+    if ( buckets == 0 )
+    {
+        buckets = nextPowerOfTwo( std::max( objects.size() * BUCKETS_PER_OBJECT,
+                                            MIN_BUCKETS ) );
+    }
+
+    mBucketMask  = buckets - 1;
+    mObjectCount = objects.size();
+    mBucketStart.assign( buckets + 1, 0 );
+
+    // First pass counts the entries that land in each bucket, and a running
+    // sum turns the counts into the end of each bucket
+    std::size_t total = 0;
+
+    for ( std::size_t i = 0; i < objects.size(); ++i )
+    {
+        const Rect& r = objects[i];
+        const uint32_t x0 = r.left() / mCellSize, x1 = r.right() / mCellSize;
+        const uint32_t y0 = r.top() / mCellSize,  y1 = r.bottom() / mCellSize;
+
+        for ( uint32_t cy = y0; cy <= y1; ++cy )
+        {
+            for ( uint32_t cx = x0; cx <= x1; ++cx )
+            {
+                mBucketStart[ bucketFor( cx, cy ) ] += 1;
+                total += 1;
+            }
+        }
+    }
+
+    ASSERT( total < 0xFFFFFFFFu );
+
+    for ( uint32_t b = 1; b < buckets; ++b )
+    {
+        mBucketStart[b] += mBucketStart[b - 1];
+    }
+
+    mBucketStart[buckets] = static_cast<uint32_t>( total );
+
+    // Second pass fills every bucket from its end, which leaves each
+    // bucket's slot in mBucketStart pointing at its first entry
+    mEntries.resize( total );
+
+    for ( std::size_t i = 0; i < objects.size(); ++i )
+    {
+        const Rect& r = objects[i];
+        Entry entry = { 0, 0, r.left(), r.top(), r.right(), r.bottom(),
+                        static_cast<ObjectId>( i ) };
+
+        for ( uint32_t cy = entry.top / mCellSize; cy <= entry.bottom / mCellSize; ++cy )
+        {
+            for ( uint32_t cx = entry.left / mCellSize; cx <= entry.right / mCellSize; ++cx )
+            {
+                entry.cellX = cx;
+                entry.cellY = cy;
+
+                mEntries[ --mBucketStart[ bucketFor( cx, cy ) ] ] = entry;
+            }
+        }
+    }
+}
+
+/**
+ * Removes every object from the grid. Memory is kept for the next rebuild
+ */
+void SpatialHashGrid::clear()
+{
+    mBucketMask  = 0;
+    mObjectCount = 0;
+
+    mEntries.clear();
+    mBucketStart.assign( 2, 0 );
+}
+
+/**
+ * Finds every pair of objects whose rectangles overlap. Replaces the
+ * contents of pairs, which come out in no particular order
+ */
+void SpatialHashGrid::findPairs( std::vector<Pair>& pairs ) const
+{
+    pairs.clear();
+    findPairsInBuckets( 0, bucketCount(), pairs );
+}
+
+/**
+ * Finds every pair of objects whose rectangles overlap, splitting the work
+ * across up to threadCount threads. The calling thread takes a share, and
+ * small grids are not split at all. Replaces the contents of pairs
+ */
+void SpatialHashGrid::findPairs( std::vector<Pair>& pairs,
+                                 unsigned int threadCount ) const
+{
+    std::size_t threads = std::min<std::size_t>(
+        threadCount, mEntries.size() / MIN_ENTRIES_PER_THREAD );
+
+    if ( threads <= 1 )
+    {
+        findPairs( pairs );
+        return;
+    }
+
+    // Cut the buckets into ranges holding about the same number of entries
+    std::vector<std::size_t> firstBucket( threads + 1, bucketCount() );
+    firstBucket[0] = 0;
+
+    for ( std::size_t t = 1; t < threads; ++t )
+    {
+        uint32_t target = static_cast<uint32_t>( mEntries.size() * t / threads );
+
+        firstBucket[t] = std::lower_bound( mBucketStart.begin(),
+                                           mBucketStart.end() - 1,
+                                           target ) - mBucketStart.begin();
+    }
+
+    std::vector< std::vector<Pair> > found( threads );
+    std::vector<std::thread> workers;
+
+    for ( std::size_t t = 1; t < threads; ++t )
+    {
+        workers.push_back( std::thread( &SpatialHashGrid::findPairsInBuckets,
+                                        this,
+                                        firstBucket[t],
+                                        firstBucket[t + 1],
+                                        std::ref( found[t] ) ) );
+    }
+
+    pairs.clear();
+    findPairsInBuckets( firstBucket[0], firstBucket[1], pairs );
+
+    for ( std::size_t t = 1; t < threads; ++t )
+    {
+        workers[t - 1].join();
+        pairs.insert( pairs.end(), found[t].begin(), found[t].end() );
+    }
+}
+
+/**
+ * Appends the id of every object whose rectangle overlaps area to results.
+ * Each object is reported once
+ */
+void SpatialHashGrid::query( const Rect& area, std::vector<ObjectId>& results ) const
+{
+    if ( mEntries.empty() )
+    {
+        return;
+    }
+
+    const uint32_t left = area.left(), right  = area.right();
+    const uint32_t top  = area.top(),  bottom = area.bottom();
+
+    for ( uint32_t cy = top / mCellSize; cy <= bottom / mCellSize; ++cy )
+    {
+        for ( uint32_t cx = left / mCellSize; cx <= right / mCellSize; ++cx )
+        {
+            uint32_t bucket = bucketFor( cx, cy );
+
+            for ( uint32_t i = mBucketStart[bucket]; i < mBucketStart[bucket + 1]; ++i )
+            {
+                const Entry& e = mEntries[i];
+
+                if ( e.cellX != cx || e.cellY != cy ||
+                     e.left > right || left > e.right ||
+                     e.top > bottom || top > e.bottom )
+                {
+                    continue;
+                }
+
+                // Only the cell holding the top left of the overlap reports it
+                if ( std::max( e.left, left ) / mCellSize == cx &&
+                     std::max( e.top, top ) / mCellSize == cy )
+                {
+                    results.push_back( e.object );
+                }
+            }
+        }
+    }
+}
+
+unsigned int SpatialHashGrid::cellSize() const
+{
+    return mCellSize;
+}
+
+std::size_t SpatialHashGrid::bucketCount() const
+{
+    return mBucketStart.size() - 1;
+}
+
+std::size_t SpatialHashGrid::objectCount() const
+{
+    return mObjectCount;
+}
+
+/**
+ * Number of (object, cell) entries, which is at least the object count
+ */
+std::size_t SpatialHashGrid::entryCount() const
+{
+    return mEntries.size();
+}
+
+uint32_t SpatialHashGrid::bucketFor( uint32_t cellX, uint32_t cellY ) const
+{
+    return ( ( cellX * 73856093u ) ^ ( cellY * 19349663u ) ) & mBucketMask;
+}
+
+void SpatialHashGrid::findPairsInBuckets( std::size_t firstBucket,
+                                          std::size_t lastBucket,
+                                          std::vector<Pair>& pairs ) const
+{
+    for ( std::size_t bucket = firstBucket; bucket < lastBucket; ++bucket )
+    {
+        const uint32_t end = mBucketStart[bucket + 1];
+
+        for ( uint32_t i = mBucketStart[bucket]; i < end; ++i )
+        {
+            const Entry& a = mEntries[i];
+
+            for ( uint32_t j = i + 1; j < end; ++j )
+            {
+                const Entry& b = mEntries[j];
+
+                // Different cells can share a bucket
+                if ( a.cellX != b.cellX || a.cellY != b.cellY ||
+                     a.left > b.right || b.left > a.right ||
+                     a.top > b.bottom || b.top > a.bottom )
+                {
+                    continue;
+                }
+
+                if ( std::max( a.left, b.left ) / mCellSize != a.cellX ||
+                     std::max( a.top, b.top ) / mCellSize != a.cellY )
+                {
+                    continue;
+                }
+
+                Pair pair = { std::min( a.object, b.object ),
+                              std::max( a.object, b.object ) };
+                pairs.push_back( pair );
+            }
+        }
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_COMMON_GAME2D_SPATIALHASHGRID_H
+#define SCOTT_COMMON_GAME2D_SPATIALHASHGRID_H
+
+#include <game2d/rect.h>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Broad phase overlap tests for a large number of rectangles that move
+ * every tick.
+ *
+ * Unlike FixedGrid, the grid is unbounded: space is cut into square cells
+ * of cellSize units and each cell is hashed into one of a power of two
+ * number of buckets. rebuild() throws away the previous tick and sorts an
+ * entry for every cell that every rectangle touches into a single flat
+ * array with a two pass counting sort, so the entries of a bucket are
+ * contiguous and nothing is allocated once the arrays have grown to fit.
+ *
+ * findPairs() then only has to compare the entries inside each bucket. A
+ * pair of rectangles that share several cells is only reported by the
+ * cell holding the top left corner of their overlap, so every pair comes
+ * out exactly once without a dedupe pass. Buckets are independent, which
+ * lets the pair pass be split across threads.
+ *
+ * Overlap is inclusive of edges to match Rect::intersects. cellSize works
+ * best at around the size of a typical rectangle: much smaller and big
+ * rectangles are copied into many cells, much bigger and buckets fill up
+ * with rectangles that are not actually near each other.
+ */
+class SpatialHashGrid
+{
+public:
+    typedef uint32_t ObjectId;
+
+    /**
+     * Two overlapping objects, with first < second
+     */
+    struct Pair
+    {
+        ObjectId first;
+        ObjectId second;
+    };
+
+    SpatialHashGrid( unsigned int cellSize, unsigned int bucketCount = 0 );
+
+    void rebuild( const std::vector<Rect>& objects );
+    void clear();
+
+    void findPairs( std::vector<Pair>& pairs ) const;
+    void findPairs( std::vector<Pair>& pairs, unsigned int threadCount ) const;
+    void query( const Rect& area, std::vector<ObjectId>& results ) const;
+
+    unsigned int cellSize() const;
+    std::size_t bucketCount() const;
+    std::size_t objectCount() const;
+    std::size_t entryCount() const;
+
+private:
+    /**
+     * One rectangle in one cell. The bounds are copied in so the pair pass
+     * never has to leave the entries array
+     */
+    struct Entry
+    {
+        uint32_t cellX;
+        uint32_t cellY;
+        uint32_t left;
+        uint32_t top;
+        uint32_t right;
+        uint32_t bottom;
+        ObjectId object;
+    };
+
+    uint32_t bucketFor( uint32_t cellX, uint32_t cellY ) const;
+    void findPairsInBuckets( std::size_t firstBucket,
+                             std::size_t lastBucket,
+                             std::vector<Pair>& pairs ) const;
+
+private:
+    unsigned int mCellSize;
+    unsigned int mFixedBucketCount;
+    uint32_t mBucketMask;
+    std::size_t mObjectCount;
+
+    // Entries sorted by bucket. Bucket b is [mBucketStart[b], mBucketStart[b+1])
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mBucketStart;
+};
+
+#endif
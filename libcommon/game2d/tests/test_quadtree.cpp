@@ -0,0 +1,394 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "game2d/quadtree.h"
+#include <googletest/googletest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+typedef QuadTree<int> QTree;
+
+namespace
+{
+    /**
+     * Keeps track of where every item in a quadtree should be, so the
+     * quadtree's answers can be checked by brute force
+     */
+    struct Shadow
+    {
+        std::vector<QTree::ItemId> ids;
+        std::vector<Point> positions;
+
+        std::vector<QTree::ItemId> inRect( const Rect& area ) const
+        {
+            std::vector<QTree::ItemId> found;
+
+            for ( std::size_t i = 0; i < ids.size(); ++i )
+            {
+                if ( area.contains( positions[i] ) )
+                {
+                    found.push_back( ids[i] );
+                }
+            }
+
+            std::sort( found.begin(), found.end() );
+            return found;
+        }
+
+        std::vector<QTree::ItemId> inRadius( const Point& c, unsigned int r ) const
+        {
+            std::vector<QTree::ItemId> found;
+
+            for ( std::size_t i = 0; i < ids.size(); ++i )
+            {
+                if ( distance2( c, positions[i] ) <= static_cast<long long>( r ) * r )
+                {
+                    found.push_back( ids[i] );
+                }
+            }
+
+            std::sort( found.begin(), found.end() );
+            return found;
+        }
+
+        long long closest( const Point& c ) const
+        {
+            long long best = -1;
+
+            for ( std::size_t i = 0; i < ids.size(); ++i )
+            {
+                long long d = distance2( c, positions[i] );
+                best = ( best < 0 || d < best ? d : best );
+            }
+
+            return best;
+        }
+
+        static long long distance2( const Point& a, const Point& b )
+        {
+            long long dx = static_cast<long long>( a.x() ) - b.x();
+            long long dy = static_cast<long long>( a.y() ) - b.y();
+
+            return dx * dx + dy * dy;
+        }
+    };
+
+    Point randomPoint( unsigned int width, unsigned int height )
+    {
+        return Point( rand() % ( width + 1 ), rand() % ( height + 1 ) );
+    }
+
+    std::vector<QTree::ItemId> sorted( std::vector<QTree::ItemId> ids )
+    {
+        std::sort( ids.begin(), ids.end() );
+        return ids;
+    }
+}
+
+TEST(QuadTree,StartsEmpty)
+{
+    QTree tree( Rect( 0, 0, 100, 100 ) );
+    std::vector<QTree::ItemId> results;
+
+    tree.queryRect( Rect( 0, 0, 100, 100 ), results );
+
+    EXPECT_EQ( 0u, tree.size() );
+    EXPECT_EQ( 1u, tree.nodeCount() );
+    EXPECT_TRUE( results.empty() );
+    EXPECT_EQ( QTree::NO_ITEM, tree.nearest( Point( 5, 5 ) ) );
+}
+
+TEST(QuadTree,InsertAndGetItems)
+{
+    QTree tree( Rect( 10, 20, 100, 50 ) );
+
+    QTree::ItemId a = tree.insert( Point( 10, 20 ), 1 );
+    QTree::ItemId b = tree.insert( Point( 110, 70 ), 2 );
+
+    EXPECT_EQ( 2u, tree.size() );
+    EXPECT_EQ( Point( 10, 20 ), tree.position( a ) );
+    EXPECT_EQ( Point( 110, 70 ), tree.position( b ) );
+    EXPECT_EQ( 1, tree.value( a ) );
+    EXPECT_EQ( 2, tree.value( b ) );
+}
+
+TEST(QuadTree,RejectsPointsOutsideOfBounds)
+{
+    QTree tree( Rect( 10, 20, 100, 50 ) );
+
+    EXPECT_EQ( QTree::NO_ITEM, tree.insert( Point( 9, 20 ), 0 ) );
+    EXPECT_EQ( QTree::NO_ITEM, tree.insert( Point( 111, 20 ), 0 ) );
+    EXPECT_EQ( QTree::NO_ITEM, tree.insert( Point( 50, 71 ), 0 ) );
+
+    QTree::ItemId id = tree.insert( Point( 50, 50 ), 0 );
+
+    EXPECT_FALSE( tree.move( id, Point( 5, 50 ) ) );
+    EXPECT_EQ( Point( 50, 50 ), tree.position( id ) );
+}
+
+TEST(QuadTree,SplitsAndCollapses)
+{
+    QTree tree( Rect( 0, 0, 1023, 1023 ), 4 );
+    std::vector<QTree::ItemId> ids;
+
+    for ( unsigned int i = 0; i < 64; ++i )
+    {
+        ids.push_back( tree.insert( Point( i * 16, i * 16 ), i ) );
+    }
+
+    EXPECT_LT( 1u, tree.nodeCount() );
+
+    for ( std::size_t i = 0; i < ids.size(); ++i )
+    {
+        tree.remove( ids[i] );
+    }
+
+    EXPECT_EQ( 0u, tree.size() );
+    EXPECT_EQ( 1u, tree.nodeCount() );
+}
+
+TEST(QuadTree,ManyItemsAtOnePoint)
+{
+    QTree tree( Rect( 0, 0, 255, 255 ), 2 );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        tree.insert( Point( 7, 7 ), i );
+    }
+
+    std::vector<QTree::ItemId> results;
+    tree.queryRect( Rect( 7, 7, 0, 0 ), results );
+
+    EXPECT_EQ( 100u, results.size() );
+}
+
+TEST(QuadTree,QueriesMatchBruteForce)
+{
+    srand( 42 );
+
+    const unsigned int W = 1000;
+    const unsigned int H = 700;
+
+    QTree tree( Rect( 0, 0, W, H ), 8 );
+    Shadow shadow;
+
+    for ( int i = 0; i < 2000; ++i )
+    {
+        Point p = randomPoint( W, H );
+
+        shadow.ids.push_back( tree.insert( p, i ) );
+        shadow.positions.push_back( p );
+    }
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        Point p = randomPoint( W, H );
+        Rect area( p, rand() % 200, rand() % 200 );
+        unsigned int radius = rand() % 150;
+
+        std::vector<QTree::ItemId> results;
+        tree.queryRect( area, results );
+        EXPECT_EQ( shadow.inRect( area ), sorted( results ) );
+
+        results.clear();
+        tree.queryRadius( p, radius, results );
+        EXPECT_EQ( shadow.inRadius( p, radius ), sorted( results ) );
+
+        QTree::ItemId nearest = tree.nearest( p );
+        EXPECT_EQ( shadow.closest( p ), Shadow::distance2( p, tree.position( nearest ) ) );
+    }
+}
+
+TEST(QuadTree,MovesAndRemovesMatchBruteForce)
+{
+    srand( 7 );
+
+    const unsigned int W = 511;
+    const unsigned int H = 511;
+
+    QTree tree( Rect( 0, 0, W, H ), 4 );
+    Shadow shadow;
+
+    for ( int step = 0; step < 20000; ++step )
+    {
+        int action = rand() % 10;
+
+        if ( action < 3 || shadow.ids.empty() )
+        {
+            Point p = randomPoint( W, H );
+
+            shadow.ids.push_back( tree.insert( p, step ) );
+            shadow.positions.push_back( p );
+        }
+        else if ( action < 4 )
+        {
+            std::size_t i = rand() % shadow.ids.size();
+            tree.remove( shadow.ids[i] );
+
+            shadow.ids.erase( shadow.ids.begin() + i );
+            shadow.positions.erase( shadow.positions.begin() + i );
+        }
+        else
+        {
+            // Mix of short hops and jumps across the map
+            std::size_t i = rand() % shadow.ids.size();
+            Point p       = shadow.positions[i];
+
+            if ( action < 8 )
+            {
+                p.set( std::min( W, p.x() + rand() % 3 ), std::min( H, p.y() + rand() % 3 ) );
+            }
+            else
+            {
+                p = randomPoint( W, H );
+            }
+
+            EXPECT_TRUE( tree.move( shadow.ids[i], p ) );
+            shadow.positions[i] = p;
+        }
+    }
+
+    EXPECT_EQ( shadow.ids.size(), tree.size() );
+
+    for ( std::size_t i = 0; i < shadow.ids.size(); ++i )
+    {
+        EXPECT_EQ( shadow.positions[i], tree.position( shadow.ids[i] ) );
+    }
+
+    std::vector<QTree::ItemId> results;
+    tree.queryRect( Rect( 0, 0, W, H ), results );
+    EXPECT_EQ( shadow.inRect( Rect( 0, 0, W, H ) ), sorted( results ) );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        Point p = randomPoint( W, H );
+        Rect area( p, rand() % 64, rand() % 64 );
+
+        results.clear();
+        tree.queryRect( area, results );
+        EXPECT_EQ( shadow.inRect( area ), sorted( results ) );
+    }
+}
+
+TEST(QuadTree,BatchedQueriesMatchSingleQueries)
+{
+    srand( 99 );
+
+    QTree tree( Rect( 0, 0, 4095, 4095 ) );
+
+    for ( int i = 0; i < 5000; ++i )
+    {
+        tree.insert( randomPoint( 4095, 4095 ), i );
+    }
+
+    std::vector<Rect> areas;
+    std::vector<Point> centers;
+
+    for ( int i = 0; i < 300; ++i )
+    {
+        areas.push_back( Rect( randomPoint( 4095, 4095 ), rand() % 300, rand() % 300 ) );
+        centers.push_back( randomPoint( 4095, 4095 ) );
+    }
+
+    std::vector<QTree::ItemId> results;
+    std::vector<QTree::QueryRange> ranges;
+
+    tree.queryRects( areas, results, ranges );
+    ASSERT_EQ( areas.size(), ranges.size() );
+
+    for ( std::size_t i = 0; i < areas.size(); ++i )
+    {
+        std::vector<QTree::ItemId> single;
+        tree.queryRect( areas[i], single );
+
+        std::vector<QTree::ItemId> batched( results.begin() + ranges[i].begin,
+                                            results.begin() + ranges[i].end );
+        EXPECT_EQ( sorted( single ), sorted( batched ) );
+    }
+
+    results.clear();
+    tree.queryRadii( centers, 120, results, ranges );
+    ASSERT_EQ( centers.size(), ranges.size() );
+
+    for ( std::size_t i = 0; i < centers.size(); ++i )
+    {
+        std::vector<QTree::ItemId> single;
+        tree.queryRadius( centers[i], 120, single );
+
+        std::vector<QTree::ItemId> batched( results.begin() + ranges[i].begin,
+                                            results.begin() + ranges[i].end );
+        EXPECT_EQ( sorted( single ), sorted( batched ) );
+    }
+}
+
+TEST(QuadTree,CompactKeepsItemsAndHandles)
+{
+    srand( 3 );
+
+    QTree tree( Rect( 0, 0, 1023, 1023 ), 4 );
+    std::vector<QTree::ItemId> ids;
+
+    for ( int i = 0; i < 3000; ++i )
+    {
+        ids.push_back( tree.insert( randomPoint( 1023, 1023 ), i ) );
+    }
+
+    for ( int i = 0; i < 2000; ++i )
+    {
+        tree.remove( ids[i] );
+    }
+
+    std::vector<QTree::ItemId> before;
+    tree.queryRect( Rect( 100, 100, 600, 600 ), before );
+
+    std::size_t nodes = tree.nodeCount();
+    tree.compact();
+
+    std::vector<QTree::ItemId> after;
+    tree.queryRect( Rect( 100, 100, 600, 600 ), after );
+
+    EXPECT_EQ( nodes, tree.nodeCount() );
+    EXPECT_EQ( sorted( before ), sorted( after ) );
+
+    // Items can still be moved and removed by their old handles
+    EXPECT_TRUE( tree.move( ids[2500], Point( 1, 1 ) ) );
+    EXPECT_EQ( ids[2500], tree.nearest( Point( 0, 0 ) ) );
+
+    tree.remove( ids[2500] );
+    EXPECT_EQ( 999u, tree.size() );
+}
+
+TEST(QuadTree,CopiesAreIndependent)
+{
+    QTree tree( Rect( 0, 0, 100, 100 ), 2 );
+
+    for ( unsigned int i = 0; i < 20; ++i )
+    {
+        tree.insert( Point( i * 5, i * 5 ), i );
+    }
+
+    QTree copy( Rect( 0, 0, 1, 1 ) );
+    copy = tree;
+
+    copy.clear();
+
+    std::vector<QTree::ItemId> results;
+    tree.queryRect( Rect( 0, 0, 100, 100 ), results );
+
+    EXPECT_EQ( 20u, results.size() );
+    EXPECT_EQ( 0u, copy.size() );
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "game2d/spatialhashgrid.h"
+#include <googletest/googletest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    typedef std::pair<SpatialHashGrid::ObjectId, SpatialHashGrid::ObjectId> IdPair;
+
+    std::vector<IdPair> sorted( const std::vector<SpatialHashGrid::Pair>& pairs )
+    {
+        std::vector<IdPair> result;
+
+        for ( std::size_t i = 0; i < pairs.size(); ++i )
+        {
+            result.push_back( IdPair( pairs[i].first, pairs[i].second ) );
+        }
+
+        std::sort( result.begin(), result.end() );
+        return result;
+    }
+
+    std::vector<IdPair> bruteForcePairs( const std::vector<Rect>& rects )
+    {
+        std::vector<IdPair> result;
+
+        for ( std::size_t i = 0; i < rects.size(); ++i )
+        {
+            for ( std::size_t j = i + 1; j < rects.size(); ++j )
+            {
+                if ( rects[i].intersects( rects[j] ) )
+                {
+                    result.push_back( IdPair( i, j ) );
+                }
+            }
+        }
+
+        return result;
+    }
+
+    std::vector<Rect> randomRects( std::size_t count,
+                                   unsigned int worldSize,
+                                   unsigned int maxSide )
+    {
+        std::vector<Rect> rects;
+
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            rects.push_back( Rect( rand() % worldSize,
+                                   rand() % worldSize,
+                                   rand() % maxSide,
+                                   rand() % maxSide ) );
+        }
+
+        return rects;
+    }
+}
+
+TEST(SpatialHashGrid,StartsEmpty)
+{
+    SpatialHashGrid grid( 32 );
+    std::vector<SpatialHashGrid::Pair> pairs;
+    std::vector<SpatialHashGrid::ObjectId> found;
+
+    grid.findPairs( pairs );
+    grid.query( Rect( 0, 0, 100, 100 ), found );
+
+    EXPECT_EQ( 32u, grid.cellSize() );
+    EXPECT_EQ( 0u, grid.objectCount() );
+    EXPECT_EQ( 0u, grid.entryCount() );
+    EXPECT_TRUE( pairs.empty() );
+    EXPECT_TRUE( found.empty() );
+}
+
+TEST(SpatialHashGrid,FindsOverlapsIncludingTouchingEdges)
+{
+    std::vector<Rect> rects;
+    rects.push_back( Rect( 0, 0, 10, 10 ) );
+    rects.push_back( Rect( 5, 5, 10, 10 ) );     // overlaps 0
+    rects.push_back( Rect( 10, 0, 4, 4 ) );      // touches the right of 0
+    rects.push_back( Rect( 100, 100, 4, 4 ) );   // alone
+
+    SpatialHashGrid grid( 8 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> pairs;
+    grid.findPairs( pairs );
+
+    std::vector<IdPair> expected;
+    expected.push_back( IdPair( 0, 1 ) );
+    expected.push_back( IdPair( 0, 2 ) );
+
+    EXPECT_EQ( expected, sorted( pairs ) );
+    EXPECT_EQ( 4u, grid.objectCount() );
+}
+
+TEST(SpatialHashGrid,ReportsPairsSharingManyCellsOnce)
+{
+    std::vector<Rect> rects;
+    rects.push_back( Rect( 0, 0, 200, 200 ) );
+    rects.push_back( Rect( 10, 10, 150, 150 ) );
+
+    SpatialHashGrid grid( 16 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> pairs;
+    grid.findPairs( pairs );
+
+    ASSERT_EQ( 1u, pairs.size() );
+    EXPECT_EQ( 0u, pairs[0].first );
+    EXPECT_EQ( 1u, pairs[0].second );
+    EXPECT_LT( 2u, grid.entryCount() );
+}
+
+TEST(SpatialHashGrid,PairsMatchBruteForce)
+{
+    srand( 49 );
+    std::vector<Rect> rects = randomRects( 2000, 2048, 40 );
+
+    SpatialHashGrid grid( 32 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> pairs;
+    grid.findPairs( pairs );
+
+    EXPECT_EQ( bruteForcePairs( rects ), sorted( pairs ) );
+}
+
+TEST(SpatialHashGrid,PairsMatchBruteForceWhenCellsCollide)
+{
+    srand( 50 );
+    std::vector<Rect> rects = randomRects( 500, 1024, 80 );
+
+    // A handful of buckets forces many cells to share each one
+    SpatialHashGrid grid( 16, 3 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> pairs;
+    grid.findPairs( pairs );
+
+    EXPECT_EQ( 4u, grid.bucketCount() );
+    EXPECT_EQ( bruteForcePairs( rects ), sorted( pairs ) );
+}
+
+TEST(SpatialHashGrid,ThreadedPairsMatchSingleThreaded)
+{
+    srand( 51 );
+    std::vector<Rect> rects = randomRects( 20000, 8192, 48 );
+
+    SpatialHashGrid grid( 32 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> single, threaded;
+    grid.findPairs( single );
+    grid.findPairs( threaded, 4 );
+
+    EXPECT_FALSE( single.empty() );
+    EXPECT_EQ( sorted( single ), sorted( threaded ) );
+}
+
+TEST(SpatialHashGrid,RebuildReplacesPreviousObjects)
+{
+    std::vector<Rect> rects;
+    rects.push_back( Rect( 0, 0, 10, 10 ) );
+    rects.push_back( Rect( 5, 5, 10, 10 ) );
+
+    SpatialHashGrid grid( 8 );
+    grid.rebuild( rects );
+
+    rects[1] = Rect( 500, 500, 10, 10 );
+    grid.rebuild( rects );
+
+    std::vector<SpatialHashGrid::Pair> pairs;
+    grid.findPairs( pairs );
+
+    EXPECT_TRUE( pairs.empty() );
+
+    grid.clear();
+    EXPECT_EQ( 0u, grid.entryCount() );
+}
+
+TEST(SpatialHashGrid,QueryMatchesBruteForce)
+{
+    srand( 52 );
+    std::vector<Rect> rects = randomRects( 3000, 2048, 64 );
+
+    SpatialHashGrid grid( 24 );
+    grid.rebuild( rects );
+
+    for ( int q = 0; q < 50; ++q )
+    {
+        Rect area( rand() % 2000, rand() % 2000, rand() % 200, rand() % 200 );
+
+        std::vector<SpatialHashGrid::ObjectId> expected, actual;
+
+        for ( std::size_t i = 0; i < rects.size(); ++i )
+        {
+            if ( rects[i].intersects( area ) )
+            {
+                expected.push_back( i );
+            }
+        }
+
+        grid.query( area, actual );
+        std::sort( actual.begin(), actual.end() );
+
+        EXPECT_EQ( expected, actual );
+    }
+}
@@ -13,57 +13,287 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#ifndef SCOTT_MATH_PERLIN_H
-#define SCOTT_MATH_PERLIN_H
+#include "math/perlin.h"
 
-#include <cstdlib>
-#include <boost/random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 namespace
 {
+    /// Frequency multiplier between two octaves of fractal noise
+    const float LACUNARITY = 2.0f;
+
+    /// Amplitude multiplier between two octaves of fractal noise
+    const float GAIN = 0.5f;
+
     inline float p_ease( float a )
     {
         return ((( a * 6 - 15 ) * a + 10 ) * a * a * a);
     }
+
+    inline float p_lerp( float a, float b, float t )
+    {
+        return a + ( b - a ) * t;
+    }
+
+    /// Number of lattice cells before the random table repeats itself
+    const float LATTICE_PERIOD = 256.0f;
+
+    /**
+     * Splits a coordinate into its lattice cell and the offset within the
+     * cell, leaving the offset in a. The cell is wrapped into the period of
+     * the random table before it is converted to an int, since far away
+     * coordinates (or a lot of octaves) go past the range of an int
+     */
+    inline int p_cell( float& a )
+    {
+        float floored = std::floor( a );
+        float wrapped = floored - LATTICE_PERIOD * std::floor( floored * ( 1.0f / LATTICE_PERIOD ) );
+
+        a -= floored;
+        return static_cast<int>( wrapped );
+    }
+
+    /**
+     * Dot product of (x,y,z) with one of twelve gradients picked by the low
+     * four bits of the hash. Four of the gradients are repeated to fill out
+     * the sixteen cases, as described in Perlin's "Improving Noise" paper
+     */
+    inline float p_grad( int hash, float x, float y, float z )
+    {
+        int h   = hash & 15;
+        float u = ( h < 8 ? x : y );
+        float v = ( h < 4 ? y : ( h == 12 || h == 14 ? x : z ) );
+
+        return ( ( h & 1 ) ? -u : u ) + ( ( h & 2 ) ? -v : v );
+    }
+
+    /**
+     * One dimensional gradient, picked from eight slopes in each direction
+     */
+    inline float p_grad( int hash, float x )
+    {
+        float g = 0.25f * static_cast<float>( 1 + ( hash & 7 ) );
+        return ( ( hash & 8 ) ? -g : g ) * x;
+    }
+
+#ifdef __AVX2__
+    /**
+     * Looks up eight entries of the random table at once
+     */
+    inline __m256i p_lookup8( const unsigned char * pLUT, __m256i index )
+    {
+        __m256i value = _mm256_i32gather_epi32( reinterpret_cast<const int*>( pLUT ),
+                                                index,
+                                                1 );
+        return _mm256_and_si256( value, _mm256_set1_epi32( 0xFF ) );
+    }
+
+    inline __m256 p_ease8( __m256 a )
+    {
+        __m256 r = _mm256_sub_ps( _mm256_mul_ps( a, _mm256_set1_ps( 6.0f ) ),
+                                  _mm256_set1_ps( 15.0f ) );
+        r = _mm256_add_ps( _mm256_mul_ps( r, a ), _mm256_set1_ps( 10.0f ) );
+
+        return _mm256_mul_ps( _mm256_mul_ps( _mm256_mul_ps( r, a ), a ), a );
+    }
+
+    inline __m256 p_lerp8( __m256 a, __m256 b, __m256 t )
+    {
+        return _mm256_add_ps( a, _mm256_mul_ps( _mm256_sub_ps( b, a ), t ) );
+    }
+
+    /**
+     * Eight gradients at once, with the cases of p_grad turned into blends
+     */
+    inline __m256 p_grad8( __m256i hash, __m256 x, __m256 y, __m256 z )
+    {
+        __m256i h = _mm256_and_si256( hash, _mm256_set1_epi32( 15 ) );
+
+        __m256 below8 = _mm256_castsi256_ps( _mm256_cmpgt_epi32( _mm256_set1_epi32( 8 ), h ) );
+        __m256 below4 = _mm256_castsi256_ps( _mm256_cmpgt_epi32( _mm256_set1_epi32( 4 ), h ) );
+        __m256 useX   = _mm256_castsi256_ps(
+            _mm256_or_si256( _mm256_cmpeq_epi32( h, _mm256_set1_epi32( 12 ) ),
+                             _mm256_cmpeq_epi32( h, _mm256_set1_epi32( 14 ) ) ) );
+
+        __m256 u = _mm256_blendv_ps( y, x, below8 );
+        __m256 v = _mm256_blendv_ps( _mm256_blendv_ps( z, x, useX ), y, below4 );
+
+        // Bits one and two of the hash flip the sign of u and v
+        __m256 uSign = _mm256_castsi256_ps(
+            _mm256_slli_epi32( _mm256_and_si256( h, _mm256_set1_epi32( 1 ) ), 31 ) );
+        __m256 vSign = _mm256_castsi256_ps(
+            _mm256_slli_epi32( _mm256_and_si256( h, _mm256_set1_epi32( 2 ) ), 30 ) );
+
+        return _mm256_add_ps( _mm256_xor_ps( u, uSign ), _mm256_xor_ps( v, vSign ) );
+    }
+
+    /**
+     * Splits eight coordinates into their lattice cell and the offset
+     * within the cell, wrapping the cells the same way as p_cell
+     */
+    inline void p_cell8( __m256& a, __m256i& a0, __m256i& a1 )
+    {
+        const __m256 period    = _mm256_set1_ps( LATTICE_PERIOD );
+        const __m256 invPeriod = _mm256_set1_ps( 1.0f / LATTICE_PERIOD );
+
+        __m256 floored = _mm256_floor_ps( a );
+        __m256 periods = _mm256_floor_ps( _mm256_mul_ps( floored, invPeriod ) );
+        __m256 wrapped = _mm256_sub_ps( floored, _mm256_mul_ps( period, periods ) );
+        __m256i cell   = _mm256_cvttps_epi32( wrapped );
+
+        a  = _mm256_sub_ps( a, floored );
+        a0 = _mm256_and_si256( cell, _mm256_set1_epi32( 255 ) );
+        a1 = _mm256_and_si256( _mm256_add_epi32( cell, _mm256_set1_epi32( 1 ) ),
+                               _mm256_set1_epi32( 255 ) );
+    }
+
+    /**
+     * Eight samples of PerlinNoise::noise( x, y )
+     */
+    __m256 p_noise8( const unsigned char * pLUT, __m256 x, __m256 y )
+    {
+        const __m256 one  = _mm256_set1_ps( 1.0f );
+        const __m256 zero = _mm256_setzero_ps();
+        __m256i x0, x1, y0, y1;
+
+        p_cell8( x, x0, x1 );
+        p_cell8( y, y0, y1 );
+
+        __m256 u = p_ease8( x );
+        __m256 v = p_ease8( y );
+
+        __m256i r0 = p_lookup8( pLUT, x0 );
+        __m256i r1 = p_lookup8( pLUT, x1 );
+
+        __m256 xm = _mm256_sub_ps( x, one );
+        __m256 ym = _mm256_sub_ps( y, one );
+
+        __m256 n00 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r0, y0 ) ), x,  y,  zero );
+        __m256 n01 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r0, y1 ) ), x,  ym, zero );
+        __m256 n10 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r1, y0 ) ), xm, y,  zero );
+        __m256 n11 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r1, y1 ) ), xm, ym, zero );
+
+        return p_lerp8( p_lerp8( n00, n01, v ), p_lerp8( n10, n11, v ), u );
+    }
+
+    /**
+     * Eight samples of PerlinNoise::noise( x, y, z )
+     */
+    __m256 p_noise8( const unsigned char * pLUT, __m256 x, __m256 y, __m256 z )
+    {
+        const __m256 one = _mm256_set1_ps( 1.0f );
+        __m256i x0, x1, y0, y1, z0, z1;
+
+        p_cell8( x, x0, x1 );
+        p_cell8( y, y0, y1 );
+        p_cell8( z, z0, z1 );
+
+        __m256 u = p_ease8( x );
+        __m256 v = p_ease8( y );
+        __m256 w = p_ease8( z );
+
+        __m256i r0  = p_lookup8( pLUT, x0 );
+        __m256i r1  = p_lookup8( pLUT, x1 );
+        __m256i r00 = p_lookup8( pLUT, _mm256_add_epi32( r0, y0 ) );
+        __m256i r01 = p_lookup8( pLUT, _mm256_add_epi32( r0, y1 ) );
+        __m256i r10 = p_lookup8( pLUT, _mm256_add_epi32( r1, y0 ) );
+        __m256i r11 = p_lookup8( pLUT, _mm256_add_epi32( r1, y1 ) );
+
+        __m256 xm = _mm256_sub_ps( x, one );
+        __m256 ym = _mm256_sub_ps( y, one );
+        __m256 zm = _mm256_sub_ps( z, one );
+
+        __m256 n000 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r00, z0 ) ), x,  y,  z  );
+        __m256 n001 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r00, z1 ) ), x,  y,  zm );
+        __m256 n010 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r01, z0 ) ), x,  ym, z  );
+        __m256 n011 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r01, z1 ) ), x,  ym, zm );
+        __m256 n100 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r10, z0 ) ), xm, y,  z  );
+        __m256 n101 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r10, z1 ) ), xm, y,  zm );
+        __m256 n110 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r11, z0 ) ), xm, ym, z  );
+        __m256 n111 = p_grad8( p_lookup8( pLUT, _mm256_add_epi32( r11, z1 ) ), xm, ym, zm );
+
+        __m256 n0 = p_lerp8( p_lerp8( n000, n001, w ), p_lerp8( n010, n011, w ), v );
+        __m256 n1 = p_lerp8( p_lerp8( n100, n101, w ), p_lerp8( n110, n111, w ), v );
+
+        return p_lerp8( n0, n1, u );
+    }
+
+    /**
+     * X coordinates of eight samples in a row, starting at column col
+     */
+    inline __m256 p_columns8( float originX, float step, unsigned int col )
+    {
+        __m256i index = _mm256_add_epi32( _mm256_set1_epi32( static_cast<int>( col ) ),
+                                          _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+
+        return _mm256_add_ps( _mm256_set1_ps( originX ),
+                              _mm256_mul_ps( _mm256_cvtepi32_ps( index ),
+                                             _mm256_set1_ps( step ) ) );
+    }
+#endif
 }
 
+/**
+ * Create a new noise generator
+ *
+ * \param  seed  Value used to shuffle the random table
+ */
 PerlinNoise::PerlinNoise( unsigned int seed )
-    : pRandomLUT( new unsigned char[RANDOM_LUT_SIZE] )
 {
     init( seed );
 }
 
-PerlinNoise::PerlinNoise( const PerlinNoise& p )
-    : pRandomLUT( new unsigned char[RANDOM_LUT_SIZE] )
+/**
+ * One dimensional noise
+ */
+float PerlinNoise::noise( float x ) const
 {
-    std::copy( p.pRandomLUT,
-               p.pRandomLUT + RANDOM_LUT_SIZE,
-               pRandomLut );
-}
+    int px = p_cell( x );
+    int x0 = px & 255, x1 = ( px + 1 ) & 255;
 
-PerlinNoise::~PerlinNoise()
-{
-    delete[] pRandomLUT;
+    return p_lerp( p_grad( mRandomLUT[x0], x ),
+                   p_grad( mRandomLUT[x1], x - 1 ),
+                   p_ease( x ) );
 }
 
-PerlinNoise& PerlinNoise::operator = ( const PerlinNoise& rhs )
+/**
+ * Two dimensional noise
+ */
+float PerlinNoise::noise( float x, float y ) const
 {
-    // Only copy the random lookup table if we are not the same instance
-    if ( this == &p )
-    {
-        // Destroy original random buffer
-        delete[] pRandomLUT;
+    int px = p_cell( x );
+    int py = p_cell( y );
 
-        // Now re-create the buffer, and populate it with the contents of
-        // 'rhs'
-        pRandomLUT = new unsigned char[RANDOM_LUT_SIZE];
+    int x0 = px & 255, x1 = ( px + 1 ) & 255;
+    int y0 = py & 255, y1 = ( py + 1 ) & 255;
 
-        std::copy( rhs.pRandomLUT,
-                   rhs.pRandomLUT + RANDOM_LUT_SIZE,
-                   pRandomLUT );
-    }
+    float u = p_ease( x );
+    float v = p_ease( y );
+
+    int r0 = mRandomLUT[ x0 ];
+    int r1 = mRandomLUT[ x1 ];
+
+    float n00 = p_grad( mRandomLUT[r0+y0], x  , y  , 0 );
+    float n01 = p_grad( mRandomLUT[r0+y1], x  , y-1, 0 );
+    float n10 = p_grad( mRandomLUT[r1+y0], x-1, y  , 0 );
+    float n11 = p_grad( mRandomLUT[r1+y1], x-1, y-1, 0 );
 
-    return *this;
+    return p_lerp( p_lerp( n00, n01, v ), p_lerp( n10, n11, v ), u );
+}
+
+/**
+ * Three dimensional noise
+ */
+float PerlinNoise::noise( float x, float y, float z ) const
+{
+    return noise3( x, y, z, 0, 0, 0 );
 }
 
 float PerlinNoise::noise3( const Vec3& pos ) const
@@ -76,6 +306,11 @@ float PerlinNoise::noise3( float x, float y, float z ) const
     return noise3( x, y, z, 0, 0, 0 );
 }
 
+/**
+ * Three dimensional noise that repeats itself along each axis. The wrap
+ * values must be powers of two no bigger than 256, and zero means that
+ * the axis only repeats every 256 units
+ */
 float PerlinNoise::noise3( float x,
                            float y,
                            float z,
@@ -83,146 +318,247 @@ float PerlinNoise::noise3( float x,
                            int yWrap,
                            int zWrap ) const
 {
-}
+    unsigned int xMask = ( xWrap - 1 ) & 255;
+    unsigned int yMask = ( yWrap - 1 ) & 255;
+    unsigned int zMask = ( zWrap - 1 ) & 255;
 
-float PerlinNoise::grad( int hash, float x, float y, float z )
-{
-    // Table of pre-computed gradient vectors
-    const static float BASIS[12][3] =
-    {
-        {  1, 1, 0 },
-        { -1, 1, 0 },
-        {  1,-1, 0 },
-        { -1,-1, 0 },
-        {  1, 0, 1 },
-        { -1, 0, 1 },
-        {  1, 0,-1 },
-        { -1, 0,-1 },
-        {  0, 1, 1 },
-        {  0,-1, 1 },
-        {  0, 1,-1 },
-        {  0,-1,-1 },
-    };
-
-    // perlin's gradient has 12 cases so some get used 1/16th of the time
-    // and some 2/16ths. We reduce bias by changing those fractions
-    // to 5/16ths and 6/16ths, and the same 4 cases get the extra weight.
-    const static unsigned char INDICES[64] =
-    {
-        0, 1, 2, 3,  4, 5, 6, 7, 8, 9, 10, 11,
-        0, 9, 1, 11,
-        0, 1, 2, 3,  4, 5, 6, 7, 8, 9, 10, 11,
-        0, 1, 2, 3,  4, 5, 6, 7, 8, 9, 10, 11,
-        0, 1, 2, 3,  4, 5, 6, 7, 8, 9, 10, 11,
-        0, 1, 2, 3,  4, 5, 6, 7, 8, 9, 10, 11,
-    };
-
-    // Generate the value using the reference permutation table
-    float *pGrad = BASIS[ INDICES[ hash & 63 ] ];
-    return pGrad[0] * x + pGrad[1] * y + pGrad[2] * z;
-}
+    // Find the unit cube that contains point. We "cut" the points by
+    // forcing our x/y/z values into a [0,*Wrap] range that will become
+    // the maximums of our unit cube (x0,y0,z0 --> x1,y1,z1). This also
+    // leaves the relative X/Y/Z of the point in the unit cube
+    int px = p_cell( x );
+    int py = p_cell( y );
+    int pz = p_cell( z );
 
-float PerlinNoise::noise( float x, float y, float z ) const
-{
-    return noise( x, y, z, 0, 0, 0 );
-}
+    int x0 = px & xMask, x1 = ( px + 1 ) & xMask;
+    int y0 = py & yMask, y1 = ( py + 1 ) & yMask;
+    int z0 = pz & zMask, z1 = ( pz + 1 ) & zMask;
 
-float PerlinNoise::noise( const Vec3& v ) const
-{
-    return noise( v.x(), v.y(), v.z(), 0, 0, 0 );
-}
+    // Compute the fade curves for x/y/z
+    float u = p_ease( x );
+    float v = p_ease( y );
+    float w = p_ease( z );
 
-float PerlinNoise::noise( float x, float y ) const
-{
+    // Hash coordinates of the eight unit cube corners
+    int r0 = mRandomLUT[ x0 ];
+    int r1 = mRandomLUT[ x1 ];
+
+    int r00 = mRandomLUT[ r0 + y0 ];
+    int r01 = mRandomLUT[ r0 + y1 ];
+    int r10 = mRandomLUT[ r1 + y0 ];
+    int r11 = mRandomLUT[ r1 + y1 ];
 
+    // Calculate the results from the eight corners of the unit cube,
+    // and then blend the results into a single returnable value
+    float n000 = p_grad( mRandomLUT[r00+z0], x  , y  , z   );
+    float n001 = p_grad( mRandomLUT[r00+z1], x  , y  , z-1 );
+    float n010 = p_grad( mRandomLUT[r01+z0], x  , y-1, z   );
+    float n011 = p_grad( mRandomLUT[r01+z1], x  , y-1, z-1 );
+    float n100 = p_grad( mRandomLUT[r10+z0], x-1, y  , z   );
+    float n101 = p_grad( mRandomLUT[r10+z1], x-1, y  , z-1 );
+    float n110 = p_grad( mRandomLUT[r11+z0], x-1, y-1, z   );
+    float n111 = p_grad( mRandomLUT[r11+z1], x-1, y-1, z-1 );
+
+    float n0 = p_lerp( p_lerp( n000, n001, w ), p_lerp( n010, n011, w ), v );
+    float n1 = p_lerp( p_lerp( n100, n101, w ), p_lerp( n110, n111, w ), v );
+
+    return p_lerp( n0, n1, u );
 }
 
-float PerlinNoise::noise( float x, float y, float z,
-                          int x_wrap,
-                          int y_wrap,
-                          int z_wrap ) const
+/**
+ * Fractal (fBm) noise made by adding up octaves of two dimensional noise.
+ * Each octave doubles the frequency and halves the amplitude of the one
+ * before it, and the sum is scaled back into the range of a single octave
+ */
+float PerlinNoise::fbm( float x, float y, unsigned int octaves ) const
 {
-    float u, v, w;
-    float n000, n001, n010, n011, n100, n101, n110, n111;
-    float n00, n01, n10, n11;
-    float n0, n1;
-
-    unsigned int x_mask = ( x_wrap - 1 ) & 255;
-    unsigned int y_mask = ( y_wrap - 1 ) & 255;
-    unsigned int z_mask = ( z_wrap - 1 ) & 255;
-
-    // Find the unit cube that contains point. We "cut" the points by
-    // forcing our x/y/z values into a [0,*_wrap] range that will become
-    // the maximums of our unit cube (x0,y0,z0 --> x1,y1,z1)
-    int px = std::floor( x );
-    int py = std::floor( y );
-    int pz = std::floor( z );
+    float total = 0.0f, range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
 
-    int x0 = px & x_mask, x1 = (px + 1) & x_mask;
-    int y0 = py & y_mask, y1 = (py + 1) & y_mask;
-    int z0 = py & z_mask, z1 = (pz + 1) & z_mask;
+    for ( unsigned int i = 0; i < std::max( octaves, 1u ); ++i )
+    {
+        total     += amplitude * noise( x * frequency, y * frequency );
+        range     += amplitude;
+        amplitude *= GAIN;
+        frequency *= LACUNARITY;
+    }
 
-    int r0, r1, r00, r01, r10, r11;
+    return total / range;
+}
 
-    // Find the relative X/Y/Z of point in the unit cube by rounding our
-    // coordinates to the nearest int
-    x -= px;
-    y -= py;
-    z -= pz;
+/**
+ * Fractal (fBm) noise made by adding up octaves of three dimensional noise
+ */
+float PerlinNoise::fbm( float x, float y, float z, unsigned int octaves ) const
+{
+    float total = 0.0f, range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
 
-    // Compute the fade curves for x/y/z
-    u  = p_ease( x );
-    v  = p_ease( y );
-    w  = p_ease( z );
+    for ( unsigned int i = 0; i < std::max( octaves, 1u ); ++i )
+    {
+        total     += amplitude * noise( x * frequency, y * frequency, z * frequency );
+        range     += amplitude;
+        amplitude *= GAIN;
+        frequency *= LACUNARITY;
+    }
 
-    // Hash coordinates of the eight unit cube corners
-    r0 = mpRandomLUT[ x0 ];
-    r1 = mpRandomLUT[ x1 ];
+    return total / range;
+}
 
-    r00 = mpRandomLUT[ r0 + y0 ];
-    r01 = mpRandomLUT[ r0 + y1 ];
-    r10 = mpRandomLUT[ r1 + y0 ];
-    r11 = mpRandomLUT[ r1 + y1 ];
+/**
+ * Fills a row major grid of width by height samples with fractal noise.
+ * The sample at column c and row r is fbm( origin.x + c * step,
+ * origin.y + r * step, octaves )
+ *
+ * \param  pGrid    Receives width * height samples
+ * \param  width    Number of samples in a row
+ * \param  height   Number of rows
+ * \param  origin   Position of the first sample
+ * \param  step     Distance between two neighbouring samples
+ * \param  octaves  Number of octaves to add up
+ */
+void PerlinNoise::fillNoise2D( float * pGrid,
+                               unsigned int width,
+                               unsigned int height,
+                               const Vec2& origin,
+                               float step,
+                               unsigned int octaves ) const
+{
+    octaves = std::max( octaves, 1u );
 
-    // Calculate the results from the eight corners of the unit cube,
-    // and then blend the results into a single returnable value
-    n000 = grad( mpRandomLUT[r00+z0], x  , y  , z   );
-    n001 = grad( mpRandomLUT[r00+z1], x  , y  , z-1 );
-    n010 = grad( mpRandomLUT[r01+z0], x  , y-1, z   );
-    n011 = grad( mpRandomLUT[r01+z1], x  , y-1, z-1 );
-    n100 = grad( mpRandomLUT[r10+z0], x-1, y  , z   );
-    n101 = grad( mpRandomLUT[r10+z1], x-1, y  , z-1 );
-    n110 = grad( mpRandomLUT[r11+z0], x-1, y-1, z   );
-    n111 = grad( mpRandomLUT[r11+z1], x-1, y-1, z-1 );
-
-    n00 = lerp( n000, n001, w );
-    n01 = lerp( n010, n011, w );
-    n10 = lerp( n100, n101, w );
-    n11 = lerp( n110, n111, w );
-
-    n0 = lerp( n00, n01, v );
-    n1 = lerp( n10, n11, v );
-
-    return lerp( n0, n1, u );
+    for ( unsigned int row = 0; row < height; ++row )
+    {
+        float * pRow   = pGrid + static_cast<std::size_t>( row ) * width;
+        float sampleY  = origin.y() + static_cast<float>( row ) * step;
+        unsigned int col = 0;
+
+#ifdef __AVX2__
+        for ( ; col + 8 <= width; col += 8 )
+        {
+            __m256 x = p_columns8( origin.x(), step, col );
+            __m256 y = _mm256_set1_ps( sampleY );
+
+            __m256 total = _mm256_setzero_ps();
+            float range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
+
+            for ( unsigned int i = 0; i < octaves; ++i )
+            {
+                __m256 f = _mm256_set1_ps( frequency );
+                __m256 n = p_noise8( mRandomLUT, _mm256_mul_ps( x, f ), _mm256_mul_ps( y, f ) );
+
+                total      = _mm256_add_ps( total, _mm256_mul_ps( _mm256_set1_ps( amplitude ), n ) );
+                range     += amplitude;
+                amplitude *= GAIN;
+                frequency *= LACUNARITY;
+            }
+
+            _mm256_storeu_ps( pRow + col, _mm256_div_ps( total, _mm256_set1_ps( range ) ) );
+        }
+#endif
+
+        for ( ; col < width; ++col )
+        {
+            pRow[col] = fbm( origin.x() + static_cast<float>( col ) * step,
+                             sampleY,
+                             octaves );
+        }
+    }
 }
 
-float PerlinNoise::lerp( float a, float b, float t )
+/**
+ * Fills a grid of width by height by depth samples with fractal noise.
+ * Samples are stored a row at a time, and a slice of rows at a time, so
+ * the sample at (c, r, s) is at index (s * height + r) * width + c
+ *
+ * \param  pGrid    Receives width * height * depth samples
+ * \param  width    Number of samples in a row
+ * \param  height   Number of rows in a slice
+ * \param  depth    Number of slices
+ * \param  origin   Position of the first sample
+ * \param  step     Distance between two neighbouring samples
+ * \param  octaves  Number of octaves to add up
+ */
+void PerlinNoise::fillNoise3D( float * pGrid,
+                               unsigned int width,
+                               unsigned int height,
+                               unsigned int depth,
+                               const Vec3& origin,
+                               float step,
+                               unsigned int octaves ) const
 {
-    return a + ( b - a ) * t;
+    octaves = std::max( octaves, 1u );
+
+    for ( unsigned int slice = 0; slice < depth; ++slice )
+    {
+        float sampleZ = origin.z() + static_cast<float>( slice ) * step;
+
+        for ( unsigned int row = 0; row < height; ++row )
+        {
+            float * pRow = pGrid + ( static_cast<std::size_t>( slice ) * height + row ) * width;
+            float sampleY = origin.y() + static_cast<float>( row ) * step;
+            unsigned int col = 0;
+
+#ifdef __AVX2__
+            for ( ; col + 8 <= width; col += 8 )
+            {
+                __m256 x = p_columns8( origin.x(), step, col );
+                __m256 y = _mm256_set1_ps( sampleY );
+                __m256 z = _mm256_set1_ps( sampleZ );
+
+                __m256 total = _mm256_setzero_ps();
+                float range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
+
+                for ( unsigned int i = 0; i < octaves; ++i )
+                {
+                    __m256 f = _mm256_set1_ps( frequency );
+                    __m256 n = p_noise8( mRandomLUT,
+                                         _mm256_mul_ps( x, f ),
+                                         _mm256_mul_ps( y, f ),
+                                         _mm256_mul_ps( z, f ) );
+
+                    total      = _mm256_add_ps( total, _mm256_mul_ps( _mm256_set1_ps( amplitude ), n ) );
+                    range     += amplitude;
+                    amplitude *= GAIN;
+                    frequency *= LACUNARITY;
+                }
+
+                _mm256_storeu_ps( pRow + col, _mm256_div_ps( total, _mm256_set1_ps( range ) ) );
+            }
+#endif
+
+            for ( ; col < width; ++col )
+            {
+                pRow[col] = fbm( origin.x() + static_cast<float>( col ) * step,
+                                 sampleY,
+                                 sampleZ,
+                                 octaves );
+            }
+        }
+    }
 }
 
 void PerlinNoise::init( unsigned int seed )
 {
-    boost::mt19937 rng( seed );
-    boost::uniform_smallint<> randomNumber( 0, 255 );
+    std::mt19937 rng( seed );
+    unsigned int half = RANDOM_LUT_SIZE / 2;
 
-    // Generate the look up table. Remember that the look up table contains
-    // 256 unique elements, but each element is duplicated (at pos i and
-    // i+256)
-    for ( unsigned int i = 0; i < RANDOM_LUT_SIZE / 2; ++i )
+    // Shuffle the values 0-255 into the first half of the look up table.
+    // The shuffle is written out rather than using std::shuffle so that a
+    // seed gives the same noise with every standard library
+    for ( unsigned int i = 0; i < half; ++i )
     {
-        unsigned char val   = randomNumber( rng );
-        pRandomLUT[i + 0]   = val;
-        pRandomLUT[i + 256] = val;
+        mRandomLUT[i] = static_cast<unsigned char>( i );
     }
+
+    for ( unsigned int i = half - 1; i > 0; --i )
+    {
+        std::swap( mRandomLUT[i], mRandomLUT[ rng() % ( i + 1 ) ] );
+    }
+
+    // Remember that the look up table contains 256 unique elements, but
+    // each element is duplicated (at pos i and i+256)
+    for ( unsigned int i = 0; i < half; ++i )
+    {
+        mRandomLUT[i + half] = mRandomLUT[i];
+    }
+
+    std::fill( mRandomLUT + RANDOM_LUT_SIZE, mRandomLUT + RANDOM_LUT_SIZE + 4, 0 );
 }
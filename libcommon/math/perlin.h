@@ -16,20 +16,28 @@
 #ifndef SCOTT_MATH_PERLIN_H
 #define SCOTT_MATH_PERLIN_H
 
-#include <stdlib>
-
-class Random;
+#include <math/vector.h>
 
 /**
- * Random number generator using the mersenne twister algorithm for
- * generating random numbers. This implementation is heavily based on the
- * work of Michael Brundage (which was placed in the public domain).
+ * Generates Ken Perlin's "improved" gradient noise in one, two and three
+ * dimensions. Every lattice point is hashed through a table of 256 random
+ * bytes picked from the seed, so two generators with the same seed always
+ * produce the same noise. Results are roughly in the range [-1, 1].
+ *
+ * Filling a whole grid of samples with fillNoise2D or fillNoise3D is a lot
+ * faster than calling noise() for each of them. When the library is built
+ * with BUILD_WITH_AVX2 the batch functions evaluate eight samples at a time
+ * with AVX2, otherwise they fall back to the scalar code. Either way they
+ * return the same values as fbm() (give or take rounding).
+ *
+ * Nothing is modified after construction, so one generator can be shared
+ * by any number of threads. Big grids are split across threads by giving
+ * each one a band of rows and moving the origin down to match.
  */
 class PerlinNoise
 {
 public:
-    PerlinNoise( unsigned int seed );
-    ~PerlinNoise();
+    explicit PerlinNoise( unsigned int seed );
 
     float noise( float x ) const;
     float noise( float x, float y ) const;
@@ -43,15 +51,35 @@ public:
                   int yWrap,
                   int zWrap ) const;
 
+    float fbm( float x, float y, unsigned int octaves ) const;
+    float fbm( float x, float y, float z, unsigned int octaves ) const;
+
+    void fillNoise2D( float * pGrid,
+                      unsigned int width,
+                      unsigned int height,
+                      const Vec2& origin,
+                      float step,
+                      unsigned int octaves = 1 ) const;
+
+    void fillNoise3D( float * pGrid,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int depth,
+                      const Vec3& origin,
+                      float step,
+                      unsigned int octaves = 1 ) const;
+
 private:
     void init( unsigned int seed );
 
 private:
     /// Size of the random table
-    const unsigned int RANDOM_LUT_SIZE = 512;
+    static const unsigned int RANDOM_LUT_SIZE = 512;
 
-    /// Buffer of randomly generated values
-    unsigned char * mpRandomLUT;
+    /// Buffer of randomly generated values. Values repeat after 256 entries
+    /// so that two hashes can be added without wrapping. The extra bytes
+    /// at the end let the AVX2 code load four bytes from any entry
+    unsigned char mRandomLUT[RANDOM_LUT_SIZE + 4];
 };
 
 #endif
@@ -0,0 +1,167 @@
+/**
+ * Unit tests for common/math/perlin
+ */
+#include <googletest/googletest.h>
+#include <math/perlin.h>
+
+#include <cmath>
+#include <vector>
+
+TEST(Math,Perlin_SameSeedSameNoise)
+{
+    PerlinNoise a( 42 ), b( 42 ), c( 43 );
+    bool anyDifferent = false;
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        float x = i * 0.37f, y = i * 0.11f, z = i * 0.73f;
+
+        EXPECT_EQ( a.noise( x, y, z ), b.noise( x, y, z ) );
+        anyDifferent = anyDifferent || ( a.noise( x, y, z ) != c.noise( x, y, z ) );
+    }
+
+    EXPECT_TRUE( anyDifferent );
+}
+
+TEST(Math,Perlin_ZeroOnLatticePoints)
+{
+    PerlinNoise perlin( 7 );
+
+    EXPECT_EQ( 0.0f, perlin.noise( 3.0f ) );
+    EXPECT_EQ( 0.0f, perlin.noise( 3.0f, -5.0f ) );
+    EXPECT_EQ( 0.0f, perlin.noise( 3.0f, -5.0f, 12.0f ) );
+}
+
+TEST(Math,Perlin_StaysInRange)
+{
+    PerlinNoise perlin( 1 );
+
+    for ( int i = 0; i < 10000; ++i )
+    {
+        float x = i * 0.0173f, y = i * 0.0291f - 50.0f, z = i * 0.0457f;
+
+        EXPECT_LE( std::fabs( perlin.noise( x ) ), 1.0f );
+        EXPECT_LE( std::fabs( perlin.noise( x, y ) ), 1.0f );
+        EXPECT_LE( std::fabs( perlin.noise( x, y, z ) ), 1.0f );
+        EXPECT_LE( std::fabs( perlin.fbm( x, y, z, 4 ) ), 1.0f );
+    }
+}
+
+TEST(Math,Perlin_WrapsAroundTheWrapSize)
+{
+    PerlinNoise perlin( 3 );
+
+    EXPECT_FLOAT_EQ( perlin.noise3( 0.25f, 1.5f, 2.75f, 16, 8, 4 ),
+                     perlin.noise3( 16.25f, 9.5f, 6.75f, 16, 8, 4 ) );
+    EXPECT_FLOAT_EQ( perlin.noise3( 0.25f, 1.5f, 2.75f ),
+                     perlin.noise3( 256.25f, 257.5f, 258.75f ) );
+}
+
+TEST(Math,Perlin_FillNoise2DMatchesFbm)
+{
+    PerlinNoise perlin( 11 );
+
+    // Odd width so that the last few columns of a row are left over
+    const unsigned int WIDTH = 21, HEIGHT = 5;
+    std::vector<float> grid( WIDTH * HEIGHT );
+
+    perlin.fillNoise2D( &grid[0], WIDTH, HEIGHT, Vec2( -3.2f, 7.9f ), 0.13f, 3 );
+
+    for ( unsigned int r = 0; r < HEIGHT; ++r )
+    {
+        for ( unsigned int c = 0; c < WIDTH; ++c )
+        {
+            float expected = perlin.fbm( -3.2f + c * 0.13f, 7.9f + r * 0.13f, 3 );
+            EXPECT_NEAR( expected, grid[ r * WIDTH + c ], 1e-5f );
+        }
+    }
+}
+
+TEST(Math,Perlin_FillNoise3DMatchesFbm)
+{
+    PerlinNoise perlin( 12 );
+
+    const unsigned int WIDTH = 19, HEIGHT = 4, DEPTH = 3;
+    std::vector<float> grid( WIDTH * HEIGHT * DEPTH );
+
+    perlin.fillNoise3D( &grid[0], WIDTH, HEIGHT, DEPTH, Vec3( 1.5f, -2.25f, 9.0f ), 0.21f );
+
+    for ( unsigned int s = 0; s < DEPTH; ++s )
+    {
+        for ( unsigned int r = 0; r < HEIGHT; ++r )
+        {
+            for ( unsigned int c = 0; c < WIDTH; ++c )
+            {
+                float expected = perlin.noise( 1.5f + c * 0.21f,
+                                               -2.25f + r * 0.21f,
+                                               9.0f + s * 0.21f );
+                EXPECT_NEAR( expected, grid[ ( s * HEIGHT + r ) * WIDTH + c ], 1e-5f );
+            }
+        }
+    }
+}
+
+TEST(Math,Perlin_FillNoise2DCanBeTiled)
+{
+    PerlinNoise perlin( 13 );
+
+    const unsigned int WIDTH = 32, HEIGHT = 8;
+    const float STEP = 0.05f;
+
+    std::vector<float> whole( WIDTH * HEIGHT ), tiled( WIDTH * HEIGHT );
+    perlin.fillNoise2D( &whole[0], WIDTH, HEIGHT, Vec2( 0.0f, 0.0f ), STEP, 2 );
+
+    // Two bands of rows, the second starting where the first one left off
+    perlin.fillNoise2D( &tiled[0], WIDTH, 3, Vec2( 0.0f, 0.0f ), STEP, 2 );
+    perlin.fillNoise2D( &tiled[3 * WIDTH], WIDTH, HEIGHT - 3, Vec2( 0.0f, 3 * STEP ), STEP, 2 );
+
+    for ( unsigned int i = 0; i < WIDTH * HEIGHT; ++i )
+    {
+        EXPECT_NEAR( whole[i], tiled[i], 1e-5f );
+    }
+}
+
+TEST(Math,Perlin_LargeCoordinatesStayFinite)
+{
+    PerlinNoise perlin( 14 );
+
+    // High octaves push the lattice coordinates well past the range of an
+    // int, both near the origin and far away from it
+    const unsigned int WIDTH = 19, HEIGHT = 3, DEPTH = 2, OCTAVES = 16;
+    const float ORIGINS[] = { 123457.0f, -123457.0f, 4e9f, -4e9f };
+
+    std::vector<float> grid2D( WIDTH * HEIGHT ), grid3D( WIDTH * HEIGHT * DEPTH );
+
+    for ( float origin : ORIGINS )
+    {
+        perlin.fillNoise2D( &grid2D[0], WIDTH, HEIGHT, Vec2( origin, origin ), 0.37f, OCTAVES );
+        perlin.fillNoise3D( &grid3D[0], WIDTH, HEIGHT, DEPTH,
+                            Vec3( origin, origin, origin ), 0.37f, OCTAVES );
+
+        for ( unsigned int r = 0; r < HEIGHT; ++r )
+        {
+            for ( unsigned int c = 0; c < WIDTH; ++c )
+            {
+                float x = origin + c * 0.37f, y = origin + r * 0.37f;
+                float expected = perlin.fbm( x, y, OCTAVES );
+
+                ASSERT_TRUE( std::isfinite( expected ) );
+                EXPECT_LE( std::fabs( expected ), 1.0f );
+                EXPECT_NEAR( expected, grid2D[ r * WIDTH + c ], 1e-5f );
+
+                for ( unsigned int s = 0; s < DEPTH; ++s )
+                {
+                    float z = origin + s * 0.37f;
+                    float expected3D = perlin.fbm( x, y, z, OCTAVES );
+
+                    ASSERT_TRUE( std::isfinite( expected3D ) );
+                    EXPECT_NEAR( expected3D, grid3D[ ( s * HEIGHT + r ) * WIDTH + c ], 1e-5f );
+                }
+            }
+        }
+    }
+
+    // Wrapping the lattice keeps the noise periodic far from the origin
+    EXPECT_FLOAT_EQ( perlin.noise( 0.25f, 1.5f ),
+                     perlin.noise( 256.0f * 1024.0f + 0.25f, 1.5f ) );
+}
@@ -1,4 +1,6 @@
 #include "archive.h"
+#include "archiveentryreader.h"
+#include "deduplication.h"
 #include "thirdparty/sha2.h"
 #include "crc.h"
 #include "constants.h"
@@ -6,12 +8,21 @@
 #include <fstream>
 #include <stdint.h>
 #include <vector>
+#include <list>
+#include <map>
 #include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
 #include <cassert>
 
 #include <boost/scoped_array.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <iostream>
 
 namespace fs = boost::filesystem;
@@ -26,6 +37,11 @@ Archive::Archive( const std::string& archiveName )
     : mArchiveName( archiveName ),
       mHeader(),
       mFileEntries(),
+      mTableOfContents(),
+      mIsDelayLoaded( false ),
+      mDeduplicate( false ),
+      mDataAlignment( DEFAULT_DATA_ALIGNMENT ),
+      mDedupStats(),
       mErrorMessage()
 {
 }
@@ -70,6 +86,7 @@ void Archive::debugDump()
         << "\tflags  : " << (int) mHeader.archiveFlags   << std::endl
         << "\tentries: " << mHeader.numFileEntries << std::endl
         << "\tentryof: " << mHeader.fileEntryDataOffset << std::endl
+        << "\talign  : " << mHeader.dataAlignment << std::endl
         << std::endl;
 
     std::cout
@@ -88,9 +105,15 @@ void Archive::debugDump()
 }
 
 /**
- * Open an archive file from disk
+ * Open an archive file from disk. Normally every file entry's data is read
+ * into memory while opening the archive, but when delay loading is requested
+ * only the header and table of contents are read. File entries can then be
+ * streamed from disk on demand with openEntry.
+ *
+ * \param  filename   Path to the archive file
+ * \param  delayLoad  Skip loading file entry data into memory
  */
-bool Archive::open( const std::string& filename )
+bool Archive::open( const std::string& filename, bool delayLoad )
 {
     // Makes sure to unload the current archive before opening a new one
     unload();
@@ -105,73 +128,198 @@ bool Archive::open( const std::string& filename )
         return false;
     }
 
-    // Pull the header in and validate it
-    ifs.read( reinterpret_cast<char*>( &mHeader ), sizeof(ArchiveHeader) );
+    // Every archive version starts with the magic number and version byte.
+    // Read those first, and then use the version to read the rest of the
+    // header. Older versions are upgraded to the current header in memory
+    uint8_t headerData[ sizeof(ArchiveHeaderV1) + sizeof(ArchiveHeader) ];
+    const std::size_t versionOffset = offsetof( ArchiveHeader, version );
+
+    ifs.read( reinterpret_cast<char*>( &headerData[0] ), versionOffset + 1 );
+
+    const uint8_t version        = headerData[ versionOffset ];
+    const std::size_t headerSize = archiveHeaderSize( version );
+
+    if (! ifs.good() || headerSize == 0 )
+    {
+        raiseError( "Archive version not supported" );
+        return false;
+    }
+
+    ifs.read( reinterpret_cast<char*>( &headerData[0] + versionOffset + 1 ),
+              headerSize - versionOffset - 1 );
+    mHeader = readArchiveHeader( &headerData[0], version );
     
-    if (! validateHeader() )
+    if (! ifs.good() || ! validateHeader() )
     {
         return false;
     }
 
-    // Read the rest of the file into a temporary memory buffer. Once everything
-    // is in memory, we can verify the archive integrity and then proceed to
-    // reading the file entries.
-    const std::size_t headerSize = sizeof(ArchiveHeader);
-    const std::size_t faeSize    = sizeof(ArchiveFileEntry);
+    // The table of contents lives at the end of the archive, after all of the
+    // file data. Read it in first so we know where each entry's data lives
     const std::size_t tocOffset  = mHeader.fileEntryDataOffset;
     const std::size_t dataSize   = tocOffset - headerSize;
-    const std::size_t totalSize  = dataSize + faeSize * mHeader.numFileEntries;
+    const std::size_t entrySize  = archiveFileEntrySize( version );
+
+    // Both the data and the table of contents have to fit in the file, which
+    // is checked before anything is allocated from the header's sizes
+    ifs.seekg( 0, std::ios::end );
+    const uint64_t archiveSize = static_cast<uint64_t>( ifs.tellg() );
+
+    if (! ifs.good() || tocOffset > archiveSize ||
+         mHeader.numFileEntries > ( archiveSize - tocOffset ) / entrySize )
+    {
+        unload();
+        raiseError( "Archive table of contents is out of bounds: " + filename );
+        return false;
+    }
+
+    if ( mHeader.numFileEntries > 0 )
+    {
+        std::vector<uint8_t> tocData( entrySize * mHeader.numFileEntries );
+
+        ifs.seekg( tocOffset, std::ios::beg );
+        ifs.read( reinterpret_cast<char*>( &tocData[0] ), tocData.size() );
+
+        for ( size_t i = 0; i < mHeader.numFileEntries; ++i )
+        {
+            mTableOfContents.push_back(
+                readArchiveFileEntry( &tocData[0] + i * entrySize, version ) );
+        }
+    }
+
+    if (! ifs.good() )
+    {
+        unload();
+        raiseError( "Failed while reading archive table of contents: " + filename );
+        return false;
+    }
+
+    if (! validateTableOfContents() )
+    {
+        unload();
+        return false;
+    }
+
+    // Delay loaded archives stop here, and leave the file data on disk until
+    // someone asks for it
+    mIsDelayLoaded = delayLoad;
+
+    if ( delayLoad )
+    {
+        mArchiveName = filename;
+        return true;
+    }
 
-    boost::scoped_array<uint8_t> pArchiveData( new uint8_t[ totalSize ] );
+    // Read the rest of the file into a temporary memory buffer. Once everything
+    // is in memory, we can verify the archive integrity and then proceed to
+    // reading the file entries.
+    boost::scoped_array<uint8_t> pArchiveData( new uint8_t[ dataSize ] );
 
     // Slurp the delicious bits into memory
-    ifs.read( reinterpret_cast<char*>(&pArchiveData[0]), totalSize );
+    ifs.seekg( headerSize, std::ios::beg );
+    ifs.read( reinterpret_cast<char*>(&pArchiveData[0]), dataSize );
 
     // Set up pointers that will allow us to easily access portions of this
     // archive
     const uint8_t * pFileDataStore          = &pArchiveData[0];
-    const ArchiveFileEntry *pArchiveEntries =
-        reinterpret_cast<ArchiveFileEntry*>( &pArchiveData[0] + dataSize );
-
-    // Compute the SHA-2 hash digest of the archive data, and compare it to the
-    // hash value stored in the archive header. If the values do not match
-    // then either the archive is corrupted or someone has tampered with it.
 
     // Now pull in all of our file entries, and for each one create the
     // appropriate filedata struct referencing the actual binary data
     for ( size_t i = 0; i < mHeader.numFileEntries; ++i )
     {
-        // Grab this entry's header from the archive data buffer
-        const ArchiveFileEntry& archiveEntry = pArchiveEntries[i];
+        // Grab this entry's header from the table of contents
+        const ArchiveFileEntry& archiveEntry = mTableOfContents[i];
+
+        // Chunked entries point to a list of chunks, which need to be
+        // stitched back together to recreate the entry's data. The table of
+        // contents was checked against the file size, but the chunks have to
+        // add up to the entry's size before it is safe to allocate it
+        std::vector<ArchiveChunkEntry> chunks;
+        std::size_t fileSize = archiveEntry.uncompressedSize;
 
-        assert( archiveEntry.fileOffset    != 0 );
-        assert( archiveEntry.fileEntrySize != 0 );
+        if ( archiveEntry.fileFlags & FILE_FLAG_CHUNKED )
+        {
+            chunks = readArchiveChunkList( &pFileDataStore[0] + archiveEntry.fileOffset - headerSize,
+                                           archiveEntry.fileEntrySize,
+                                           version );
+            uint64_t chunkedSize = 0;
+            bool isTooBig        = false;
+
+            for ( size_t j = 0; j < chunks.size() && ! isTooBig; ++j )
+            {
+                isTooBig     = chunks[j].chunkSize > fileSize - chunkedSize;
+                chunkedSize += ( isTooBig ? 0 : chunks[j].chunkSize );
+            }
+
+            if ( isTooBig || chunkedSize != fileSize )
+            {
+                std::string name = archiveEntry.name();
+
+                unload();
+                raiseError( "Corrupted chunk list for file " + name );
+                return false;
+            }
+        }
 
         // Allocate space for the entry's file data, and then copy it from
-        // the temporary data store
-        std::size_t dataOffset   = archiveEntry.fileOffset - headerSize;
-        const uint8_t * pDataPtr = &pFileDataStore[0] + dataOffset;
-        uint8_t * pFileData      = new uint8_t[ archiveEntry.fileEntrySize ];
+        // the temporary data store. Offsets come from the file, so every
+        // extent is checked against the data store before it is copied
+        uint8_t * pFileData = new uint8_t[ fileSize ];
+        std::string corruption;
 
-        std::copy( &pFileDataStore[0] + dataOffset,
-                   &pFileDataStore[0] + dataOffset + archiveEntry.fileEntrySize,
-                   &pFileData[0] );
+        if ( archiveEntry.fileFlags & FILE_FLAG_CHUNKED )
+        {
+            std::size_t copied = 0;
+
+            for ( size_t j = 0; j < chunks.size() && corruption.empty(); ++j )
+            {
+                std::size_t chunkSize = chunks[j].chunkSize;
+
+                if (! isExtentInside( chunks[j].chunkOffset, chunkSize, headerSize, tocOffset ) )
+                {
+                    corruption = "Corrupted chunk list for file ";
+                }
+                else
+                {
+                    const uint8_t * pChunk = &pFileDataStore[0] + chunks[j].chunkOffset - headerSize;
+
+                    std::copy( pChunk, pChunk + chunkSize, &pFileData[0] + copied );
+                    copied += chunkSize;
+                }
+            }
+        }
+        else
+        {
+            const uint8_t * pData = &pFileDataStore[0] + archiveEntry.fileOffset - headerSize;
+
+            std::copy( pData, pData + fileSize, &pFileData[0] );
+        }
 
         // Check that the CRC stored in the archive matches up with a CRC
         // calculate from the data in memory
-        uint32_t result = crc32( pFileData, archiveEntry.fileEntrySize );
+        if ( corruption.empty() && crc32( pFileData, fileSize ) != archiveEntry.checksum )
+        {
+            corruption = "CRC32 checksum failed for file ";
+        }
 
-        if ( result != archiveEntry.checksum )
+        // A damaged entry leaves the archive half loaded, so throw away
+        // everything read so far rather than hand out partial data
+        if (! corruption.empty() )
         {
-            std::string filename( archiveEntry.filename );
-            raiseError( "CRC32 checksum failed for file " + filename );
+            std::string name = archiveEntry.name();
+
+            boost::checked_array_delete( pFileData );
+            unload();
+
+            raiseError( corruption + name );
+            return false;
         }
 
         // Add this file entry to our archive so we can refer back to it
         // when the user asks for file data
         FileEntry fileEntry( archiveEntry.filename,
                              pFileData,
-                             archiveEntry.fileEntrySize );
+                             fileSize );
 
         mFileEntries.push_back( fileEntry );
     }
@@ -197,6 +345,51 @@ bool Archive::open( const std::string& filename )
     return true;
 }
 
+/**
+ * Opens a reader that streams a file entry's data from the archive on disk.
+ * This works for both delay loaded and fully loaded archives, as long as
+ * the archive was opened from a file. The caller is responsible for deleting
+ * the returned reader.
+ *
+ * \param  filename  Name of the file entry to read
+ * \return           Reader for the entry, or NULL if it was not found
+ */
+ArchiveEntryReader* Archive::openEntry( const std::string& filename )
+{
+    for ( size_t i = 0; i < mTableOfContents.size(); ++i )
+    {
+        const ArchiveFileEntry& entry = mTableOfContents[i];
+
+        if ( entry.name() == filename )
+        {
+            return new ArchiveEntryReader( mArchiveName, entry, mHeader.version );
+        }
+    }
+
+    raiseError( "No such file in archive: " + filename );
+    return NULL;
+}
+
+/**
+ * Opens a reader that streams a file entry's data from the archive on disk,
+ * using the entry's position in the archive's table of contents.
+ *
+ * \param  index  Index of the entry, in the same order as fileNameList
+ * \return        Reader for the entry, or NULL if the index is invalid
+ */
+ArchiveEntryReader* Archive::openEntry( std::size_t index )
+{
+    if ( index >= mTableOfContents.size() )
+    {
+        raiseError( "File entry index out of range" );
+        return NULL;
+    }
+
+    return new ArchiveEntryReader( mArchiveName,
+                                   mTableOfContents[index],
+                                   mHeader.version );
+}
+
 /**
  * Instructs the archive instance to unload, which will remove all archive
  * entries from memeory and any unsaved changes to be lost.
@@ -216,7 +409,9 @@ void Archive::unload()
     mHeader.fileEntryDataOffset = 0;
 
     mFileEntries.clear();
+    mTableOfContents.clear();
     mArchiveName.clear();
+    mIsDelayLoaded = false;
 }
 
 /**
@@ -251,6 +446,7 @@ bool Archive::add( const std::string& filename,
     mFileEntries.push_back( FileEntry( filename, pFileData, numberOfBytes ) );
 
     mHeader.numFileEntries += 1;
+    return true;
 }
 
 /**
@@ -264,6 +460,23 @@ bool Archive::remove( const std::string& filename )
 // Check if a file is in the archive
 bool Archive::exists( const std::string& filename )
 {
+    for ( size_t i = 0; i < mTableOfContents.size(); ++i )
+    {
+        if ( mTableOfContents[i].name() == filename )
+        {
+            return true;
+        }
+    }
+
+    for ( size_t i = 0; i < mFileEntries.size(); ++i )
+    {
+        if ( mFileEntries[i].filename() == filename )
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 size_t Archive::calculateFileDataStoreSize() const
@@ -283,6 +496,11 @@ size_t Archive::calculateFileDataStoreSize() const
  */
 size_t Archive::fileCount() const
 {
+    if ( mIsDelayLoaded )
+    {
+        return mTableOfContents.size();
+    }
+
     return mFileEntries.size();
 }
 
@@ -293,6 +511,16 @@ std::vector<std::string> Archive::fileNameList() const
 {
     std::vector<std::string> filenames;
 
+    if ( mIsDelayLoaded )
+    {
+        for ( size_t i = 0; i < mTableOfContents.size(); ++i )
+        {
+            filenames.push_back( mTableOfContents[i].name() );
+        }
+
+        return filenames;
+    }
+
     for ( int i = 0; i < mFileEntries.size(); ++i )
     {
         filenames.push_back( mFileEntries[i].filename() ) ;
@@ -303,7 +531,14 @@ std::vector<std::string> Archive::fileNameList() const
 
 /**
  * Updates all record data in the archive, and then writes everything out
- * to disk
+ * to disk. Archives are always written in the current format version, with
+ * every file entry's data starting at an offset that is a multiple of the
+ * archive's data alignment.
+ *
+ * When deduplication is enabled, file entries with identical contents share
+ * a single copy of their data in the archive. Large entries are further
+ * split into content defined chunks, and any chunk that was already stored
+ * by another entry is referenced rather than being written out again.
  */
 bool Archive::save()
 {
@@ -314,48 +549,127 @@ bool Archive::save()
     assert( mArchiveName.size() > 0 );
     assert( mHeader.numFileEntries == mFileEntries.size() );
 
-    // Calculate the total size that will be required when writing out all
-    // of the file entry's file data
-    const std::size_t fileDataSize = calculateFileDataStoreSize();
-
-    // Allocate a memory buff to store all the file contents, and then
-    // copy each file's data into this memory buffer. Also start creating a
-    // list of TOC entries that will be written out
-    boost::scoped_array<uint8_t> pFileDataStore(new uint8_t[fileDataSize]);
+    // Work out where each file entry's data is going to be stored, and build
+    // up the list of data regions that need to be written to disk. Regions
+    // point directly at the file entry memory so nothing is copied before it
+    // is written.
     std::vector<ArchiveFileEntry> archiveEntries;
+    std::vector< std::pair<const uint8_t*, std::size_t> > dataRegions;
+    std::list< std::vector<ArchiveChunkEntry> > chunkLists;
+    std::map<ContentDigest, uint64_t> storedRegions;
+
+    const std::size_t headerSize = sizeof( ArchiveHeader );
+    uint64_t fileOffset          = headerSize;
 
-    std::size_t headerSize      = sizeof( ArchiveHeader );
-    std::size_t fileStoreOffset = 0;
+    mHeader.version       = ARCHIVE_VERSION;
+    mHeader.dataAlignment = mDataAlignment;
+    mDedupStats           = DeduplicationStats();
 
     for ( size_t i = 0; i < mFileEntries.size(); ++i )
     {
         const FileEntry& fileEntry = mFileEntries[i];
+        const uint8_t * pFileData  = fileEntry.memoryPointer();
+        const std::size_t fileSize = fileEntry.memorySize();
         
         // Calculate the CRC32 checksum for this file entry's file data
-        uint32_t result = crc32( fileEntry.memoryPointer(),
-                                 fileEntry.memorySize() );
+        uint32_t result = crc32( pFileData, fileSize );
 
-        // Generate the file archive entry before copying memory
-        ArchiveFileEntry farEntry( fileEntry.filename(),
-                                   fileEntry.memorySize(),
-                                   fileStoreOffset + headerSize,
-                                   result );
+        mDedupStats.logicalBytes += fileSize;
 
-        archiveEntries.push_back( farEntry );
+        if (! mDeduplicate )
+        {
+            // Generate the file archive entry, and store the data as is
+            uint64_t offset = appendRegion( pFileData, fileSize,
+                                            fileOffset, dataRegions );
+
+            archiveEntries.push_back( ArchiveFileEntry( fileEntry.filename(),
+                                                        fileSize,
+                                                        offset,
+                                                        result ) );
+        }
+        else if ( fileSize < CHUNKING_THRESHOLD )
+        {
+            // Small entries are deduplicated as a whole
+            uint64_t offset = storeRegion( pFileData, fileSize, fileOffset,
+                                           storedRegions, dataRegions );
+
+            archiveEntries.push_back( ArchiveFileEntry( fileEntry.filename(),
+                                                        fileSize,
+                                                        offset,
+                                                        result ) );
+        }
+        else
+        {
+            // Large entries are split into chunks, and the entry points at a
+            // list of chunks rather than at the data itself
+            std::vector<std::size_t> chunkSizes =
+                findContentChunks( pFileData, fileSize );
+
+            chunkLists.push_back( std::vector<ArchiveChunkEntry>() );
+            std::vector<ArchiveChunkEntry>& chunkList = chunkLists.back();
+
+            std::size_t chunkStart = 0;
+
+            for ( size_t j = 0; j < chunkSizes.size(); ++j )
+            {
+                ArchiveChunkEntry chunk;
+                chunk.chunkSize   = chunkSizes[j];
+                chunk.chunkOffset = storeRegion( pFileData + chunkStart,
+                                                 chunkSizes[j],
+                                                 fileOffset,
+                                                 storedRegions,
+                                                 dataRegions );
+
+                chunkStart += chunkSizes[j];
+
+                chunkList.push_back( chunk );
+            }
+
+            // The chunk list itself is written into the data region
+            const std::size_t chunkListSize =
+                sizeof(ArchiveChunkEntry) * chunkList.size();
+
+            uint64_t offset = appendRegion(
+                    reinterpret_cast<const uint8_t*>( &chunkList[0] ),
+                    chunkListSize,
+                    fileOffset,
+                    dataRegions );
+
+            ArchiveFileEntry farEntry( fileEntry.filename(),
+                                       chunkListSize,
+                                       offset,
+                                       result );
+            farEntry.uncompressedSize = fileSize;
+            farEntry.fileFlags       |= FILE_FLAG_CHUNKED;
+
+            archiveEntries.push_back( farEntry );
+            mDedupStats.chunkedEntries += 1;
+        }
+    }
 
-        // Now copy the entry's file data into our temporary memory buffer
-        // that will be written to disk
-        const uint8_t * pFileData = fileEntry.memoryPointer();
-        std::copy( &pFileData[0],
-                   &pFileData[0] + fileEntry.memorySize(),
-                   &pFileDataStore[0] + fileStoreOffset );
+    // Update the header's TOC offset to account for the data chunks. The
+    // table of contents is aligned just like file data
+    mHeader.fileEntryDataOffset = appendRegion( NULL, 0, fileOffset, dataRegions );
+    mDedupStats.storedBytes     = fileOffset - headerSize;
 
-        // Move the file store pointer further into the buffer
-        fileStoreOffset += fileEntry.memorySize();
+    // Hash everything that follows the header, so that tampering with either
+    // the file data or the table of contents can be detected
+    SHA256_CTX hashContext;
+    SHA256_Init( &hashContext );
+
+    for ( size_t i = 0; i < dataRegions.size(); ++i )
+    {
+        SHA256_Update( &hashContext, dataRegions[i].first, dataRegions[i].second );
     }
 
-    // Update the header's TOC offset to account for the data chunks
-    mHeader.fileEntryDataOffset = fileDataSize + headerSize;
+    if (! archiveEntries.empty() )
+    {
+        SHA256_Update( &hashContext,
+                       reinterpret_cast<const uint8_t*>( &archiveEntries[0] ),
+                       sizeof(ArchiveFileEntry) * archiveEntries.size() );
+    }
+
+    SHA256_Final( mHeader.archiveHash, &hashContext );
 
     // Create an output filestream that we will use to stream all of te
     // archive data to
@@ -371,9 +685,12 @@ bool Archive::save()
     // First we need to write the file header (Who would've guessed?)
     afs.write( reinterpret_cast<char*>(&mHeader), sizeof(ArchiveHeader) );
     
-    // Write out the archive file data
-    afs.write( reinterpret_cast<char*>(&pFileDataStore[0]),
-               sizeof(uint8_t) * fileDataSize );
+    // Write out the archive file data, one region at a time
+    for ( size_t i = 0; i < dataRegions.size(); ++i )
+    {
+        afs.write( reinterpret_cast<const char*>( dataRegions[i].first ),
+                   sizeof(uint8_t) * dataRegions[i].second );
+    }
 
     // Write out the archive table of contents. Simply loop through our
     // generated list of file archive structs and dump them to disk
@@ -384,17 +701,361 @@ bool Archive::save()
                   sizeof(ArchiveFileEntry) );
     }
 
+    if (! afs.good() )
+    {
+        raiseError( "Failed while writing archive: " + mArchiveName );
+        return false;
+    }
+
     afs.close();
     return true;
 }
 
+/**
+ * Queues up a region of data to be written at the end of the data store.
+ * Padding is inserted before the region so that it starts on a multiple of
+ * the archive's data alignment.
+ *
+ * \param  pData          Data to store
+ * \param  numberOfBytes  Size of the data
+ * \param  fileOffset     File offset of the end of the data store, which is
+ *                        advanced past the padding and data
+ * \param  dataRegions    List of data regions to be written
+ * \return                File offset the data will be written at
+ */
+uint64_t Archive::appendRegion(
+        const uint8_t * pData,
+        std::size_t numberOfBytes,
+        uint64_t& fileOffset,
+        std::vector< std::pair<const uint8_t*, std::size_t> >& dataRegions )
+{
+    static const uint8_t ALIGNMENT_PADDING[MAX_DATA_ALIGNMENT] = { 0 };
+    const std::size_t padding =
+        ( mDataAlignment - fileOffset % mDataAlignment ) % mDataAlignment;
+
+    if ( padding > 0 )
+    {
+        dataRegions.push_back( std::make_pair( ALIGNMENT_PADDING, padding ) );
+        fileOffset += padding;
+    }
+
+    const uint64_t regionOffset = fileOffset;
+
+    if ( numberOfBytes > 0 )
+    {
+        dataRegions.push_back( std::make_pair( pData, numberOfBytes ) );
+        fileOffset += numberOfBytes;
+    }
+
+    return regionOffset;
+}
+
+/**
+ * Looks for an already stored data region with the same contents as the
+ * given data. If one exists its offset is returned, otherwise the data is
+ * queued up to be written at the end of the data store.
+ *
+ * \param  pData          Data to store
+ * \param  numberOfBytes  Size of the data
+ * \param  fileOffset     File offset of the end of the data store, which is
+ *                        advanced past the data if it needs to be written
+ * \param  storedRegions  Offsets of already stored data, by content digest
+ * \param  dataRegions    List of data regions to be written
+ * \return                File offset of the stored data
+ */
+uint64_t Archive::storeRegion(
+        const uint8_t * pData,
+        std::size_t numberOfBytes,
+        uint64_t& fileOffset,
+        std::map<ContentDigest, uint64_t>& storedRegions,
+        std::vector< std::pair<const uint8_t*, std::size_t> >& dataRegions )
+{
+    ContentDigest digest( pData, numberOfBytes );
+    std::map<ContentDigest, uint64_t>::const_iterator itr =
+        storedRegions.find( digest );
+
+    if ( itr != storedRegions.end() )
+    {
+        mDedupStats.duplicateRegions += 1;
+        return itr->second;
+    }
+
+    uint64_t offset = appendRegion( pData, numberOfBytes, fileOffset, dataRegions );
+    storedRegions.insert( std::make_pair( digest, offset ) );
+
+    mDedupStats.uniqueRegions += 1;
+    return offset;
+}
+
+/**
+ * Sets the alignment of file entry data when the archive is saved. The
+ * alignment must be a power of two no larger than MAX_DATA_ALIGNMENT.
+ */
+bool Archive::setDataAlignment( std::size_t alignment )
+{
+    if ( alignment == 0 || alignment > MAX_DATA_ALIGNMENT ||
+         ( alignment & ( alignment - 1 ) ) != 0 )
+    {
+        raiseError( "Data alignment must be a power of two up to 4096" );
+        return false;
+    }
+
+    mDataAlignment = alignment;
+    return true;
+}
+
+/**
+ * Enables or disables deduplication of file data when the archive is saved
+ */
+void Archive::setDeduplication( bool enabled )
+{
+    mDeduplicate = enabled;
+}
+
+/**
+ * Returns statistics on how well the archive's data deduplicated during the
+ * last save
+ */
+DeduplicationStats Archive::deduplicationStats() const
+{
+    return mDedupStats;
+}
+
+/**
+ * Verifies the integrity of an opened archive by checking every file entry's
+ * CRC32 checksum, and the SHA-256 hash of the whole archive. The archive is
+ * memory mapped and the checks are spread out over a pool of worker threads,
+ * with the archive hash scheduled first since it is the largest single job.
+ *
+ * Archives written before the hash was stored have an empty hash, and only
+ * have their file entries checked.
+ *
+ * \param  numThreads  Most worker threads to verify with. No more threads are
+ *                     started than there are jobs to run
+ * \return             Report listing failed entries and throughput
+ */
+ArchiveVerifyReport Archive::verify( unsigned int numThreads )
+{
+    ArchiveVerifyReport report;
+    boost::posix_time::ptime startTime =
+        boost::posix_time::microsec_clock::universal_time();
+
+    boost::iostreams::mapped_file_source mappedFile;
+
+    try
+    {
+        mappedFile.open( mArchiveName );
+    }
+    catch ( const std::exception& e )
+    {
+        raiseError( "Failed to map archive for verification: " + mArchiveName );
+        report.failures.push_back( e.what() );
+        return report;
+    }
+
+    const uint8_t * pArchive = reinterpret_cast<const uint8_t*>( mappedFile.data() );
+    const std::size_t archiveSize = mappedFile.size();
+
+    // An archive hash of all zeros means the archive predates archive hashing
+    const uint8_t * pStoredHash = mHeader.archiveHash;
+    report.hashPresent = std::count( pStoredHash,
+                                     pStoredHash + SHA256_DIGEST_LENGTH,
+                                     0 ) != SHA256_DIGEST_LENGTH;
+
+    // Job zero is the archive hash, and every job after that checks a single
+    // file entry. Workers keep pulling the next job until they run out
+    std::size_t nextJob = report.hashPresent ? 0 : 1;
+    const std::size_t numJobs = mTableOfContents.size() + 1;
+    boost::mutex jobMutex;
+
+    // There is no point starting more workers than there are jobs for them
+    boost::thread_group workers;
+    numThreads = static_cast<unsigned int>(
+        std::min<std::size_t>( std::max( numThreads, 1u ), numJobs - nextJob ) );
+
+    for ( unsigned int i = 0; i < numThreads; ++i )
+    {
+        workers.create_thread(
+            boost::bind( &Archive::verifyWorker, this,
+                         pArchive, archiveSize,
+                         boost::ref( nextJob ), numJobs,
+                         boost::ref( jobMutex ), boost::ref( report ) ) );
+    }
+
+    workers.join_all();
+
+    // Report the results, sorted so they do not depend on thread timing
+    std::sort( report.failures.begin(), report.failures.end() );
+
+    for ( size_t i = 0; i < report.failures.size(); ++i )
+    {
+        raiseError( report.failures[i] );
+    }
+
+    boost::posix_time::time_duration elapsed =
+        boost::posix_time::microsec_clock::universal_time() - startTime;
+    report.elapsedSeconds = elapsed.total_microseconds() / 1000000.0;
+
+    return report;
+}
+
+/**
+ * Verification worker thread. Repeatedly claims the next unclaimed job and
+ * runs it until all jobs have been claimed. Job zero is the archive hash,
+ * and the remaining jobs are the file entries in table of contents order.
+ */
+void Archive::verifyWorker( const uint8_t * pArchive,
+                            std::size_t archiveSize,
+                            std::size_t& nextJob,
+                            std::size_t numJobs,
+                            boost::mutex& jobMutex,
+                            ArchiveVerifyReport& report ) const
+{
+    const std::size_t headerSize = archiveHeaderSize( mHeader.version );
+
+    for (;;)
+    {
+        std::size_t job = 0;
+
+        {
+            boost::mutex::scoped_lock lock( jobMutex );
+
+            if ( nextJob >= numJobs )
+            {
+                return;
+            }
+
+            job = nextJob++;
+        }
+
+        std::string failure;
+        std::size_t bytesChecked = 0;
+
+        if ( job == 0 )
+        {
+            // Hash everything following the header and compare it to the
+            // hash the archive was saved with
+            uint8_t digest[SHA256_DIGEST_LENGTH];
+            SHA256_CTX context;
+
+            SHA256_Init( &context );
+            SHA256_Update( &context, pArchive + headerSize, archiveSize - headerSize );
+            SHA256_Final( digest, &context );
+
+            bytesChecked = archiveSize - headerSize;
+
+            if (! std::equal( digest, digest + SHA256_DIGEST_LENGTH,
+                              mHeader.archiveHash ) )
+            {
+                failure = "SHA-256 archive hash does not match, archive is "
+                          "corrupted or has been tampered with";
+            }
+        }
+        else
+        {
+            const ArchiveFileEntry& entry = mTableOfContents[ job - 1 ];
+            failure = verifyEntry( entry, pArchive, archiveSize, bytesChecked );
+        }
+
+        boost::mutex::scoped_lock lock( jobMutex );
+
+        if ( job == 0 )
+        {
+            report.hashMatches = failure.empty();
+        }
+        else
+        {
+            report.entriesChecked += 1;
+        }
+
+        report.bytesChecked += bytesChecked;
+
+        if (! failure.empty() )
+        {
+            report.failures.push_back( failure );
+        }
+    }
+}
+
+/**
+ * Checks a single file entry against its CRC32 checksum, using the memory
+ * mapped archive data.
+ *
+ * \param  entry         Table of contents record for the entry
+ * \param  pArchive      Pointer to the start of the mapped archive
+ * \param  archiveSize   Size of the mapped archive
+ * \param  bytesChecked  Receives the number of bytes that were checksummed
+ * \return               Description of the failure, or empty if the entry
+ *                       is valid
+ */
+std::string Archive::verifyEntry( const ArchiveFileEntry& entry,
+                                  const uint8_t * pArchive,
+                                  std::size_t archiveSize,
+                                  std::size_t& bytesChecked ) const
+{
+    const std::size_t headerSize = archiveHeaderSize( mHeader.version );
+    const std::size_t dataEnd    = std::min<std::size_t>( mHeader.fileEntryDataOffset,
+                                                          archiveSize );
+
+    // Gather up the extents holding the entry's data
+    std::vector<ArchiveChunkEntry> extents;
+
+    if ( entry.fileFlags & FILE_FLAG_CHUNKED )
+    {
+        if (! isExtentInside( entry.fileOffset, entry.fileEntrySize, headerSize, dataEnd ) )
+        {
+            return "Chunk list out of bounds for file " + entry.name();
+        }
+
+        extents = readArchiveChunkList( pArchive + entry.fileOffset,
+                                        entry.fileEntrySize,
+                                        mHeader.version );
+    }
+    else
+    {
+        ArchiveChunkEntry extent;
+        extent.chunkOffset = entry.fileOffset;
+        extent.chunkSize   = entry.fileEntrySize;
+
+        extents.push_back( extent );
+    }
+
+    uint32_t checksum = 0;
+
+    for ( size_t i = 0; i < extents.size(); ++i )
+    {
+        const std::size_t offset = extents[i].chunkOffset;
+        const std::size_t size   = extents[i].chunkSize;
+
+        if (! isExtentInside( offset, size, headerSize, dataEnd ) )
+        {
+            return "Data out of bounds for file " + entry.name();
+        }
+
+        checksum      = crc32Update( checksum, pArchive + offset, size );
+        bytesChecked += size;
+    }
+
+    if ( bytesChecked != entry.uncompressedSize )
+    {
+        return "Size mismatch for file " + entry.name();
+    }
+
+    if ( checksum != entry.checksum )
+    {
+        return "CRC32 checksum failed for file " + entry.name();
+    }
+
+    return std::string();
+}
+
 /**
  * Validate the archive header
  */
 bool Archive::validateHeader()
 {
     const ArchiveHeader& h  = mHeader;
-    const size_t headerSize = sizeof(ArchiveHeader); 
+    const size_t headerSize = archiveHeaderSize( h.version );
     bool isValid            = true;
 
     if ( h.magic[0] != 0x89 || h.magic[1] != 0x46 ||
@@ -406,7 +1067,7 @@ bool Archive::validateHeader()
         isValid = false;
     }
 
-    if ( h.version != 1 )
+    if ( h.version != ARCHIVE_VERSION_1 && h.version != ARCHIVE_VERSION_2 )
     {
         raiseError( "Archive version not supported" );
         isValid = false;
@@ -428,6 +1089,85 @@ bool Archive::validateHeader()
     return isValid;
 }
 
+/**
+ * Validate the table of contents against the header. Every entry's data, or
+ * its chunk list, has to lie between the header and the table of contents,
+ * and the sizes stored for it have to agree, so nothing read from the table
+ * of contents can make the archive allocate or read more than the file holds
+ */
+bool Archive::validateTableOfContents()
+{
+    const std::size_t headerSize     = archiveHeaderSize( mHeader.version );
+    const std::size_t chunkEntrySize = archiveChunkEntrySize( mHeader.version );
+    const uint64_t tocOffset         = mHeader.fileEntryDataOffset;
+
+    for ( size_t i = 0; i < mTableOfContents.size(); ++i )
+    {
+        const ArchiveFileEntry& entry = mTableOfContents[i];
+
+        if (! isExtentInside( entry.fileOffset, entry.fileEntrySize, headerSize, tocOffset ) )
+        {
+            raiseError( "File data out of bounds for file " + entry.name() );
+            return false;
+        }
+
+        if ( entry.fileFlags & FILE_FLAG_CHUNKED )
+        {
+            // Chunk lists did not exist before version 2, so a chunked entry
+            // in an older archive means the archive is damaged
+            if ( chunkEntrySize == 0 )
+            {
+                raiseError( "Chunked entry in an archive version without chunks: " + entry.name() );
+                return false;
+            }
+
+            if ( entry.fileEntrySize % chunkEntrySize != 0 )
+            {
+                raiseError( "Corrupted chunk list for file " + entry.name() );
+                return false;
+            }
+        }
+        else if ( entry.fileEntrySize != entry.uncompressedSize )
+        {
+            raiseError( "Entry size does not match uncompressed size: " + entry.name() );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+ArchiveVerifyReport::ArchiveVerifyReport()
+    : failures(),
+      entriesChecked( 0 ),
+      bytesChecked( 0 ),
+      hashPresent( false ),
+      hashMatches( false ),
+      elapsedSeconds( 0.0 )
+{
+}
+
+/**
+ * Checks if the archive passed verification
+ */
+bool ArchiveVerifyReport::isValid() const
+{
+    return failures.empty() && ( hashMatches || ! hashPresent );
+}
+
+/**
+ * Returns the verification throughput in megabytes per second
+ */
+double ArchiveVerifyReport::throughput() const
+{
+    if ( elapsedSeconds <= 0.0 )
+    {
+        return 0.0;
+    }
+
+    return ( bytesChecked / ( 1024.0 * 1024.0 ) ) / elapsedSeconds;
+}
+
 /**
  * Clears any active errors
  */
@@ -4,11 +4,36 @@
 #include <stdint.h>
 #include <vector>
 #include <string>
+#include <map>
+#include <utility>
 
 #include "thirdparty/sha2.h"
 #include "constants.h"
 #include "archivedata.h"
 #include "fileentry.h"
+#include "deduplication.h"
+
+#include <boost/thread/mutex.hpp>
+
+class ArchiveEntryReader;
+
+/**
+ * Results of verifying an archive's integrity
+ */
+struct ArchiveVerifyReport
+{
+    ArchiveVerifyReport();
+
+    bool isValid() const;
+    double throughput() const;
+
+    std::vector<std::string> failures;  // Description of each failure
+    std::size_t entriesChecked;         // Number of file entries checked
+    std::size_t bytesChecked;           // Bytes checksummed or hashed
+    bool hashPresent;                   // Archive has a stored SHA-256 hash
+    bool hashMatches;                   // Stored hash matched the archive
+    double elapsedSeconds;              // Time taken to verify
+};
 
 class Archive
 {
@@ -20,7 +45,11 @@ public:
     void debugDump();
 
     // Open an archive file
-    bool open( const std::string& filename );
+    bool open( const std::string& filename, bool delayLoad = false );
+
+    // Open a streaming reader for a file in the archive
+    ArchiveEntryReader* openEntry( const std::string& filename );
+    ArchiveEntryReader* openEntry( std::size_t index );
 
     // Close an archive file
     void close();
@@ -47,18 +76,61 @@ public:
     size_t calculateFileDataStoreSize() const;
     bool save();
 
+    // Check all file entry checksums and the archive hash in parallel
+    ArchiveVerifyReport verify( unsigned int numThreads );
+
+    // Share identical file data and chunks when saving the archive
+    void setDeduplication( bool enabled );
+
+    // Set the alignment of file data when saving the archive
+    bool setDataAlignment( std::size_t alignment );
+
+    // Get statistics on deduplication from the last save
+    DeduplicationStats deduplicationStats() const;
+
 protected:
     void raiseError( const std::string& message );
     void clearErrors();
     bool validateHeader();
+    bool validateTableOfContents();
 
     bool load();
     void unload();
 
+    void verifyWorker( const uint8_t * pArchive,
+                       std::size_t archiveSize,
+                       std::size_t& nextJob,
+                       std::size_t numJobs,
+                       boost::mutex& jobMutex,
+                       ArchiveVerifyReport& report ) const;
+
+    std::string verifyEntry( const ArchiveFileEntry& entry,
+                             const uint8_t * pArchive,
+                             std::size_t archiveSize,
+                             std::size_t& bytesChecked ) const;
+
+    uint64_t appendRegion(
+            const uint8_t * pData,
+            std::size_t numberOfBytes,
+            uint64_t& fileOffset,
+            std::vector< std::pair<const uint8_t*, std::size_t> >& dataRegions );
+
+    uint64_t storeRegion(
+            const uint8_t * pData,
+            std::size_t numberOfBytes,
+            uint64_t& fileOffset,
+            std::map<ContentDigest, uint64_t>& storedRegions,
+            std::vector< std::pair<const uint8_t*, std::size_t> >& dataRegions );
+
 private:
     std::string mArchiveName;
     ArchiveHeader mHeader;
     std::vector<FileEntry> mFileEntries;
+    std::vector<ArchiveFileEntry> mTableOfContents;
+    bool mIsDelayLoaded;
+    bool mDeduplicate;
+    std::size_t mDataAlignment;
+    DeduplicationStats mDedupStats;
     std::string mErrorMessage;
 };
 
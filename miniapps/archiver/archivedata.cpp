@@ -6,13 +6,18 @@
 #include <string>
 #include <cstddef>      // remove?
 #include <cstring>      // remove
+#include <vector>
 
 ArchiveHeader::ArchiveHeader()
     : magic(),
-      version( 1 ),
+      version( ARCHIVE_VERSION ),
       archiveFlags( 0 ),
+      reserved0( 0 ),
       numFileEntries( 0 ),
-      fileEntryDataOffset( 0 )      // invalid offset on purpose!
+      fileEntryDataOffset( 0 ),     // invalid offset on purpose!
+      dataAlignment( DEFAULT_DATA_ALIGNMENT ),
+      reserved1( 0 ),
+      archiveHash()
 {
     magic[0] = 0x89;
     magic[1] = 0x46;
@@ -29,24 +34,194 @@ ArchiveFileEntry::ArchiveFileEntry()
       uncompressedSize( 0 ),
       fileOffset( 0 ),
       checksum( 0 ),
-      fileFlags( 0 )
+      fileFlags( 0 ),
+      reserved()
 {
     // change to stl algo
     memset( &filename[0], 0, MAX_FILENAME_LENGTH * sizeof(char) );
 }
 
 ArchiveFileEntry::ArchiveFileEntry( const std::string& filename_,
-                                    const std::size_t archiveEntrySize,
-                                    const std::size_t fileDataOffset,
+                                    const uint64_t archiveEntrySize,
+                                    const uint64_t fileDataOffset,
                                     uint32_t checksum_ )
     : fileEntrySize( archiveEntrySize ),
       uncompressedSize( archiveEntrySize ),
       fileOffset( fileDataOffset ),
       checksum( checksum_ ),
       fileFlags( 0 ),
+      reserved(),
       filename()
 {
     // Copy the name into a fixed length buffer, change to STL algo
     memset( &filename[0], 0, MAX_FILENAME_LENGTH * sizeof(char) );
     strncpy( &filename[0], filename_.c_str(), MAX_FILENAME_LENGTH * sizeof(char) );
 }
+
+/**
+ * Returns the entry's filename. The stored name is not null terminated when
+ * it uses the full filename buffer.
+ */
+std::string ArchiveFileEntry::name() const
+{
+    return std::string( &filename[0],
+                        strnlen( &filename[0], MAX_FILENAME_LENGTH ) );
+}
+
+/**
+ * Returns the size of the archive header for an archive version
+ */
+std::size_t archiveHeaderSize( uint8_t version )
+{
+    switch ( version )
+    {
+        case ARCHIVE_VERSION_1:
+            return sizeof(ArchiveHeaderV1);
+        case ARCHIVE_VERSION_2:
+            return sizeof(ArchiveHeader);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns the size of a table of contents entry for an archive version
+ */
+std::size_t archiveFileEntrySize( uint8_t version )
+{
+    switch ( version )
+    {
+        case ARCHIVE_VERSION_1:
+            return sizeof(ArchiveFileEntryV1);
+        case ARCHIVE_VERSION_2:
+            return sizeof(ArchiveFileEntry);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns the size of a chunk list entry for an archive version, or zero if
+ * the version does not support chunked entries
+ */
+std::size_t archiveChunkEntrySize( uint8_t version )
+{
+    switch ( version )
+    {
+        case ARCHIVE_VERSION_2:
+            return sizeof(ArchiveChunkEntry);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Reads an archive header that was stored in the given format version, and
+ * returns it as a current archive header. The header keeps its original
+ * version number so the rest of the archive can be read correctly.
+ *
+ * \param  pData    Pointer to the stored header
+ * \param  version  Format version of the stored header
+ * \return          The header in the current format
+ */
+ArchiveHeader readArchiveHeader( const uint8_t * pData, uint8_t version )
+{
+    ArchiveHeader header;
+
+    if ( version == ARCHIVE_VERSION_1 )
+    {
+        ArchiveHeaderV1 old;
+        memcpy( &old, pData, sizeof(ArchiveHeaderV1) );
+
+        memcpy( header.magic, old.magic, sizeof(header.magic) );
+        memcpy( header.archiveHash, old.archiveHash, SHA256_DIGEST_LENGTH );
+
+        header.version             = old.version;
+        header.archiveFlags        = old.archiveFlags;
+        header.numFileEntries      = old.numFileEntries;
+        header.fileEntryDataOffset = old.fileEntryDataOffset;
+        header.dataAlignment       = 1;
+    }
+    else
+    {
+        memcpy( &header, pData, sizeof(ArchiveHeader) );
+    }
+
+    return header;
+}
+
+/**
+ * Reads a table of contents entry that was stored in the given format
+ * version, and returns it as a current entry
+ */
+ArchiveFileEntry readArchiveFileEntry( const uint8_t * pData, uint8_t version )
+{
+    ArchiveFileEntry entry;
+
+    if ( version == ARCHIVE_VERSION_1 )
+    {
+        ArchiveFileEntryV1 old;
+        memcpy( &old, pData, sizeof(ArchiveFileEntryV1) );
+
+        entry.fileEntrySize    = old.fileEntrySize;
+        entry.uncompressedSize = old.uncompressedSize;
+        entry.fileOffset       = old.fileOffset;
+        entry.checksum         = old.checksum;
+        entry.fileFlags        = old.fileFlags;
+
+        memcpy( entry.filename, old.filename, MAX_FILENAME_LENGTH );
+    }
+    else
+    {
+        memcpy( &entry, pData, sizeof(ArchiveFileEntry) );
+    }
+
+    return entry;
+}
+
+/**
+ * Reads a chunked file entry's list of chunks that was stored in the given
+ * format version.
+ *
+ * \param  pData          Pointer to the stored chunk list
+ * \param  numberOfBytes  Size of the stored chunk list
+ * \param  version        Format version of the archive
+ * \return                List of chunks in the current format
+ */
+std::vector<ArchiveChunkEntry> readArchiveChunkList( const uint8_t * pData,
+                                                     uint64_t numberOfBytes,
+                                                     uint8_t version )
+{
+    const std::size_t entrySize = archiveChunkEntrySize( version );
+    std::vector<ArchiveChunkEntry> chunks;
+
+    if ( entrySize == 0 )
+    {
+        return chunks;
+    }
+
+    chunks.resize( numberOfBytes / entrySize );
+
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        memcpy( &chunks[i], pData + i * entrySize, sizeof(ArchiveChunkEntry) );
+    }
+
+    return chunks;
+}
+
+/**
+ * Checks that an extent of an archive lies within a region of the archive.
+ * Offsets and sizes are read from the archive, so they are compared in a way
+ * that cannot overflow no matter how large they are.
+ *
+ * \param  offset  Offset of the extent
+ * \param  size    Size of the extent
+ * \param  begin   Start of the region
+ * \param  end     End of the region, one past the last byte
+ * eturn         True if the whole extent is inside the region
+ */
+bool isExtentInside( uint64_t offset, uint64_t size, uint64_t begin, uint64_t end )
+{
+    return begin <= end && offset >= begin && offset <= end && size <= end - offset;
+}
@@ -1,12 +1,18 @@
+#ifndef SCOTT_ARCHIVE_ARCHIVEDATA_H
+#define SCOTT_ARCHIVE_ARCHIVEDATA_H
+
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <cstddef>
 
 #include "thirdparty/sha2.h"
 #include "constants.h"
 
 /**
- * This is found at the beginning of every archive
+ * This is found at the beginning of every archive. Every archive version
+ * starts with the magic number followed by the version byte, so the version
+ * can be read before the rest of the header is interpreted.
  */
 struct ArchiveHeader
 {
@@ -15,24 +21,87 @@ struct ArchiveHeader
     uint8_t magic[8];       // file header 0x89 0x46 0x41 0x52 0D 0A 1A 0A
     uint8_t version;        // version the archive format
     uint8_t archiveFlags;   // 0: archive full compression
+    uint16_t reserved0;
     uint32_t numFileEntries;// number of files in archive
-    uint32_t fileEntryDataOffset; // XXX rename to fileEntryListOffset
-    uint32_t archiveHash[SHA256_DIGEST_LENGTH]; // 32 bytes
+    uint64_t fileEntryDataOffset; // XXX rename to fileEntryListOffset
+    uint32_t dataAlignment; // alignment of file data offsets
+    uint32_t reserved1;
+    uint8_t archiveHash[SHA256_DIGEST_LENGTH]; // 32 bytes
 } __attribute__((__packed__));
 
 struct ArchiveFileEntry
 {
     ArchiveFileEntry();
     ArchiveFileEntry( const std::string& filename_,
-                      const std::size_t archiveEntrySize,
-                      const std::size_t fileDataOffset,
+                      const uint64_t archiveEntrySize,
+                      const uint64_t fileDataOffset,
                       uint32_t checksum_ );
 
-    uint32_t fileEntrySize;     // Size of data as stored in archive
-    uint32_t uncompressedSize;  // Size once uncompressed
-    uint32_t fileOffset;        // Offset from start of file
+    std::string name() const;
+
+    uint64_t fileEntrySize;     // Size of data as stored in archive
+    uint64_t uncompressedSize;  // Size once uncompressed
+    uint64_t fileOffset;        // Offset from start of file
     uint32_t checksum;          // CRC32 file signature
-    uint8_t  fileFlags;         // 0: deleted, 1: compressed
+    uint8_t  fileFlags;         // 0: deleted, 1: compressed, 2: chunked
+    uint8_t  reserved[3];
     char     filename[MAX_FILENAME_LENGTH];
 } __attribute__((__packed__));
 
+/**
+ * Chunked file entries point to a list of these instead of their data. The
+ * entry's data is every chunk in the list concatenated together, and chunks
+ * may be shared between several file entries. Chunk lists were added in
+ * version 2, so version 1 archives never have chunked entries.
+ */
+struct ArchiveChunkEntry
+{
+    uint64_t chunkOffset;       // Offset from start of file
+    uint64_t chunkSize;         // Size of the chunk
+} __attribute__((__packed__));
+
+/**
+ * Version 1 archive header, which is upgraded to the current header when a
+ * version 1 archive is opened
+ */
+struct ArchiveHeaderV1
+{
+    uint8_t magic[8];
+    uint8_t version;
+    uint8_t archiveFlags;
+    uint32_t numFileEntries;
+    uint32_t fileEntryDataOffset;
+    uint32_t archiveHash[SHA256_DIGEST_LENGTH]; // hash in first 32 bytes
+} __attribute__((__packed__));
+
+/**
+ * Version 1 table of contents entry
+ */
+struct ArchiveFileEntryV1
+{
+    uint32_t fileEntrySize;
+    uint32_t uncompressedSize;
+    uint32_t fileOffset;
+    uint32_t checksum;
+    uint8_t  fileFlags;
+    char     filename[MAX_FILENAME_LENGTH];
+} __attribute__((__packed__));
+
+// Size of the on disk structures for an archive version, or zero if the
+// version is not supported
+std::size_t archiveHeaderSize( uint8_t version );
+std::size_t archiveFileEntrySize( uint8_t version );
+std::size_t archiveChunkEntrySize( uint8_t version );
+
+// Convert on disk structures of an archive version to the current version
+ArchiveHeader readArchiveHeader( const uint8_t * pData, uint8_t version );
+ArchiveFileEntry readArchiveFileEntry( const uint8_t * pData, uint8_t version );
+std::vector<ArchiveChunkEntry> readArchiveChunkList( const uint8_t * pData,
+                                                     uint64_t numberOfBytes,
+                                                     uint8_t version );
+
+// Checks that size bytes starting at offset lie within [begin, end), without
+// letting a crafted offset or size overflow
+bool isExtentInside( uint64_t offset, uint64_t size, uint64_t begin, uint64_t end );
+
+#endif
@@ -0,0 +1,384 @@
+#include "archiveentryreader.h"
+#include "archivedata.h"
+#include "constants.h"
+#include "crc.h"
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    const std::size_t NO_BLOCK = static_cast<std::size_t>( -1 );
+}
+
+const std::size_t ArchiveEntryReader::BLOCK_SIZE;
+
+/**
+ * Entry reader constructor. Opens the archive file, and prepares to stream
+ * the requested entry's data out of it.
+ *
+ * \param  archivePath     Path to the archive file on disk
+ * \param  entry           Table of contents record for the entry to read
+ * \param  archiveVersion  Format version of the archive
+ */
+ArchiveEntryReader::ArchiveEntryReader( const std::string& archivePath,
+                                        const ArchiveFileEntry& entry,
+                                        uint8_t archiveVersion )
+    : mFilename( entry.name() ),
+      mStream( archivePath.c_str(), std::ios::binary | std::ios::in ),
+      mExtents(),
+      mExtentStarts(),
+      mSize( entry.uncompressedSize ),
+      mPosition( 0 ),
+      mExpectedChecksum( entry.checksum ),
+      mpBlock( new uint8_t[ BLOCK_SIZE ] ),
+      mBlockIndex( NO_BLOCK ),
+      mBlockSize( 0 ),
+      mRunningChecksum( 0 ),
+      mChecksummedBytes( 0 ),
+      mChecksumVerified( false ),
+      mErrorMessage()
+{
+    if (! mStream.good() )
+    {
+        raiseError( "Failed to open archive for entry reading: " + archivePath );
+        return;
+    }
+
+    // Entries are stored uncompressed until per file compression is
+    // supported by the archive writer
+    if ( entry.fileFlags & FILE_FLAG_COMPRESSED )
+    {
+        raiseError( "Compressed entries are not supported: " + mFilename );
+        return;
+    }
+
+    // The entry's offsets and sizes come straight from the archive, so check
+    // them against the archive's size before allocating or reading anything
+    const std::size_t headerSize = archiveHeaderSize( archiveVersion );
+
+    mStream.seekg( 0, std::ios::end );
+    const uint64_t archiveSize = static_cast<uint64_t>( mStream.tellg() );
+
+    if (! mStream.good() ||
+        ! isExtentInside( entry.fileOffset, entry.fileEntrySize, headerSize, archiveSize ) )
+    {
+        raiseError( "Entry data out of bounds for archive entry: " + mFilename );
+        return;
+    }
+
+    // Work out where the entry's data lives. Normal entries are stored in one
+    // piece, while chunked entries point to a list of the chunks to stitch
+    // together
+    if ( entry.fileFlags & FILE_FLAG_CHUNKED )
+    {
+        std::vector<uint8_t> chunkList( entry.fileEntrySize );
+
+        if (! chunkList.empty() )
+        {
+            mStream.seekg( entry.fileOffset, std::ios::beg );
+            mStream.read( reinterpret_cast<char*>( &chunkList[0] ),
+                          chunkList.size() );
+
+            mExtents = readArchiveChunkList( &chunkList[0],
+                                             chunkList.size(),
+                                             archiveVersion );
+        }
+    }
+    else if ( entry.fileEntrySize != entry.uncompressedSize )
+    {
+        raiseError( "Entry size does not match uncompressed size: " + mFilename );
+        return;
+    }
+    else
+    {
+        ArchiveChunkEntry extent;
+        extent.chunkOffset = entry.fileOffset;
+        extent.chunkSize   = entry.fileEntrySize;
+
+        mExtents.push_back( extent );
+    }
+
+    std::size_t extentStart = 0;
+    bool isCorrupt          = false;
+
+    for ( size_t i = 0; i < mExtents.size() && ! isCorrupt; ++i )
+    {
+        isCorrupt = mExtents[i].chunkSize > mSize - extentStart ||
+                    ! isExtentInside( mExtents[i].chunkOffset, mExtents[i].chunkSize,
+                                      headerSize, archiveSize );
+
+        mExtentStarts.push_back( extentStart );
+        extentStart += ( isCorrupt ? 0 : mExtents[i].chunkSize );
+    }
+
+    if (! mStream.good() || isCorrupt || extentStart != mSize )
+    {
+        raiseError( "Corrupted chunk list for archive entry: " + mFilename );
+        return;
+    }
+
+    // There are no blocks to read from an empty entry, so check its checksum
+    // now rather than waiting for a read that will never happen
+    if ( mSize == 0 )
+    {
+        mChecksumVerified = ( mRunningChecksum == mExpectedChecksum );
+
+        if (! mChecksumVerified )
+        {
+            raiseError( "CRC32 checksum failed for file " + mFilename );
+        }
+    }
+}
+
+/**
+ * Entry reader destructor
+ */
+ArchiveEntryReader::~ArchiveEntryReader()
+{
+}
+
+/**
+ * Returns the name of the file entry being read
+ */
+std::string ArchiveEntryReader::filename() const
+{
+    return mFilename;
+}
+
+/**
+ * Returns the size of the file entry, in bytes
+ */
+std::size_t ArchiveEntryReader::size() const
+{
+    return mSize;
+}
+
+/**
+ * Returns the current read position
+ */
+std::size_t ArchiveEntryReader::tell() const
+{
+    return mPosition;
+}
+
+/**
+ * Checks if the reader has reached the end of the entry
+ */
+bool ArchiveEntryReader::eof() const
+{
+    return mPosition >= mSize;
+}
+
+/**
+ * Reads bytes from the entry's current position into the caller's buffer,
+ * and then advances the read position past the bytes that were read.
+ *
+ * \param  pBuffer   Buffer to copy the entry data into
+ * \param  numBytes  Maximum number of bytes to read
+ * \return           Number of bytes actually read
+ */
+std::size_t ArchiveEntryReader::read( uint8_t * pBuffer, std::size_t numBytes )
+{
+    std::size_t bytesRead = pread( pBuffer, numBytes, mPosition );
+    mPosition += bytesRead;
+
+    return bytesRead;
+}
+
+/**
+ * Reads bytes from an arbitrary offset in the entry without moving the
+ * current read position.
+ *
+ * \param  pBuffer   Buffer to copy the entry data into
+ * \param  numBytes  Maximum number of bytes to read
+ * \param  offset    Offset from the start of the entry to begin reading at
+ * \return           Number of bytes actually read
+ */
+std::size_t ArchiveEntryReader::pread( uint8_t * pBuffer,
+                                       std::size_t numBytes,
+                                       std::size_t offset )
+{
+    assert( pBuffer != NULL || numBytes == 0 );
+
+    if ( hasErrors() || offset >= mSize )
+    {
+        return 0;
+    }
+
+    std::size_t bytesLeft = std::min( numBytes, mSize - offset );
+    std::size_t bytesRead = 0;
+
+    while ( bytesLeft > 0 )
+    {
+        // Page in the block that holds the next byte we need, and then copy
+        // out as much of the block as the caller asked for
+        std::size_t blockIndex  = offset / BLOCK_SIZE;
+        std::size_t blockOffset = offset % BLOCK_SIZE;
+
+        if (! loadBlock( blockIndex ) )
+        {
+            break;
+        }
+
+        std::size_t count = std::min( bytesLeft, mBlockSize - blockOffset );
+
+        std::copy( &mpBlock[0] + blockOffset,
+                   &mpBlock[0] + blockOffset + count,
+                   pBuffer + bytesRead );
+
+        offset    += count;
+        bytesRead += count;
+        bytesLeft -= count;
+    }
+
+    return bytesRead;
+}
+
+/**
+ * Moves the read position to a new offset in the entry. Seeking does not
+ * invalidate checksum verification, but the entry will only be verified
+ * once every block has been read in order from the start of the entry.
+ *
+ * \param  offset  Offset from the start of the entry
+ * \return         True if the offset was inside of the entry
+ */
+bool ArchiveEntryReader::seek( std::size_t offset )
+{
+    if ( offset > mSize )
+    {
+        return false;
+    }
+
+    mPosition = offset;
+    return true;
+}
+
+/**
+ * Checks if the entry has been completely read and matched the checksum
+ * stored in the archive
+ */
+bool ArchiveEntryReader::isChecksumVerified() const
+{
+    return mChecksumVerified;
+}
+
+/**
+ * Reads a block of the entry's data from the archive into the block buffer.
+ * Blocks are checksummed as they are loaded, provided they directly follow
+ * the last block that was checksummed.
+ *
+ * \param  blockIndex  Index of the block to load
+ * \return             True if the block was loaded
+ */
+bool ArchiveEntryReader::loadBlock( std::size_t blockIndex )
+{
+    if ( blockIndex == mBlockIndex )
+    {
+        return true;
+    }
+
+    std::size_t blockStart = blockIndex * BLOCK_SIZE;
+    std::size_t blockSize  = std::min( BLOCK_SIZE, mSize - blockStart );
+
+    if (! readStoredData( blockStart, &mpBlock[0], blockSize ) )
+    {
+        mBlockIndex = NO_BLOCK;
+        raiseError( "Failed while reading archive entry: " + mFilename );
+        return false;
+    }
+
+    mBlockIndex = blockIndex;
+    mBlockSize  = blockSize;
+
+    // Fold this block into the running checksum if it is the next block in
+    // sequence, and check the result once the final block has been seen
+    if ( blockStart == mChecksummedBytes )
+    {
+        mRunningChecksum   = crc32Update( mRunningChecksum, &mpBlock[0], blockSize );
+        mChecksummedBytes += blockSize;
+
+        if ( mChecksummedBytes == mSize )
+        {
+            mChecksumVerified = ( mRunningChecksum == mExpectedChecksum );
+
+            if (! mChecksumVerified )
+            {
+                raiseError( "CRC32 checksum failed for file " + mFilename );
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Reads a range of the entry's data from the archive, following the entry's
+ * extents when the range crosses from one chunk into the next.
+ *
+ * \param  offset   Offset from the start of the entry
+ * \param  pBuffer  Buffer to read the data into
+ * \param  count    Number of bytes to read
+ * \return          True if all of the bytes were read
+ */
+bool ArchiveEntryReader::readStoredData( std::size_t offset,
+                                         uint8_t * pBuffer,
+                                         std::size_t count )
+{
+    // Find the last extent that starts at or before the requested offset
+    std::size_t extent =
+        std::upper_bound( mExtentStarts.begin(), mExtentStarts.end(), offset ) -
+        mExtentStarts.begin() - 1;
+
+    while ( count > 0 && extent < mExtents.size() )
+    {
+        std::size_t extentOffset = offset - mExtentStarts[extent];
+        std::size_t readSize     = std::min( count,
+                                             mExtents[extent].chunkSize - extentOffset );
+
+        mStream.seekg( mExtents[extent].chunkOffset + extentOffset, std::ios::beg );
+        mStream.read( reinterpret_cast<char*>( pBuffer ), readSize );
+
+        pBuffer += readSize;
+        offset  += readSize;
+        count   -= readSize;
+        extent  += 1;
+    }
+
+    return ( count == 0 && mStream.good() );
+}
+
+/**
+ * Checks for the existence of an error
+ */
+bool ArchiveEntryReader::hasErrors() const
+{
+    return (! mErrorMessage.empty() );
+}
+
+/**
+ * Returns the error message
+ */
+std::string ArchiveEntryReader::errorMessage() const
+{
+    return mErrorMessage;
+}
+
+/**
+ * Raises an error
+ */
+void ArchiveEntryReader::raiseError( const std::string& message )
+{
+    if ( mErrorMessage.empty() )
+    {
+        mErrorMessage = message;
+    }
+    else
+    {
+        mErrorMessage += "\n";
+        mErrorMessage += message;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef SCOTT_ARCHIVE_ARCHIVEENTRYREADER_H
+#define SCOTT_ARCHIVE_ARCHIVEENTRYREADER_H
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <cstddef>
+#include <vector>
+
+#include <boost/scoped_array.hpp>
+
+#include "archivedata.h"
+
+/**
+ * Streams the contents of a single file entry out of an archive on disk.
+ * Rather than pulling the entire entry into memory, the reader pages the
+ * entry in one fixed size block at a time which lets callers extract or
+ * play back entries that are far larger than available memory.
+ *
+ * The entry's CRC32 checksum is verified incrementally as blocks are read
+ * in order. Once every block has been read sequentially from the start of
+ * the entry the checksum is compared with the value in the archive's table
+ * of contents, and any mismatch is reported as an error.
+ *
+ * Chunked entries are stitched back together from their chunk list as they
+ * are read, so callers never need to know how an entry is stored.
+ *
+ * A reader keeps its own file handle and block buffer, so it is safe to have
+ * several readers open on the same archive. A single reader instance is not
+ * safe to share between threads.
+ */
+class ArchiveEntryReader
+{
+public:
+    // Size of the blocks that are read from the archive
+    static const std::size_t BLOCK_SIZE = 64 * 1024;
+
+    ArchiveEntryReader( const std::string& archivePath,
+                        const ArchiveFileEntry& entry,
+                        uint8_t archiveVersion );
+    ~ArchiveEntryReader();
+
+    // Name of the file entry being read
+    std::string filename() const;
+
+    // Uncompressed size of the file entry
+    std::size_t size() const;
+
+    // Current read position in the entry
+    std::size_t tell() const;
+
+    // Checks if the read position has reached the end of the entry
+    bool eof() const;
+
+    // Read bytes from the current position, and advance the position
+    std::size_t read( uint8_t * pBuffer, std::size_t numBytes );
+
+    // Read bytes from an offset without changing the current position
+    std::size_t pread( uint8_t * pBuffer,
+                       std::size_t numBytes,
+                       std::size_t offset );
+
+    // Move the read position
+    bool seek( std::size_t offset );
+
+    // Checks if the entry's data has been fully read and checksummed
+    bool isChecksumVerified() const;
+
+    bool hasErrors() const;
+    std::string errorMessage() const;
+
+protected:
+    void raiseError( const std::string& message );
+    bool loadBlock( std::size_t blockIndex );
+    bool readStoredData( std::size_t offset, uint8_t * pBuffer, std::size_t count );
+
+private:
+    ArchiveEntryReader( const ArchiveEntryReader& );
+    ArchiveEntryReader& operator = ( const ArchiveEntryReader& );
+
+private:
+    std::string mFilename;
+    std::ifstream mStream;
+    std::vector<ArchiveChunkEntry> mExtents;
+    std::vector<std::size_t> mExtentStarts;
+    std::size_t mSize;
+    std::size_t mPosition;
+    uint32_t mExpectedChecksum;
+    boost::scoped_array<uint8_t> mpBlock;
+    std::size_t mBlockIndex;
+    std::size_t mBlockSize;
+    uint32_t mRunningChecksum;
+    std::size_t mChecksummedBytes;
+    bool mChecksumVerified;
+    std::string mErrorMessage;
+};
+
+#endif
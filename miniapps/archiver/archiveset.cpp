@@ -0,0 +1,277 @@
+#include "archiveset.h"
+#include "archive.h"
+#include "archiveentryreader.h"
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cassert>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+/**
+ * Archive set constructor. Creates a set with no archives mounted
+ */
+ArchiveSet::ArchiveSet()
+    : mMounts(),
+      mIndex(),
+      mNextMountOrder( 0 ),
+      mErrorMessage()
+{
+}
+
+/**
+ * Archive set destructor. Unmounts all archives
+ */
+ArchiveSet::~ArchiveSet()
+{
+    clear();
+}
+
+/**
+ * Mounts an archive into the set. Only the archive's header and table of
+ * contents are read, and its files are merged into the set's index. If the
+ * archive is already mounted it is unmounted first, which makes re-mounting
+ * an updated patch archive cost no more than the size of the patch.
+ *
+ * \param  filename  Path to the archive file
+ * \param  priority  Priority of the archive's files over other archives
+ * \return           True if the archive was mounted
+ */
+bool ArchiveSet::mount( const std::string& filename, int priority )
+{
+    boost::shared_ptr<Archive> archive( new Archive( filename ) );
+
+    if (! archive->open( filename, true ) )
+    {
+        raiseError( archive->errorMessage() );
+        return false;
+    }
+
+    unmount( filename );
+
+    boost::shared_ptr<MountedArchive> mounted( new MountedArchive );
+    mounted->path       = filename;
+    mounted->priority   = priority;
+    mounted->mountOrder = mNextMountOrder++;
+    mounted->archive    = archive;
+
+    mMounts.push_back( mounted );
+
+    // Merge the archive's files into the index. Each file's provider list is
+    // kept sorted so the winning archive is always at the front
+    std::vector<std::string> filenames = archive->fileNameList();
+
+    for ( size_t i = 0; i < filenames.size(); ++i )
+    {
+        Provider provider;
+        provider.mount      = mounted;
+        provider.entryIndex = i;
+
+        std::vector<Provider>& providers = mIndex[ filenames[i] ];
+        std::vector<Provider>::iterator itr = providers.begin();
+
+        while ( itr != providers.end() && itr->outranks( provider ) )
+        {
+            ++itr;
+        }
+
+        providers.insert( itr, provider );
+    }
+
+    return true;
+}
+
+/**
+ * Unmounts an archive from the set. Any files that the archive was
+ * overriding will resolve to the next archive that contains them.
+ *
+ * \param  filename  Path the archive was mounted with
+ * \return           True if the archive was mounted
+ */
+bool ArchiveSet::unmount( const std::string& filename )
+{
+    std::vector< boost::shared_ptr<MountedArchive> >::iterator mountItr =
+        mMounts.begin();
+
+    while ( mountItr != mMounts.end() && (*mountItr)->path != filename )
+    {
+        ++mountItr;
+    }
+
+    if ( mountItr == mMounts.end() )
+    {
+        return false;
+    }
+
+    // Remove this archive as a provider from each of its files, and drop
+    // files from the index once nobody provides them anymore
+    boost::shared_ptr<MountedArchive> mounted = *mountItr;
+    std::vector<std::string> filenames = mounted->archive->fileNameList();
+
+    for ( size_t i = 0; i < filenames.size(); ++i )
+    {
+        FileIndex::iterator indexItr = mIndex.find( filenames[i] );
+
+        if ( indexItr == mIndex.end() )
+        {
+            continue;
+        }
+
+        std::vector<Provider>& providers = indexItr->second;
+
+        for ( size_t j = 0; j < providers.size(); ++j )
+        {
+            if ( providers[j].mount == mounted )
+            {
+                providers.erase( providers.begin() + j );
+                break;
+            }
+        }
+
+        if ( providers.empty() )
+        {
+            mIndex.erase( indexItr );
+        }
+    }
+
+    mMounts.erase( mountItr );
+    return true;
+}
+
+/**
+ * Unmounts every archive in the set
+ */
+void ArchiveSet::clear()
+{
+    mIndex.clear();
+    mMounts.clear();
+}
+
+/**
+ * Checks if a file is in any of the mounted archives
+ */
+bool ArchiveSet::exists( const std::string& filename ) const
+{
+    return mIndex.find( filename ) != mIndex.end();
+}
+
+/**
+ * Returns the path of the archive that a file resolves to, or an empty
+ * string if no mounted archive contains the file
+ */
+std::string ArchiveSet::archiveFor( const std::string& filename ) const
+{
+    FileIndex::const_iterator itr = mIndex.find( filename );
+
+    if ( itr == mIndex.end() )
+    {
+        return std::string();
+    }
+
+    return itr->second.front().mount->path;
+}
+
+/**
+ * Opens a reader for a file, streamed from the highest priority archive
+ * that contains it. The caller is responsible for deleting the reader.
+ *
+ * \param  filename  Name of the file to read
+ * \return           Reader for the file, or NULL if it was not found
+ */
+ArchiveEntryReader* ArchiveSet::openEntry( const std::string& filename )
+{
+    FileIndex::const_iterator itr = mIndex.find( filename );
+
+    if ( itr == mIndex.end() )
+    {
+        raiseError( "No such file in mounted archives: " + filename );
+        return NULL;
+    }
+
+    const Provider& provider = itr->second.front();
+    return provider.mount->archive->openEntry( provider.entryIndex );
+}
+
+/**
+ * Returns the number of mounted archives
+ */
+std::size_t ArchiveSet::archiveCount() const
+{
+    return mMounts.size();
+}
+
+/**
+ * Returns the number of unique files across all mounted archives
+ */
+std::size_t ArchiveSet::fileCount() const
+{
+    return mIndex.size();
+}
+
+/**
+ * Returns a sorted list of the unique files in all mounted archives
+ */
+std::vector<std::string> ArchiveSet::fileNameList() const
+{
+    std::vector<std::string> filenames;
+    filenames.reserve( mIndex.size() );
+
+    for ( FileIndex::const_iterator itr = mIndex.begin();
+          itr != mIndex.end();
+          ++itr )
+    {
+        filenames.push_back( itr->first );
+    }
+
+    std::sort( filenames.begin(), filenames.end() );
+    return filenames;
+}
+
+/**
+ * Checks if this provider's copy of a file takes precedence over another
+ * provider's copy
+ */
+bool ArchiveSet::Provider::outranks( const Provider& other ) const
+{
+    if ( mount->priority != other.mount->priority )
+    {
+        return mount->priority > other.mount->priority;
+    }
+
+    return mount->mountOrder > other.mount->mountOrder;
+}
+
+/**
+ * Checks for the existence of an error
+ */
+bool ArchiveSet::hasErrors() const
+{
+    return (! mErrorMessage.empty() );
+}
+
+/**
+ * Returns the error message
+ */
+std::string ArchiveSet::errorMessage() const
+{
+    return mErrorMessage;
+}
+
+/**
+ * Raises an error
+ */
+void ArchiveSet::raiseError( const std::string& message )
+{
+    if ( mErrorMessage.empty() )
+    {
+        mErrorMessage = message;
+    }
+    else
+    {
+        mErrorMessage += "\n";
+        mErrorMessage += message;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SCOTT_ARCHIVE_ARCHIVESET_H
+#define SCOTT_ARCHIVE_ARCHIVESET_H
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+class Archive;
+class ArchiveEntryReader;
+
+/**
+ * Mounts several archives on top of each other so they can be treated as a
+ * single collection of files. Each archive is given a priority when it is
+ * mounted, and when more than one archive contains the same file the copy
+ * from the archive with the highest priority is used. Archives mounted with
+ * equal priority are resolved in favor of the one mounted last.
+ *
+ * This allows small patch archives to be layered over large base archives,
+ * with the patches overriding the files they contain.
+ *
+ * Lookups go through a single index that merges every mounted archive's
+ * table of contents, so resolving a file costs one hash lookup no matter
+ * how many archives are mounted. The index remembers which archives every
+ * file is shadowing, so mounting or unmounting an archive only touches the
+ * index entries for the files inside of that archive.
+ */
+class ArchiveSet
+{
+public:
+    ArchiveSet();
+    ~ArchiveSet();
+
+    // Mount an archive, replacing it if it was already mounted
+    bool mount( const std::string& filename, int priority );
+
+    // Unmount a previously mounted archive
+    bool unmount( const std::string& filename );
+
+    // Unmount every archive
+    void clear();
+
+    // Check if a file is in any of the mounted archives
+    bool exists( const std::string& filename ) const;
+
+    // Get the path of the archive that a file will be read from
+    std::string archiveFor( const std::string& filename ) const;
+
+    // Open a streaming reader for a file from the highest priority archive
+    ArchiveEntryReader* openEntry( const std::string& filename );
+
+    // Gets the number of mounted archives
+    std::size_t archiveCount() const;
+
+    // Gets the number of unique files across all mounted archives
+    std::size_t fileCount() const;
+
+    // Get a listing of all the unique files across all mounted archives
+    std::vector<std::string> fileNameList() const;
+
+    bool hasErrors() const;
+    std::string errorMessage() const;
+
+protected:
+    void raiseError( const std::string& message );
+
+private:
+    ArchiveSet( const ArchiveSet& );
+    ArchiveSet& operator = ( const ArchiveSet& );
+
+    /**
+     * An archive that has been mounted into the set
+     */
+    struct MountedArchive
+    {
+        std::string path;
+        int priority;
+        std::size_t mountOrder;
+        boost::shared_ptr<Archive> archive;
+    };
+
+    /**
+     * One archive's copy of a file. The first provider in an index entry's
+     * list is the one that wins, and the rest are shadowed by it
+     */
+    struct Provider
+    {
+        boost::shared_ptr<MountedArchive> mount;
+        std::size_t entryIndex;
+
+        bool outranks( const Provider& other ) const;
+    };
+
+    typedef boost::unordered_map< std::string, std::vector<Provider> > FileIndex;
+
+private:
+    std::vector< boost::shared_ptr<MountedArchive> > mMounts;
+    FileIndex mIndex;
+    std::size_t mNextMountOrder;
+    std::string mErrorMessage;
+};
+
+#endif
@@ -24,10 +24,18 @@
 #include <boost/scoped_ptr.hpp>
 #include <iostream>
 #include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
 #include "archive.h"
+#include "archiveentryreader.h"
+#include "extractpath.h"
 
 namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+/// Most threads the user can ask to verify with
+const unsigned int MAX_VERIFY_THREADS = 256;
 
 bool executeHelp()
 {
@@ -37,11 +45,14 @@ bool executeHelp()
 
 bool executeCreate( Archive& archive,
                     const std::string& target,
-                    const std::vector<std::string>& input )
+                    const std::vector<std::string>& input,
+                    bool deduplicate )
 {
     std::cout << "CREATE: " << target << std::endl;
     bool actionStatus = true;
 
+    archive.setDeduplication( deduplicate );
+
     // Now we should add files to the archive
     for ( size_t i = 0; i < input.size() && (!archive.hasErrors()); ++i )
     {
@@ -73,6 +84,19 @@ bool executeCreate( Archive& archive,
     if ( archive.hasErrors() == false )
     {
         archive.save();
+
+        if ( deduplicate )
+        {
+            DeduplicationStats stats = archive.deduplicationStats();
+
+            std::cout << "DEDUP : " << stats.logicalBytes << " bytes stored as "
+                      << stats.storedBytes << " bytes ("
+                      << stats.ratio() << "x), "
+                      << stats.uniqueRegions << " unique and "
+                      << stats.duplicateRegions << " shared regions, "
+                      << stats.chunkedEntries << " chunked files"
+                      << std::endl;
+        }
     }
     else
     {
@@ -92,6 +116,101 @@ bool executeInfo( Archive& archive, const std::string& target )
     return true;
 }
 
+/**
+ * Extracts files from the archive to disk. Entries are streamed out of the
+ * archive one block at a time, so even very large entries can be extracted
+ * without loading them into memory.
+ */
+bool executeExtract( Archive& archive,
+                     const std::string& target,
+                     const std::vector<std::string>& files,
+                     const std::string& outputDir )
+{
+    if (! archive.open( target, true ) )
+    {
+        return false;
+    }
+
+    // Extract everything when the user did not ask for specific files
+    std::vector<std::string> names = files;
+
+    if ( names.empty() )
+    {
+        names = archive.fileNameList();
+    }
+
+    boost::scoped_array<uint8_t> pBuffer(
+            new uint8_t[ ArchiveEntryReader::BLOCK_SIZE ] );
+
+    for ( size_t i = 0; i < names.size(); ++i )
+    {
+        // Never write outside of the output directory, no matter what the
+        // archive claims the file is called
+        fs::path outputPath;
+
+        if (! resolveExtractPath( outputDir, names[i], outputPath ) )
+        {
+            std::cerr << "Refusing to extract unsafe file name: "
+                      << names[i] << std::endl;
+            return false;
+        }
+
+        boost::scoped_ptr<ArchiveEntryReader> reader(
+                archive.openEntry( names[i] ) );
+
+        if ( reader.get() == NULL )
+        {
+            return false;
+        }
+
+        // Make sure the directory the entry lives in exists before writing
+        boost::system::error_code error;
+        fs::create_directories( outputPath.parent_path(), error );
+
+        if ( error )
+        {
+            std::cerr << "Failed to create directory for file: " << names[i]
+                      << " (" << error.message() << ")" << std::endl;
+            return false;
+        }
+
+        std::ofstream ofs( outputPath.string().c_str(),
+                           std::ios::binary | std::ios::out );
+
+        if (! ofs.good() )
+        {
+            std::cerr << "Failed to create file: " << names[i] << std::endl;
+            return false;
+        }
+
+        std::cout << "EXTRACT: " << names[i] << std::endl;
+
+        while (! reader->eof() && ! reader->hasErrors() && ofs.good() )
+        {
+            std::size_t count = reader->read( &pBuffer[0],
+                                              ArchiveEntryReader::BLOCK_SIZE );
+            ofs.write( reinterpret_cast<const char*>( &pBuffer[0] ), count );
+        }
+
+        // Writes can fail as late as the final flush when the disk fills up,
+        // so only trust the file once it has been closed
+        ofs.close();
+
+        if ( reader->hasErrors() || ! ofs )
+        {
+            std::cerr << ( reader->hasErrors() ? reader->errorMessage()
+                                               : "Failed to write file: " + names[i] )
+                      << std::endl;
+
+            // Don't leave a truncated file behind looking like a good one
+            fs::remove( outputPath, error );
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool executeList( Archive& archive, const std::string& target )
 {
     archive.open( target );
@@ -109,6 +228,49 @@ bool executeList( Archive& archive, const std::string& target )
     return true;
 }
 
+/**
+ * Verifies the integrity of one or more archives, and reports any damaged
+ * file entries along with how quickly the archive was checked
+ */
+bool executeVerify( const std::vector<std::string>& targets,
+                    unsigned int numThreads )
+{
+    bool allValid = true;
+
+    for ( size_t i = 0; i < targets.size(); ++i )
+    {
+        Archive archive( targets[i] );
+
+        if (! archive.open( targets[i], true ) )
+        {
+            std::cerr << "FAILED: " << targets[i] << std::endl
+                      << archive.errorMessage() << std::endl;
+            allValid = false;
+            continue;
+        }
+
+        ArchiveVerifyReport report = archive.verify( numThreads );
+
+        for ( size_t j = 0; j < report.failures.size(); ++j )
+        {
+            std::cerr << "  " << report.failures[j] << std::endl;
+        }
+
+        std::cout << ( report.isValid() ? "OK    : " : "FAILED: " )
+                  << targets[i] << " ("
+                  << report.entriesChecked << " files, "
+                  << ( report.hashPresent ? "hash checked, " : "no hash, " )
+                  << report.bytesChecked << " bytes in "
+                  << report.elapsedSeconds << "s, "
+                  << report.throughput() << " MB/s)"
+                  << std::endl;
+
+        allValid = allValid && report.isValid();
+    }
+
+    return allValid;
+}
+
 int main( int argc, char* argv[] )
 {
     //
@@ -124,6 +286,10 @@ int main( int argc, char* argv[] )
         ( "info,i",    po::value<std::string>(), "Show information about the archive" )
         ( "remove,r",  po::value<std::string>(), "Remove one or more files from the archive" )
         ( "extract,x", po::value<std::string>(), "Extract files from the archive" )
+        ( "verify,y",  po::value<std::string>(), "Verify the integrity of [archive] and any other listed archives" )
+        ( "threads,t", po::value<unsigned int>(), "Number of threads to use when verifying" )
+        ( "output,o",  po::value<std::string>(), "Directory to extract files into" )
+        ( "dedup,d",        "Share identical file data when creating an archive" )
         ( "file,f", po::value< std::vector<std::string> >(), "Files to add/remove/update from archive" )
         ;
 
@@ -131,10 +297,19 @@ int main( int argc, char* argv[] )
     p.add( "file", -1 );
 
     po::variables_map varmap;
-    po::store( po::command_line_parser( argc, argv ).
-                  options(options).positional(p).run(),
-               varmap );
-    po::notify( varmap );
+
+    try
+    {
+        po::store( po::command_line_parser( argc, argv ).
+                      options(options).positional(p).run(),
+                   varmap );
+        po::notify( varmap );
+    }
+    catch ( const po::error& e )
+    {
+        std::cerr << e.what() << std::endl << options << std::endl;
+        return EXIT_FAILURE;
+    }
 
     //
     // Get a list of files the user wanted to process
@@ -160,7 +335,8 @@ int main( int argc, char* argv[] )
     else if ( varmap.count("create") )
     {
         std::string name = varmap["create"].as<std::string>();
-        didWork = executeCreate( target, name, filenames );
+        didWork = executeCreate( target, name, filenames,
+                                 varmap.count("dedup") > 0 );
     }
     else if ( varmap.count("list") )
     {
@@ -172,6 +348,40 @@ int main( int argc, char* argv[] )
         std::string name = varmap["info"].as<std::string>();
         didWork = executeInfo( target, name );
     }
+    else if ( varmap.count("verify") )
+    {
+        std::vector<std::string> targets( 1, varmap["verify"].as<std::string>() );
+        targets.insert( targets.end(), filenames.begin(), filenames.end() );
+
+        unsigned int numThreads = boost::thread::hardware_concurrency();
+
+        if ( varmap.count("threads") )
+        {
+            numThreads = varmap["threads"].as<unsigned int>();
+
+            if ( numThreads == 0 || numThreads > MAX_VERIFY_THREADS )
+            {
+                std::cerr << "Number of threads must be between 1 and "
+                          << MAX_VERIFY_THREADS << std::endl
+                          << options << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        didWork = executeVerify( targets, numThreads );
+    }
+    else if ( varmap.count("extract") )
+    {
+        std::string name      = varmap["extract"].as<std::string>();
+        std::string outputDir = ".";
+
+        if ( varmap.count("output") )
+        {
+            outputDir = varmap["output"].as<std::string>();
+        }
+
+        didWork = executeExtract( target, name, filenames, outputDir );
+    }
     else
     {
         std::cerr << "Unknown command, exiting" << std::endl;
@@ -1,6 +1,27 @@
 #ifndef SCOTT_ARCHIVE_CONSTANTS_H
 #define SCOTT_ARCHIVE_CONSTANTS_H
 
+#include <stdint.h>
+#include <cstddef>
+
 const size_t MAX_FILENAME_LENGTH = 64;
 
+// Archive format versions. Version 1 uses 32 bit offsets and sizes, and
+// version 2 uses 64 bit offsets and sizes with aligned file data. Chunked
+// entries are only allowed in version 2 and later
+const uint8_t ARCHIVE_VERSION_1 = 1;
+const uint8_t ARCHIVE_VERSION_2 = 2;
+const uint8_t ARCHIVE_VERSION   = ARCHIVE_VERSION_2;
+
+// Alignment of file entry data in version 2 archives. The default of 64 bytes
+// suits cache lines and SIMD loads, while 4096 matches the page size so
+// entries can be handed straight to APIs that want page aligned buffers
+const size_t DEFAULT_DATA_ALIGNMENT = 64;
+const size_t MAX_DATA_ALIGNMENT     = 4096;
+
+// ArchiveFileEntry::fileFlags bits
+const uint8_t FILE_FLAG_DELETED    = 0x01;
+const uint8_t FILE_FLAG_COMPRESSED = 0x02;
+const uint8_t FILE_FLAG_CHUNKED    = 0x04;
+
 #endif
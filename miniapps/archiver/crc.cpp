@@ -75,7 +75,23 @@ uint32_t CRC_TABLE[CRC_TABLE_SIZE] =
  */
 uint32_t crc32( const uint8_t * pInput, size_t length )
 {
-    uint32_t crc = 0xFFFFFFFF;
+    return crc32Update( 0, pInput, length );
+}
+
+/**
+ * Continues a CRC32 checksum calculation over another block of bytes. This
+ * allows large inputs to be checksummed incrementally, one block at a time,
+ * without having the entire input in memory. Passing zero as the previous
+ * value starts a new checksum.
+ *
+ * \param  previous  CRC32 value of all the bytes that came before this block
+ * \param  pInput    Pointer to the next array of bytes
+ * \param  length    Number of bytes in the provided array
+ * \return           CRC32 checksum value including this block
+ */
+uint32_t crc32Update( uint32_t previous, const uint8_t * pInput, size_t length )
+{
+    uint32_t crc = previous ^ 0xFFFFFFFF;
 
     if ( pInput != NULL )
     {
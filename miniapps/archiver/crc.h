@@ -20,6 +20,7 @@
 #include <string>
 
 uint32_t crc32( const uint8_t * pInput, size_t length );
+uint32_t crc32Update( uint32_t previous, const uint8_t * pInput, size_t length );
 uint32_t crc32( const std::string& input );
 
 /**
@@ -0,0 +1,138 @@
+#include "deduplication.h"
+#include "thirdparty/sha2.h"
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+namespace
+{
+    /**
+     * Table of random values used by the gear rolling hash. The values are
+     * generated with a fixed seed, because chunk boundaries must be identical
+     * between runs for chunks to be shared.
+     */
+    struct GearTable
+    {
+        GearTable()
+        {
+            uint64_t state = 0x5CA77CA5EDB10B5ull;
+
+            for ( size_t i = 0; i < 256; ++i )
+            {
+                // splitmix64
+                uint64_t z = ( state += 0x9E3779B97F4A7C15ull );
+                z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+                z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+                values[i] = z ^ ( z >> 31 );
+            }
+        }
+
+        uint64_t values[256];
+    };
+
+    const GearTable GEAR;
+}
+
+/**
+ * Calculates the SHA-256 digest of a block of data
+ */
+ContentDigest::ContentDigest( const uint8_t * pData, std::size_t numberOfBytes )
+{
+    SHA256_CTX context;
+
+    SHA256_Init( &context );
+    SHA256_Update( &context, pData, numberOfBytes );
+    SHA256_Final( digest, &context );
+}
+
+bool ContentDigest::operator < ( const ContentDigest& rhs ) const
+{
+    return memcmp( digest, rhs.digest, SHA256_DIGEST_LENGTH ) < 0;
+}
+
+bool ContentDigest::operator == ( const ContentDigest& rhs ) const
+{
+    return memcmp( digest, rhs.digest, SHA256_DIGEST_LENGTH ) == 0;
+}
+
+DeduplicationStats::DeduplicationStats()
+    : logicalBytes( 0 ),
+      storedBytes( 0 ),
+      uniqueRegions( 0 ),
+      duplicateRegions( 0 ),
+      chunkedEntries( 0 )
+{
+}
+
+/**
+ * Returns how many times smaller the stored data is than the original data.
+ * A ratio of 1.0 means nothing was deduplicated
+ */
+double DeduplicationStats::ratio() const
+{
+    if ( storedBytes == 0 )
+    {
+        return 1.0;
+    }
+
+    return static_cast<double>( logicalBytes ) /
+           static_cast<double>( storedBytes );
+}
+
+/**
+ * Splits a block of data into content defined chunks using a gear rolling
+ * hash. Chunk boundaries are placed wherever the hash of the preceding bytes
+ * matches the boundary mask, which means an insertion or deletion near the
+ * start of a file only changes the chunks around the edit. The remaining
+ * chunks keep their boundaries and can be shared with other copies of the
+ * data.
+ *
+ * \param  pData          Data to be chunked
+ * \param  numberOfBytes  Size of the data
+ * \return                Sizes of each chunk, in order
+ */
+std::vector<std::size_t> findContentChunks( const uint8_t * pData,
+                                            std::size_t numberOfBytes )
+{
+    assert( pData != NULL || numberOfBytes == 0 );
+
+    std::vector<std::size_t> chunks;
+    std::size_t chunkStart = 0;
+
+    while ( chunkStart < numberOfBytes )
+    {
+        std::size_t remaining = numberOfBytes - chunkStart;
+
+        if ( remaining <= MIN_CHUNK_SIZE )
+        {
+            chunks.push_back( remaining );
+            break;
+        }
+
+        // Skip over the minimum chunk size, since a boundary cannot be placed
+        // there anyways. Then roll the hash forward until we find a boundary
+        // or hit the maximum chunk size
+        std::size_t limit = std::min( remaining, MAX_CHUNK_SIZE );
+        std::size_t size  = MIN_CHUNK_SIZE;
+        uint64_t hash     = 0;
+
+        while ( size < limit )
+        {
+            hash = ( hash << 1 ) + GEAR.values[ pData[ chunkStart + size ] ];
+            size += 1;
+
+            if ( ( hash & CHUNK_BOUNDARY_MASK ) == 0 )
+            {
+                break;
+            }
+        }
+
+        chunks.push_back( size );
+        chunkStart += size;
+    }
+
+    return chunks;
+}
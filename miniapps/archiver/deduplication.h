@@ -0,0 +1,54 @@
+#ifndef SCOTT_ARCHIVE_DEDUPLICATION_H
+#define SCOTT_ARCHIVE_DEDUPLICATION_H
+
+#include <stdint.h>
+#include <vector>
+#include <cstddef>
+
+#include "thirdparty/sha2.h"
+
+// Entries at least this large are split into content defined chunks
+const std::size_t CHUNKING_THRESHOLD = 256 * 1024;
+
+// Content defined chunk size limits. The average chunk size is controlled by
+// the number of bits in the chunk boundary mask (2^16 = 64 KiB)
+const std::size_t MIN_CHUNK_SIZE     = 16 * 1024;
+const std::size_t MAX_CHUNK_SIZE     = 256 * 1024;
+const uint64_t    CHUNK_BOUNDARY_MASK = 0xFFFF000000000000ull;
+
+/**
+ * SHA-256 digest of a block of data, used to find identical file entries
+ * and chunks when deduplicating archive contents
+ */
+struct ContentDigest
+{
+    ContentDigest( const uint8_t * pData, std::size_t numberOfBytes );
+
+    bool operator <  ( const ContentDigest& rhs ) const;
+    bool operator == ( const ContentDigest& rhs ) const;
+
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+};
+
+/**
+ * Statistics gathered while writing a deduplicated archive
+ */
+struct DeduplicationStats
+{
+    DeduplicationStats();
+
+    // Ratio of logical bytes to bytes actually stored in the archive
+    double ratio() const;
+
+    std::size_t logicalBytes;       // Size of all file entries added up
+    std::size_t storedBytes;        // Size of the archive's data region
+    std::size_t uniqueRegions;      // Number of entries and chunks stored
+    std::size_t duplicateRegions;   // Number of entries and chunks shared
+    std::size_t chunkedEntries;     // Number of entries that were chunked
+};
+
+// Split data into content defined chunks, and return the size of each chunk
+std::vector<std::size_t> findContentChunks( const uint8_t * pData,
+                                            std::size_t numberOfBytes );
+
+#endif
@@ -0,0 +1,62 @@
+#include "extractpath.h"
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+/**
+ * Works out where an archive entry should be written when it is extracted.
+ * Entry names come straight out of the archive and cannot be trusted, so
+ * names that are absolute or contain a ".." component are rejected, as is
+ * any name that resolves to somewhere outside of the output directory.
+ *
+ * \param  outputDir  Directory that files are extracted into
+ * \param  name       Name of the entry in the archive
+ * \param  result     Receives the path to write the entry to
+ * \return            True if the entry can be safely extracted
+ */
+bool resolveExtractPath( const fs::path& outputDir,
+                         const std::string& name,
+                         fs::path& result )
+{
+    fs::path entryPath( name );
+
+    if ( name.empty() || entryPath.has_root_path() )
+    {
+        return false;
+    }
+
+    for ( fs::path::iterator itr = entryPath.begin(); itr != entryPath.end(); ++itr )
+    {
+        if ( *itr == ".." )
+        {
+            return false;
+        }
+    }
+
+    // Resolve both paths, following any links that already exist on disk, and
+    // make sure the entry's path still starts with the output directory
+    fs::path base = fs::weakly_canonical( fs::absolute( outputDir ) );
+    fs::path full = fs::weakly_canonical( base / entryPath );
+
+    fs::path::iterator baseItr = base.begin();
+    fs::path::iterator fullItr = full.begin();
+
+    for ( ; baseItr != base.end(); ++baseItr, ++fullItr )
+    {
+        if ( fullItr == full.end() || *fullItr != *baseItr )
+        {
+            return false;
+        }
+    }
+
+    if ( fullItr == full.end() )
+    {
+        return false;
+    }
+
+    result = full;
+    return true;
+}
@@ -0,0 +1,14 @@
+#ifndef SCOTT_ARCHIVE_EXTRACTPATH_H
+#define SCOTT_ARCHIVE_EXTRACTPATH_H
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+// Work out where an archive entry is written when extracted, refusing names
+// that would land outside of the output directory
+bool resolveExtractPath( const boost::filesystem::path& outputDir,
+                         const std::string& name,
+                         boost::filesystem::path& result );
+
+#endif
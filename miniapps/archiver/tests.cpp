@@ -0,0 +1,1138 @@
+/**
+ * Copyright 2011 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <googletest/googletest.h>
+
+#include <fstream>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
+
+#include "archive.h"
+#include "archivedata.h"
+#include "archiveentryreader.h"
+#include "archiveset.h"
+#include "crc.h"
+#include "constants.h"
+#include "deduplication.h"
+#include "extractpath.h"
+
+namespace fs = boost::filesystem;
+
+/**
+ * Creates a uniquely named temporary file path that is removed once the
+ * test is finished with it
+ */
+class TempArchivePath
+{
+public:
+    TempArchivePath()
+        : mPath( fs::temp_directory_path() / fs::unique_path( "far-%%%%-%%%%.far" ) )
+    {
+    }
+
+    ~TempArchivePath()
+    {
+        fs::remove( mPath );
+    }
+
+    std::string str() const
+    {
+        return mPath.string();
+    }
+
+private:
+    fs::path mPath;
+};
+
+/**
+ * Creates a uniquely named temporary directory that is removed, along with
+ * everything in it, once the test is finished with it
+ */
+class TempDirectory
+{
+public:
+    TempDirectory()
+        : mPath( fs::temp_directory_path() / fs::unique_path( "far-%%%%-%%%%" ) )
+    {
+        fs::create_directories( mPath );
+    }
+
+    ~TempDirectory()
+    {
+        boost::system::error_code error;
+        fs::remove_all( mPath, error );
+    }
+
+    const fs::path& path() const
+    {
+        return mPath;
+    }
+
+private:
+    fs::path mPath;
+};
+
+/**
+ * Reads an entire entry out of an archive with an entry reader
+ */
+std::string readEntry( Archive& archive, const std::string& name, bool * pVerified )
+{
+    boost::scoped_ptr<ArchiveEntryReader> reader( archive.openEntry( name ) );
+    std::string contents;
+
+    if ( reader.get() == NULL )
+    {
+        return contents;
+    }
+
+    uint8_t buffer[7];
+
+    while (! reader->eof() && ! reader->hasErrors() )
+    {
+        std::size_t count = reader->read( buffer, sizeof(buffer) );
+        contents.append( reinterpret_cast<const char*>( buffer ), count );
+    }
+
+    *pVerified = reader->isChecksumVerified();
+    return contents;
+}
+
+/**
+ * Saves an archive holding files with the given names and contents
+ */
+void saveArchive( const std::string& path,
+                  const std::vector< std::pair<std::string, std::string> >& files )
+{
+    Archive archive( path );
+
+    for ( size_t i = 0; i < files.size(); ++i )
+    {
+        archive.add( files[i].first,
+                     reinterpret_cast<const uint8_t*>( files[i].second.c_str() ),
+                     files[i].second.size() );
+    }
+
+    archive.save();
+}
+
+/**
+ * Reads an entire file out of an archive set
+ */
+std::string readSetEntry( ArchiveSet& set, const std::string& name )
+{
+    boost::scoped_ptr<ArchiveEntryReader> reader( set.openEntry( name ) );
+
+    if ( reader.get() == NULL )
+    {
+        return std::string();
+    }
+
+    std::string contents( reader->size(), '\0' );
+    reader->read( reinterpret_cast<uint8_t*>( &contents[0] ), contents.size() );
+
+    return contents;
+}
+
+TEST(ArchiveFormat,OnDiskStructureSizes)
+{
+    EXPECT_EQ( 64u,  sizeof(ArchiveHeader) );
+    EXPECT_EQ( 96u,  sizeof(ArchiveFileEntry) );
+    EXPECT_EQ( 16u,  sizeof(ArchiveChunkEntry) );
+    EXPECT_EQ( 146u, sizeof(ArchiveHeaderV1) );
+    EXPECT_EQ( 81u,  sizeof(ArchiveFileEntryV1) );
+}
+
+TEST(ArchiveFormat,SavesVersionTwoWithAlignedData)
+{
+    TempArchivePath path;
+    const std::string first  = "hello world";
+    const std::string second = "the quick brown fox";
+
+    {
+        Archive archive( path.str() );
+        archive.add( "first.txt",
+                     reinterpret_cast<const uint8_t*>( first.c_str() ),
+                     first.size() );
+        archive.add( "second.txt",
+                     reinterpret_cast<const uint8_t*>( second.c_str() ),
+                     second.size() );
+        ASSERT_TRUE( archive.save() );
+    }
+
+    // Pick apart the archive by hand to check the layout
+    std::ifstream ifs( path.str().c_str(), std::ios::binary );
+    ArchiveHeader header;
+    ifs.read( reinterpret_cast<char*>( &header ), sizeof(header) );
+
+    EXPECT_EQ( ARCHIVE_VERSION_2, header.version );
+    EXPECT_EQ( DEFAULT_DATA_ALIGNMENT, header.dataAlignment );
+    EXPECT_EQ( 2u, header.numFileEntries );
+
+    std::vector<ArchiveFileEntry> entries( header.numFileEntries );
+    ifs.seekg( header.fileEntryDataOffset, std::ios::beg );
+    ifs.read( reinterpret_cast<char*>( &entries[0] ),
+              sizeof(ArchiveFileEntry) * entries.size() );
+
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        EXPECT_EQ( 0u, entries[i].fileOffset % DEFAULT_DATA_ALIGNMENT );
+    }
+
+    // And then read it back
+    Archive archive( "readback" );
+    bool verified = false;
+
+    ASSERT_TRUE( archive.open( path.str() ) );
+    EXPECT_EQ( 2u, archive.fileCount() );
+    EXPECT_EQ( second, readEntry( archive, "second.txt", &verified ) );
+    EXPECT_TRUE( verified );
+}
+
+TEST(ArchiveFormat,ReadsVersionOneArchives)
+{
+    TempArchivePath path;
+    const std::string contents = "version one file contents";
+
+    // Write out an archive in the version one layout
+    ArchiveHeaderV1 header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, ArchiveHeader().magic, sizeof(header.magic) );
+    header.version             = ARCHIVE_VERSION_1;
+    header.numFileEntries      = 1;
+    header.fileEntryDataOffset = sizeof(ArchiveHeaderV1) + contents.size();
+
+    ArchiveFileEntryV1 entry;
+    memset( &entry, 0, sizeof(entry) );
+    entry.fileEntrySize    = contents.size();
+    entry.uncompressedSize = contents.size();
+    entry.fileOffset       = sizeof(ArchiveHeaderV1);
+    entry.checksum         = crc32( contents );
+    strncpy( entry.filename, "old.txt", MAX_FILENAME_LENGTH );
+
+    {
+        std::ofstream ofs( path.str().c_str(), std::ios::binary );
+        ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+        ofs.write( contents.c_str(), contents.size() );
+        ofs.write( reinterpret_cast<const char*>( &entry ), sizeof(entry) );
+    }
+
+    // Both the fully loaded and delay loaded paths should understand it
+    Archive archive( "v1" );
+    bool verified = false;
+
+    ASSERT_TRUE( archive.open( path.str() ) );
+    EXPECT_FALSE( archive.hasErrors() );
+    EXPECT_EQ( contents, readEntry( archive, "old.txt", &verified ) );
+    EXPECT_TRUE( verified );
+
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+    ASSERT_EQ( 1u, archive.fileNameList().size() );
+    EXPECT_EQ( "old.txt", archive.fileNameList()[0] );
+}
+
+TEST(ArchiveFormat,ReadsSparseArchiveLargerThanFourGigabytes)
+{
+    TempArchivePath path;
+
+    // Lay out an archive with a 5 GB entry of zeros in the middle, followed by
+    // a small entry whose offset does not fit in 32 bits. The big entry is
+    // never written, so the file system leaves a hole instead of using disk
+    const uint64_t hugeSize   = 5ull * 1024 * 1024 * 1024;
+    const uint64_t hugeOffset = DEFAULT_DATA_ALIGNMENT * 64;
+    const uint64_t tailOffset = hugeOffset + hugeSize;
+    const std::string tail    = "data past the four gigabyte mark";
+
+    ArchiveHeader header;
+    header.numFileEntries      = 2;
+    header.fileEntryDataOffset = tailOffset + DEFAULT_DATA_ALIGNMENT;
+
+    ArchiveFileEntry hugeEntry( "huge.bin", hugeSize, hugeOffset, 0 );
+    ArchiveFileEntry tailEntry( "tail.txt", tail.size(), tailOffset, crc32( tail ) );
+
+    {
+        std::ofstream ofs( path.str().c_str(), std::ios::binary );
+        ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+        ofs.seekp( tailOffset, std::ios::beg );
+        ofs.write( tail.c_str(), tail.size() );
+        ofs.seekp( header.fileEntryDataOffset, std::ios::beg );
+        ofs.write( reinterpret_cast<const char*>( &hugeEntry ), sizeof(hugeEntry) );
+        ofs.write( reinterpret_cast<const char*>( &tailEntry ), sizeof(tailEntry) );
+        ASSERT_TRUE( ofs.good() );
+    }
+
+    EXPECT_GT( fs::file_size( path.str() ), 4ull * 1024 * 1024 * 1024 );
+
+    Archive archive( "sparse" );
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+    EXPECT_EQ( 2u, archive.fileCount() );
+
+    // Read from the middle of the huge entry, past the 32 bit limit
+    boost::scoped_ptr<ArchiveEntryReader> huge( archive.openEntry( "huge.bin" ) );
+    ASSERT_TRUE( huge.get() != NULL );
+    EXPECT_EQ( hugeSize, huge->size() );
+
+    uint8_t buffer[16];
+    memset( buffer, 0xFF, sizeof(buffer) );
+
+    EXPECT_EQ( sizeof(buffer), huge->pread( buffer, sizeof(buffer), hugeSize - 100 ) );
+    EXPECT_EQ( 0u, huge->tell() );
+    EXPECT_EQ( 0, buffer[0] );
+    EXPECT_EQ( 0, buffer[15] );
+
+    EXPECT_TRUE( huge->seek( hugeSize - 8 ) );
+    EXPECT_EQ( 8u, huge->read( buffer, sizeof(buffer) ) );
+    EXPECT_TRUE( huge->eof() );
+    EXPECT_FALSE( huge->hasErrors() );
+
+    // The entry stored after the huge entry should read back and verify
+    bool verified = false;
+    EXPECT_EQ( tail, readEntry( archive, "tail.txt", &verified ) );
+    EXPECT_TRUE( verified );
+}
+
+TEST(ArchiveSet,HigherPriorityArchivesOverrideFiles)
+{
+    TempArchivePath basePath, patchPath;
+    std::vector< std::pair<std::string, std::string> > baseFiles, patchFiles;
+
+    baseFiles.push_back( std::make_pair( "a.txt", "base a" ) );
+    baseFiles.push_back( std::make_pair( "b.txt", "base b" ) );
+    patchFiles.push_back( std::make_pair( "b.txt", "patched b" ) );
+    patchFiles.push_back( std::make_pair( "c.txt", "patch c" ) );
+
+    saveArchive( basePath.str(), baseFiles );
+    saveArchive( patchPath.str(), patchFiles );
+
+    // Mount the patch first to make sure priority wins over mount order
+    ArchiveSet set;
+    ASSERT_TRUE( set.mount( patchPath.str(), 10 ) );
+    ASSERT_TRUE( set.mount( basePath.str(), 0 ) );
+
+    EXPECT_EQ( 2u, set.archiveCount() );
+    EXPECT_EQ( 3u, set.fileCount() );
+    EXPECT_EQ( "base a",    readSetEntry( set, "a.txt" ) );
+    EXPECT_EQ( "patched b", readSetEntry( set, "b.txt" ) );
+    EXPECT_EQ( "patch c",   readSetEntry( set, "c.txt" ) );
+    EXPECT_EQ( patchPath.str(), set.archiveFor( "b.txt" ) );
+    EXPECT_FALSE( set.exists( "d.txt" ) );
+
+    // Unmounting the patch uncovers the base archive's files
+    ASSERT_TRUE( set.unmount( patchPath.str() ) );
+
+    EXPECT_EQ( 2u, set.fileCount() );
+    EXPECT_EQ( "base b", readSetEntry( set, "b.txt" ) );
+    EXPECT_FALSE( set.exists( "c.txt" ) );
+    EXPECT_FALSE( set.hasErrors() );
+}
+
+TEST(ArchiveSet,RemountingReplacesArchiveContents)
+{
+    TempArchivePath basePath, patchPath;
+    std::vector< std::pair<std::string, std::string> > baseFiles, patchFiles;
+
+    baseFiles.push_back( std::make_pair( "a.txt", "base a" ) );
+    patchFiles.push_back( std::make_pair( "a.txt", "patch one" ) );
+
+    saveArchive( basePath.str(), baseFiles );
+    saveArchive( patchPath.str(), patchFiles );
+
+    ArchiveSet set;
+    ASSERT_TRUE( set.mount( basePath.str(), 0 ) );
+    ASSERT_TRUE( set.mount( patchPath.str(), 1 ) );
+    EXPECT_EQ( "patch one", readSetEntry( set, "a.txt" ) );
+
+    // Ship a new version of the patch, and mount it again
+    patchFiles.clear();
+    patchFiles.push_back( std::make_pair( "a.txt", "patch two" ) );
+    patchFiles.push_back( std::make_pair( "new.txt", "new file" ) );
+    saveArchive( patchPath.str(), patchFiles );
+
+    ASSERT_TRUE( set.mount( patchPath.str(), 1 ) );
+
+    EXPECT_EQ( 2u, set.archiveCount() );
+    EXPECT_EQ( "patch two", readSetEntry( set, "a.txt" ) );
+    EXPECT_EQ( "new file",  readSetEntry( set, "new.txt" ) );
+}
+
+/**
+ * Corrupts an archive by flipping the bits of one byte near a file's data.
+ * The data is found by searching the archive for the file's contents
+ *
+ * \param  path      Path to the archive
+ * \param  contents  Contents of the file to corrupt
+ * \param  offset    Offset of the byte to flip, from the start of the file.
+ *                   Offsets past the end of the file hit the padding after it
+ */
+bool flipArchiveByte( const std::string& path,
+                      const std::string& contents,
+                      std::size_t offset )
+{
+    std::fstream fs( path.c_str(), std::ios::binary | std::ios::in | std::ios::out );
+    std::string bytes( (std::istreambuf_iterator<char>( fs )),
+                        std::istreambuf_iterator<char>() );
+    std::size_t start = bytes.find( contents );
+
+    if ( start == std::string::npos )
+    {
+        return false;
+    }
+
+    if ( start + offset >= bytes.size() )
+    {
+        return false;
+    }
+
+    fs.clear();
+    fs.seekp( start + offset, std::ios::beg );
+    fs.put( static_cast<char>( ~bytes[ start + offset ] ) );
+
+    return fs.good();
+}
+
+/**
+ * Builds a block of test data that is a few entry reader blocks long, and
+ * does not repeat on block boundaries
+ */
+std::string makeStreamingData()
+{
+    std::string data( ArchiveEntryReader::BLOCK_SIZE * 2 + 1234, '\0' );
+
+    for ( size_t i = 0; i < data.size(); ++i )
+    {
+        data[i] = static_cast<char>( ( i * 7 + i / 251 ) & 0xFF );
+    }
+
+    return data;
+}
+
+TEST(ArchiveEntryReader,ReadsAtOffsetsAcrossBlockBoundaries)
+{
+    TempArchivePath path;
+    const std::string data = makeStreamingData();
+    const std::size_t block = ArchiveEntryReader::BLOCK_SIZE;
+
+    std::vector< std::pair<std::string, std::string> > files;
+    files.push_back( std::make_pair( "stream.bin", data ) );
+    saveArchive( path.str(), files );
+
+    Archive archive( "stream" );
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+
+    boost::scoped_ptr<ArchiveEntryReader> reader( archive.openEntry( "stream.bin" ) );
+    ASSERT_TRUE( reader.get() != NULL );
+    ASSERT_EQ( data.size(), reader->size() );
+
+    // Reads that straddle the end of the first and second blocks
+    const std::size_t offsets[] = { 0, block - 5, block, 2 * block - 1, data.size() - 10 };
+    uint8_t buffer[32];
+
+    for ( size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i )
+    {
+        std::size_t expected = std::min( sizeof(buffer), data.size() - offsets[i] );
+
+        EXPECT_EQ( expected, reader->pread( buffer, sizeof(buffer), offsets[i] ) );
+        EXPECT_EQ( 0, memcmp( buffer, data.c_str() + offsets[i], expected ) );
+        EXPECT_EQ( 0u, reader->tell() );
+    }
+
+    // Reading past the end of the entry gives nothing back
+    EXPECT_EQ( 0u, reader->pread( buffer, sizeof(buffer), data.size() ) );
+
+    // Seek into the middle of the first block and read across into the second
+    ASSERT_TRUE( reader->seek( block - 3 ) );
+    EXPECT_EQ( 8u, reader->read( buffer, 8 ) );
+    EXPECT_EQ( block + 5, reader->tell() );
+    EXPECT_EQ( 0, memcmp( buffer, data.c_str() + block - 3, 8 ) );
+
+    EXPECT_FALSE( reader->seek( data.size() + 1 ) );
+    EXPECT_TRUE( reader->seek( data.size() ) );
+    EXPECT_TRUE( reader->eof() );
+    EXPECT_FALSE( reader->hasErrors() );
+}
+
+TEST(ArchiveEntryReader,ChecksumVerifiedAfterPartialThenFullRead)
+{
+    TempArchivePath path;
+    const std::string data = makeStreamingData();
+
+    std::vector< std::pair<std::string, std::string> > files;
+    files.push_back( std::make_pair( "stream.bin", data ) );
+    saveArchive( path.str(), files );
+
+    Archive archive( "stream" );
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+
+    boost::scoped_ptr<ArchiveEntryReader> reader( archive.openEntry( "stream.bin" ) );
+    ASSERT_TRUE( reader.get() != NULL );
+
+    // Random access past the checksummed bytes does not verify anything
+    uint8_t buffer[100];
+    reader->pread( buffer, sizeof(buffer), data.size() - sizeof(buffer) );
+    EXPECT_FALSE( reader->isChecksumVerified() );
+
+    // Read half of the entry, and then the rest of it
+    std::string contents( data.size(), '\0' );
+    uint8_t * pContents = reinterpret_cast<uint8_t*>( &contents[0] );
+    std::size_t half    = data.size() / 2;
+
+    EXPECT_EQ( half, reader->read( pContents, half ) );
+    EXPECT_FALSE( reader->isChecksumVerified() );
+
+    EXPECT_EQ( data.size() - half, reader->read( pContents + half, data.size() ) );
+    EXPECT_TRUE( reader->isChecksumVerified() );
+    EXPECT_FALSE( reader->hasErrors() );
+    EXPECT_EQ( data, contents );
+}
+
+TEST(ArchiveEntryReader,ChecksumFailsOnCorruptedData)
+{
+    TempArchivePath path;
+    const std::string data = makeStreamingData();
+
+    std::vector< std::pair<std::string, std::string> > files;
+    files.push_back( std::make_pair( "stream.bin", data ) );
+    saveArchive( path.str(), files );
+
+    Archive archive( "stream" );
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+
+    // Flip a byte in the last block of the entry's data
+    ASSERT_TRUE( flipArchiveByte( path.str(), data, data.size() - 1 ) );
+
+    bool verified = true;
+    std::string contents = readEntry( archive, "stream.bin", &verified );
+
+    EXPECT_FALSE( verified );
+}
+
+TEST(ArchiveEntryReader,ZeroSizeEntryIsVerified)
+{
+    TempArchivePath path;
+
+    // Archive::add does not take empty files, so lay the archive out by hand
+    ArchiveHeader header;
+    header.numFileEntries      = 1;
+    header.fileEntryDataOffset = DEFAULT_DATA_ALIGNMENT * 2;
+
+    ArchiveFileEntry entry( "empty.txt", 0, DEFAULT_DATA_ALIGNMENT, crc32( std::string() ) );
+
+    {
+        std::ofstream ofs( path.str().c_str(), std::ios::binary );
+        ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+        ofs.seekp( header.fileEntryDataOffset, std::ios::beg );
+        ofs.write( reinterpret_cast<const char*>( &entry ), sizeof(entry) );
+        ASSERT_TRUE( ofs.good() );
+    }
+
+    Archive archive( "empty" );
+    ASSERT_TRUE( archive.open( path.str(), true ) );
+
+    boost::scoped_ptr<ArchiveEntryReader> reader( archive.openEntry( "empty.txt" ) );
+    ASSERT_TRUE( reader.get() != NULL );
+
+    uint8_t buffer[4];
+
+    EXPECT_EQ( 0u, reader->size() );
+    EXPECT_TRUE( reader->eof() );
+    EXPECT_EQ( 0u, reader->read( buffer, sizeof(buffer) ) );
+    EXPECT_TRUE( reader->isChecksumVerified() );
+    EXPECT_FALSE( reader->hasErrors() );
+}
+
+/**
+ * Generates a repeatable block of pseudo random bytes
+ */
+std::string makeRandomData( std::size_t size, uint32_t seed )
+{
+    std::string data( size, '\0' );
+    uint32_t state = seed;
+
+    for ( size_t i = 0; i < size; ++i )
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        data[i] = static_cast<char>( state & 0xFF );
+    }
+
+    return data;
+}
+
+/**
+ * Returns the end offset of every content defined chunk in a block of data
+ */
+std::vector<std::size_t> contentChunkEnds( const std::string& data )
+{
+    std::vector<std::size_t> sizes =
+        findContentChunks( reinterpret_cast<const uint8_t*>( data.c_str() ),
+                           data.size() );
+    std::vector<std::size_t> ends;
+    std::size_t end = 0;
+
+    for ( size_t i = 0; i < sizes.size(); ++i )
+    {
+        end += sizes[i];
+        ends.push_back( end );
+    }
+
+    return ends;
+}
+
+TEST(Deduplication,ContentChunksStayInSizeLimits)
+{
+    const std::string data = makeRandomData( 3 * 1024 * 1024, 1234 );
+    std::vector<std::size_t> sizes =
+        findContentChunks( reinterpret_cast<const uint8_t*>( data.c_str() ),
+                           data.size() );
+    std::size_t total = 0;
+
+    ASSERT_GT( sizes.size(), 1u );
+
+    for ( size_t i = 0; i < sizes.size(); ++i )
+    {
+        // Only the last chunk is allowed to come up short
+        if ( i + 1 < sizes.size() )
+        {
+            EXPECT_GE( sizes[i], MIN_CHUNK_SIZE );
+        }
+
+        EXPECT_LE( sizes[i], MAX_CHUNK_SIZE );
+        total += sizes[i];
+    }
+
+    EXPECT_EQ( data.size(), total );
+}
+
+TEST(Deduplication,ChunkBoundariesSurviveAnInsertion)
+{
+    const std::size_t insertAt = 300 * 1024;
+    const std::string inserted = "a few extra bytes";
+
+    std::string original = makeRandomData( 3 * 1024 * 1024, 99 );
+    std::string edited   = original;
+    edited.insert( insertAt, inserted );
+
+    std::vector<std::size_t> before = contentChunkEnds( original );
+    std::vector<std::size_t> after  = contentChunkEnds( edited );
+
+    // Move the edited boundaries back to where they would be without the
+    // insertion, and then see how many of the original boundaries past the
+    // edit are still there
+    std::vector<std::size_t> shifted;
+
+    for ( size_t i = 0; i < after.size(); ++i )
+    {
+        if ( after[i] > insertAt + inserted.size() )
+        {
+            shifted.push_back( after[i] - inserted.size() );
+        }
+    }
+
+    std::size_t moved = 0, total = 0;
+
+    for ( size_t i = 0; i < before.size(); ++i )
+    {
+        if ( before[i] > insertAt )
+        {
+            total += 1;
+            moved += std::binary_search( shifted.begin(), shifted.end(), before[i] ) ? 0 : 1;
+        }
+    }
+
+    // Only the chunk holding the insertion, and maybe the one after it as
+    // the hash resynchronizes, are allowed to change
+    ASSERT_GT( total, 10u );
+    EXPECT_LE( moved, 2u );
+}
+
+TEST(Deduplication,IdenticalFilesShareChunks)
+{
+    TempArchivePath path;
+    const std::string big   = makeRandomData( 1024 * 1024, 7 );
+    const std::string small = "a small file that is stored twice";
+
+    std::vector<std::size_t> bigChunks = contentChunkEnds( big );
+
+    {
+        Archive archive( path.str() );
+        archive.setDeduplication( true );
+
+        archive.add( "a.bin", reinterpret_cast<const uint8_t*>( big.c_str() ), big.size() );
+        archive.add( "b.bin", reinterpret_cast<const uint8_t*>( big.c_str() ), big.size() );
+        archive.add( "a.txt", reinterpret_cast<const uint8_t*>( small.c_str() ), small.size() );
+        archive.add( "b.txt", reinterpret_cast<const uint8_t*>( small.c_str() ), small.size() );
+        ASSERT_TRUE( archive.save() );
+
+        // Each chunk of the big file and the small file is stored once, and
+        // shared by the second copy
+        DeduplicationStats stats = archive.deduplicationStats();
+
+        EXPECT_EQ( 2 * ( big.size() + small.size() ), stats.logicalBytes );
+        EXPECT_EQ( bigChunks.size() + 1, stats.uniqueRegions );
+        EXPECT_EQ( bigChunks.size() + 1, stats.duplicateRegions );
+        EXPECT_EQ( 2u, stats.chunkedEntries );
+        EXPECT_LT( stats.storedBytes, big.size() + small.size() + 64 * 1024 );
+        EXPECT_GT( stats.ratio(), 1.9 );
+    }
+
+    EXPECT_LT( fs::file_size( path.str() ), big.size() + 128 * 1024 );
+
+    // Saved archives with chunked entries must never claim to be version 1
+    std::ifstream ifs( path.str().c_str(), std::ios::binary );
+    ArchiveHeader header;
+    ifs.read( reinterpret_cast<char*>( &header ), sizeof(header) );
+
+    EXPECT_EQ( ARCHIVE_VERSION_2, header.version );
+}
+
+TEST(Deduplication,RoundTripIsByteExact)
+{
+    TempArchivePath path;
+    std::vector< std::pair<std::string, std::string> > files;
+
+    std::string edited = makeRandomData( 900 * 1024, 5 );
+    edited.insert( 123456, "inserted" );
+
+    files.push_back( std::make_pair( "one.bin",   makeRandomData( 900 * 1024, 5 ) ) );
+    files.push_back( std::make_pair( "two.bin",   edited ) );
+    files.push_back( std::make_pair( "three.bin", makeRandomData( 300 * 1024, 6 ) ) );
+    files.push_back( std::make_pair( "small.txt", std::string( "small" ) ) );
+    files.push_back( std::make_pair( "copy.txt",  std::string( "small" ) ) );
+
+    {
+        Archive archive( path.str() );
+        archive.setDeduplication( true );
+
+        for ( size_t i = 0; i < files.size(); ++i )
+        {
+            archive.add( files[i].first,
+                         reinterpret_cast<const uint8_t*>( files[i].second.c_str() ),
+                         files[i].second.size() );
+        }
+
+        ASSERT_TRUE( archive.save() );
+        EXPECT_GT( archive.deduplicationStats().duplicateRegions, 1u );
+    }
+
+    // Read everything back through both the fully loaded and the streamed
+    // code paths
+    for ( int delayLoad = 0; delayLoad < 2; ++delayLoad )
+    {
+        Archive archive( "dedup" );
+        ASSERT_TRUE( archive.open( path.str(), delayLoad != 0 ) );
+
+        for ( size_t i = 0; i < files.size(); ++i )
+        {
+            bool verified = false;
+
+            EXPECT_TRUE( files[i].second == readEntry( archive, files[i].first, &verified ) )
+                << files[i].first;
+            EXPECT_TRUE( verified ) << files[i].first;
+        }
+
+        EXPECT_FALSE( archive.hasErrors() );
+    }
+}
+
+TEST(Deduplication,VersionOneArchivesCannotHaveChunks)
+{
+    TempArchivePath path;
+    const std::string contents = "not really a chunk list";
+
+    ArchiveHeaderV1 header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, ArchiveHeader().magic, sizeof(header.magic) );
+    header.version             = ARCHIVE_VERSION_1;
+    header.numFileEntries      = 1;
+    header.fileEntryDataOffset = sizeof(ArchiveHeaderV1) + contents.size();
+
+    ArchiveFileEntryV1 entry;
+    memset( &entry, 0, sizeof(entry) );
+    entry.fileEntrySize    = contents.size();
+    entry.uncompressedSize = contents.size();
+    entry.fileOffset       = sizeof(ArchiveHeaderV1);
+    entry.fileFlags        = FILE_FLAG_CHUNKED;
+    strncpy( entry.filename, "chunked.txt", MAX_FILENAME_LENGTH );
+
+    {
+        std::ofstream ofs( path.str().c_str(), std::ios::binary );
+        ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+        ofs.write( contents.c_str(), contents.size() );
+        ofs.write( reinterpret_cast<const char*>( &entry ), sizeof(entry) );
+    }
+
+    Archive archive( "v1" );
+
+    EXPECT_FALSE( archive.open( path.str() ) );
+    EXPECT_FALSE( archive.open( path.str(), true ) );
+    EXPECT_TRUE( archive.hasErrors() );
+}
+
+/**
+ * Lays out a version 2 archive by hand that holds a single chunked entry.
+ * The entry's data follows the header, its chunk list follows the data,
+ * and the table of contents comes last. Corruption tests point the chunk
+ * list and chunks at places they should not be
+ */
+void writeChunkedArchive( const std::string& path,
+                          const std::string& contents,
+                          ArchiveFileEntry entry,
+                          const std::vector<ArchiveChunkEntry>& chunks )
+{
+    const std::size_t chunkListSize = chunks.size() * sizeof(ArchiveChunkEntry);
+
+    ArchiveHeader header;
+    header.numFileEntries      = 1;
+    header.fileEntryDataOffset = sizeof(ArchiveHeader) + contents.size() + chunkListSize;
+
+    entry.fileFlags = FILE_FLAG_CHUNKED;
+    strncpy( entry.filename, "chunked.bin", MAX_FILENAME_LENGTH );
+
+    std::ofstream ofs( path.c_str(), std::ios::binary );
+    ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+    ofs.write( contents.c_str(), contents.size() );
+
+    if (! chunks.empty() )
+    {
+        ofs.write( reinterpret_cast<const char*>( &chunks[0] ), chunkListSize );
+    }
+
+    ofs.write( reinterpret_cast<const char*>( &entry ), sizeof(entry) );
+}
+
+TEST(Deduplication,ChunkOffsetBelowTheHeaderIsRejected)
+{
+    TempArchivePath path;
+    const std::string contents = "some chunk data";
+
+    // Pick a chunk that starts inside the header, and whose end lands just
+    // past the start of the data once the offset wraps around
+    ArchiveChunkEntry chunk;
+    chunk.chunkOffset = 4;
+    chunk.chunkSize   = sizeof(ArchiveHeader) - 2;
+
+    ArchiveFileEntry entry;
+    entry.fileOffset       = sizeof(ArchiveHeader) + contents.size();
+    entry.fileEntrySize    = sizeof(ArchiveChunkEntry);
+    entry.uncompressedSize = chunk.chunkSize;
+
+    writeChunkedArchive( path.str(), contents, entry, std::vector<ArchiveChunkEntry>( 1, chunk ) );
+
+    Archive archive( "corrupt" );
+
+    EXPECT_FALSE( archive.open( path.str() ) );
+    EXPECT_TRUE( archive.hasErrors() );
+    EXPECT_EQ( 0u, archive.fileCount() );
+}
+
+TEST(Deduplication,ChunkListPastTheEndIsRejected)
+{
+    TempArchivePath path;
+    const std::string contents = "some chunk data";
+
+    ArchiveChunkEntry chunk;
+    chunk.chunkOffset = sizeof(ArchiveHeader);
+    chunk.chunkSize   = contents.size();
+
+    ArchiveFileEntry entry;
+    entry.fileOffset       = sizeof(ArchiveHeader) + contents.size();
+    entry.fileEntrySize    = 1024 * sizeof(ArchiveChunkEntry);
+    entry.uncompressedSize = contents.size();
+
+    writeChunkedArchive( path.str(), contents, entry, std::vector<ArchiveChunkEntry>( 1, chunk ) );
+
+    Archive archive( "corrupt" );
+
+    EXPECT_FALSE( archive.open( path.str() ) );
+    EXPECT_TRUE( archive.hasErrors() );
+    EXPECT_EQ( 0u, archive.fileCount() );
+}
+
+TEST(Deduplication,HandBuiltChunkedArchiveLoads)
+{
+    TempArchivePath path;
+    const std::string contents = "some chunk data";
+
+    // Sanity check for the corruption tests: the same layout with valid
+    // chunks opens cleanly
+    std::vector<ArchiveChunkEntry> chunks( 2 );
+    chunks[0].chunkOffset = sizeof(ArchiveHeader) + 5;
+    chunks[0].chunkSize   = 6;
+    chunks[1].chunkOffset = sizeof(ArchiveHeader);
+    chunks[1].chunkSize   = 4;
+
+    ArchiveFileEntry entry;
+    entry.fileOffset       = sizeof(ArchiveHeader) + contents.size();
+    entry.fileEntrySize    = chunks.size() * sizeof(ArchiveChunkEntry);
+    entry.uncompressedSize = 10;
+    entry.checksum         = crc32( std::string( "chunk some" ) );
+
+    writeChunkedArchive( path.str(), contents, entry, chunks );
+
+    Archive archive( "handmade" );
+
+    ASSERT_TRUE( archive.open( path.str() ) );
+    EXPECT_FALSE( archive.hasErrors() );
+    EXPECT_EQ( 1u, archive.fileCount() );
+}
+
+/**
+ * Lays out a version 2 archive by hand that holds a single entry stored in
+ * one piece right after the header, with a table of contents entry that can
+ * be tampered with
+ */
+void writeSingleEntryArchive( const std::string& path,
+                              const std::string& contents,
+                              const ArchiveFileEntry& entry,
+                              uint32_t numFileEntries = 1 )
+{
+    ArchiveHeader header;
+    header.numFileEntries      = numFileEntries;
+    header.fileEntryDataOffset = sizeof(ArchiveHeader) + contents.size();
+
+    std::ofstream ofs( path.c_str(), std::ios::binary );
+    ofs.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+    ofs.write( contents.c_str(), contents.size() );
+    ofs.write( reinterpret_cast<const char*>( &entry ), sizeof(entry) );
+}
+
+TEST(ArchiveFormat,TableOfContentsIsCheckedAgainstTheFile)
+{
+    const std::string contents = "plain file data";
+    const uint64_t dataStart   = sizeof(ArchiveHeader);
+
+    ArchiveFileEntry valid( "plain.txt", contents.size(), dataStart, crc32( contents ) );
+    std::vector<ArchiveFileEntry> entries;
+
+    // A huge uncompressed size that would be allocated up front
+    entries.push_back( valid );
+    entries.back().uncompressedSize = uint64_t( 1 ) << 62;
+
+    // Data that runs past the table of contents
+    entries.push_back( valid );
+    entries.back().fileEntrySize    = contents.size() + 1000;
+    entries.back().uncompressedSize = contents.size() + 1000;
+
+    // Data that starts inside the header, or far past the end of the file
+    entries.push_back( valid );
+    entries.back().fileOffset = 8;
+    entries.push_back( valid );
+    entries.back().fileOffset = ~uint64_t( 0 ) - 4;
+
+    // A chunk list that is not a whole number of chunks
+    entries.push_back( valid );
+    entries.back().fileFlags = FILE_FLAG_CHUNKED;
+
+    for ( size_t i = 0; i < entries.size(); ++i )
+    {
+        TempArchivePath path;
+        writeSingleEntryArchive( path.str(), contents, entries[i] );
+
+        for ( int delayLoad = 0; delayLoad < 2; ++delayLoad )
+        {
+            Archive archive( "corrupt" );
+
+            EXPECT_FALSE( archive.open( path.str(), delayLoad != 0 ) ) << "entry " << i;
+            EXPECT_TRUE( archive.hasErrors() );
+            EXPECT_EQ( 0u, archive.fileCount() );
+        }
+
+        // Readers are handed table of contents entries directly as well
+        ArchiveEntryReader reader( path.str(), entries[i], ARCHIVE_VERSION_2 );
+        EXPECT_TRUE( reader.hasErrors() ) << "entry " << i;
+    }
+
+    // More entries than the file has room for
+    TempArchivePath path;
+    writeSingleEntryArchive( path.str(), contents, valid, 0xFFFFFFFF );
+
+    Archive archive( "corrupt" );
+    EXPECT_FALSE( archive.open( path.str() ) );
+
+    // The untouched entry still loads
+    writeSingleEntryArchive( path.str(), contents, valid );
+    Archive clean( "clean" );
+
+    ASSERT_TRUE( clean.open( path.str() ) );
+    EXPECT_EQ( 1u, clean.fileCount() );
+    EXPECT_FALSE( clean.hasErrors() );
+}
+
+/**
+ * Saves a small archive for the verification tests, and returns the files
+ * that were put in it
+ */
+std::vector< std::pair<std::string, std::string> > saveVerifyArchive( const std::string& path )
+{
+    std::vector< std::pair<std::string, std::string> > files;
+
+    files.push_back( std::make_pair( "first.txt",  std::string( "the first file" ) ) );
+    files.push_back( std::make_pair( "second.bin", makeRandomData( 100 * 1024, 3 ) ) );
+    files.push_back( std::make_pair( "third.txt",  std::string( "the third and final file" ) ) );
+
+    saveArchive( path, files );
+    return files;
+}
+
+TEST(ArchiveVerify,CleanArchivePasses)
+{
+    TempArchivePath path;
+    std::vector< std::pair<std::string, std::string> > files = saveVerifyArchive( path.str() );
+
+    // One thread, and more threads than there are jobs. Verify only starts
+    // as many threads as it has jobs, so a silly count is harmless
+    const unsigned int threadCounts[] = { 1, 16, 100000 };
+
+    for ( size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i )
+    {
+        Archive archive( "verify" );
+        ASSERT_TRUE( archive.open( path.str(), true ) );
+
+        ArchiveVerifyReport report = archive.verify( threadCounts[i] );
+
+        EXPECT_TRUE( report.isValid() );
+        EXPECT_TRUE( report.failures.empty() );
+        EXPECT_TRUE( report.hashPresent );
+        EXPECT_TRUE( report.hashMatches );
+        EXPECT_EQ( files.size(), report.entriesChecked );
+        EXPECT_GT( report.bytesChecked, files[1].second.size() * 2 );
+        EXPECT_FALSE( archive.hasErrors() );
+    }
+}
+
+TEST(ArchiveVerify,FlippedDataByteFailsChecksum)
+{
+    TempArchivePath path;
+    std::vector< std::pair<std::string, std::string> > files = saveVerifyArchive( path.str() );
+
+    ASSERT_TRUE( flipArchiveByte( path.str(), files[1].second, 5000 ) );
+
+    const unsigned int threadCounts[] = { 1, 16 };
+
+    for ( size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i )
+    {
+        Archive archive( "verify" );
+        ASSERT_TRUE( archive.open( path.str(), true ) );
+
+        ArchiveVerifyReport report = archive.verify( threadCounts[i] );
+
+        // The damaged entry fails its CRC, and the archive hash fails with it
+        EXPECT_FALSE( report.isValid() );
+        EXPECT_FALSE( report.hashMatches );
+        EXPECT_EQ( files.size(), report.entriesChecked );
+        ASSERT_EQ( 2u, report.failures.size() );
+        EXPECT_EQ( "CRC32 checksum failed for file second.bin", report.failures[0] );
+        EXPECT_NE( std::string::npos, report.failures[1].find( "SHA-256" ) );
+        EXPECT_TRUE( archive.hasErrors() );
+    }
+}
+
+TEST(ArchiveVerify,FlippedPaddingByteFailsHash)
+{
+    TempArchivePath path;
+    std::vector< std::pair<std::string, std::string> > files = saveVerifyArchive( path.str() );
+
+    // The byte right after the first file is alignment padding, which is only
+    // covered by the archive hash
+    ASSERT_TRUE( flipArchiveByte( path.str(), files[0].second, files[0].second.size() ) );
+
+    const unsigned int threadCounts[] = { 1, 16 };
+
+    for ( size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i )
+    {
+        Archive archive( "verify" );
+        ASSERT_TRUE( archive.open( path.str(), true ) );
+
+        ArchiveVerifyReport report = archive.verify( threadCounts[i] );
+
+        EXPECT_FALSE( report.isValid() );
+        EXPECT_TRUE( report.hashPresent );
+        EXPECT_FALSE( report.hashMatches );
+        EXPECT_EQ( files.size(), report.entriesChecked );
+        ASSERT_EQ( 1u, report.failures.size() );
+        EXPECT_NE( std::string::npos, report.failures[0].find( "SHA-256" ) );
+    }
+}
+
+TEST(ExtractPath,PlainNamesLandInTheOutputDirectory)
+{
+    TempDirectory temp;
+    fs::path result;
+
+    ASSERT_TRUE( resolveExtractPath( temp.path(), "file.txt", result ) );
+    EXPECT_EQ( fs::weakly_canonical( temp.path() / "file.txt" ), result );
+
+    ASSERT_TRUE( resolveExtractPath( temp.path(), "a/b/./c.txt", result ) );
+    EXPECT_EQ( fs::weakly_canonical( temp.path() / "a/b/c.txt" ), result );
+}
+
+TEST(ExtractPath,AbsoluteNamesAreRejected)
+{
+    TempDirectory temp;
+    fs::path result;
+
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "/etc/passwd", result ) );
+    EXPECT_FALSE( resolveExtractPath( temp.path(), ( temp.path() / "file.txt" ).string(), result ) );
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "", result ) );
+    EXPECT_FALSE( resolveExtractPath( temp.path(), ".", result ) );
+}
+
+TEST(ExtractPath,ParentComponentsAreRejected)
+{
+    TempDirectory temp;
+    fs::path result;
+
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "..", result ) );
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "../escaped.txt", result ) );
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "a/../../escaped.txt", result ) );
+
+    // Even when the name would end up back inside the output directory
+    EXPECT_FALSE( resolveExtractPath( temp.path(), "a/../file.txt", result ) );
+}
+
+TEST(ExtractPath,SymlinkedParentsCannotEscape)
+{
+    TempDirectory temp;
+    fs::path outputDir = temp.path() / "out";
+    fs::path outside   = temp.path() / "outside";
+    fs::path result;
+
+    fs::create_directories( outputDir / "inner" );
+    fs::create_directories( outside );
+
+    // A link out of the output directory, and one that stays inside it
+    fs::create_directory_symlink( outside, outputDir / "escape" );
+    fs::create_directory_symlink( outputDir / "inner", outputDir / "shortcut" );
+
+    EXPECT_FALSE( resolveExtractPath( outputDir, "escape/file.txt", result ) );
+    EXPECT_FALSE( resolveExtractPath( outputDir, "escape/new/file.txt", result ) );
+
+    ASSERT_TRUE( resolveExtractPath( outputDir, "shortcut/file.txt", result ) );
+    EXPECT_EQ( fs::weakly_canonical( outputDir / "inner" / "file.txt" ), result );
+
+    // The output directory itself can be reached through a link
+    fs::create_directory_symlink( outputDir, temp.path() / "linked" );
+
+    ASSERT_TRUE( resolveExtractPath( temp.path() / "linked", "file.txt", result ) );
+    EXPECT_EQ( fs::weakly_canonical( outputDir / "file.txt" ), result );
+}
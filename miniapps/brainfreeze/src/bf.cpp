@@ -5,12 +5,38 @@
  * Virtual machine source code
  */
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <stack>
+#include <map>
 #include <string>
+#include <cstring>
 #include <cassert>
 
 #include "bf.h"
+#include "jit.h"
+#include "profile.h"
+
+//
+// GCC and clang can jump straight to the handler for the next instruction
+// through a table of label addresses, which predicts far better than the
+// single indirect jump at the top of a switch statement. Define
+// BF_NO_COMPUTED_GOTO to build the portable switch based loop instead.
+//
+#if defined(__GNUC__) && !defined(BF_NO_COMPUTED_GOTO)
+#   define BF_COMPUTED_GOTO
+#endif
+
+#ifdef BF_COMPUTED_GOTO
+#   define OPCODE(op) LABEL_##op:
+#   define DISPATCH()                                   \
+        profiler.instructionRun( ip - pCode );          \
+        goto *dispatchTable[ ip->opcode() ]
+#   define NEXT() ++ip; DISPATCH()
+#else
+#   define OPCODE(op) case op:
+#   define NEXT() ++ip; break
+#endif
 
 const char    CHR_EOF     = '\0';
 const char    CHR_PTR_INC = '>';
@@ -22,17 +48,6 @@ const char    CHR_READ    = ',';
 const char    CHR_JMP_FWD = '[';
 const char    CHR_JMP_BAC = ']';
 
-const uint8_t OP_EOF     = 0;
-const uint8_t OP_NOP     = 1;
-const uint8_t OP_PTR_INC = 2;
-const uint8_t OP_PTR_DEC = 3;
-const uint8_t OP_MEM_INC = 4;
-const uint8_t OP_MEM_DEC = 5;
-const uint8_t OP_READ    = 6;
-const uint8_t OP_WRITE   = 7;
-const uint8_t OP_JMP_FWD = 9;
-const uint8_t OP_JMP_BAC = 10;
-
 namespace BF
 {
     bool isInstruction( char c )
@@ -79,7 +94,9 @@ namespace BF
 
     Data read()         // fixme
     {
-        Data d;
+        // Reads past the end of input give zero, so that every way of
+        // running a program sees the same input
+        Data d = 0;
 
         if( std::cin >> d )
         {
@@ -92,253 +109,698 @@ namespace BF
 
         return d;
     }
-}
 
-BFProgram::BFProgram( const std::string& codestr )
-    : m_codestr(codestr),
-      m_instructions(),
-      m_memory(),
-      m_ip(),
-      m_mp(),
-      m_bCompiled(false),
-      m_bFinished(false)
-{
-    m_instructions.clear();
-    m_memory.resize(1024 * 32);
+    /**
+     * Converts brainfreeze source code into a list of instructions,
+     * skipping over any characters that are not brainfreeze instructions.
+     * With instruction de-duplication enabled, runs of the same pointer or
+     * memory instruction are merged into one instruction.
+     */
+    Instructions parse( const std::string& code )
+    {
+        Instructions instrs;
 
-    m_mp = m_memory.begin();
-}
+        for ( std::string::const_iterator itr  = code.begin();
+                                          itr != code.end();
+                                        ++itr )
+        {
+            if (! isInstruction( *itr ) )
+            {
+                continue;
+            }
 
-void BFProgram::run()
-{
-    // Compile it first
-    if(! m_bCompiled )
-    {
-        compile();
-    }
+            Instruction instr = convert( *itr );
 
-    // Run the application until we hit the terminating point
-    //   XXX can we get rid of the null sentinel?
-    while( m_ip != m_instructions.end() && !m_ip->isA(OP_EOF) )
-    {
-        runStep();      // maybe bring m_ip++ here and change runStep name
-    }
-}
+#ifdef ENABLE_INSTR_DEDUP
+            //
+            // Was the last character a repeat of +, -, >, <
+            //
+            bool isRepeatable = instr.isA( OP_PTR_INC ) ||
+                                instr.isA( OP_PTR_DEC ) ||
+                                instr.isA( OP_MEM_INC ) ||
+                                instr.isA( OP_MEM_DEC );
 
-void BFProgram::runStep()
-{
-    switch( m_ip->opcode() )
-    {
-        case OP_PTR_INC:
-            assert( m_mp != m_memory.end() );
-            m_mp += m_ip->param();
-            break;
-
-        case OP_PTR_DEC:
-            assert( m_mp != m_memory.begin() );
-            m_mp -= m_ip->param();
-            break;
-
-        case OP_MEM_INC:
-            assert( m_mp != m_memory.end() );
-            *m_mp += m_ip->param();
-            break;
-
-        case OP_MEM_DEC:
-            assert( m_mp != m_memory.end() );
-            *m_mp -= m_ip->param();
-            break;
-
-        case OP_WRITE:
-            BF::write( *m_mp );
-            break;
-
-        case OP_READ:
-            *m_mp = BF::read();
-            break;
-
-        case OP_JMP_FWD:
-            // Only execute if byte at data pointer is zero
-            if( *m_mp != 0 ) 
+            if ( isRepeatable && !instrs.empty() &&
+                 instrs.back().isA( instr.opcode() ) )
             {
-                break;
+                instrs.back().setParam( instrs.back().param() + 1 );
+                continue;
             }
-#ifdef ENABLE_FAST_JUMPS
-            else
+#endif
+
+            instrs.push_back( instr );
+        }
+
+        return instrs;
+    }
+
+    /**
+     * Replaces simple loops with a single instruction that does the same
+     * work. A simple loop only contains pointer and memory instructions.
+     *
+     * If a simple loop leaves the memory pointer where it started, and
+     * changes the starting cell by one each time around, then it runs
+     * ( starting cell ) times and can be replaced by one multiply for every
+     * other cell it changes, followed by clearing the starting cell. This
+     * covers clear loops ([-]) along with copy and multiply loops
+     * ([->+>++<<]).
+     *
+     * If a simple loop only moves the memory pointer then it is scanning
+     * for a zero cell ([>] and [<<]), and becomes a scan instruction.
+     */
+    Instructions foldLoops( const Instructions& input )
+    {
+        Instructions output;
+        output.reserve( input.size() );
+
+        for ( std::size_t i = 0; i < input.size(); ++i )
+        {
+            if (! input[i].isA( OP_JMP_FWD ) )
             {
-                m_ip += m_ip->param();
+                output.push_back( input[i] );
+                continue;
             }
-#else
-            while( true )
+
+            //
+            // Find the end of the loop, and work out how the loop body
+            // changes the memory pointer and the cells around it
+            //
+            std::map<int, int> deltas;
+            int  shift    = 0;
+            bool isSimple = true;
+            std::size_t end = i + 1;
+
+            for ( ; end < input.size(); ++end )
             {
-                m_ip++;
-
-                // don't go past the end
-                assert( m_ip != m_instructions.end() );
-                assert( m_ip->isA(OP_EOF) == false );
-                
-                // scope open/close?
-                if( m_ip->isA(OP_JMP_FWD) )
+                const Instruction& instr = input[end];
+                int param = static_cast<int>( instr.param() );
+
+                if ( instr.isA( OP_PTR_INC ) )      { shift += param; }
+                else if ( instr.isA( OP_PTR_DEC ) ) { shift -= param; }
+                else if ( instr.isA( OP_MEM_INC ) ) { deltas[shift] += param; }
+                else if ( instr.isA( OP_MEM_DEC ) ) { deltas[shift] -= param; }
+                else
                 {
-                    // open...
-                    depth++;
+                    isSimple = instr.isA( OP_JMP_BAC );
+                    break;
                 }
-                else if ( m_ip->isA(OP_JMP_BAC) )
+            }
+
+            if (! isSimple || end == input.size() )
+            {
+                output.push_back( input[i] );
+                continue;
+            }
+
+            bool changesMemory = false;
+
+            for ( std::map<int, int>::const_iterator itr  = deltas.begin();
+                                                     itr != deltas.end();
+                                                   ++itr )
+            {
+                changesMemory = changesMemory || ( itr->second & 0xFF ) != 0;
+            }
+
+            int counterDelta = deltas[0] & 0xFF;
+
+            if ( shift == 0 && ( counterDelta == 0x01 || counterDelta == 0xFF ) )
+            {
+                // Counting down runs the loop ( cell ) times, and counting up
+                // runs it ( -cell ) times
+                int sign = ( counterDelta == 0xFF ? 1 : -1 );
+
+                for ( std::map<int, int>::const_iterator itr  = deltas.begin();
+                                                         itr != deltas.end();
+                                                       ++itr )
                 {
-                    // close
-                    if( depth == 0 )
-                    {
-                        break;
-                    }
-                    else
+                    int factor = ( sign * itr->second ) & 0xFF;
+
+                    if ( itr->first != 0 && factor != 0 )
                     {
-                        depth--;
+                        output.push_back( Instruction( OP_MUL, factor, itr->first ) );
                     }
                 }
-            }
-#endif
-
-            break;
 
-        case OP_JMP_BAC:
-            // Only execute if byte at data pointer is non-zero
-            if( *m_mp == 0 ) 
+                output.push_back( Instruction( OP_SET, 0, 0 ) );
+            }
+            else if ( shift != 0 && !changesMemory )
             {
-                break;
+                output.push_back( shift > 0 ? Instruction( OP_SCAN_R,  shift )
+                                            : Instruction( OP_SCAN_L, -shift ) );
             }
-#ifdef ENABLE_FAST_JUMPS
             else
             {
-                m_ip -= m_ip->param();
+                output.push_back( input[i] );
+                continue;
             }
-#else
-            while( true )
+
+            // Skip over the loop that was just replaced
+            i = end;
+        }
+
+        return output;
+    }
+
+    /**
+     * Finds the last instruction in output[ blockStart, end ) that works on
+     * the cell at the given offset, or returns -1 if there is none
+     */
+    int findLastAt( const Instructions& output,
+                    std::size_t blockStart,
+                    int offset )
+    {
+        for ( std::size_t i = output.size(); i > blockStart; --i )
+        {
+            if ( output[i-1].offset() == offset )
             {
-                m_ip--;
+                return static_cast<int>( i - 1 );
+            }
+        }
+
+        return -1;
+    }
+
+    /**
+     * Folds pointer moves into the memory instructions that follow them.
+     * Between two loop boundaries the memory pointer is only moved once,
+     * at the end of the block, and each memory instruction carries the
+     * offset of the cell it works on. Changes to the same cell within a
+     * block are merged together.
+     */
+    Instructions foldOffsets( const Instructions& input )
+    {
+        Instructions output;
+        output.reserve( input.size() );
+
+        std::size_t blockStart = 0;
+        int shift = 0;
+
+        for ( InstrConstItr itr = input.begin(); itr != input.end(); ++itr )
+        {
+            int param = static_cast<int>( itr->param() );
+
+            switch ( itr->opcode() )
+            {
+                case OP_PTR_INC:
+                    shift += param;
+                    break;
+
+                case OP_PTR_DEC:
+                    shift -= param;
+                    break;
 
-                // don't go past the end
-                assert( m_ip != m_instructions.begin() );
-                
-                // scope open/close?
-                if( m_ip->isA(OP_JMP_BAC) )
+                case OP_MEM_INC:
+                case OP_MEM_DEC:
                 {
-                    // open...
-                    depth++;
+                    int delta  = itr->isA( OP_MEM_INC ) ? param : -param;
+                    int offset = shift + itr->offset();
+                    int last   = findLastAt( output, blockStart, offset );
+
+                    if ( last >= 0 && output[last].isA( OP_MEM_INC ) )
+                    {
+                        int value = ( output[last].param() + delta ) & 0xFF;
+
+                        if ( value == 0 )
+                        {
+                            output.erase( output.begin() + last );
+                        }
+                        else
+                        {
+                            output[last].setParam( value );
+                        }
+                    }
+                    else if ( last >= 0 && output[last].isA( OP_SET ) )
+                    {
+                        output[last].setParam( ( output[last].param() + delta ) & 0xFF );
+                    }
+                    else if ( ( delta & 0xFF ) != 0 )
+                    {
+                        output.push_back( Instruction( OP_MEM_INC, delta & 0xFF, offset ) );
+                    }
+                    break;
                 }
-                else if ( m_ip->isA(OP_JMP_FWD) )
+
+                case OP_SET:
                 {
-                    // close
-                    if( depth == 0 )
+                    // Setting a cell throws away any earlier changes to it
+                    int offset = shift + itr->offset();
+                    int last   = findLastAt( output, blockStart, offset );
+
+                    if ( last >= 0 && ( output[last].isA( OP_MEM_INC ) ||
+                                        output[last].isA( OP_SET ) ) )
                     {
-                        break;
+                        output[last] = Instruction( OP_SET, param, offset );
                     }
                     else
                     {
-                        depth--;
+                        output.push_back( Instruction( OP_SET, param, offset ) );
                     }
+                    break;
                 }
+
+                case OP_READ:
+                case OP_WRITE:
+                    output.push_back( Instruction( itr->opcode(), 0,
+                                                    shift + itr->offset() ) );
+                    break;
+
+                default:
+                    //
+                    // Loops, multiplies and scans all look at the cell under
+                    // the memory pointer, so the pointer has to be caught up
+                    // before them
+                    //
+                    if ( shift > 0 )
+                    {
+                        output.push_back( Instruction( OP_PTR_INC, shift ) );
+                    }
+                    else if ( shift < 0 )
+                    {
+                        output.push_back( Instruction( OP_PTR_DEC, -shift ) );
+                    }
+
+                    output.push_back( *itr );
+
+                    shift      = 0;
+                    blockStart = output.size();
+                    break;
             }
-#endif
-            break;
+        }
 
-        default:
-            assert("Unknown opcode");
-    }
+        if ( shift > 0 )
+        {
+            output.push_back( Instruction( OP_PTR_INC, shift ) );
+        }
+        else if ( shift < 0 )
+        {
+            output.push_back( Instruction( OP_PTR_DEC, -shift ) );
+        }
 
-    m_ip++;            // maybe integrate into switch
-}
+        return output;
+    }
 
-/**
- * Compiles a brainfreeze program. It converts the program's
- * textual representation into a program containing only the
- * brainfreeze instructions.
- *
- * Additionally, it performs jump optimizations so jumps no
- * longer need to be calculated on execution.
- */
-void BFProgram::compile()
-{
-    Instructions temp;
-    Instruction  last = Instruction( OP_EOF, 0 );
-    std::stack<int> jumps;  // record positions for [
-
-    //
-    // Scan the code string. Replace each BF instruction 
-    // with its symbolic equivilant.
-    //
-    int icount = 0;
-    for( std::string::iterator itr  = m_codestr.begin();
-                               itr != m_codestr.end();
-                             ++itr )
+    /**
+     * Stores the distance between each pair of matching jump instructions
+     * in both of them, so jumps no longer need to be calculated on
+     * execution.
+     */
+    void resolveJumps( Instructions& instrs )
     {
-        if( BF::isInstruction( *itr ) )
-        {
-            // Convert the character into an instruction
-            Instruction instr = BF::convert( *itr );
+        std::stack<std::size_t> jumps;  // record positions for [
 
-            //
-            // Is this a jump instruction?
-            //
-            if ( *itr == CHR_JMP_FWD )
+        for ( std::size_t i = 0; i < instrs.size(); ++i )
+        {
+            if ( instrs[i].isA( OP_JMP_FWD ) )
             {
                 // This is a forward jump. Record its position
-                jumps.push(icount);
+                jumps.push( i );
             }
-            else if ( *itr == CHR_JMP_BAC )
+            else if ( instrs[i].isA( OP_JMP_BAC ) )
             {
                 // This is a backward jump. Pop the corresponding
                 // forward jump marker off the stack, and update both
-                // of the instructions with the location of their 
+                // of the instructions with the location of their
                 // corresponding targets.
-                int backpos = jumps.top(); jumps.pop();
-                int dist    = icount - backpos;
+                assert( jumps.size() > 0 && "Mismatched jump detected" );
 
-                assert( dist > 0 );
+                std::size_t backpos = jumps.top(); jumps.pop();
+                std::size_t dist    = i - backpos;
 
-                // Update the [ character
-                temp[backpos].setParam( dist );
-
-                // Update the ] (current) character
-                instr.setParam( dist );
+                instrs[backpos].setParam( dist );
+                instrs[i].setParam( dist );
             }
+        }
 
-            //
-            // Was the last character a repeat of +, -, >, <
-            //
-            if ( false /* ( instr == last ) &&
-                 ( instr == OP_PTR_INC || instr == OP_PTR_DEC ||
-                   instr == OP_MEM_INC || instr == OP_MEM_DEC ) */ )
-            {
-                // Get the last character, and update its occurrence
-                temp[icount-1].setParam( temp[icount-1].param() + 1 );
-            }
-            else
-            {
-                // Add the instruction to the instruction stream
-                temp.push_back( instr );
+        // Verify the jump stack is empty. If not, then there is a
+        // mismatched jump somewhere!
+        assert( jumps.size() == 0 && "Mismatched jump detected" );
+    }
 
-                // Remember last instruction
-                last = instr;
+    const char * opcodeName( uint8_t op )
+    {
+        switch ( op )
+        {
+            case OP_EOF:     return "eof";
+            case OP_NOP:     return "nop";
+            case OP_PTR_INC: return "ptr+";
+            case OP_PTR_DEC: return "ptr-";
+            case OP_MEM_INC: return "add";
+            case OP_MEM_DEC: return "sub";
+            case OP_READ:    return "read";
+            case OP_WRITE:   return "write";
+            case OP_JMP_FWD: return "[";
+            case OP_JMP_BAC: return "]";
+            case OP_SET:     return "set";
+            case OP_MUL:     return "mul";
+            case OP_SCAN_R:  return "scan>";
+            case OP_SCAN_L:  return "scan<";
+            default:         return "???";
+        }
+    }
 
-                // Increment instruction counter
-                icount += 1;
-            }
+    /**
+     * Prints an instruction as its opcode name and parameter, followed by
+     * the cell offset when it has one. eg "add 3 @-1"
+     */
+    std::string disassemble( const Instruction& instr )
+    {
+        std::stringstream ss;
+        ss << opcodeName( instr.opcode() ) << " " << instr.param();
 
-            // Remember the last instruction
-            last = instr;
+        if ( instr.offset() != 0 )
+        {
+            ss << " @" << instr.offset();
         }
+
+        return ss.str();
     }
 
-    // Verify the jump stack is empty. If not, then there is a
-    // mismatched jump somewhere!
-    assert( jumps.size() == 0 && "Mismatched jump detected" );
+    /**
+     * Moves right from mp in steps until it finds a zero cell. Single
+     * steps are handed to memchr, which checks many cells at once
+     */
+    Data * scanRight( Data * mp, Data * pMemEnd, std::size_t step )
+    {
+        if ( step == 1 )
+        {
+            mp = static_cast<Data*>( memchr( mp, 0, pMemEnd - mp ) );
+            assert( mp != NULL && "Scanned past the end of memory" );
+
+            return mp;
+        }
+
+        while ( *mp != 0 )
+        {
+            mp += step;
+            assert( mp < pMemEnd );
+        }
+
+        return mp;
+    }
+
+    /**
+     * Moves left from mp in steps until it finds a zero cell
+     */
+    Data * scanLeft( Data * pMemBegin, Data * mp, std::size_t step )
+    {
+#ifdef __GLIBC__
+        if ( step == 1 )
+        {
+            mp = static_cast<Data*>( memrchr( pMemBegin, 0, mp - pMemBegin + 1 ) );
+            assert( mp != NULL && "Scanned past the start of memory" );
+
+            return mp;
+        }
+#endif
+
+        while ( *mp != 0 )
+        {
+            mp -= step;
+            assert( mp >= pMemBegin );
+        }
+
+        return mp;
+    }
+}
+
+
+BFProgram::BFProgram( const std::string& codestr )
+    : m_codestr(codestr),
+      m_instructions(),
+      m_memory(),
+      m_ip(),
+      m_mp(),
+      m_bCompiled(false),
+      m_bFinished(false),
+      m_pJit(NULL)
+{
+    m_instructions.clear();
+    m_memory.resize(1024 * 32);
+
+    m_mp = m_memory.begin();
+}
+
+BFProgram::~BFProgram()
+{
+    delete m_pJit;
+}
+
+namespace
+{
+    /**
+     * Profiler that does nothing. Every call on it is inlined away, so
+     * run() pays nothing for the profiling hooks in execute()
+     */
+    struct NoProfiling
+    {
+        void instructionRun( std::size_t ) { }
+        void loopEntered( std::size_t ) { }
+        void loopRepeated( std::size_t ) { }
+    };
+}
+
+/**
+ * Runs the program until it reaches the end of its instructions. The
+ * program is compiled first if that has not been done yet
+ */
+void BFProgram::run()
+{
+    NoProfiling profiler;
+    execute( profiler );
+}
+
+/**
+ * Runs the program with the interpreter, and records how often each of
+ * its instructions and loops ran in the given profile
+ */
+void BFProgram::runProfiled( BFProfile& profile )
+{
+    if(! m_bCompiled )
+    {
+        compile();
+    }
+
+    profile.reset( m_instructions );
+    execute( profile );
+}
+
+/**
+ * The interpreter loop. Profiler is told about every instruction that is
+ * run and every loop that is entered or repeated
+ */
+template<typename Profiler>
+void BFProgram::execute( Profiler& profiler )
+{
+    // Compile it first
+    if(! m_bCompiled )
+    {
+        compile();
+    }
+
+    // Work with raw pointers while the program runs, and only write them
+    // back to the iterators once it is done
+    const Instruction * pCode = &m_instructions[0];
+    const Instruction * ip    = pCode + ( m_ip - m_instructions.begin() );
+
+    Data * pMemBegin = &m_memory[0];
+    Data * pMemEnd   = pMemBegin + m_memory.size();
+    Data * mp        = pMemBegin + ( m_mp - m_memory.begin() );
+
+#ifdef BF_COMPUTED_GOTO
+    static void * dispatchTable[OP_COUNT] =
+    {
+        &&LABEL_OP_EOF,
+        &&LABEL_OP_NOP,
+        &&LABEL_OP_PTR_INC,
+        &&LABEL_OP_PTR_DEC,
+        &&LABEL_OP_MEM_INC,
+        &&LABEL_OP_MEM_DEC,
+        &&LABEL_OP_READ,
+        &&LABEL_OP_WRITE,
+        &&LABEL_OP_UNKNOWN,     // 8 is not used
+        &&LABEL_OP_JMP_FWD,
+        &&LABEL_OP_JMP_BAC,
+        &&LABEL_OP_SET,
+        &&LABEL_OP_MUL,
+        &&LABEL_OP_SCAN_R,
+        &&LABEL_OP_SCAN_L
+    };
+
+    DISPATCH();
+#else
+    for (;;)
+    {
+        profiler.instructionRun( ip - pCode );
+
+        switch( ip->opcode() )
+        {
+#endif
+            OPCODE(OP_NOP)
+                NEXT();
+
+            OPCODE(OP_PTR_INC)
+                mp += ip->param();
+                assert( mp < pMemEnd );
+                NEXT();
+
+            OPCODE(OP_PTR_DEC)
+                mp -= ip->param();
+                assert( mp >= pMemBegin );
+                NEXT();
+
+            OPCODE(OP_MEM_INC)
+                mp[ ip->offset() ] += ip->param();
+                NEXT();
+
+            OPCODE(OP_MEM_DEC)
+                mp[ ip->offset() ] -= ip->param();
+                NEXT();
+
+            OPCODE(OP_WRITE)
+                BF::write( mp[ ip->offset() ] );
+                NEXT();
+
+            OPCODE(OP_READ)
+                mp[ ip->offset() ] = BF::read();
+                NEXT();
+
+            OPCODE(OP_JMP_FWD)
+                // Skip past the loop if the byte at the data pointer is zero
+                if( *mp == 0 )
+                {
+                    ip += ip->param();
+                }
+                else
+                {
+                    profiler.loopEntered( ip - pCode );
+                }
+                NEXT();
+
+            OPCODE(OP_JMP_BAC)
+                // Go back to the start of the loop if the byte at the data
+                // pointer is non-zero
+                if( *mp != 0 )
+                {
+                    ip -= ip->param();
+                    profiler.loopRepeated( ip - pCode );
+                }
+                NEXT();
+
+            OPCODE(OP_SET)
+                mp[ ip->offset() ] = static_cast<Data>( ip->param() );
+                NEXT();
+
+            OPCODE(OP_MUL)
+                mp[ ip->offset() ] += static_cast<Data>( *mp * ip->param() );
+                NEXT();
+
+            OPCODE(OP_SCAN_R)
+                mp = BF::scanRight( mp, pMemEnd, ip->param() );
+                NEXT();
+
+            OPCODE(OP_SCAN_L)
+                mp = BF::scanLeft( pMemBegin, mp, ip->param() );
+                NEXT();
+
+#ifdef BF_COMPUTED_GOTO
+            LABEL_OP_UNKNOWN:
+#else
+            default:
+#endif
+                assert( false && "Unknown opcode" );
+                goto finished;
+
+            OPCODE(OP_EOF)
+                goto finished;
+
+#ifndef BF_COMPUTED_GOTO
+        }
+    }
+#endif
+
+finished:
+    m_ip = m_instructions.begin() + ( ip - pCode );
+    m_mp = m_memory.begin() + ( mp - pMemBegin );
+
+    m_bFinished = true;
+}
+
+/**
+ * Runs the program as native code. If native code cannot be generated
+ * on this machine, the program is run by the interpreter instead
+ */
+void BFProgram::runJit()
+{
+    if(! m_bCompiled )
+    {
+        compile();
+    }
+
+    if ( m_bFinished )
+    {
+        return;
+    }
+
+    if ( m_pJit == NULL && BFJit::isSupported() )
+    {
+        m_pJit = new BFJit;
+
+        if (! m_pJit->compile( m_instructions,
+                               &m_memory[0],
+                               &m_memory[0] + m_memory.size() ) )
+        {
+            delete m_pJit;
+            m_pJit = NULL;
+        }
+    }
+
+    if ( m_pJit == NULL )
+    {
+        run();
+        return;
+    }
+
+    Data * pMemBegin = &m_memory[0];
+    Data * mp = m_pJit->run( pMemBegin + ( m_mp - m_memory.begin() ) );
+
+    // Native code always runs to the end of the program
+    m_ip = m_instructions.end() - 1;
+    m_mp = m_memory.begin() + ( mp - pMemBegin );
+
+    m_bFinished = true;
+}
+
+/**
+ * Compiles a brainfreeze program. It converts the program's
+ * textual representation into a program containing only the
+ * brainfreeze instructions, and then runs the optimization
+ * passes over it.
+ *
+ * Lastly it performs jump optimizations so jumps no longer need
+ * to be calculated on execution.
+ */
+void BFProgram::compile()
+{
+    Instructions temp = BF::parse( m_codestr );
+
+#ifdef ENABLE_IDIOMS
+    temp = BF::foldLoops( temp );
+#endif
+
+#ifdef ENABLE_INSTR_DEDUP
+    temp = BF::foldOffsets( temp );
+#endif
+
+    BF::resolveJumps( temp );
 
     // Insert end of program instruction
     temp.push_back( Instruction( OP_EOF, 0 ) );
-    
+
     // Save it to m_instructions
     m_instructions.swap( temp );
     m_ip = m_instructions.begin();
+
+    m_bCompiled = true;
 }
 
 Data BFProgram::valueAt( int offset ) const
@@ -354,7 +816,17 @@ std::size_t BFProgram::instructionOffset() const
     return m_ip - m_instructions.begin();
 }
 
+const Instructions& BFProgram::instructions() const
+{
+    return m_instructions;
+}
+
 std::size_t BFProgram::memoryPointerOffset() const
 {
     return m_mp - m_memory.begin();
 }
+
+std::size_t BFProgram::memorySize() const
+{
+    return m_memory.size();
+}
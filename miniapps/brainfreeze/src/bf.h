@@ -13,6 +13,8 @@
 
 class Instruction;
 class BFProgram;
+class BFJit;
+class BFProfile;
 
 typedef int8_t Data;
 typedef std::vector<Instruction> Instructions;
@@ -25,6 +27,28 @@ typedef Memory::const_iterator       MemoryConstItr;
 
 void runTests();
 
+//
+// Instructions understood by the brainfreeze virtual machine. The first
+// group map directly onto brainfreeze characters, the rest are produced by
+// the optimizer when it recognizes a common idiom. Every memory operation
+// applies to the cell at ( memory pointer + instruction offset ).
+//
+const uint8_t OP_EOF     = 0;
+const uint8_t OP_NOP     = 1;
+const uint8_t OP_PTR_INC = 2;       // mp += param
+const uint8_t OP_PTR_DEC = 3;       // mp -= param
+const uint8_t OP_MEM_INC = 4;       // mp[offset] += param
+const uint8_t OP_MEM_DEC = 5;       // mp[offset] -= param
+const uint8_t OP_READ    = 6;       // mp[offset] = read()
+const uint8_t OP_WRITE   = 7;       // write( mp[offset] )
+const uint8_t OP_JMP_FWD = 9;       // if mp[0] == 0, skip ahead param instrs
+const uint8_t OP_JMP_BAC = 10;      // if mp[0] != 0, go back param instrs
+const uint8_t OP_SET     = 11;      // mp[offset] = param
+const uint8_t OP_MUL     = 12;      // mp[offset] += mp[0] * param
+const uint8_t OP_SCAN_R  = 13;      // while mp[0] != 0, mp += param
+const uint8_t OP_SCAN_L  = 14;      // while mp[0] != 0, mp -= param
+const uint8_t OP_COUNT   = 15;
+
 namespace BF
 {
     bool isInstruction( char c );
@@ -34,16 +58,48 @@ namespace BF
     void write( const Data& d );
 
     Data read();
+
+    // Compiler passes, run in this order by BFProgram::compile()
+    Instructions parse( const std::string& code );
+    Instructions foldLoops( const Instructions& input );
+    Instructions foldOffsets( const Instructions& input );
+    void resolveJumps( Instructions& instrs );
+
+    // Readable names for opcodes and instructions
+    const char * opcodeName( uint8_t op );
+    std::string disassemble( const Instruction& instr );
+
+    // Find the nearest zero cell, stepping right or left from mp
+    Data * scanRight( Data * mp, Data * pMemEnd, std::size_t step );
+    Data * scanLeft( Data * pMemBegin, Data * mp, std::size_t step );
 }
 
 class BFProgram
 {
     public:
         BFProgram( const std::string& code );
+        ~BFProgram();
 
         void compile();
         void run();
 
+        /**
+         * Runs the program as native code, or with the interpreter when
+         * native code is not supported on this machine
+         */
+        void runJit();
+
+        /**
+         * Runs the program with the interpreter while counting how often
+         * each instruction and loop runs. Results go into profile
+         */
+        void runProfiled( BFProfile& profile );
+
+        /**
+         * Retrieves the program's compiled instructions
+         */
+        const Instructions& instructions() const;
+
         /**
          * Retrieves the value stored at the specified offset in the
          * program's memory.
@@ -64,8 +120,17 @@ class BFProgram
          */
         std::size_t memoryPointerOffset() const;
 
+        /**
+         * Retrieves the number of cells in the program's memory
+         */
+        std::size_t memorySize() const;
+
     private:
-        void runStep();
+        BFProgram( const BFProgram& );
+        BFProgram& operator = ( const BFProgram& );
+
+        template<typename Profiler>
+        void execute( Profiler& profiler );
 
         std::string  m_codestr;
         Instructions m_instructions;
@@ -76,13 +141,16 @@ class BFProgram
 
         bool         m_bCompiled;
         bool         m_bFinished;
+
+        BFJit *      m_pJit;
 };
 
 class Instruction
 {
 public:
-    Instruction( uint8_t op, uint32_t arg )
-        : m_idata( ( 0x000000FF & op ) | ( arg << 8 ) )
+    Instruction( uint8_t op, uint32_t arg, int32_t offset = 0 )
+        : m_idata( ( 0x000000FF & op ) | ( arg << 8 ) ),
+          m_offset( offset )
     {
     }
 
@@ -110,8 +178,24 @@ public:
 		return ( (m_idata & 0x000000FF) == op );
 	}
 
+    /**
+     * Offset from the memory pointer of the cell this instruction works
+     * on. Lets the optimizer fold pointer moves into the instructions
+     * around them
+     */
+    int32_t offset() const
+    {
+        return m_offset;
+    }
+
+    void setOffset( int32_t offset )
+    {
+        m_offset = offset;
+    }
+
 private:
     uint32_t m_idata;
+    int32_t  m_offset;
 };
 
 #endif
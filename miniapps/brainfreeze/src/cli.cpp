@@ -5,6 +5,7 @@
  * Command line interface to the interpreter
  */
 #include "bf.h"
+#include "profile.h"
 
 #include <iostream>
 #include <fstream>
@@ -56,6 +57,8 @@ void printVersionInfo()
 int main( int argc, char * argv[] )
 {
 	std::string code;
+    bool useJit = false;
+    bool useProfiler = false;
 
     //
     // Command line parsing
@@ -71,6 +74,14 @@ int main( int argc, char * argv[] )
             printVersionInfo();
             return 0;
         }
+        else if ( strcmp( arg, "--jit" ) == 0 )
+        {
+            useJit = true;
+        }
+        else if ( strcmp( arg, "--profile" ) == 0 )
+        {
+            useProfiler = true;
+        }
         else
         {
             // Must be a file then
@@ -83,5 +94,21 @@ int main( int argc, char * argv[] )
     }
 
     BFProgram app(code);
-    app.run();
+
+    if ( useProfiler )
+    {
+        // Report goes to stderr so it does not mix with program output
+        BFProfile profile;
+
+        app.runProfiled( profile );
+        profile.report( std::cerr );
+    }
+    else if ( useJit )
+    {
+        app.runJit();
+    }
+    else
+    {
+        app.run();
+    }
 }
@@ -0,0 +1,321 @@
+/**
+ * Brainfreeze Language Interpreter
+ * (c) 2009 Scott MacDonald. All rights reserved.
+ *
+ * x86-64 native code generator
+ */
+#include <vector>
+#include <stack>
+#include <cstring>
+#include <cassert>
+
+#include "jit.h"
+#include "bf.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#   define BF_JIT_X86_64
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+namespace
+{
+    // Generated code keeps the memory pointer in rbx, which the functions
+    // it calls are required to preserve. These wrappers give the BF
+    // helpers a plain C calling convention friendly signature.
+    void jitWrite( int value )
+    {
+        BF::write( static_cast<Data>( value ) );
+    }
+
+    int jitRead()
+    {
+        return BF::read();
+    }
+
+    typedef Data * (*NativeProgram)( Data * );
+}
+
+BFJit::BFJit()
+    : m_code(),
+      m_pExecutable( NULL ),
+      m_executableSize( 0 )
+{
+}
+
+BFJit::~BFJit()
+{
+    release();
+}
+
+bool BFJit::isSupported()
+{
+#ifdef BF_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool BFJit::compile( const Instructions& instrs, Data * pMemBegin, Data * pMemEnd )
+{
+    release();
+    m_code.clear();
+
+#ifdef BF_JIT_X86_64
+    std::stack<std::size_t> jumps;   // location of each open ['s rel32
+
+    // push rbx; mov rbx, rdi
+    emit( 0x53 );
+    emit( 0x48, 0x89, 0xFB );
+
+    for ( InstrConstItr itr = instrs.begin(); itr != instrs.end(); ++itr )
+    {
+        uint32_t param  = itr->param();
+        uint32_t offset = static_cast<uint32_t>( itr->offset() );
+
+        switch ( itr->opcode() )
+        {
+            case OP_NOP:
+                break;
+
+            case OP_PTR_INC:
+                // add rbx, imm32
+                emit( 0x48, 0x81, 0xC3 );
+                emit32( param );
+                break;
+
+            case OP_PTR_DEC:
+                // sub rbx, imm32
+                emit( 0x48, 0x81, 0xEB );
+                emit32( param );
+                break;
+
+            case OP_MEM_INC:
+                // add byte [rbx + offset], imm8
+                emit( 0x80, 0x83 );
+                emit32( offset );
+                emit( static_cast<uint8_t>( param ) );
+                break;
+
+            case OP_MEM_DEC:
+                // sub byte [rbx + offset], imm8
+                emit( 0x80, 0xAB );
+                emit32( offset );
+                emit( static_cast<uint8_t>( param ) );
+                break;
+
+            case OP_SET:
+                // mov byte [rbx + offset], imm8
+                emit( 0xC6, 0x83 );
+                emit32( offset );
+                emit( static_cast<uint8_t>( param ) );
+                break;
+
+            case OP_MUL:
+                // movzx eax, byte [rbx]; imul eax, eax, imm32
+                // add byte [rbx + offset], al
+                emit( 0x0F, 0xB6, 0x03 );
+                emit( 0x69, 0xC0 );
+                emit32( param );
+                emit( 0x00, 0x83 );
+                emit32( offset );
+                break;
+
+            case OP_WRITE:
+                // movsx edi, byte [rbx + offset]; call jitWrite
+                emit( 0x0F, 0xBE, 0xBB );
+                emit32( offset );
+                emitCall( reinterpret_cast<const void*>( &jitWrite ) );
+                break;
+
+            case OP_READ:
+                // call jitRead; mov byte [rbx + offset], al
+                emitCall( reinterpret_cast<const void*>( &jitRead ) );
+                emit( 0x88, 0x83 );
+                emit32( offset );
+                break;
+
+            case OP_JMP_FWD:
+                // cmp byte [rbx], 0; je <after the matching ]>
+                emit( 0x80, 0x3B, 0x00 );
+                emit( 0x0F, 0x84 );
+                jumps.push( m_code.size() );
+                emit32( 0 );
+                break;
+
+            case OP_JMP_BAC:
+            {
+                assert( jumps.size() > 0 && "Mismatched jump detected" );
+
+                std::size_t forward = jumps.top(); jumps.pop();
+                std::size_t body    = forward + 4;
+
+                // cmp byte [rbx], 0; jne <start of the loop body>
+                emit( 0x80, 0x3B, 0x00 );
+                emit( 0x0F, 0x85 );
+                emit32( static_cast<uint32_t>( body - ( m_code.size() + 4 ) ) );
+
+                patch32( forward,
+                         static_cast<uint32_t>( m_code.size() - body ) );
+                break;
+            }
+
+            case OP_SCAN_R:
+                // mp = scanRight( mp, pMemEnd, step )
+                emit( 0x48, 0x89, 0xDF );
+                emit( 0x48, 0xBE );
+                emit64( reinterpret_cast<uint64_t>( pMemEnd ) );
+                emit( 0xBA );
+                emit32( param );
+                emitCall( reinterpret_cast<const void*>( &BF::scanRight ) );
+                emit( 0x48, 0x89, 0xC3 );
+                break;
+
+            case OP_SCAN_L:
+                // mp = scanLeft( pMemBegin, mp, step )
+                emit( 0x48, 0xBF );
+                emit64( reinterpret_cast<uint64_t>( pMemBegin ) );
+                emit( 0x48, 0x89, 0xDE );
+                emit( 0xBA );
+                emit32( param );
+                emitCall( reinterpret_cast<const void*>( &BF::scanLeft ) );
+                emit( 0x48, 0x89, 0xC3 );
+                break;
+
+            case OP_EOF:
+                break;
+
+            default:
+                assert( false && "Unknown opcode" );
+                return false;
+        }
+
+        if ( itr->isA( OP_EOF ) )
+        {
+            break;
+        }
+    }
+
+    assert( jumps.size() == 0 && "Mismatched jump detected" );
+
+    // mov rax, rbx; pop rbx; ret
+    emit( 0x48, 0x89, 0xD8 );
+    emit( 0x5B );
+    emit( 0xC3 );
+
+    //
+    // Copy the code into its own pages, and then flip them from writable
+    // to executable
+    //
+    std::size_t pageSize = static_cast<std::size_t>( sysconf( _SC_PAGESIZE ) );
+    std::size_t size     = ( m_code.size() + pageSize - 1 ) / pageSize * pageSize;
+
+    void * pPages = mmap( NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if ( pPages == MAP_FAILED )
+    {
+        return false;
+    }
+
+    memcpy( pPages, &m_code[0], m_code.size() );
+
+    if ( mprotect( pPages, size, PROT_READ | PROT_EXEC ) != 0 )
+    {
+        munmap( pPages, size );
+        return false;
+    }
+
+    m_pExecutable    = pPages;
+    m_executableSize = size;
+
+    return true;
+#else
+    (void) instrs;
+    (void) pMemBegin;
+    (void) pMemEnd;
+
+    return false;
+#endif
+}
+
+Data * BFJit::run( Data * mp ) const
+{
+    assert( m_pExecutable != NULL );
+
+    NativeProgram program = reinterpret_cast<NativeProgram>( m_pExecutable );
+    return program( mp );
+}
+
+std::size_t BFJit::codeSize() const
+{
+    return m_code.size();
+}
+
+void BFJit::emit( uint8_t byte )
+{
+    m_code.push_back( byte );
+}
+
+void BFJit::emit( uint8_t b0, uint8_t b1 )
+{
+    m_code.push_back( b0 );
+    m_code.push_back( b1 );
+}
+
+void BFJit::emit( uint8_t b0, uint8_t b1, uint8_t b2 )
+{
+    m_code.push_back( b0 );
+    m_code.push_back( b1 );
+    m_code.push_back( b2 );
+}
+
+void BFJit::emit32( uint32_t value )
+{
+    for ( int i = 0; i < 4; ++i )
+    {
+        m_code.push_back( static_cast<uint8_t>( value >> ( i * 8 ) ) );
+    }
+}
+
+void BFJit::emit64( uint64_t value )
+{
+    for ( int i = 0; i < 8; ++i )
+    {
+        m_code.push_back( static_cast<uint8_t>( value >> ( i * 8 ) ) );
+    }
+}
+
+/**
+ * Calls a function through rax, since the generated code is rarely within
+ * a 32 bit displacement of the function
+ */
+void BFJit::emitCall( const void * pFunction )
+{
+    // mov rax, imm64; call rax
+    emit( 0x48, 0xB8 );
+    emit64( reinterpret_cast<uint64_t>( pFunction ) );
+    emit( 0xFF, 0xD0 );
+}
+
+void BFJit::patch32( std::size_t at, uint32_t value )
+{
+    for ( int i = 0; i < 4; ++i )
+    {
+        m_code[at + i] = static_cast<uint8_t>( value >> ( i * 8 ) );
+    }
+}
+
+void BFJit::release()
+{
+#ifdef BF_JIT_X86_64
+    if ( m_pExecutable != NULL )
+    {
+        munmap( m_pExecutable, m_executableSize );
+    }
+#endif
+
+    m_pExecutable    = NULL;
+    m_executableSize = 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Brainfreeze Language Interpreter
+ * (c) 2009 Scott MacDonald. All rights reserved.
+ *
+ * Native code generator header file
+ */
+#ifndef BRAINFREEZE_JIT_H
+#define BRAINFREEZE_JIT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "bf.h"
+
+/**
+ * Translates a compiled brainfreeze program into x86-64 machine code, and
+ * runs it. Each instruction becomes a handful of native instructions that
+ * work on the memory pointer held in a register, so there is no dispatch
+ * cost at all. Reads, writes and scans call back into the BF helpers.
+ *
+ * The generated code is written into a buffer from mmap, which is made
+ * executable (and read only) once code generation is done. On any other
+ * architecture isSupported() returns false and compile() fails, so callers
+ * should fall back to the interpreter.
+ */
+class BFJit
+{
+public:
+    BFJit();
+    ~BFJit();
+
+    /**
+     * Checks if native code can be generated on this machine
+     */
+    static bool isSupported();
+
+    /**
+     * Generates native code for a compiled program. The program's memory
+     * must stay at the same address for as long as the code is used
+     *
+     * \param  instrs     Compiled instructions, ending with OP_EOF
+     * \param  pMemBegin  Start of the program's memory
+     * \param  pMemEnd    End of the program's memory
+     * \return            True if native code was generated
+     */
+    bool compile( const Instructions& instrs, Data * pMemBegin, Data * pMemEnd );
+
+    /**
+     * Runs the generated code until the program finishes
+     *
+     * \param  mp  Memory pointer to start from
+     * \return     Memory pointer when the program finished
+     */
+    Data * run( Data * mp ) const;
+
+    /**
+     * Size of the generated code, in bytes
+     */
+    std::size_t codeSize() const;
+
+private:
+    BFJit( const BFJit& );
+    BFJit& operator = ( const BFJit& );
+
+    void emit( uint8_t byte );
+    void emit( uint8_t b0, uint8_t b1 );
+    void emit( uint8_t b0, uint8_t b1, uint8_t b2 );
+    void emit32( uint32_t value );
+    void emit64( uint64_t value );
+    void emitCall( const void * pFunction );
+    void patch32( std::size_t at, uint32_t value );
+
+    void release();
+
+    std::vector<uint8_t> m_code;
+    void *               m_pExecutable;
+    std::size_t          m_executableSize;
+};
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * Brainfreeze Language Interpreter
+ * (c) 2009 Scott MacDonald. All rights reserved.
+ *
+ * Execution profiler
+ */
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <cassert>
+
+#include "profile.h"
+#include "bf.h"
+
+namespace
+{
+    bool moreIterations( const BFLoopStats& a, const BFLoopStats& b )
+    {
+        return a.iterations > b.iterations;
+    }
+
+    // Longest loop body that is printed out in full by the report
+    const std::size_t MAX_BODY_LENGTH = 8;
+}
+
+BFProfile::BFProfile()
+    : m_instrs(),
+      m_instrCounts(),
+      m_loopEntries(),
+      m_loopRepeats()
+{
+}
+
+void BFProfile::reset( const Instructions& instrs )
+{
+    m_instrs = instrs;
+
+    m_instrCounts.assign( instrs.size(), 0 );
+    m_loopEntries.assign( instrs.size(), 0 );
+    m_loopRepeats.assign( instrs.size(), 0 );
+}
+
+uint64_t BFProfile::instructionsRun() const
+{
+    uint64_t total = 0;
+
+    for ( std::size_t i = 0; i < m_instrCounts.size(); ++i )
+    {
+        total += m_instrCounts[i];
+    }
+
+    return total;
+}
+
+uint64_t BFProfile::instructionCount( std::size_t offset ) const
+{
+    assert( offset < m_instrCounts.size() );
+    return m_instrCounts[offset];
+}
+
+uint64_t BFProfile::opcodeCount( uint8_t opcode ) const
+{
+    uint64_t total = 0;
+
+    for ( std::size_t i = 0; i < m_instrs.size(); ++i )
+    {
+        if ( m_instrs[i].isA( opcode ) )
+        {
+            total += m_instrCounts[i];
+        }
+    }
+
+    return total;
+}
+
+double BFProfile::averageParam( uint8_t opcode ) const
+{
+    double   sum   = 0.0;
+    uint64_t count = 0;
+
+    for ( std::size_t i = 0; i < m_instrs.size(); ++i )
+    {
+        if ( m_instrs[i].isA( opcode ) )
+        {
+            sum   += static_cast<double>( m_instrs[i].param() ) * m_instrCounts[i];
+            count += m_instrCounts[i];
+        }
+    }
+
+    return ( count > 0 ? sum / count : 0.0 );
+}
+
+std::vector<BFLoopStats> BFProfile::hotLoops( std::size_t maxLoops ) const
+{
+    std::vector<BFLoopStats> loops;
+
+    for ( std::size_t i = 0; i < m_instrs.size(); ++i )
+    {
+        if ( m_instrs[i].isA( OP_JMP_FWD ) && m_loopEntries[i] > 0 )
+        {
+            BFLoopStats stats;
+
+            stats.start      = i;
+            stats.end        = i + m_instrs[i].param();
+            stats.entries    = m_loopEntries[i];
+            stats.iterations = m_loopEntries[i] + m_loopRepeats[i];
+
+            loops.push_back( stats );
+        }
+    }
+
+    std::stable_sort( loops.begin(), loops.end(), moreIterations );
+
+    if ( loops.size() > maxLoops )
+    {
+        loops.resize( maxLoops );
+    }
+
+    return loops;
+}
+
+void BFProfile::report( std::ostream& out, std::size_t maxLoops ) const
+{
+    uint64_t total = instructionsRun();
+
+    out << "Instructions run: " << total << std::endl << std::endl;
+
+    //
+    // Per opcode counts
+    //
+    out << std::left  << std::setw(10) << "opcode"
+        << std::right << std::setw(16) << "count"
+        << std::setw(9)  << "%"
+        << std::setw(12) << "avg param" << std::endl;
+
+    for ( int op = 0; op < OP_COUNT; ++op )
+    {
+        uint64_t count = opcodeCount( static_cast<uint8_t>( op ) );
+
+        if ( count == 0 )
+        {
+            continue;
+        }
+
+        out << std::left  << std::setw(10) << BF::opcodeName( static_cast<uint8_t>( op ) )
+            << std::right << std::setw(16) << count
+            << std::fixed << std::setprecision(2)
+            << std::setw(9)  << ( 100.0 * count / total )
+            << std::setw(12) << averageParam( static_cast<uint8_t>( op ) )
+            << std::endl;
+    }
+
+    //
+    // Loops that ran the most iterations
+    //
+    std::vector<BFLoopStats> loops = hotLoops( maxLoops );
+
+    out << std::endl
+        << std::right << std::setw(8) << "loop"
+        << std::setw(14) << "iterations"
+        << std::setw(12) << "entries"
+        << std::setw(10) << "avg"
+        << "  body" << std::endl;
+
+    for ( std::size_t i = 0; i < loops.size(); ++i )
+    {
+        const BFLoopStats& loop = loops[i];
+        std::size_t length      = loop.end - loop.start - 1;
+
+        out << std::setw(8)  << loop.start
+            << std::setw(14) << loop.iterations
+            << std::setw(12) << loop.entries
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << ( static_cast<double>( loop.iterations ) / loop.entries )
+            << "  ";
+
+        if ( length <= MAX_BODY_LENGTH )
+        {
+            for ( std::size_t j = loop.start + 1; j < loop.end; ++j )
+            {
+                out << BF::disassemble( m_instrs[j] ) << "; ";
+            }
+        }
+        else
+        {
+            out << "(" << length << " instructions)";
+        }
+
+        out << std::endl;
+    }
+}
@@ -0,0 +1,107 @@
+/**
+ * Brainfreeze Language Interpreter
+ * (c) 2009 Scott MacDonald. All rights reserved.
+ *
+ * Execution profiler header file
+ */
+#ifndef BRAINFREEZE_PROFILE_H
+#define BRAINFREEZE_PROFILE_H
+
+#include <stdint.h>
+#include <vector>
+#include <ostream>
+
+#include "bf.h"
+
+/**
+ * Statistics for one loop, identified by the offset of its [ instruction
+ */
+struct BFLoopStats
+{
+    std::size_t start;          // offset of the [ instruction
+    std::size_t end;            // offset of the matching ] instruction
+    uint64_t    entries;        // times the loop body was entered from [
+    uint64_t    iterations;     // times the loop body ran in total
+};
+
+/**
+ * Collects metrics while BFProgram::runProfiled() runs a program: how many
+ * times each instruction ran, and how many times each loop was entered and
+ * went around. Per opcode counts and average parameters are worked out
+ * from the per instruction counts afterwards, which keeps the work done
+ * per instruction down to a single increment.
+ *
+ * The report lists the loops that ran the most iterations along with the
+ * instructions in their bodies, which shows which loop idioms are worth
+ * teaching the optimizer about.
+ */
+class BFProfile
+{
+public:
+    BFProfile();
+
+    /**
+     * Clears all counts and prepares to profile the given instructions
+     */
+    void reset( const Instructions& instrs );
+
+    // Hooks called by the interpreter
+    void instructionRun( std::size_t offset )
+    {
+        m_instrCounts[offset] += 1;
+    }
+
+    void loopEntered( std::size_t offset )
+    {
+        m_loopEntries[offset] += 1;
+    }
+
+    void loopRepeated( std::size_t offset )
+    {
+        m_loopRepeats[offset] += 1;
+    }
+
+    /**
+     * Total number of instructions that were run
+     */
+    uint64_t instructionsRun() const;
+
+    /**
+     * Number of times the instruction at an offset was run
+     */
+    uint64_t instructionCount( std::size_t offset ) const;
+
+    /**
+     * Number of instructions with the given opcode that were run
+     */
+    uint64_t opcodeCount( uint8_t opcode ) const;
+
+    /**
+     * Average parameter of the instructions with the given opcode that
+     * were run, weighted by how often each of them ran
+     */
+    double averageParam( uint8_t opcode ) const;
+
+    /**
+     * Loops that ran at least once, sorted with the most iterations first
+     *
+     * \param  maxLoops  Maximum number of loops to return
+     */
+    std::vector<BFLoopStats> hotLoops( std::size_t maxLoops ) const;
+
+    /**
+     * Writes a human readable report of the profile
+     *
+     * \param  out       Stream to write the report to
+     * \param  maxLoops  Number of hot loops to list
+     */
+    void report( std::ostream& out, std::size_t maxLoops = 10 ) const;
+
+private:
+    Instructions          m_instrs;
+    std::vector<uint64_t> m_instrCounts;
+    std::vector<uint64_t> m_loopEntries;
+    std::vector<uint64_t> m_loopRepeats;
+};
+
+#endif
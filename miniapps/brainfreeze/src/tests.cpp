@@ -1,8 +1,17 @@
 #include "bf.h"
+#include "jit.h"
+#include "profile.h"
 #include <cassert>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
 
+#ifndef BF_SAMPLES_DIR
+#define BF_SAMPLES_DIR "../samples"
+#endif
+
 class UnitTest
 {
 public:
@@ -13,6 +22,10 @@ public:
     {
     }
 
+    virtual ~UnitTest()
+    {
+    }
+
     virtual void run() = 0;
     virtual const char* name() const = 0;
     
@@ -158,6 +171,278 @@ TEST(NonDestructiveCopy)
     CHECKMEM(1,4);
 }
 
+TEST(MultiplyLoop)
+{
+    // 3 * 4 into cell 1, 3 * -2 into cell 3
+    CODE("+++[->++++>>--<<<]");
+    CHECKMEM(0,0);
+    CHECKMEM(1,12);
+    CHECKMEM(2,0);
+    CHECKMEM(3,-6);
+    CHECKMPTR(0);
+}
+
+TEST(CountUpMultiplyLoop)
+{
+    // -3 counts up to zero three times
+    CODE("---[+>++<]");
+    CHECKMEM(0,0);
+    CHECKMEM(1,6);
+}
+
+TEST(ClearThenAdd)
+{
+    CODE("+++++[-]++>+++[+]-");
+    CHECKMEM(0,2);
+    CHECKMEM(1,-1);
+    CHECKMPTR(1);
+}
+
+TEST(SkipsMultiplyOnZero)
+{
+    CODE(">+++<[->+<]");
+    CHECKMEM(0,0);
+    CHECKMEM(1,3);
+}
+
+TEST(ScanRightInSteps)
+{
+    CODE("+>>+>>+>+<<<<<[>>]");
+    CHECKMPTR(6);
+}
+
+TEST(ScanLeftInSteps)
+{
+    CODE(">>>+>>+[<<]");
+    CHECKMPTR(1);
+}
+
+TEST(OffsetsAcrossLoop)
+{
+    // Pointer moves must be caught up before the loop checks its cell
+    CODE(">>++<<+>>[->+<]<<");
+    CHECKMEM(0,1);
+    CHECKMEM(2,0);
+    CHECKMEM(3,2);
+    CHECKMPTR(0);
+}
+
+#if defined(ENABLE_IDIOMS) && defined(ENABLE_INSTR_DEDUP)
+TEST(OptimizedInstructions)
+{
+    BFProgram app( std::string( "++>+<[->++<]>>[-]+++[<]" ) );
+    app.compile();
+
+    const Instructions& code = app.instructions();
+
+    assertEquals( code.size(), 8u );
+    assertTrue( code[0].isA( OP_MEM_INC ) );
+    assertEquals( code[0].param(), 2u );
+    assertEquals( code[0].offset(), 0 );
+    assertTrue( code[1].isA( OP_MEM_INC ) );
+    assertEquals( code[1].offset(), 1 );
+    assertTrue( code[2].isA( OP_MUL ) );
+    assertEquals( code[2].param(), 2u );
+    assertEquals( code[2].offset(), 1 );
+    assertTrue( code[3].isA( OP_SET ) );
+    assertEquals( code[3].param(), 0u );
+    assertTrue( code[4].isA( OP_SET ) );
+    assertEquals( code[4].param(), 3u );
+    assertEquals( code[4].offset(), 2 );
+    assertTrue( code[5].isA( OP_PTR_INC ) );
+    assertEquals( code[5].param(), 2u );
+    assertTrue( code[6].isA( OP_SCAN_L ) );
+    assertTrue( code[7].isA( OP_EOF ) );
+}
+#endif
+
+/**
+ * Runs a program with the given input, and captures everything it writes
+ * along with where its memory pointer finished
+ */
+struct ProgramRun
+{
+    std::string output;
+    std::vector<Data> memory;
+    std::size_t memoryPointer;
+};
+
+ProgramRun runProgram( const std::string& code,
+                       const std::string& input,
+                       bool useJit )
+{
+    std::istringstream in( input );
+    std::ostringstream out;
+
+    std::streambuf * pOldIn  = std::cin.rdbuf( in.rdbuf() );
+    std::streambuf * pOldOut = std::cout.rdbuf( out.rdbuf() );
+
+    BFProgram app( code );
+
+    if ( useJit )
+    {
+        app.runJit();
+    }
+    else
+    {
+        app.run();
+    }
+
+    std::cin.rdbuf( pOldIn );
+    std::cin.clear();
+    std::cout.rdbuf( pOldOut );
+
+    ProgramRun result;
+    result.output        = out.str();
+    result.memoryPointer = app.memoryPointerOffset();
+
+    for ( std::size_t i = 0; i < app.memorySize(); ++i )
+    {
+        result.memory.push_back( app.valueAt( static_cast<int>(i) ) );
+    }
+
+    return result;
+}
+
+bool sameRun( const ProgramRun& a, const ProgramRun& b )
+{
+    return a.output == b.output &&
+           a.memory == b.memory &&
+           a.memoryPointer == b.memoryPointer;
+}
+
+std::string loadSample( const std::string& name )
+{
+    std::ifstream file( ( std::string( BF_SAMPLES_DIR ) + "/" + name ).c_str() );
+    std::stringstream ss;
+
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+TEST(JitSimplePrograms)
+{
+    const char * programs[] =
+    {
+        "",
+        ">+++>--<<>>>",
+        "+++++[-]++>+++[+]-",
+        "+++[->++++>>--<<<]",
+        "---[+>++<]",
+        "++>+<[->++<]>>[-]+++[<]",
+        "+>>+>>+>+<<<<<[>>]",
+        ">>>+>>+[<<]",
+        ">++++++++[<+++++++++>-]<.>++++[<+++++++>-]<+.+++++++..+++.",
+        "+[>,.]"
+    };
+
+    for ( std::size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); ++i )
+    {
+        ProgramRun interpreted = runProgram( programs[i], "abc", false );
+        ProgramRun native      = runProgram( programs[i], "abc", true );
+
+        assertTrue( sameRun( interpreted, native ) );
+    }
+}
+
+TEST(JitMatchesInterpreterOnSamples)
+{
+    // Samples paired with the input they are given
+    const char * samples[][2] =
+    {
+        { "99botles.bf",      "" },
+        { "HELLOBF.BF",       "" },
+        { "HELLOUM.BF",       "" },
+        { "PI16.BF",          "" },
+        { "jabh.bf",          "" },
+        { "triangle.bf",      "" },
+        { "hanoi.bf",         "" },
+        { "mandelbrot.bf",    "" },
+        { "collatz.bf",       "27\n" },
+        { "wc.bf",            "hello world\nfoo\n" },
+        { "yapi.bf",          "10\n" }
+    };
+
+    for ( std::size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i )
+    {
+        std::string code = loadSample( samples[i][0] );
+        assertFalse( code.empty() );
+
+        ProgramRun interpreted = runProgram( code, samples[i][1], false );
+        ProgramRun native      = runProgram( code, samples[i][1], true );
+
+        assertFalse( interpreted.output.empty() );
+        assertTrue( sameRun( interpreted, native ) );
+    }
+}
+
+TEST(ProfileCounts)
+{
+    std::istringstream in( "abc" );
+    std::streambuf * pOldIn = std::cin.rdbuf( in.rdbuf() );
+
+    // Read loop goes around once per input character
+    BFProgram app( std::string( ",[>+<,]" ) );
+    BFProfile profile;
+
+    app.runProfiled( profile );
+
+    std::cin.rdbuf( pOldIn );
+    std::cin.clear();
+
+    CHECKMEM(1,3);
+
+    assertEquals( profile.opcodeCount( OP_READ ), 4u );
+    assertEquals( profile.opcodeCount( OP_JMP_FWD ), 1u );
+    assertEquals( profile.opcodeCount( OP_JMP_BAC ), 3u );
+    assertEquals( profile.opcodeCount( OP_EOF ), 1u );
+
+    uint64_t total = 0;
+
+    for ( int op = 0; op < OP_COUNT; ++op )
+    {
+        total += profile.opcodeCount( static_cast<uint8_t>( op ) );
+    }
+
+    assertEquals( profile.instructionsRun(), total );
+
+    std::vector<BFLoopStats> loops = profile.hotLoops( 10 );
+
+    assertEquals( loops.size(), 1u );
+    assertEquals( loops[0].entries, 1u );
+    assertEquals( loops[0].iterations, 3u );
+    assertTrue( app.instructions()[ loops[0].start ].isA( OP_JMP_FWD ) );
+    assertTrue( app.instructions()[ loops[0].end ].isA( OP_JMP_BAC ) );
+}
+
+TEST(ProfileHotLoops)
+{
+    // Inner loop runs 2 * 3 times, outer loop runs twice and the last
+    // loop is never entered
+    BFProgram app( std::string( "++[>+++[>+.<-]<-]>>>[,]" ) );
+    BFProfile profile;
+    std::ostringstream out;
+
+    std::streambuf * pOldOut = std::cout.rdbuf( out.rdbuf() );
+    app.runProfiled( profile );
+    std::cout.rdbuf( pOldOut );
+
+    std::vector<BFLoopStats> loops = profile.hotLoops( 10 );
+
+    assertEquals( loops.size(), 2u );
+    assertEquals( loops[0].iterations, 6u );
+    assertEquals( loops[0].entries, 2u );
+    assertEquals( loops[1].iterations, 2u );
+    assertEquals( loops[1].entries, 1u );
+    assertEquals( profile.opcodeCount( OP_WRITE ), 6u );
+    assertEquals( profile.opcodeCount( OP_READ ), 0u );
+
+    std::ostringstream report;
+    profile.report( report );
+
+    assertFalse( report.str().empty() );
+}
+
 void runTests()
 {
     int passed = 0;
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#include "compiler.h"
+#include "scheduler.h"
+#include "value.h"
+#include "vm.h"
+
+namespace
+{
+    // Number of times each program is run. The fastest run is reported
+    const int RUNS_PER_PROGRAM = 5;
+
+    double now()
+    {
+        timeval tv;
+        gettimeofday( &tv, NULL );
+
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+    }
+
+    bool loadFile( const std::string& path, std::string& contents )
+    {
+        std::ifstream file( path.c_str(), std::ios::in );
+
+        if (! file )
+        {
+            return false;
+        }
+
+        std::stringstream ss;
+        ss << file.rdbuf() << " ";
+
+        contents = ss.str();
+        return true;
+    }
+
+    /**
+     * Runs many copies of a program as green threads on the scheduler,
+     * and checks that every copy gets the expected result
+     */
+    bool benchGreenThreads( const std::string& name,
+                            const Program& program,
+                            const Value& expected,
+                            std::size_t numContexts,
+                            std::size_t numWorkers )
+    {
+        std::vector<ThreadContext*> contexts;
+
+        for ( std::size_t i = 0; i < numContexts; ++i )
+        {
+            contexts.push_back( new ThreadContext( program ) );
+        }
+
+        Scheduler scheduler( numWorkers );
+
+        for ( std::size_t i = 0; i < contexts.size(); ++i )
+        {
+            scheduler.spawn( contexts[i] );
+        }
+
+        double start = now();
+        scheduler.run();
+        double end   = now();
+
+        bool matched = true;
+
+        for ( std::size_t i = 0; i < contexts.size(); ++i )
+        {
+            if ( contexts[i]->status != ESTATUS_FINISHED ||
+                 !( contexts[i]->result == expected ) )
+            {
+                matched = false;
+            }
+
+            delete contexts[i];
+        }
+
+        std::cout << std::left  << std::setw(32) << name
+                  << std::right << std::setw(8)  << scheduler.workerCount()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << ( end - start ) * 1000.0
+                  << std::setw(10) << scheduler.sliceCount()
+                  << std::setw(10) << scheduler.stealCount()
+                  << ( matched ? "" : "  MISMATCH" ) << std::endl;
+
+        return matched;
+    }
+}
+
+/**
+ * Usage: calcbench [--green N] program.calc [program.calc ...]
+ *
+ * Runs each program by walking its expression tree, and again as bytecode
+ * on the virtual machine, and reports how long each took. Both ways of
+ * running a program must give the same result. See samples/bench for a set
+ * of arithmetic heavy programs.
+ *
+ * With --green, each program is also run as N green threads on the
+ * scheduler with an increasing number of workers.
+ */
+int main( int argc, char* argv[] )
+{
+    std::vector<std::string> files;
+    std::size_t greenThreads = 0;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--green" ) == 0 && i + 1 < argc )
+        {
+            greenThreads = atoi( argv[++i] );
+        }
+        else
+        {
+            files.push_back( argv[i] );
+        }
+    }
+
+    if ( files.empty() )
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--green N] program.calc [...]" << std::endl;
+        return 1;
+    }
+
+    bool allMatched = true;
+    std::vector<Program> programs( files.size() );
+    std::vector<Value> results( files.size() );
+
+    std::cout << std::left  << std::setw(32) << "program"
+              << std::right << std::setw(12) << "tree (ms)"
+              << std::setw(12) << "vm (ms)"
+              << std::setw(10) << "speedup" << std::endl;
+
+    for ( std::size_t i = 0; i < files.size(); ++i )
+    {
+        std::string code;
+
+        if (! loadFile( files[i], code ) )
+        {
+            std::cerr << "Could not read " << files[i] << std::endl;
+            return 1;
+        }
+
+        Compiler compiler( code );
+        Expression * tree = compiler.compile();
+        Program& program  = programs[i];
+
+        if (! compiler.compileBytecode( program ) )
+        {
+            return 1;
+        }
+
+        double treeTime = 0.0;
+        double vmTime   = 0.0;
+        Value treeResult;
+        Value vmResult;
+
+        for ( int run = 0; run < RUNS_PER_PROGRAM; ++run )
+        {
+            double start = now();
+            treeResult   = tree->evaluate();
+            double mid   = now();
+            vmResult     = ::run( program );
+            double end   = now();
+
+            if ( run == 0 || mid - start < treeTime ) { treeTime = mid - start; }
+            if ( run == 0 || end - mid < vmTime )     { vmTime   = end - mid; }
+        }
+
+        std::cout << std::left  << std::setw(32) << files[i]
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << treeTime * 1000.0
+                  << std::setw(12) << vmTime * 1000.0
+                  << std::setw(9)  << treeTime / vmTime << "x";
+
+        if (! ( treeResult == vmResult ) )
+        {
+            std::cout << "  MISMATCH: " << treeResult.toString()
+                      << " != " << vmResult.toString();
+            allMatched = false;
+        }
+
+        std::cout << std::endl;
+        results[i] = vmResult;
+
+        delete tree;
+    }
+
+    if ( greenThreads > 0 )
+    {
+        std::cout << std::endl
+                  << std::left  << std::setw(32) << "green threads"
+                  << std::right << std::setw(8)  << "workers"
+                  << std::setw(12) << "time (ms)"
+                  << std::setw(10) << "slices"
+                  << std::setw(10) << "steals" << std::endl;
+
+        std::size_t maxWorkers = std::max( 4u, std::thread::hardware_concurrency() );
+
+        for ( std::size_t i = 0; i < files.size(); ++i )
+        {
+            for ( std::size_t workers = 1; workers <= maxWorkers; workers *= 2 )
+            {
+                allMatched &= benchGreenThreads( files[i],
+                                                 programs[i],
+                                                 results[i],
+                                                 greenThreads,
+                                                 workers );
+            }
+        }
+    }
+
+    return allMatched ? 0 : 1;
+}
@@ -0,0 +1,429 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <stack>
+#include <sstream>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "value.h"
+#include "vm.h"
+
+namespace
+{
+    /**
+     * Functions that compile down to a single instruction. Function names
+     * are looked up in this table once while compiling, so the virtual
+     * machine never has to look at a function's name
+     */
+    struct Builtin
+    {
+        const char * name;
+        EOpcode op;
+        size_t arity;
+    };
+
+    const Builtin BUILTINS[] =
+    {
+        { "+",    EOP_ADD,  2 },
+        { "-",    EOP_SUB,  2 },
+        { "*",    EOP_MUL,  2 },
+        { "/",    EOP_DIV,  2 },
+        { "<",    EOP_LESS, 2 },
+        { "==",   EOP_EQ,   2 },
+        { "test", EOP_TEST, 2 }
+    };
+
+    const Builtin * findBuiltin( const std::string& name )
+    {
+        for ( size_t i = 0; i < sizeof(BUILTINS) / sizeof(BUILTINS[0]); ++i )
+        {
+            if ( name == BUILTINS[i].name )
+            {
+                return &BUILTINS[i];
+            }
+        }
+
+        return NULL;
+    }
+}
+
+std::string toString( TokenType t )
+{
+    switch ( t )
+    {
+        case TOK_OPEN:
+            return "TOK_OPEN";
+        case TOK_CLOSE:
+            return "TOK_CLOSE";
+        case TOK_IDENT:
+            return "TOK_IDENT";
+        case TOK_NUMERIC:
+            return "TOK_NUMERIC";
+        case TOK_SEP:
+            return "TOK_SEP";
+        case TOK_UNKNOWN:
+            return "TOK_UNKNOWN";
+        case TOK_EOF:
+            return "TOK_EOF";
+        default:
+            return "TOK_NO_SUCH_TOK";
+    }
+}
+
+bool isWhitespace( char c )
+{
+    return ( c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+}
+
+bool isEndOfToken( char c )
+{
+    return ( isWhitespace(c) || c == '(' || c == ')' || c == ',' );
+}
+
+bool isNumeric( char c )
+{
+    return ( c >= '0' && c <= '9' );
+}
+
+bool isIdent( char c )
+{
+    return (c >= '*' && c <= 'z') || c == '%' || c == '&';
+}
+
+uint16_t CodeGenerator::allocRegister()
+{
+    if ( nextRegister == 0xFFFF )
+    {
+        error( "Expression is too complex, ran out of registers" );
+        return 0;
+    }
+
+    uint16_t reg = nextRegister++;
+
+    if ( nextRegister > program.registerCount )
+    {
+        program.registerCount = nextRegister;
+    }
+
+    return reg;
+}
+
+void CodeGenerator::freeRegisters( uint16_t firstRegister )
+{
+    assert( firstRegister <= nextRegister );
+    nextRegister = firstRegister;
+}
+
+uint16_t CodeGenerator::constant( const Value& value )
+{
+    for ( size_t i = 0; i < program.constants.size(); ++i )
+    {
+        if ( program.constants[i] == value )
+        {
+            return static_cast<uint16_t>( i );
+        }
+    }
+
+    if ( program.constants.size() == 0xFFFF )
+    {
+        error( "Too many constants in program" );
+        return 0;
+    }
+
+    program.constants.push_back( value );
+    return static_cast<uint16_t>( program.constants.size() - 1 );
+}
+
+size_t CodeGenerator::emit( const Instruction& instruction )
+{
+    program.instructions.push_back( instruction );
+    return program.instructions.size() - 1;
+}
+
+size_t CodeGenerator::here() const
+{
+    return program.instructions.size();
+}
+
+void CodeGenerator::patchJump( size_t jumpAddress, size_t target )
+{
+    assert( jumpAddress < program.instructions.size() );
+
+    if ( target > 0xFFFF )
+    {
+        error( "Program is too long, jump target out of range" );
+        return;
+    }
+
+    program.instructions[jumpAddress].b = static_cast<uint16_t>( target );
+}
+
+void CodeGenerator::error( const std::string& message )
+{
+    std::cerr << "Compile error: " << message << std::endl;
+    failed = true;
+}
+
+bool CodeGenerator::hasFailed() const
+{
+    return failed;
+}
+
+Value FuncCallExpression::evaluate()
+{
+    //
+    // What kind of function is this?
+    //  (horrible...)
+    //
+    if ( function == "-" )
+    {
+        // ASSUME
+        return ( params[0]->evaluate().fVal - 
+                 params[1]->evaluate().fVal );
+    }
+    if ( function == "+" )
+    {
+        return ( params[0]->evaluate().fVal +
+                 params[1]->evaluate().fVal );
+    }
+    if ( function == "*" )
+    {
+        return ( params[0]->evaluate().fVal *
+                 params[1]->evaluate().fVal );
+    }
+    if ( function == "/" )
+    {
+        return ( params[0]->evaluate().fVal /
+                 params[1]->evaluate().fVal );
+    }
+    if ( function == "<" )
+    {
+        return ( params[0]->evaluate().fVal <
+                 params[1]->evaluate().fVal );
+    }
+    if ( function == "==" )
+    {
+        return ( params[0]->evaluate() == params[1]->evaluate() );
+    }
+    if ( function == "print" )
+    {
+        Value v = params[0]->evaluate();
+        std::cout << v.toString() << std::endl;
+
+        return v;
+    }
+    if ( function == "repeat" )
+    {
+        Value count  = params[0]->evaluate();
+        Value result;
+
+        for ( float i = count.fVal; 0 < i; i -= 1 )
+        {
+            result = params[1]->evaluate();
+        }
+
+        return result;
+    }
+    if ( function == "test" )
+    {
+        Value v1 = params[0]->evaluate();
+        Value v2 = params[1]->evaluate();
+        bool  eq = v1 == v2;
+
+        if ( eq )
+        {
+            // TODO move test to special function class impl
+            std::cout << "Line X, PASSED: "
+                      << v1.toString() << " = " << v2.toString()
+                      << std::endl;
+        }
+        else
+        {
+            std::cout << "Line X, FAILED: "
+                      << v1.toString() << " = " << v2.toString()
+                      << std::endl;
+        }
+
+        return eq;
+    }
+    else
+    {
+        std::cerr << "<unknown function call: " << function
+                  << ">" << std::endl;
+        return Value();
+    }
+}
+
+void FuncCallExpression::emit( CodeGenerator& gen, uint16_t target ) const
+{
+    //
+    // Calls to builtins turn into one instruction. The first argument is
+    // computed straight into the target register, and the second argument
+    // into a temporary that is released right after
+    //
+    const Builtin * pBuiltin = findBuiltin( function );
+
+    if ( pBuiltin != NULL )
+    {
+        if ( params.size() != pBuiltin->arity )
+        {
+            gen.error( "Wrong number of arguments to " + function );
+            return;
+        }
+
+        uint16_t temp = gen.allocRegister();
+
+        params[0]->emit( gen, target );
+        params[1]->emit( gen, temp );
+
+        gen.emit( Instruction( pBuiltin->op, target, target, temp ) );
+        gen.freeRegisters( temp );
+    }
+    else if ( function == "print" && params.size() == 1 )
+    {
+        params[0]->emit( gen, target );
+
+        gen.emit( Instruction( EOP_PRINT, target ) );
+        gen.emit( Instruction( EOP_PRINT_NEWLINE ) );
+    }
+    else if ( function == "repeat" && params.size() == 2 )
+    {
+        emitRepeat( gen, target );
+    }
+    else
+    {
+        gen.error( "Unknown function call: " + function );
+    }
+}
+
+/**
+ * Emits a counted loop. The loop body's value from the last pass through
+ * the loop is left in the target register
+ */
+void FuncCallExpression::emitRepeat( CodeGenerator& gen, uint16_t target ) const
+{
+    uint16_t counter = gen.allocRegister();
+    uint16_t one     = gen.allocRegister();
+    uint16_t zero    = gen.allocRegister();
+    uint16_t check   = gen.allocRegister();
+
+    params[0]->emit( gen, counter );
+
+    gen.emit( Instruction( EOP_LOAD_CONST, one, gen.constant( Value( 1.0f ) ) ) );
+    gen.emit( Instruction( EOP_LOAD_CONST, zero, gen.constant( Value( 0.0f ) ) ) );
+    gen.emit( Instruction( EOP_LOAD_CONST, target, gen.constant( Value() ) ) );
+
+    // while ( 0 < counter )
+    size_t loopStart = gen.here();
+
+    gen.emit( Instruction( EOP_LESS, check, zero, counter ) );
+    size_t exitJump = gen.emit( Instruction( EOP_JMP_F, check ) );
+
+    params[1]->emit( gen, target );
+
+    gen.emit( Instruction( EOP_SUB, counter, counter, one ) );
+    size_t backJump = gen.emit( Instruction( EOP_JMP ) );
+
+    gen.patchJump( backJump, loopStart );
+    gen.patchJump( exitJump, gen.here() );
+
+    gen.freeRegisters( counter );
+}
+
+Expression* Compiler::compile()
+{
+    Tokenizer tokenizer( codestr );
+    return compileStartTuple(tokenizer);
+}
+
+bool Compiler::compileBytecode( Program& program )
+{
+    Expression * expr = compile();
+    CodeGenerator gen;
+
+    uint16_t result = gen.allocRegister();
+
+    expr->emit( gen, result );
+    gen.emit( Instruction( EOP_RETURN, result ) );
+
+    delete expr;
+
+    if ( gen.hasFailed() )
+    {
+        return false;
+    }
+
+    program = gen.program;
+    return true;
+}
+
+Expression* Compiler::compileStartTuple( Tokenizer& tokenizer )
+{
+    Expression * expr = NULL;
+    std::vector<Expression*> params;
+
+    while ( tokenizer.parseForNextToken() )
+    {
+        //
+        // What is this element? If this is the start of an expression
+        //
+        if ( tokenizer.getLastTokenType() == TOK_OPEN )
+        {
+            params.push_back( compileStartTuple(tokenizer) );
+        }
+        else if ( tokenizer.getLastTokenType() == TOK_CLOSE )
+        {
+            break;
+        }
+        else if ( tokenizer.getLastTokenType() == TOK_IDENT )
+        {
+            params.push_back(
+                    new ValueExpression( Value( tokenizer.getLastToken() ) )
+            );
+        }
+        else if ( tokenizer.getLastTokenType() == TOK_NUMERIC )
+        {
+            params.push_back( 
+                    new ValueExpression( 
+                        Value( atof( tokenizer.getLastToken().c_str() ) )
+                    )
+            );
+        }
+    }
+
+    expr = constructExpression( params );
+
+    assert( expr != NULL );
+    return expr;
+}
+
+Expression* Compiler::constructExpression( std::vector<Expression*> params ) const
+{
+    //
+    // Construct it
+    //
+    if ( params.size() == 0 )
+    {
+        return new Expression();
+    }
+    else if ( params.size() == 1 )
+    {
+        return params[0];
+    }
+    else
+    {
+        Expression * name = params[0];
+        Expression * call = new FuncCallExpression(
+                name->evaluate().toString(), 
+                std::vector<Expression*>( params.begin() + 1,
+                                          params.end() )
+        );
+
+        delete name;
+        return call;
+    }
+}
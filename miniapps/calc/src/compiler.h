@@ -0,0 +1,372 @@
+#ifndef CALC_COMPILER_H
+#define CALC_COMPILER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include "value.h"
+#include "vm.h"
+
+enum TokenType
+{
+    TOK_OPEN,
+    TOK_CLOSE,
+    TOK_IDENT,
+    TOK_NUMERIC,
+    TOK_SEP,
+    TOK_UNKNOWN,
+    TOK_EOF
+};
+
+std::string toString( TokenType t );
+bool isWhitespace( char c );
+bool isEndOfToken( char c );
+bool isNumeric( char c );
+bool isIdent( char c );
+
+class Tokenizer
+{
+public:
+    Tokenizer( const std::string str )
+        : codestr( str ),
+          lastTokenString(),
+          lastTokenType( TOK_UNKNOWN ),
+          currentPosition(0)
+    {
+    }
+
+    ~Tokenizer()
+    {
+    }
+
+    bool parseForNextToken()
+    {
+        size_t pos      = getCurrentPosition();
+        assert( pos < codestr.size() );
+
+        //
+        // Consume whitespace
+        //
+        for ( ; 
+              pos < codestr.size() && isWhitespace(codestr[pos]);
+            ++pos )
+        {
+            // do nothing, just consume space. 
+        }
+
+        //
+        // End of the line?
+        //
+        if ( pos == codestr.size() )
+        {
+            setLastToken( "", TOK_EOF );
+            return false;
+        }
+
+        size_t startPos = pos;
+
+        //
+        // Search for the next token
+        //
+        TokenType type  = TOK_UNKNOWN;
+        bool      done  = false;
+        bool      error = false;
+
+        for ( ;
+            (!done) && pos < codestr.size() && (!isWhitespace(codestr[pos]))
+                    && ((pos == startPos) || !isEndOfToken(codestr[pos]) );
+            ++pos )
+        {
+            char c = codestr[pos];
+
+            switch ( type )
+            {
+                case TOK_UNKNOWN:
+                    if ( c == '(' )
+                    {
+                        type = TOK_OPEN;
+                        done = true;
+                    }
+                    else if ( c == ')' )
+                    {
+                        type = TOK_CLOSE;
+                        done = true;
+                    }
+                    else if ( c == ',' )
+                    {
+                        type = TOK_SEP;
+                        done = true;
+                    }
+                    else if ( isNumeric( c ) )
+                    {
+                        type = TOK_NUMERIC;
+                    }
+                    else if ( isIdent( c ) )
+                    {
+                        type = TOK_IDENT;
+                    }
+                    else
+                    {
+                        error = true;
+                    }
+                    break;
+                
+                case TOK_NUMERIC:
+                    if ( isNumeric( c ) == false )
+                    {
+                        error = true;
+                    }
+                    break;
+
+                case TOK_IDENT:
+                    if ( isIdent( c ) == false )
+                    {
+                        error = true;
+                    }
+                    break;
+
+                default:
+                    error = true;
+            }
+
+            //
+            // Was there an error while parsing the token?
+            //
+            if ( error )
+            {
+                    std::cerr << "Error while parsing token. "
+                            << "start=" << startPos << ", "
+                            << "pos="   << pos      << ", "
+                            << "type="  << toString(type) << ", "
+                            << "value: "
+                            << codestr.substr( startPos, pos - startPos+1 )
+                            << std::endl;
+
+                    return false;
+            }
+        }
+
+        setLastToken( codestr.substr(startPos, pos - startPos), type );
+        setCurrentPosition( pos );
+
+        return !isEOF();
+    }
+
+    bool isEOF() const
+    {
+        return getCurrentPosition() >= codestr.size();
+    }
+
+    TokenType getLastTokenType() const
+    {
+        return lastTokenType;
+    }
+
+    std::string getLastToken() const
+    {
+        return lastTokenString;
+    }
+
+    private:
+        void setLastToken( const std::string& str, TokenType type )
+        {
+            lastTokenString = str;
+            lastTokenType   = type;
+        }
+
+        size_t getCurrentPosition() const { return currentPosition; }
+        void setCurrentPosition( int p ) { currentPosition = p; }
+
+        std::string codestr;
+        std::string lastTokenString;
+        TokenType   lastTokenType;
+        int currentPosition;
+};
+
+/**
+ * Builds the bytecode for a program. Expressions ask the generator for
+ * registers and constants as they emit their instructions, and registers
+ * are handed out like a stack so that temporaries are reused as soon as an
+ * expression is done with them.
+ */
+class CodeGenerator
+{
+public:
+    CodeGenerator()
+        : program(),
+          nextRegister(0),
+          failed(false)
+    {
+    }
+
+    // Reserve a register for a temporary value
+    uint16_t allocRegister();
+
+    // Release the most recently reserved registers
+    void freeRegisters( uint16_t firstRegister );
+
+    // Get the index of a constant, adding it to the program if needed
+    uint16_t constant( const Value& value );
+
+    // Append an instruction, and return its address
+    size_t emit( const Instruction& instruction );
+
+    // Address of the next instruction to be emitted
+    size_t here() const;
+
+    // Point a previously emitted jump at an address
+    void patchJump( size_t jumpAddress, size_t target );
+
+    // Report a compile error
+    void error( const std::string& message );
+
+    bool hasFailed() const;
+
+    Program program;
+
+private:
+    uint16_t nextRegister;
+    bool failed;
+};
+
+/**
+ * Base compiled expression class. All types of compiled expressions
+ * derieve from here
+ */
+class Expression
+{
+    public:
+        Expression()
+            : params()
+        {
+        }
+
+        Expression( const std::vector<Expression*> params )
+            : params( params )
+        {
+        }
+
+        virtual ~Expression()
+        {
+            for ( size_t i = 0; i < params.size(); ++i )
+            {
+                delete params[i];
+            }
+        }
+
+        virtual std::string dump() const
+        {
+            return std::string("<BaseExpression>");
+        }
+
+        virtual Value evaluate()
+        {
+            return Value();
+        }
+
+        // Emit instructions that leave the expression's value in a register
+        virtual void emit( CodeGenerator& gen, uint16_t target ) const
+        {
+            gen.emit( Instruction( EOP_LOAD_CONST,
+                                   target,
+                                   gen.constant( Value() ) ) );
+        }
+
+        void addParam( Expression* param )
+        {
+            params.push_back( param );
+        }
+
+    protected:
+        std::vector<Expression*> params;
+};
+
+/**
+ * A function call expression. Basically if its not an value node or
+ * an assignment node then it is a function call of some sort.
+ */
+class FuncCallExpression : public Expression
+{
+public:
+    FuncCallExpression( const std::string& function,
+                        const std::vector<Expression*> params )
+        : Expression( params ),
+          function( function )
+    {
+    }
+
+    Value evaluate();
+
+    void emit( CodeGenerator& gen, uint16_t target ) const;
+
+    virtual std::string dump() const
+    {
+        return std::string("<function-call: ") + function +
+               std::string(">");
+    }
+
+private:
+    void emitRepeat( CodeGenerator& gen, uint16_t target ) const;
+
+    std::string function;
+};
+
+/**
+ * A bare value expression - returns the value that it encapsulates
+ */
+class ValueExpression : public Expression
+{
+public:
+    ValueExpression( const Value& value )
+        : Expression(),
+          value( value )
+    {
+    }
+
+    Value evaluate()
+    {
+        return value;
+    }
+
+    void emit( CodeGenerator& gen, uint16_t target ) const
+    {
+        gen.emit( Instruction( EOP_LOAD_CONST,
+                               target,
+                               gen.constant( value ) ) );
+    }
+
+    virtual std::string dump() const
+    {
+        return std::string("<eval-const-value: ") + value.toString() +
+               std::string(">");
+    }
+
+private:
+    Value value;
+};
+
+class Compiler
+{
+public:
+    Compiler( const std::string& codestr )
+        : codestr( codestr )
+    {
+    }
+
+    // Parse the code into an expression tree
+    Expression* compile();
+
+    // Parse the code and generate bytecode for the virtual machine
+    bool compileBytecode( Program& program );
+
+    Expression* compileStartTuple( Tokenizer& tokenizer );
+
+private:
+    Expression* constructExpression( std::vector<Expression*> params ) const;
+
+    std::string codestr;
+};
+
+#endif
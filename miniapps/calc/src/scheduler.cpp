@@ -0,0 +1,293 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+
+#include "scheduler.h"
+#include "vm.h"
+
+const std::size_t Scheduler::DEFAULT_BUDGET;
+
+/**
+ * Creates the scheduler and starts its worker threads.
+ *
+ * \param  numWorkers  Number of workers, or zero to use one per core
+ * \param  budget      Instructions a context runs before it yields
+ */
+Scheduler::Scheduler( std::size_t numWorkers, std::size_t budget )
+    : m_budget( std::max<std::size_t>( budget, 1 ) ),
+      m_queues(),
+      m_threads(),
+      m_stateLock(),
+      m_wake(),
+      m_done(),
+      m_generation( 0 ),
+      m_activeWorkers( 0 ),
+      m_shutdown( false ),
+      m_idleLock(),
+      m_idle(),
+      m_idleWorkers( 0 ),
+      m_nextQueue( 0 ),
+      m_queued( 0 ),
+      m_pending( 0 ),
+      m_steals( 0 ),
+      m_slices( 0 )
+{
+    if ( numWorkers == 0 )
+    {
+        numWorkers = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+
+    for ( std::size_t i = 0; i < numWorkers; ++i )
+    {
+        m_queues.push_back( std::unique_ptr<WorkQueue>( new WorkQueue ) );
+    }
+
+    // The thread calling run() acts as worker zero, so only the remaining
+    // workers need threads of their own
+    for ( std::size_t i = 1; i < numWorkers; ++i )
+    {
+        m_threads.push_back( std::thread( &Scheduler::workerMain, this, i ) );
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> guard( m_stateLock );
+        m_shutdown = true;
+    }
+
+    m_wake.notify_all();
+
+    for ( std::size_t i = 0; i < m_threads.size(); ++i )
+    {
+        m_threads[i].join();
+    }
+}
+
+void Scheduler::spawn( ThreadContext * pContext )
+{
+    assert( pContext != NULL );
+    assert( pContext->status != ESTATUS_FINISHED );
+
+    // Deal new contexts out to the workers in turn
+    pushLocal( m_nextQueue, pContext );
+    m_nextQueue = ( m_nextQueue + 1 ) % m_queues.size();
+
+    m_pending.fetch_add( 1 );
+}
+
+void Scheduler::run()
+{
+    if ( m_pending.load() == 0 )
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard( m_stateLock );
+
+        m_generation   += 1;
+        m_activeWorkers = m_threads.size();
+    }
+
+    m_wake.notify_all();
+
+    workLoop( 0 );
+
+    // Wait for the other workers to go back to sleep, so that nobody is
+    // still touching the queues when we return
+    std::unique_lock<std::mutex> guard( m_stateLock );
+
+    while ( m_activeWorkers > 0 )
+    {
+        m_done.wait( guard );
+    }
+}
+
+std::size_t Scheduler::workerCount() const
+{
+    return m_queues.size();
+}
+
+std::size_t Scheduler::stealCount() const
+{
+    return m_steals.load();
+}
+
+std::size_t Scheduler::sliceCount() const
+{
+    return m_slices.load();
+}
+
+/**
+ * Entry point for the worker threads. Workers sleep until run() is called,
+ * help run the contexts, and then go back to sleep
+ */
+void Scheduler::workerMain( std::size_t worker )
+{
+    std::size_t lastGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard( m_stateLock );
+
+            while (! m_shutdown && m_generation == lastGeneration )
+            {
+                m_wake.wait( guard );
+            }
+
+            if ( m_shutdown )
+            {
+                return;
+            }
+
+            lastGeneration = m_generation;
+        }
+
+        workLoop( worker );
+
+        {
+            std::lock_guard<std::mutex> guard( m_stateLock );
+            m_activeWorkers -= 1;
+        }
+
+        m_done.notify_all();
+    }
+}
+
+/**
+ * Runs contexts until every context has finished
+ */
+void Scheduler::workLoop( std::size_t worker )
+{
+    while ( m_pending.load() > 0 )
+    {
+        ThreadContext * pContext = popLocal( worker );
+
+        if ( pContext == NULL )
+        {
+            pContext = steal( worker );
+        }
+
+        if ( pContext == NULL )
+        {
+            // Everything left is being run by other workers
+            waitForWork();
+            continue;
+        }
+
+        m_slices.fetch_add( 1, std::memory_order_relaxed );
+
+        if ( execute( *pContext, m_budget ) != ESTATUS_FINISHED )
+        {
+            pushLocal( worker, pContext );
+        }
+        else if ( m_pending.fetch_sub( 1 ) == 1 )
+        {
+            // That was the last context, so nobody needs to wait any more
+            wakeIdleWorkers();
+        }
+    }
+}
+
+/**
+ * Puts a worker to sleep until there is a queued context it could run, or
+ * every context has finished
+ */
+void Scheduler::waitForWork()
+{
+    std::unique_lock<std::mutex> guard( m_idleLock );
+    m_idleWorkers.fetch_add( 1 );
+
+    while ( m_queued.load() == 0 && m_pending.load() > 0 )
+    {
+        m_idle.wait( guard );
+    }
+
+    m_idleWorkers.fetch_sub( 1 );
+}
+
+/**
+ * Wakes any workers sleeping in waitForWork, so they can check again
+ */
+void Scheduler::wakeIdleWorkers()
+{
+    // Taking the lock makes sure that a worker that has just decided to
+    // sleep is actually waiting before it is notified
+    {
+        std::lock_guard<std::mutex> guard( m_idleLock );
+    }
+
+    m_idle.notify_all();
+}
+
+/**
+ * Takes the context at the front of a worker's own queue. Contexts that
+ * yield go on the back, so the queue is worked through round robin
+ */
+ThreadContext * Scheduler::popLocal( std::size_t worker )
+{
+    WorkQueue& queue = *m_queues[worker];
+    std::lock_guard<std::mutex> guard( queue.lock );
+
+    if ( queue.contexts.empty() )
+    {
+        return NULL;
+    }
+
+    ThreadContext * pContext = queue.contexts.front();
+    queue.contexts.pop_front();
+    m_queued.fetch_sub( 1 );
+
+    return pContext;
+}
+
+/**
+ * Takes a context from the back of another worker's queue
+ */
+ThreadContext * Scheduler::steal( std::size_t worker )
+{
+    for ( std::size_t i = 1; i < m_queues.size(); ++i )
+    {
+        WorkQueue& victim = *m_queues[ ( worker + i ) % m_queues.size() ];
+        std::lock_guard<std::mutex> guard( victim.lock );
+
+        if (! victim.contexts.empty() )
+        {
+            ThreadContext * pContext = victim.contexts.back();
+            victim.contexts.pop_back();
+            m_queued.fetch_sub( 1 );
+
+            m_steals.fetch_add( 1, std::memory_order_relaxed );
+            return pContext;
+        }
+    }
+
+    return NULL;
+}
+
+void Scheduler::pushLocal( std::size_t worker, ThreadContext * pContext )
+{
+    {
+        WorkQueue& queue = *m_queues[worker];
+        std::lock_guard<std::mutex> guard( queue.lock );
+
+        queue.contexts.push_back( pContext );
+        m_queued.fetch_add( 1 );
+    }
+
+    // Only pay for a wake up when somebody is actually asleep. Both counters
+    // are sequentially consistent, so either the sleeping worker sees the
+    // new context or this sees the sleeping worker
+    if ( m_idleWorkers.load() > 0 )
+    {
+        wakeIdleWorkers();
+    }
+}
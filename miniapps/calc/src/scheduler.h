@@ -0,0 +1,99 @@
+#ifndef CALC_SCHEDULER_H
+#define CALC_SCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "vm.h"
+
+/**
+ * Runs many virtual machine threads (ThreadContexts) at once by sharing a
+ * small pool of OS worker threads between them. Scheduling is cooperative:
+ * a worker runs a context for a fixed budget of instructions, and if the
+ * context has not finished it goes to the back of that worker's queue so
+ * the other contexts get a turn.
+ *
+ * Contexts are dealt out to the workers' queues when they are spawned.
+ * A worker that runs out of contexts steals from the other workers, so
+ * the load evens out even when some scripts run much longer than others.
+ *
+ * The worker threads are created once and sleep between calls to run(),
+ * which makes it cheap to spawn and run a batch of scripts every tick.
+ * Workers that find nothing to run while other workers are still busy
+ * also sleep, until a context is requeued or the last one finishes.
+ * Contexts must not be spawned while run() is in progress.
+ */
+class Scheduler
+{
+public:
+    // Default number of instructions a context runs before yielding
+    static const std::size_t DEFAULT_BUDGET = 1024;
+
+    explicit Scheduler( std::size_t numWorkers = 0,
+                        std::size_t budget = DEFAULT_BUDGET );
+    ~Scheduler();
+
+    // Queue a context to be run. The scheduler does not take ownership
+    void spawn( ThreadContext * pContext );
+
+    // Run every queued context until all of them have finished
+    void run();
+
+    // Number of worker threads, including the thread that calls run()
+    std::size_t workerCount() const;
+
+    // Number of contexts that were stolen from another worker's queue
+    std::size_t stealCount() const;
+
+    // Number of time slices that have been run
+    std::size_t sliceCount() const;
+
+private:
+    Scheduler( const Scheduler& );
+    Scheduler& operator = ( const Scheduler& );
+
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<ThreadContext*> contexts;
+    };
+
+    void workerMain( std::size_t worker );
+    void workLoop( std::size_t worker );
+
+    ThreadContext * popLocal( std::size_t worker );
+    ThreadContext * steal( std::size_t worker );
+    void pushLocal( std::size_t worker, ThreadContext * pContext );
+
+    void waitForWork();
+    void wakeIdleWorkers();
+
+private:
+    std::size_t m_budget;
+    std::vector< std::unique_ptr<WorkQueue> > m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_stateLock;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::size_t m_generation;
+    std::size_t m_activeWorkers;
+    bool m_shutdown;
+
+    std::mutex m_idleLock;
+    std::condition_variable m_idle;
+    std::atomic<std::size_t> m_idleWorkers;
+
+    std::size_t m_nextQueue;
+    std::atomic<std::size_t> m_queued;
+    std::atomic<std::size_t> m_pending;
+    std::atomic<std::size_t> m_steals;
+    std::atomic<std::size_t> m_slices;
+};
+
+#endif
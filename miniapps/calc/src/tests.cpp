@@ -0,0 +1,178 @@
+#include <googletest/googletest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "compiler.h"
+#include "scheduler.h"
+#include "value.h"
+#include "vm.h"
+
+namespace
+{
+    /**
+     * Expressions that exercise every builtin, on their own and nested
+     */
+    const char * EXPRESSIONS[] =
+    {
+        "(+ 40 2)",
+        "(- 44 ( + 1 1 ) )",
+        "(* 6 7)",
+        "(/ 84 2)",
+        "(/ 1 3)",
+        "(< 1 2)",
+        "(< 2 1)",
+        "(== 3 3)",
+        "(== (+ 1 2) (* 2 2))",
+        "(test 42 ( - 44 ( + 1 1 ) ) )",
+        "(test 41 42)",
+        "(print (* 3 (+ 4 5)))",
+        "(repeat 10 (+ 1 2))",
+        "(repeat 0 (+ 1 2))",
+        "(repeat 3 (repeat 4 (- (* 2 (+ 3 4)) (/ 9 3))))",
+        "(+ (* (- 17 5) (/ 81 9)) (- (* 3 (+ 4 5)) (/ 100 (+ 2 3))))"
+    };
+
+    /**
+     * Programs in samples/bench, which are big enough to take many slices
+     */
+    const char * BENCH_SAMPLES[] =
+    {
+        "arith.calc",
+        "compare.calc",
+        "nested.calc",
+        "poly.calc"
+    };
+
+    std::string loadSample( const std::string& name )
+    {
+        std::ifstream file( ( std::string( CALC_SAMPLES_DIR ) + "/bench/" + name ).c_str() );
+        std::stringstream ss;
+
+        ss << file.rdbuf() << " ";
+        return ss.str();
+    }
+
+    /**
+     * Runs a program by walking its expression tree, and again as bytecode,
+     * and checks that both give the same result
+     */
+    void expectSameResult( const std::string& code )
+    {
+        Compiler compiler( code );
+        Expression * pTree = compiler.compile();
+        ASSERT_TRUE( pTree != NULL ) << code;
+
+        Program program;
+        ASSERT_TRUE( Compiler( code ).compileBytecode( program ) ) << code;
+
+        Value expected = pTree->evaluate();
+        Value actual   = run( program );
+
+        EXPECT_TRUE( expected == actual )
+            << code << ": " << expected.toString() << " != " << actual.toString();
+
+        delete pTree;
+    }
+
+    Program compileProgram( const std::string& code )
+    {
+        Program program;
+        Compiler( code ).compileBytecode( program );
+
+        return program;
+    }
+}
+
+TEST(CalcVM,BytecodeMatchesTreeWalker)
+{
+    for ( size_t i = 0; i < sizeof(EXPRESSIONS) / sizeof(EXPRESSIONS[0]); ++i )
+    {
+        expectSameResult( std::string( EXPRESSIONS[i] ) + " " );
+    }
+}
+
+TEST(CalcVM,BenchSamplesMatchTreeWalker)
+{
+    for ( size_t i = 0; i < sizeof(BENCH_SAMPLES) / sizeof(BENCH_SAMPLES[0]); ++i )
+    {
+        std::string code = loadSample( BENCH_SAMPLES[i] );
+
+        ASSERT_GT( code.size(), 1u ) << BENCH_SAMPLES[i];
+        expectSameResult( code );
+    }
+}
+
+TEST(CalcVM,BudgetedExecutionResumes)
+{
+    Program program = compileProgram( "(repeat 50 (* 6 7)) " );
+    ThreadContext context( program );
+    std::size_t slices = 0;
+
+    while ( execute( context, 7 ) != ESTATUS_FINISHED )
+    {
+        slices += 1;
+    }
+
+    EXPECT_GT( slices, 10u );
+    EXPECT_TRUE( context.result == run( program ) );
+}
+
+TEST(CalcScheduler,InterleavesAndFinishesGreenThreads)
+{
+    const std::size_t NUM_CONTEXTS = 64;
+    const std::size_t BUDGET       = 32;
+
+    Program program = compileProgram( "(repeat 200 (+ (* 2 3) (- 9 4))) " );
+    Value expected  = run( program );
+
+    const std::size_t workerCounts[] = { 1, 3 };
+
+    for ( size_t w = 0; w < sizeof(workerCounts) / sizeof(workerCounts[0]); ++w )
+    {
+        std::vector<ThreadContext*> contexts;
+        Scheduler scheduler( workerCounts[w], BUDGET );
+
+        for ( std::size_t i = 0; i < NUM_CONTEXTS; ++i )
+        {
+            contexts.push_back( new ThreadContext( program ) );
+            scheduler.spawn( contexts.back() );
+        }
+
+        scheduler.run();
+
+        // Every context ran for many slices before finishing, so they had
+        // to take turns instead of each running to completion
+        EXPECT_EQ( workerCounts[w], scheduler.workerCount() );
+        EXPECT_GT( scheduler.sliceCount(), NUM_CONTEXTS * 10 );
+
+        for ( std::size_t i = 0; i < contexts.size(); ++i )
+        {
+            EXPECT_EQ( ESTATUS_FINISHED, contexts[i]->status );
+            EXPECT_TRUE( contexts[i]->result == expected );
+
+            delete contexts[i];
+        }
+    }
+}
+
+TEST(CalcScheduler,MoreWorkersThanContexts)
+{
+    Program program = compileProgram( "(repeat 2000 (+ 1 2)) " );
+    Scheduler scheduler( 4, 16 );
+
+    // Most workers have nothing to do and must sleep until the context
+    // finishes. Run a few batches to make sure they wake up every time
+    for ( int batch = 0; batch < 3; ++batch )
+    {
+        ThreadContext context( program );
+
+        scheduler.spawn( &context );
+        scheduler.run();
+
+        EXPECT_EQ( ESTATUS_FINISHED, context.status );
+        EXPECT_TRUE( context.result == run( program ) );
+    }
+}
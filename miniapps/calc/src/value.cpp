@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <set>
+
+#include "value.h"
+
+const char * StringPool::intern( const std::string& str )
+{
+    // Nodes in a std::set never move, so the strings stored in it can be
+    // handed out by pointer
+    static std::set<std::string> pool;
+    return pool.insert( str ).first->c_str();
+}
+
+std::string Value::toString() const
+{
+    std::stringstream ss;
+
+    switch ( type )
+    {
+        case TYPE_NULL:
+            ss << "(nil)";
+            break;
+
+        case TYPE_INT:
+            ss << iVal;
+            break;
+
+        case TYPE_FLOAT:
+            ss << fVal;
+            break;
+
+        case TYPE_BOOL:
+            ss << ( bVal ? ":true" : ":false" );
+            break;
+
+        case TYPE_STRING:
+            ss << sVal;
+            break;
+
+        default:
+            ss << "<??? type>";
+            break;
+    }
+
+    return ss.str();
+}
+
+bool Value::operator == ( const Value& rhs ) const
+{
+    if ( type != rhs.type ) { return false; }
+    else if ( type == TYPE_NULL ) { return true; }
+    else
+    {
+        if ( type == TYPE_INT )
+        {
+            return iVal == rhs.iVal;
+        }
+        else if ( type == TYPE_FLOAT )
+        {
+            return fVal == rhs.fVal;
+        }
+        else if ( type == TYPE_STRING )
+        {
+            // Strings are interned, so equal strings share one pointer
+            return sVal == rhs.sVal;
+        }
+        else if ( type == TYPE_BOOL )
+        {
+            return bVal == rhs.bVal;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+void printValue( const Value& val )
+{
+    switch ( val.type )
+    {
+        case TYPE_NULL:
+            std::cout << "<type: null, value: (nil)>";
+            break;
+        case TYPE_INT:
+            std::cout << "<type: int, value: " << val.iVal << ">";
+            break;
+        case TYPE_FLOAT:
+            std::cout << "<type: float, value: " << val.fVal << ">";
+            break;
+        case TYPE_STRING:
+            std::cout << "<type: string, value: " << val.sVal << ">";
+            break;
+        case TYPE_BOOL:
+            std::cout << "<type: bool, value: "
+                      << ( val.bVal ? ":true" : ":false" ) << ">";
+            break;
+        default:
+            std::cout << "(unknown value type)";
+    }
+}
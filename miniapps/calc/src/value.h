@@ -0,0 +1,85 @@
+#ifndef CALC_VALUE_H
+#define CALC_VALUE_H
+
+#include <string>
+
+enum ValueType
+{
+    TYPE_NULL,
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_STRING,
+    TYPE_BOOL,
+    TYPE_UNKNOWN
+};
+
+/**
+ * Interns strings used by calc programs. Every distinct string is stored
+ * exactly once and lives until the program exits, so values can hold a
+ * plain pointer to it and compare strings by comparing pointers.
+ */
+class StringPool
+{
+public:
+    static const char * intern( const std::string& str );
+};
+
+/**
+ * A value in a calc program. Values are small enough to be copied around
+ * freely; strings are interned so a string value is a single pointer.
+ */
+struct Value
+{
+    Value()
+        : iVal(0),
+          type(TYPE_NULL)
+    {
+    }
+
+    Value( int v )
+        : iVal(v),
+          type(TYPE_INT)
+    {
+    }
+
+    Value( float v )
+        : fVal(v),
+          type(TYPE_FLOAT)
+    {
+    }
+
+    Value( double v )
+        : fVal( static_cast<float>(v) ),
+          type(TYPE_FLOAT)
+    {
+    }
+
+    Value( const std::string& str )
+        : sVal( StringPool::intern( str ) ),
+          type(TYPE_STRING)
+    {
+    }
+
+    Value( bool b )
+        : bVal( b ),
+          type(TYPE_BOOL)
+    {
+    }
+
+    std::string toString() const;
+
+    bool operator == ( const Value& rhs ) const;
+
+    union
+    {
+        int iVal;
+        float fVal;
+        const char * sVal;
+        bool bVal;
+    };
+    ValueType type;
+};
+
+void printValue( const Value& val );
+
+#endif
@@ -0,0 +1,270 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <limits>
+#include <cassert>
+
+#include "vm.h"
+#include "value.h"
+
+//
+// GCC and clang can jump straight to the handler for the next instruction
+// through a table of label addresses. Every handler gets its own indirect
+// jump, which the branch predictor tracks separately, instead of sharing
+// the single indirect jump at the top of a switch statement. Define
+// CALC_NO_COMPUTED_GOTO to build the portable switch based loop instead.
+//
+#if defined(__GNUC__) && !defined(CALC_NO_COMPUTED_GOTO)
+#   define CALC_COMPUTED_GOTO
+#endif
+
+#ifdef CALC_COMPUTED_GOTO
+#   define OPCODE(op) LABEL_##op:
+#   define DISPATCH()                                   \
+        if ( budget-- == 0 ) { goto yield; }            \
+        pInstruction = pCode + ip++;                    \
+        goto *dispatchTable[ pInstruction->op ]
+#   define NEXT() DISPATCH()
+#else
+#   define OPCODE(op) case op:
+#   define NEXT() break
+#endif
+
+/**
+ * Runs a thread for up to a given number of instructions. If the thread's
+ * program has not finished by then, the thread is put back into the waiting
+ * state and picks up where it left off the next time it is executed.
+ *
+ * \param  context  The thread to run
+ * \param  budget   Maximum number of instructions to run
+ * \return          Status of the thread
+ */
+EExecutionStatus execute( ThreadContext& context, std::size_t budget )
+{
+    const Program& program = context.program;
+
+    assert( context.registers.size() >= program.registerCount );
+
+    if ( program.instructions.empty() )
+    {
+        context.status = ESTATUS_FINISHED;
+        return context.status;
+    }
+
+    const Instruction * pCode = &program.instructions[0];
+    const Value * K = program.constants.empty() ? NULL : &program.constants[0];
+    Value * R       = context.registers.empty() ? NULL : &context.registers[0];
+
+    const Instruction * pInstruction = NULL;
+    std::size_t ip = context.ip;
+
+    context.status = ESTATUS_RUNNING;
+
+#ifdef CALC_COMPUTED_GOTO
+    static void * dispatchTable[EOP_COUNT] =
+    {
+        &&LABEL_EOP_NOP,
+        &&LABEL_EOP_LOAD_CONST,
+        &&LABEL_EOP_MOVE,
+        &&LABEL_EOP_ADD,
+        &&LABEL_EOP_SUB,
+        &&LABEL_EOP_MUL,
+        &&LABEL_EOP_DIV,
+        &&LABEL_EOP_LESS,
+        &&LABEL_EOP_EQ,
+        &&LABEL_EOP_TEST,
+        &&LABEL_EOP_PRINT,
+        &&LABEL_EOP_PRINT_NEWLINE,
+        &&LABEL_EOP_JMP,
+        &&LABEL_EOP_JMP_T,
+        &&LABEL_EOP_JMP_F,
+        &&LABEL_EOP_RETURN
+    };
+
+    DISPATCH();
+#else
+    for (;;)
+    {
+        if ( budget-- == 0 )
+        {
+            goto yield;
+        }
+
+        pInstruction = pCode + ip++;
+
+        switch ( pInstruction->op )
+        {
+#endif
+            OPCODE(EOP_NOP)
+                NEXT();
+
+            OPCODE(EOP_LOAD_CONST)
+                R[pInstruction->a] = K[pInstruction->b];
+                NEXT();
+
+            OPCODE(EOP_MOVE)
+                R[pInstruction->a] = R[pInstruction->b];
+                NEXT();
+
+            OPCODE(EOP_ADD)
+                R[pInstruction->a] = Value( R[pInstruction->b].fVal +
+                                            R[pInstruction->c].fVal );
+                NEXT();
+
+            OPCODE(EOP_SUB)
+                R[pInstruction->a] = Value( R[pInstruction->b].fVal -
+                                            R[pInstruction->c].fVal );
+                NEXT();
+
+            OPCODE(EOP_MUL)
+                R[pInstruction->a] = Value( R[pInstruction->b].fVal *
+                                            R[pInstruction->c].fVal );
+                NEXT();
+
+            OPCODE(EOP_DIV)
+                R[pInstruction->a] = Value( R[pInstruction->b].fVal /
+                                            R[pInstruction->c].fVal );
+                NEXT();
+
+            OPCODE(EOP_LESS)
+                R[pInstruction->a] = Value( R[pInstruction->b].fVal <
+                                            R[pInstruction->c].fVal );
+                NEXT();
+
+            OPCODE(EOP_EQ)
+                R[pInstruction->a] = Value( R[pInstruction->b] ==
+                                            R[pInstruction->c] );
+                NEXT();
+
+            OPCODE(EOP_TEST)
+            {
+                const Value& v1 = R[pInstruction->b];
+                const Value& v2 = R[pInstruction->c];
+                bool eq = ( v1 == v2 );
+
+                std::cout << "Line X, " << ( eq ? "PASSED: " : "FAILED: " )
+                          << v1.toString() << " = " << v2.toString()
+                          << std::endl;
+
+                R[pInstruction->a] = Value( eq );
+                NEXT();
+            }
+
+            OPCODE(EOP_PRINT)
+                std::cout << R[pInstruction->a].toString();
+                NEXT();
+
+            OPCODE(EOP_PRINT_NEWLINE)
+                std::cout << std::endl;
+                NEXT();
+
+            OPCODE(EOP_JMP)
+                ip = pInstruction->b;
+                NEXT();
+
+            OPCODE(EOP_JMP_T)
+                if ( R[pInstruction->a].bVal )
+                {
+                    ip = pInstruction->b;
+                }
+                NEXT();
+
+            OPCODE(EOP_JMP_F)
+                if (! R[pInstruction->a].bVal )
+                {
+                    ip = pInstruction->b;
+                }
+                NEXT();
+
+            OPCODE(EOP_RETURN)
+                context.result = R[pInstruction->a];
+                goto finished;
+
+#ifndef CALC_COMPUTED_GOTO
+            default:
+                std::cerr << "UNKNOWN OPCODE " << pInstruction->op
+                          << std::endl;
+                goto finished;
+        }
+    }
+#endif
+
+yield:
+    // Out of instructions for now. Save where the thread was so it can be
+    // resumed later
+    context.ip     = ip;
+    context.status = ESTATUS_WAITING;
+    return context.status;
+
+finished:
+    // Program has finished. Reset the instruction pointer and mark it as
+    // finished
+    context.ip     = 0;
+    context.status = ESTATUS_FINISHED;
+    return context.status;
+}
+
+void execute( ThreadContext& context )
+{
+    execute( context, std::numeric_limits<std::size_t>::max() );
+}
+
+Value run( const Program& program )
+{
+    ThreadContext context( program );
+    execute( context );
+
+    return context.result;
+}
+
+std::string toString( EOpcode op )
+{
+    switch ( op )
+    {
+        case EOP_NOP:           return "nop";
+        case EOP_LOAD_CONST:    return "load.const";
+        case EOP_MOVE:          return "move";
+        case EOP_ADD:           return "add";
+        case EOP_SUB:           return "sub";
+        case EOP_MUL:           return "mul";
+        case EOP_DIV:           return "div";
+        case EOP_LESS:          return "lt";
+        case EOP_EQ:            return "eq";
+        case EOP_TEST:          return "test";
+        case EOP_PRINT:         return "print";
+        case EOP_PRINT_NEWLINE: return "print.newline";
+        case EOP_JMP:           return "jmp";
+        case EOP_JMP_T:         return "jmpt";
+        case EOP_JMP_F:         return "jmpf";
+        case EOP_RETURN:        return "return";
+        default:                return "???";
+    }
+}
+
+/**
+ * Prints the program in the same assembly style as the listings in the
+ * samples directory
+ */
+std::string Program::disassemble() const
+{
+    std::stringstream ss;
+
+    ss << ".function \"main\" @entry" << std::endl;
+    ss << ".registers " << registerCount << std::endl;
+
+    for ( size_t i = 0; i < constants.size(); ++i )
+    {
+        ss << ".const " << i << " " << constants[i].toString() << std::endl;
+    }
+
+    ss << ".start" << std::endl;
+
+    for ( size_t i = 0; i < instructions.size(); ++i )
+    {
+        const Instruction& ins = instructions[i];
+        ss << i << "\t" << toString( static_cast<EOpcode>( ins.op ) )
+           << " " << ins.a << " " << ins.b << " " << ins.c << std::endl;
+    }
+
+    return ss.str();
+}
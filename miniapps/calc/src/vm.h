@@ -0,0 +1,137 @@
+#ifndef CALC_VM_H
+#define CALC_VM_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "value.h"
+
+/**
+ * Instructions understood by the calc virtual machine. The machine is
+ * register based: each instruction names the registers it reads from and
+ * writes to in its a, b and c operands.
+ */
+enum EOpcode
+{
+    EOP_NOP = 0,
+    EOP_LOAD_CONST,     // R[a] = K[b]
+    EOP_MOVE,           // R[a] = R[b]
+    EOP_ADD,            // R[a] = R[b] + R[c]
+    EOP_SUB,            // R[a] = R[b] - R[c]
+    EOP_MUL,            // R[a] = R[b] * R[c]
+    EOP_DIV,            // R[a] = R[b] / R[c]
+    EOP_LESS,           // R[a] = R[b] < R[c]
+    EOP_EQ,             // R[a] = R[b] == R[c]
+    EOP_TEST,           // R[a] = R[b] == R[c], and report the result
+    EOP_PRINT,          // print R[a]
+    EOP_PRINT_NEWLINE,  // print a newline
+    EOP_JMP,            // ip = b
+    EOP_JMP_T,          // if R[a] is true then ip = b
+    EOP_JMP_F,          // if R[a] is false then ip = b
+    EOP_RETURN,         // finish the program with R[a] as its result
+    EOP_COUNT
+};
+
+enum EExecutionStatus
+{
+    ESTATUS_WAITING,
+    ESTATUS_RUNNING,
+    ESTATUS_FINISHED
+};
+
+struct Instruction
+{
+    explicit Instruction( EOpcode op,
+                          uint16_t a = 0,
+                          uint16_t b = 0,
+                          uint16_t c = 0 )
+        : op( static_cast<uint16_t>(op) ),
+          a(a),
+          b(b),
+          c(c)
+    {
+    }
+
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+typedef std::vector<Instruction>   InstructionList;
+typedef InstructionList::iterator  InstructionListItr;
+typedef InstructionList::const_iterator InstructionListConstItr;
+
+/**
+ * A compiled calc program. All of the symbols in the source code have been
+ * resolved to opcodes, registers and constants by the compiler, so the
+ * program can be run without looking anything up by name.
+ */
+struct Program
+{
+    Program()
+        : instructions(),
+          constants(),
+          registerCount(0)
+    {
+    }
+
+    std::string disassemble() const;
+
+    std::vector<Instruction> instructions;
+    std::vector<Value> constants;
+    std::size_t registerCount;
+};
+
+/**
+ * ThreadContext contains all information required to execute an instruction
+ * in the virtual machine
+ */
+struct ThreadContext
+{
+    ThreadContext( const Program& program )
+        : program( program ),
+          status( ESTATUS_WAITING ),
+          ip( 0u ),
+          registers( program.registerCount ),
+          result()
+    {
+    }
+
+    // The program that is being executed by this thread context
+    const Program& program;
+
+    // Program execution status
+    EExecutionStatus status;
+
+    // The current instruction that is scheduled for execution
+    std::size_t ip;
+
+    // Contents of the thread's registers
+    std::vector<Value> registers;
+
+    // Value returned by the program once it has finished
+    Value result;
+
+    // Restart the program from the beginning
+    void reset()
+    {
+        status = ESTATUS_WAITING;
+        ip     = 0;
+        result = Value();
+    }
+};
+
+// Run a thread until its program finishes
+void execute( ThreadContext& context );
+
+// Run a thread for at most a number of instructions
+EExecutionStatus execute( ThreadContext& context, std::size_t budget );
+
+// Run a program from start to finish, and return its result
+Value run( const Program& program );
+
+std::string toString( EOpcode op );
+
+#endif
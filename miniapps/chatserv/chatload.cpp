@@ -0,0 +1,541 @@
+/**
+ * Load generator for chatserv. Opens a large number of connections to the
+ * server, has a few of them send timestamped messages at a fixed rate, and
+ * measures how quickly the server fans each message out to everyone else.
+ *
+ * Every message is a line holding the time it was sent, so each client
+ * that receives it can work out how long it took to arrive. The client and
+ * server have to be on the same machine for those times to agree.
+ */
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include "iopool.h"
+#include "options.h"
+
+using boost::asio::ip::tcp;
+using namespace boost::asio;
+
+namespace
+{
+    // Most connection attempts each io_service has waiting at once, which
+    // keeps the server's listen backlog from overflowing
+    const std::size_t MAX_PENDING_CONNECTS = 256;
+
+    // Largest values the command line options accept
+    const uint64_t MAX_CONNECTIONS = 1000000;
+    const uint64_t MAX_RATE        = 1000000;
+    const uint64_t MAX_SECONDS     = 86400;
+    const uint64_t MAX_THREADS     = 1024;
+
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t nowMicros()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now().time_since_epoch() ).count();
+    }
+}
+
+/**
+ * Counters for the connections run by one io_service. Only that
+ * io_service's thread writes to them
+ */
+struct ShardStats
+{
+    ShardStats()
+        : received( 0 ),
+          sent( 0 ),
+          latencies()
+    {
+    }
+
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> sent;
+    std::vector<uint32_t> latencies;        // microseconds
+};
+
+/**
+ * Settings and state shared by the whole load test
+ */
+struct LoadTest
+{
+    LoadTest()
+        : port( 4201 ),
+          connections( 10000 ),
+          senders( 10 ),
+          rate( 10 ),
+          seconds( 10 ),
+          threads( 1 ),
+          connected( 0 ),
+          failed( 0 ),
+          measureFrom( UINT64_MAX ),
+          measuring( false ),
+          sending( false )
+    {
+    }
+
+    tcp::endpoint endpoint;
+    unsigned short port;
+    std::size_t connections;
+    std::size_t senders;
+    std::size_t rate;                       // messages per second, in total
+    std::size_t seconds;
+    std::size_t threads;
+
+    std::atomic<std::size_t> connected;
+    std::atomic<std::size_t> failed;
+    std::atomic<uint64_t> measureFrom;      // messages sent before are ignored
+    std::atomic<bool> measuring;
+    std::atomic<bool> sending;
+};
+
+/**
+ * One simulated chat client
+ */
+class LoadClient : public boost::enable_shared_from_this<LoadClient>
+{
+public:
+    typedef boost::shared_ptr<LoadClient> pointer;
+
+    LoadClient( io_service& ioService,
+                LoadTest& test,
+                ShardStats& stats,
+                bool sender )
+        : m_socket( ioService ),
+          m_timer( ioService ),
+          m_test( test ),
+          m_stats( stats ),
+          m_input(),
+          m_output(),
+          m_sender( sender ),
+          m_writing( false )
+    {
+    }
+
+    template<typename Handler>
+    void connect( Handler onConnected )
+    {
+        m_socket.async_connect( m_test.endpoint, onConnected );
+    }
+
+    void start()
+    {
+        boost::system::error_code error;
+        m_socket.set_option( tcp::no_delay( true ), error );
+
+        startRead();
+
+        if ( m_sender )
+        {
+            scheduleSend();
+        }
+    }
+
+    void stop()
+    {
+        boost::system::error_code error;
+
+        m_timer.cancel( error );
+        m_socket.close( error );
+    }
+
+private:
+    void startRead()
+    {
+        boost::asio::async_read_until(
+            m_socket,
+            m_input,
+            '\n',
+            boost::bind( &LoadClient::handleRead,
+                         shared_from_this(),
+                         boost::asio::placeholders::error,
+                         boost::asio::placeholders::bytes_transferred )
+        );
+    }
+
+    void handleRead( const boost::system::error_code& error,
+                     size_t bytesTransferred )
+    {
+        if ( error )
+        {
+            return;
+        }
+
+        const char * pLine = buffer_cast<const char*>( m_input.data() );
+        uint64_t sentAt    = strtoull( pLine, NULL, 10 );
+
+        m_input.consume( bytesTransferred );
+
+        if ( sentAt >= m_test.measureFrom.load( std::memory_order_relaxed ) )
+        {
+            m_stats.received.fetch_add( 1, std::memory_order_relaxed );
+            m_stats.latencies.push_back(
+                static_cast<uint32_t>( nowMicros() - sentAt ) );
+        }
+
+        startRead();
+    }
+
+    void scheduleSend()
+    {
+        Clock::duration period = std::chrono::microseconds(
+            1000000 * m_test.senders / std::max<std::size_t>( m_test.rate, 1 ) );
+
+        m_timer.expires_after( period );
+        m_timer.async_wait( boost::bind( &LoadClient::handleTimer,
+                                         shared_from_this(),
+                                         boost::asio::placeholders::error ) );
+    }
+
+    void handleTimer( const boost::system::error_code& error )
+    {
+        if ( error )
+        {
+            return;
+        }
+
+        // Skip a tick rather than queue up behind a write that has not
+        // finished, so a backed up server shows up as lower throughput
+        if ( m_test.sending.load( std::memory_order_relaxed ) && ! m_writing )
+        {
+            std::ostringstream ss;
+            ss << nowMicros() << " the quick brown fox jumps over the lazy dog\n";
+            m_output = ss.str();
+            m_writing = true;
+
+            boost::asio::async_write(
+                m_socket,
+                buffer( m_output ),
+                boost::bind( &LoadClient::handleWrite,
+                             shared_from_this(),
+                             boost::asio::placeholders::error ) );
+
+            if ( m_test.measuring.load( std::memory_order_relaxed ) )
+            {
+                m_stats.sent.fetch_add( 1, std::memory_order_relaxed );
+            }
+        }
+
+        scheduleSend();
+    }
+
+    void handleWrite( const boost::system::error_code& )
+    {
+        m_writing = false;
+    }
+
+private:
+    tcp::socket m_socket;
+    steady_timer m_timer;
+    LoadTest& m_test;
+    ShardStats& m_stats;
+    boost::asio::streambuf m_input;
+    std::string m_output;
+    bool m_sender;
+    bool m_writing;
+};
+
+/**
+ * Opens one io_service's share of the connections, keeping no more than
+ * MAX_PENDING_CONNECTS of them in progress at once
+ */
+class Connector
+{
+public:
+    Connector( io_service& ioService,
+               LoadTest& test,
+               ShardStats& stats,
+               std::size_t count,
+               std::size_t senders )
+        : m_ioService( ioService ),
+          m_test( test ),
+          m_stats( stats ),
+          m_clients(),
+          m_remaining( count ),
+          m_senders( senders )
+    {
+    }
+
+    void start()
+    {
+        for ( std::size_t i = 0; i < MAX_PENDING_CONNECTS; ++i )
+        {
+            connectNext();
+        }
+    }
+
+    void stop()
+    {
+        for ( std::size_t i = 0; i < m_clients.size(); ++i )
+        {
+            m_clients[i]->stop();
+        }
+    }
+
+private:
+    void connectNext()
+    {
+        if ( m_remaining == 0 )
+        {
+            return;
+        }
+
+        m_remaining -= 1;
+
+        bool sender = ( m_senders > 0 );
+        m_senders  -= ( sender ? 1 : 0 );
+
+        LoadClient::pointer client(
+            new LoadClient( m_ioService, m_test, m_stats, sender ) );
+
+        m_clients.push_back( client );
+        client->connect( boost::bind( &Connector::handleConnect,
+                                      this,
+                                      client,
+                                      boost::asio::placeholders::error ) );
+    }
+
+    void handleConnect( LoadClient::pointer client,
+                        const boost::system::error_code& error )
+    {
+        if ( error )
+        {
+            m_test.failed.fetch_add( 1 );
+        }
+        else
+        {
+            client->start();
+            m_test.connected.fetch_add( 1 );
+        }
+
+        connectNext();
+    }
+
+private:
+    io_service& m_ioService;
+    LoadTest& m_test;
+    ShardStats& m_stats;
+    std::vector<LoadClient::pointer> m_clients;
+    std::size_t m_remaining;
+    std::size_t m_senders;
+};
+
+uint32_t percentile( const std::vector<uint32_t>& sorted, double p )
+{
+    if ( sorted.empty() )
+    {
+        return 0;
+    }
+
+    std::size_t index = static_cast<std::size_t>( p * ( sorted.size() - 1 ) );
+    return sorted[index];
+}
+
+void printUsage()
+{
+    std::cerr << "Usage: chatload [--host ADDR] [--port N] [--connections N] "
+              << "[--senders N] [--rate MSGS_PER_SEC] [--seconds N] "
+              << "[--threads N]" << std::endl;
+}
+
+/**
+ * Parses the value of a numeric option, complaining if it isn't a number
+ * between minValue and maxValue
+ */
+bool parseOption( const char * name,
+                  const char * text,
+                  uint64_t minValue,
+                  uint64_t maxValue,
+                  uint64_t& value )
+{
+    if ( ! parseNumber( text, minValue, maxValue, value ) )
+    {
+        std::cerr << name << " must be between " << minValue << " and "
+                  << maxValue << ": " << text << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main( int argc, char* argv[] )
+{
+    LoadTest test;
+    std::string host = "127.0.0.1";
+
+    test.threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( i + 1 >= argc )
+        {
+            printUsage();
+            return 1;
+        }
+
+        const char * name = argv[i];
+        const char * text = argv[i + 1];
+        uint64_t value    = 0;
+
+        if ( strcmp( name, "--host" ) == 0 )
+        {
+            host = text;
+        }
+        else if ( strcmp( name, "--port" ) == 0 && parseOption( name, text, 1, 65535, value ) )
+        {
+            test.port = static_cast<unsigned short>( value );
+        }
+        else if ( strcmp( name, "--connections" ) == 0 &&
+                  parseOption( name, text, 1, MAX_CONNECTIONS, value ) )
+        {
+            test.connections = value;
+        }
+        else if ( strcmp( name, "--senders" ) == 0 &&
+                  parseOption( name, text, 0, MAX_CONNECTIONS, value ) )
+        {
+            test.senders = value;
+        }
+        else if ( strcmp( name, "--rate" ) == 0 && parseOption( name, text, 1, MAX_RATE, value ) )
+        {
+            test.rate = value;
+        }
+        else if ( strcmp( name, "--seconds" ) == 0 && parseOption( name, text, 1, MAX_SECONDS, value ) )
+        {
+            test.seconds = value;
+        }
+        else if ( strcmp( name, "--threads" ) == 0 && parseOption( name, text, 1, MAX_THREADS, value ) )
+        {
+            test.threads = value;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+
+        ++i;
+    }
+
+    boost::system::error_code error;
+    ip::address address = ip::address::from_string( host, error );
+
+    if ( error )
+    {
+        std::cerr << "--host must be an IP address: " << host << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    test.senders  = std::min( test.senders, test.connections );
+    test.endpoint = tcp::endpoint( address, test.port );
+
+    IoServicePool pool( test.threads );
+    std::vector<ShardStats> stats( test.threads );
+    std::vector<boost::shared_ptr<Connector> > connectors;
+
+    for ( std::size_t i = 0; i < test.threads; ++i )
+    {
+        std::size_t count   = test.connections / test.threads
+                            + ( i < test.connections % test.threads ? 1 : 0 );
+        std::size_t senders = test.senders / test.threads
+                            + ( i < test.senders % test.threads ? 1 : 0 );
+
+        boost::shared_ptr<Connector> connector(
+            new Connector( pool.at( i ), test, stats[i], count, senders ) );
+
+        connectors.push_back( connector );
+        pool.at( i ).post( boost::bind( &Connector::start, connector ) );
+    }
+
+    std::thread runner( boost::bind( &IoServicePool::run, &pool ) );
+
+    //
+    // Wait for everyone to connect, then let the senders warm up for a
+    // second before measuring
+    //
+    Clock::time_point connectStart = Clock::now();
+
+    while ( test.connected + test.failed < test.connections )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    }
+
+    double connectSeconds = std::chrono::duration<double>(
+        Clock::now() - connectStart ).count();
+
+    std::cout << "Connected " << test.connected << " clients ("
+              << test.failed << " failed) in " << std::fixed
+              << std::setprecision( 2 ) << connectSeconds << "s" << std::endl;
+
+    test.sending = true;
+    std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+
+    Clock::time_point measureStart = Clock::now();
+    test.measureFrom = nowMicros();
+    test.measuring   = true;
+    std::this_thread::sleep_for( std::chrono::seconds( test.seconds ) );
+    test.measuring = false;
+    test.sending   = false;
+
+    double elapsed = std::chrono::duration<double>(
+        Clock::now() - measureStart ).count();
+
+    // Give messages that are still on their way a moment to arrive
+    std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+
+    for ( std::size_t i = 0; i < connectors.size(); ++i )
+    {
+        pool.at( i ).post( boost::bind( &Connector::stop, connectors[i] ) );
+    }
+
+    pool.stop();
+    runner.join();
+
+    //
+    // Report
+    //
+    uint64_t sent     = 0;
+    uint64_t received = 0;
+    std::vector<uint32_t> latencies;
+
+    for ( std::size_t i = 0; i < stats.size(); ++i )
+    {
+        sent     += stats[i].sent;
+        received += stats[i].received;
+        latencies.insert( latencies.end(),
+                          stats[i].latencies.begin(),
+                          stats[i].latencies.end() );
+    }
+
+    std::sort( latencies.begin(), latencies.end() );
+
+    std::cout << "Sent " << sent << " messages, received " << received
+              << " (" << std::setprecision( 1 )
+              << ( sent > 0 ? 100.0 * received / ( sent * test.connected ) : 0.0 )
+              << "% of expected)" << std::endl;
+
+    std::cout << "Messages/sec delivered: " << std::setprecision( 0 )
+              << received / elapsed << std::endl;
+
+    std::cout << std::setprecision( 2 )
+              << "Latency p50 " << percentile( latencies, 0.50 ) / 1000.0
+              << "ms, p99 " << percentile( latencies, 0.99 ) / 1000.0
+              << "ms, max " << percentile( latencies, 1.0 ) / 1000.0
+              << "ms" << std::endl;
+
+    return 0;
+}
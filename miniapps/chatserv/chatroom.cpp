@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+#include "chatroom.h"
+#include "iopool.h"
+
+ChatParticipant::~ChatParticipant()
+{
+}
+
+OutgoingQueue::OutgoingQueue( std::size_t highWatermark, std::size_t hardLimit )
+    : m_messages(),
+      m_highWatermark( highWatermark ),
+      m_lowWatermark( highWatermark / 2 ),
+      m_hardLimit( hardLimit ),
+      m_readPaused( false )
+{
+}
+
+bool OutgoingQueue::push( const ChatMessage& message )
+{
+    if ( m_messages.size() >= m_hardLimit )
+    {
+        return false;
+    }
+
+    m_messages.push_back( message );
+    return true;
+}
+
+bool OutgoingQueue::pop( std::size_t count )
+{
+    m_messages.erase( m_messages.begin(),
+                      m_messages.begin() + std::min( count, m_messages.size() ) );
+
+    if ( m_readPaused && m_messages.size() <= m_lowWatermark )
+    {
+        m_readPaused = false;
+        return true;
+    }
+
+    return false;
+}
+
+bool OutgoingQueue::pauseReading()
+{
+    m_readPaused = m_readPaused || m_messages.size() >= m_highWatermark;
+    return m_readPaused;
+}
+
+ChatRoom::ChatRoom( IoServicePool& pool )
+    : m_pool( pool ),
+      m_shards( pool.size() )
+{
+}
+
+void ChatRoom::join( const ChatParticipantPtr& participant, std::size_t shard )
+{
+    m_shards.at( shard ).insert( participant );
+}
+
+void ChatRoom::leave( const ChatParticipantPtr& participant, std::size_t shard )
+{
+    m_shards.at( shard ).erase( participant );
+}
+
+void ChatRoom::broadcast( const ChatMessage& message )
+{
+    for ( std::size_t i = 0; i < m_shards.size(); ++i )
+    {
+        m_pool.at( i ).post(
+            boost::bind( &ChatRoom::deliverToShard, this, i, message ) );
+    }
+}
+
+std::size_t ChatRoom::size( std::size_t shard ) const
+{
+    return m_shards.at( shard ).size();
+}
+
+void ChatRoom::deliverToShard( std::size_t shard, ChatMessage message )
+{
+    Participants& participants = m_shards[shard];
+    Participants::iterator itr = participants.begin();
+
+    while ( itr != participants.end() )
+    {
+        // A participant that is too far behind leaves the room while the
+        // message is delivered, so step past it before delivering
+        ChatParticipantPtr participant = *itr++;
+        participant->deliver( message );
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef CHATSERV_CHATROOM_H
+#define CHATSERV_CHATROOM_H
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+class IoServicePool;
+
+/**
+ * A chat message. Messages are never changed once they have been made, so
+ * the same buffer is handed to every connection that the message goes out
+ * to instead of each one getting its own copy. The buffer is freed once
+ * the last connection has finished writing it.
+ */
+typedef boost::shared_ptr<const std::string> ChatMessage;
+
+/**
+ * Anything in a chat room that messages can be delivered to
+ */
+class ChatParticipant
+{
+public:
+    virtual ~ChatParticipant();
+
+    /**
+     * Queues a message to be sent to the participant. Always called from
+     * the thread running the participant's io_service
+     */
+    virtual void deliver( const ChatMessage& message ) = 0;
+};
+
+typedef boost::shared_ptr<ChatParticipant> ChatParticipantPtr;
+
+/**
+ * Messages waiting to be written out to one participant, and the flow
+ * control that stops a slow client from holding up the room.
+ *
+ * Once the queue reaches its high watermark the participant should stop
+ * reading from its client, and it starts again when the queue has drained
+ * to half of that. A participant that falls behind all the way to the
+ * hard limit is too slow to keep, and push() tells it to drop out rather
+ * than letting the queue grow without bound.
+ */
+class OutgoingQueue
+{
+public:
+    OutgoingQueue( std::size_t highWatermark, std::size_t hardLimit );
+
+    /**
+     * Adds a message to the back of the queue. Returns false, without
+     * adding the message, if the queue is already at its hard limit
+     */
+    bool push( const ChatMessage& message );
+
+    /**
+     * Removes messages from the front of the queue once they have been
+     * written. Returns true if reading was paused and should now resume
+     */
+    bool pop( std::size_t count );
+
+    /**
+     * Called after reading a message. Returns true if reading should pause
+     * until pop() says otherwise
+     */
+    bool pauseReading();
+
+    const ChatMessage& at( std::size_t index ) const { return m_messages.at( index ); }
+
+    std::size_t size() const { return m_messages.size(); }
+
+    bool empty() const { return m_messages.empty(); }
+
+    void clear() { m_messages.clear(); }
+
+private:
+    std::deque<ChatMessage> m_messages;
+    std::size_t m_highWatermark;
+    std::size_t m_lowWatermark;
+    std::size_t m_hardLimit;
+    bool m_readPaused;
+};
+
+/**
+ * A chat room that sends every message to everyone in it.
+ *
+ * The room is split into one shard per io_service in the pool, and each
+ * shard only holds the participants that live on its io_service. Joining
+ * and leaving happen on the participant's own thread, and a broadcast
+ * posts a single handler to every shard which then hands the message out
+ * to its local participants. That keeps the room free of locks, and costs
+ * one post per thread rather than one per connection.
+ */
+class ChatRoom
+{
+public:
+    explicit ChatRoom( IoServicePool& pool );
+
+    /**
+     * Adds a participant to a shard. Must be called on that shard's thread
+     */
+    void join( const ChatParticipantPtr& participant, std::size_t shard );
+
+    /**
+     * Removes a participant from a shard. Must be called on that shard's
+     * thread
+     */
+    void leave( const ChatParticipantPtr& participant, std::size_t shard );
+
+    /**
+     * Sends a message to everyone in the room. Safe to call from any thread
+     */
+    void broadcast( const ChatMessage& message );
+
+    /**
+     * Number of participants in a shard. Must be called on that shard's
+     * thread
+     */
+    std::size_t size( std::size_t shard ) const;
+
+private:
+    ChatRoom( const ChatRoom& );
+    ChatRoom& operator = ( const ChatRoom& );
+
+    void deliverToShard( std::size_t shard, ChatMessage message );
+
+    typedef std::set<ChatParticipantPtr> Participants;
+
+    IoServicePool& m_pool;
+    std::vector<Participants> m_shards;
+};
+
+#endif
@@ -1,19 +1,68 @@
-#include <ctime>
 #include <iostream>
 #include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
 #include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include "chatroom.h"
+#include "iopool.h"
+#include "listener.h"
+#include "options.h"
 
 using boost::asio::ip::tcp;
 using namespace boost::asio;
 
-class TcpConnection : public boost::enable_shared_from_this<TcpConnection>
+namespace
+{
+    // Longest line a client may send, newline included
+    const std::size_t MAX_LINE_LENGTH = 4096;
+
+    // Most queued messages gathered into one write
+    const std::size_t MAX_GATHERED_WRITES = 64;
+
+    // Once a connection has this many messages waiting to go out it stops
+    // reading from its client, and starts again when half of them are gone
+    const std::size_t QUEUE_HIGH_WATERMARK = 64;
+
+    // A client that falls this far behind is too slow to keep, and is
+    // dropped rather than letting its queue grow without bound
+    const std::size_t QUEUE_HARD_LIMIT = 1024;
+
+    const unsigned short DEFAULT_PORT = 4201;
+
+    // How long to wait before accepting again after accept fails, which
+    // usually means the process is out of file descriptors
+    const long ACCEPT_RETRY_MS = 100;
+
+    // Most io_service threads that can be asked for
+    const uint64_t MAX_THREADS = 1024;
+}
+
+/**
+ * A client connected to the chat room. Each line the client sends is
+ * broadcast to the room, and every message broadcast to the room is queued
+ * up to be written back out to the client.
+ *
+ * A connection only ever runs on the thread of the io_service it was
+ * created on, so none of its state needs locking.
+ */
+class TcpConnection : public ChatParticipant,
+                      public boost::enable_shared_from_this<TcpConnection>
 {
 public:
     typedef boost::shared_ptr<TcpConnection> pointer;
 
-    static pointer create( io_service& ioService )
+    static pointer create( io_service& ioService,
+                           ChatRoom& room,
+                           std::size_t shard )
     {
-        return pointer( new TcpConnection( ioService ) );
+        return pointer( new TcpConnection( ioService, room, shard ) );
     }
 
     tcp::socket& socket()
@@ -23,82 +72,330 @@ public:
 
     void start()
     {
-        m_message = "hello there";
+        boost::system::error_code error;
+        m_socket.set_option( tcp::no_delay( true ), error );
 
-        boost::asio::async_write(
+        m_room.join( shared_from_this(), m_shard );
+        startRead();
+    }
+
+    virtual void deliver( const ChatMessage& message )
+    {
+        if ( m_closed )
+        {
+            return;
+        }
+
+        if ( ! m_queue.push( message ) )
+        {
+            close();
+            return;
+        }
+
+        if ( ! m_writing )
+        {
+            startWrite();
+        }
+    }
+
+private:
+    TcpConnection( io_service& ioService, ChatRoom& room, std::size_t shard )
+        : m_socket( ioService ),
+          m_room( room ),
+          m_shard( shard ),
+          m_input( MAX_LINE_LENGTH ),
+          m_queue( QUEUE_HIGH_WATERMARK, QUEUE_HARD_LIMIT ),
+          m_gathered(),
+          m_writeCount( 0 ),
+          m_writing( false ),
+          m_closed( false )
+    {
+    }
+
+    void startRead()
+    {
+        boost::asio::async_read_until(
             m_socket,
-            boost::asio::buffer( m_message ),
-            boost::bind( &TcpConnection::handleWrite,
+            m_input,
+            '\n',
+            boost::bind( &TcpConnection::handleRead,
                          shared_from_this(),
                          boost::asio::placeholders::error,
                          boost::asio::placeholders::bytes_transferred )
         );
     }
 
-private:
-    TcpConnection( boost::asio::io_service& ioService )
-        : m_socket( ioService )
+    void handleRead( const boost::system::error_code& error,
+                     size_t bytesTransferred )
+    {
+        if ( error || m_closed )
+        {
+            // Includes clients that sent a line longer than MAX_LINE_LENGTH
+            close();
+            return;
+        }
+
+        // Copy the line out of the input buffer once, into the message that
+        // is shared by every connection it gets sent to
+        const char * pData = buffer_cast<const char*>( m_input.data() );
+        ChatMessage message( new std::string( pData, bytesTransferred ) );
+
+        m_input.consume( bytesTransferred );
+        m_room.broadcast( message );
+
+        // Otherwise handleWrite() starts reading again once the queue drains
+        if ( ! m_queue.pauseReading() )
+        {
+            startRead();
+        }
+    }
+
+    void startWrite()
+    {
+        m_writeCount = std::min( m_queue.size(), MAX_GATHERED_WRITES );
+        m_gathered.clear();
+
+        for ( std::size_t i = 0; i < m_writeCount; ++i )
+        {
+            m_gathered.push_back( buffer( *m_queue.at( i ) ) );
+        }
+
+        m_writing = true;
+
+        boost::asio::async_write(
+            m_socket,
+            m_gathered,
+            boost::bind( &TcpConnection::handleWrite,
+                         shared_from_this(),
+                         boost::asio::placeholders::error )
+        );
+    }
+
+    void handleWrite( const boost::system::error_code& error )
     {
+        m_writing = false;
+
+        if ( error || m_closed )
+        {
+            close();
+            return;
+        }
+
+        bool resumeReading = m_queue.pop( m_writeCount );
+
+        if ( ! m_queue.empty() )
+        {
+            startWrite();
+        }
+
+        if ( resumeReading )
+        {
+            startRead();
+        }
     }
 
-    void handleWrite( const boost::system::error_code& error,
-                      size_t bytesTransferred )
+    void close()
     {
+        if ( m_closed )
+        {
+            return;
+        }
+
+        m_closed = true;
+        m_room.leave( shared_from_this(), m_shard );
+
+        boost::system::error_code error;
+        m_socket.close( error );
+
+        // Messages in flight stay alive until the write handler runs
+        if ( ! m_writing )
+        {
+            m_queue.clear();
+        }
     }
 
 private:
     tcp::socket m_socket;
-    std::string m_message;
+    ChatRoom& m_room;
+    std::size_t m_shard;
+    boost::asio::streambuf m_input;
+    OutgoingQueue m_queue;
+    std::vector<const_buffer> m_gathered;
+    std::size_t m_writeCount;
+    bool m_writing;
+    bool m_closed;
 };
 
+/**
+ * Accepts clients into the chat room, spreading them across the
+ * io_service pool.
+ *
+ * Where the platform has SO_REUSEPORT every io_service gets a listening
+ * socket of its own bound to the same port, and the kernel shares new
+ * connections out between them. Otherwise a single listener hands its
+ * connections to each io_service in turn.
+ *
+ * When accept fails the listener waits a moment before trying again, so
+ * running out of file descriptors doesn't turn into a busy loop.
+ */
 class ChatServer
 {
 public:
-    ChatServer( io_service& ioService )
-        : m_acceptor( ioService, tcp::endpoint( tcp::v4(), 13 ) )
+    ChatServer( IoServicePool& pool, ChatRoom& room, unsigned short port )
+        : m_pool( pool ),
+          m_room( room ),
+          m_acceptors(),
+          m_retryTimers()
     {
-        startAccept();
+        tcp::endpoint endpoint( tcp::v4(), port );
+        std::size_t listeners = ( canSharePort() ? m_pool.size() : 1 );
+
+        for ( std::size_t i = 0; i < listeners; ++i )
+        {
+            m_acceptors.push_back(
+                openListener( m_pool.at( i ), endpoint, canSharePort() ) );
+            m_retryTimers.push_back( TimerPtr( new deadline_timer( m_pool.at( i ) ) ) );
+            startAccept( i );
+        }
     }
 
 private:
-    void startAccept()
+    void startAccept( std::size_t listener )
     {
-        tcp_connection::pointer connection =
-            tcp_connection::create( m_acceptor.io_service() );
+        std::size_t shard = ( canSharePort() ? listener : m_pool.next() );
+
+        TcpConnection::pointer connection =
+            TcpConnection::create( m_pool.at( shard ), m_room, shard );
 
-        m_acceptor.async_accept( connection->socket,
-            boost::Bind( &ChatServer::handleAccept,
+        m_acceptors[listener]->async_accept( connection->socket(),
+            boost::bind( &ChatServer::handleAccept,
                          this,
+                         listener,
+                         shard,
                          connection,
-                         placeholders::error )
+                         boost::asio::placeholders::error )
         );
     }
 
-    void handleAccept( tcp_connection::pointer newConnection,
+    void handleAccept( std::size_t listener,
+                       std::size_t shard,
+                       TcpConnection::pointer newConnection,
                        const boost::system::error_code& error )
     {
-        if ( error )
+        if ( error == boost::asio::error::operation_aborted )
         {
-            std::cerr << "Had error ,bailing" << std::endl;
+            return;
         }
+        else if ( error )
+        {
+            // Usually out of file descriptors. Accepting again right away
+            // would just fail again, so give connections time to close
+            std::cerr << "Failed to accept connection: "
+                      << error.message() << std::endl;
+
+            m_retryTimers[listener]->expires_from_now(
+                boost::posix_time::milliseconds( ACCEPT_RETRY_MS ) );
+            m_retryTimers[listener]->async_wait(
+                boost::bind( &ChatServer::handleRetry,
+                             this,
+                             listener,
+                             boost::asio::placeholders::error ) );
+            return;
+        }
+        else
+        {
+            // The connection's io_service may be on another thread
+            m_pool.at( shard ).post(
+                boost::bind( &TcpConnection::start, newConnection ) );
+        }
+
+        startAccept( listener );
+    }
 
-        newConnection->start();
-        startAccept();
+    void handleRetry( std::size_t listener, const boost::system::error_code& error )
+    {
+        if ( error != boost::asio::error::operation_aborted )
+        {
+            startAccept( listener );
+        }
     }
+
+private:
+    typedef boost::shared_ptr<deadline_timer> TimerPtr;
+
+    IoServicePool& m_pool;
+    ChatRoom& m_room;
+    std::vector<AcceptorPtr> m_acceptors;
+    std::vector<TimerPtr> m_retryTimers;
 };
 
+void printUsage()
+{
+    std::cerr << "Usage: chatserv [--port N] [--threads N]" << std::endl;
+}
+
 int main( int argc, char* argv[] )
 {
+    unsigned short port = DEFAULT_PORT;
+    std::size_t threads = std::thread::hardware_concurrency();
+    uint64_t value      = 0;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--port" ) == 0 && i + 1 < argc )
+        {
+            if ( ! parseNumber( argv[++i], 1, 65535, value ) )
+            {
+                std::cerr << "Port must be between 1 and 65535: " << argv[i] << std::endl;
+                printUsage();
+                return 1;
+            }
+
+            port = static_cast<unsigned short>( value );
+        }
+        else if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc )
+        {
+            if ( ! parseNumber( argv[++i], 1, MAX_THREADS, value ) )
+            {
+                std::cerr << "Thread count must be between 1 and "
+                          << MAX_THREADS << ": " << argv[i] << std::endl;
+                printUsage();
+                return 1;
+            }
+
+            threads = static_cast<std::size_t>( value );
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // hardware_concurrency() is allowed to return 0 when it can't tell
+    if ( threads == 0 )
+    {
+        threads = 1;
+    }
+
     try
     {
-        io_service io_service;
-        ChatServer server( io_service );
+        IoServicePool pool( threads );
+        ChatRoom room( pool );
+        ChatServer server( pool, room, port );
+
+        signal_set signals( pool.at( 0 ), SIGINT, SIGTERM );
+        signals.async_wait( boost::bind( &IoServicePool::stop, &pool ) );
+
+        std::cout << "chatserv listening on port " << port << " with "
+                  << threads << " threads" << std::endl;
 
-        io_service.run();
+        pool.run();
     }
     catch ( std::exception& ex )
     {
-        std::cerr << e.what() << std::endl;
+        std::cerr << ex.what() << std::endl;
+        return 1;
     }
 
     return 0;
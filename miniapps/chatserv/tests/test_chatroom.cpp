@@ -0,0 +1,208 @@
+#include "chatroom.h"
+#include "iopool.h"
+
+#include <googletest/googletest.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace
+{
+    /**
+     * Participant that remembers everything delivered to it. It is only
+     * touched on its shard's thread, and read once the pool has stopped
+     */
+    class FakeParticipant : public ChatParticipant
+    {
+    public:
+        virtual void deliver( const ChatMessage& message )
+        {
+            messages.push_back( message );
+        }
+
+        std::vector<ChatMessage> messages;
+    };
+
+    /**
+     * Participant that leaves the room as soon as a message arrives, the
+     * way a connection that falls too far behind does
+     */
+    class LeavingParticipant : public FakeParticipant
+    {
+    public:
+        LeavingParticipant( ChatRoom& room, std::size_t shard )
+            : m_room( room ), m_shard( shard )
+        {
+        }
+
+        virtual void deliver( const ChatMessage& message )
+        {
+            FakeParticipant::deliver( message );
+            m_room.leave( self, m_shard );
+            self.reset();
+        }
+
+        ChatParticipantPtr self;
+
+    private:
+        ChatRoom& m_room;
+        std::size_t m_shard;
+    };
+
+    ChatMessage makeMessage( const char * pText )
+    {
+        return ChatMessage( new std::string( pText ) );
+    }
+
+    /**
+     * Runs the pool until everything posted to it so far has been handled.
+     * Each io_service runs its handlers in order, so a handler posted last
+     * to every shard runs once the rest are done
+     */
+    void runPosted( IoServicePool& pool )
+    {
+        std::atomic<std::size_t> shardsLeft( pool.size() );
+
+        for ( std::size_t i = 0; i < pool.size(); ++i )
+        {
+            pool.at( i ).post( [&pool, &shardsLeft]()
+            {
+                if ( --shardsLeft == 0 )
+                {
+                    pool.stop();
+                }
+            } );
+        }
+
+        pool.run();
+    }
+}
+
+TEST(ChatRoom,BroadcastReachesEveryShard)
+{
+    IoServicePool pool( 3 );
+    ChatRoom room( pool );
+    std::vector<boost::shared_ptr<FakeParticipant> > participants;
+
+    for ( std::size_t i = 0; i < 6; ++i )
+    {
+        boost::shared_ptr<FakeParticipant> participant( new FakeParticipant );
+        std::size_t shard = i % pool.size();
+
+        participants.push_back( participant );
+        pool.at( shard ).post( [&room, participant, shard]() { room.join( participant, shard ); } );
+    }
+
+    ChatMessage first = makeMessage( "hello\n" ), second = makeMessage( "again\n" );
+
+    room.broadcast( first );
+    room.broadcast( second );
+    runPosted( pool );
+
+    for ( std::size_t i = 0; i < participants.size(); ++i )
+    {
+        // Everyone shares the one copy of each message, in the order sent
+        ASSERT_EQ( 2u, participants[i]->messages.size() );
+        EXPECT_EQ( first.get(), participants[i]->messages[0].get() );
+        EXPECT_EQ( second.get(), participants[i]->messages[1].get() );
+    }
+
+    for ( std::size_t shard = 0; shard < pool.size(); ++shard )
+    {
+        EXPECT_EQ( 2u, room.size( shard ) );
+    }
+}
+
+TEST(ChatRoom,ParticipantCanLeaveWhileDelivering)
+{
+    IoServicePool pool( 1 );
+    ChatRoom room( pool );
+
+    boost::shared_ptr<LeavingParticipant> leaver( new LeavingParticipant( room, 0 ) );
+    std::vector<boost::shared_ptr<FakeParticipant> > others;
+
+    leaver->self = leaver;
+    others.resize( 4 );
+
+    pool.at( 0 ).post( [&room, leaver, &others]()
+    {
+        room.join( leaver, 0 );
+
+        for ( std::size_t i = 0; i < others.size(); ++i )
+        {
+            others[i].reset( new FakeParticipant );
+            room.join( others[i], 0 );
+        }
+    } );
+
+    room.broadcast( makeMessage( "one\n" ) );
+    room.broadcast( makeMessage( "two\n" ) );
+    runPosted( pool );
+
+    EXPECT_EQ( 1u, leaver->messages.size() );
+    EXPECT_EQ( 4u, room.size( 0 ) );
+
+    for ( std::size_t i = 0; i < others.size(); ++i )
+    {
+        EXPECT_EQ( 2u, others[i]->messages.size() );
+    }
+}
+
+TEST(OutgoingQueue,RefusesMessagesPastTheHardLimit)
+{
+    OutgoingQueue queue( 4, 6 );
+
+    for ( int i = 0; i < 6; ++i )
+    {
+        EXPECT_TRUE( queue.push( makeMessage( "x\n" ) ) );
+    }
+
+    EXPECT_FALSE( queue.push( makeMessage( "x\n" ) ) );
+    EXPECT_EQ( 6u, queue.size() );
+
+    // Writing some out makes room again
+    queue.pop( 1 );
+    EXPECT_TRUE( queue.push( makeMessage( "x\n" ) ) );
+}
+
+TEST(OutgoingQueue,PausesAtHighWatermarkAndResumesAtHalf)
+{
+    OutgoingQueue queue( 4, 100 );
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        queue.push( makeMessage( "x\n" ) );
+    }
+
+    EXPECT_FALSE( queue.pauseReading() );
+
+    queue.push( makeMessage( "x\n" ) );
+    EXPECT_TRUE( queue.pauseReading() );
+
+    // Stays paused until the queue is down to half of the high watermark
+    EXPECT_FALSE( queue.pop( 1 ) );
+    EXPECT_TRUE( queue.pauseReading() );
+    EXPECT_TRUE( queue.pop( 1 ) );
+    EXPECT_FALSE( queue.pauseReading() );
+
+    // Only says to resume once for each pause
+    EXPECT_FALSE( queue.pop( 1 ) );
+}
+
+TEST(OutgoingQueue,PopsInOrder)
+{
+    OutgoingQueue queue( 4, 100 );
+    ChatMessage a = makeMessage( "a\n" ), b = makeMessage( "b\n" );
+
+    queue.push( a );
+    queue.push( b );
+    queue.pop( 1 );
+
+    ASSERT_EQ( 1u, queue.size() );
+    EXPECT_EQ( b.get(), queue.at( 0 ).get() );
+
+    // Popping more than is queued just empties it
+    queue.pop( 5 );
+    EXPECT_TRUE( queue.empty() );
+}
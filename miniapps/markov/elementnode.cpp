@@ -26,39 +26,77 @@
  * those of the authors and should not be interpreted as representing official
  * policies, either expressed or implied, of Scott MacDonald.
  */
-#include <iostream>
-#include <string>
-#include <unordered_map>
-#include <googletest/googletest.h>
 #include <cassert>
 
 #include "elementnode.h"
+#include "symboltable.h"
 
 ElementNode::ElementNode()
-    : value(),
-      weightsum(0),
-      children()
+    : value( SymbolTable::INVALID_SYMBOL ),
+      weightsum( 0 ),
+      childCount( 0 ),
+      childCapacity( 0 ),
+      children( NULL )
 {
 }
 
-ElementNode::ElementNode( const std::string& value )
+ElementNode::ElementNode( Symbol value )
     : value( value ),
       weightsum( 0 ),
-      children()
+      childCount( 0 ),
+      childCapacity( 0 ),
+      children( NULL )
+{
+}
+
+bool ElementNode::hasChildren() const
 {
+    return childCount > 0;
 }
 
-ElementNode::~ElementNode()
+ElementNode* ElementNode::findChild( Symbol value )
 {
-    for ( ENodeChildrenItr itr  = children.begin();
-                           itr != children.end();
-                         ++itr )
+    uint32_t index = lowerBound( value );
+
+    if ( index < childCount && children[index].value == value )
     {
-        delete itr->second;
+        return &children[index];
     }
+
+    return NULL;
 }
 
-bool ElementNode::hasChildren() const
+const ElementNode* ElementNode::findChild( Symbol value ) const
+{
+    uint32_t index = lowerBound( value );
+
+    if ( index < childCount && children[index].value == value )
+    {
+        return &children[index];
+    }
+
+    return NULL;
+}
+
+uint32_t ElementNode::lowerBound( Symbol value ) const
 {
-    return children.size() > 0;
+    uint32_t first = 0;
+    uint32_t count = childCount;
+
+    while ( count > 0 )
+    {
+        uint32_t step = count / 2;
+
+        if ( children[first + step].value < value )
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+        {
+            count = step;
+        }
+    }
+
+    return first;
 }
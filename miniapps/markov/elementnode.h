@@ -29,21 +29,39 @@
 #ifndef MARKOV_ELEMENT_NODE_H
 #define MARKOV_ELEMENT_NODE_H
 
-#include <string>
+#include <stdint.h>
 #include "markov.h"
 
+/**
+ * A single node in the markov model's n-gram tree. The node's value is the
+ * symbol of the word it stands for, and its weightsum counts the number of
+ * chains that passed through it.
+ *
+ * A node's children are stored in one flat array sorted by symbol, so they
+ * can be found with a binary search and walked without chasing a pointer for
+ * every child. Child arrays are allocated from the owning model's NodeArena
+ * and are never freed individually, which means ElementNode is a plain value
+ * that can be copied around freely.
+ */
 struct ElementNode
 {
     ElementNode();
-    ElementNode( const std::string& value );
-
-    ~ElementNode();
+    explicit ElementNode( Symbol value );
 
     bool hasChildren() const;
 
-    std::string value;
-    size_t weightsum;
-    ENodeChildren children;
+    // Get the child holding a symbol, or NULL if there is no such child
+    ElementNode* findChild( Symbol value );
+    const ElementNode* findChild( Symbol value ) const;
+
+    // Get the position where a child holding the symbol is or would be
+    uint32_t lowerBound( Symbol value ) const;
+
+    Symbol        value;
+    uint32_t      weightsum;
+    uint32_t      childCount;
+    uint32_t      childCapacity;
+    ElementNode * children;
 };
 
 #endif
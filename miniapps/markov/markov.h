@@ -31,13 +31,17 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <stdint.h>
 
 struct ElementNode;
 
+/**
+ * Words (or letters) stored in a markov model are interned into a symbol
+ * table, and the model refers to them by their 32 bit symbol id
+ */
+typedef uint32_t Symbol;
+
 typedef std::vector<std::string> MarkovChain;
-typedef std::unordered_map<std::string, ElementNode*> ENodeChildren;
-typedef ENodeChildren::iterator ENodeChildrenItr;
-typedef ENodeChildren::const_iterator ENodeChildrenConstItr;
+typedef std::vector<Symbol> SymbolChain;
 
 #endif
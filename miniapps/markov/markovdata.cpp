@@ -27,25 +27,53 @@
  * policies, either expressed or implied, of Scott MacDonald.
  */
 #include <string>
-#include <unordered_map>
+#include <cstring>
 #include <cassert>
 #include <sstream>
+#include <utility>
 
 #include "logging.h"
 #include "markov.h"
 #include "markovdata.h"
 #include "elementnode.h"
+#include "nodearena.h"
+#include "symboltable.h"
 
 MarkovData::MarkovData( size_t depth )
     : m_depth( depth ),
-      m_root()
+      m_root(),
+      m_arena(),
+      m_symbols(),
+      m_nodeCount( 0 )
 {
     assert( depth > 0 && depth < 10 );
 }
 
+MarkovData::MarkovData( MarkovData&& other )
+    : m_depth( other.m_depth ),
+      m_root( other.m_root ),
+      m_arena( std::move( other.m_arena ) ),
+      m_symbols( std::move( other.m_symbols ) ),
+      m_nodeCount( other.m_nodeCount )
+{
+    // The other model's nodes now belong to our arena
+    other.m_root      = ElementNode();
+    other.m_nodeCount = 0;
+}
+
+size_t MarkovData::depth() const
+{
+    return m_depth;
+}
+
+const ElementNode& MarkovData::root() const
+{
+    return m_root;
+}
+
 int MarkovData::childrenAtRoot() const
 {
-    return m_root.children.size();
+    return m_root.childCount;
 }
 
 int MarkovData::weightSumAtRoot() const
@@ -66,14 +94,32 @@ void MarkovData::insert( const std::vector<std::string>& chain )
         DEBUGLOG << "\t'" << chain[i] << "'" ENDLOG;
     }
 
+    //
+    // Intern the chain's words, and then insert the symbols
+    //
+    Symbol symbols[10];
+
+    for ( size_t i = 0; i < chain.size(); ++i )
+    {
+        symbols[i] = m_symbols.intern( chain[i] );
+    }
+
+    insert( symbols, chain.size() );
+}
+
+void MarkovData::insert( const Symbol * pChain, size_t length )
+{
+    assert( pChain != NULL );
+    assert( length == m_depth+1 );
+
     //
     // Insert the chain into the markov database
     //
     ElementNode * node = &m_root;
 
-    for ( size_t i = 0; i < chain.size(); ++i )
+    for ( size_t i = 0; i < length; ++i )
     {
-        node = insertAt( node, chain[i] );
+        node = insertAt( node, pChain[i] );
     }
 
     node->weightsum += 1;       // tick the leaf
@@ -83,103 +129,164 @@ ElementNode* MarkovData::getNodeFor( const MarkovChain& chain )
 {
     assert( chain.size() <= m_depth +1 );
 
-    // Recursively look up the node
-    return getNodeFor( chain, &m_root, 0 );
+    ElementNode * node = &m_root;
+
+    for ( size_t i = 0; i < chain.size() && node != NULL; ++i )
+    {
+        Symbol value = m_symbols.find( chain[i] );
+
+        if ( value == SymbolTable::INVALID_SYMBOL )
+        {
+            return NULL;
+        }
+
+        node = node->findChild( value );
+    }
+
+    return node;
 }
 
-ElementNode* MarkovData::insertAt( ElementNode* node,
-                                   const std::string& value )
+const SymbolTable& MarkovData::symbols() const
 {
-    assert( node != 0 );
+    return m_symbols;
+}
 
-    //
-    // Test if the element exists as a child of the current node.
-    // If it does, increment summation. Otherwise add the element as
-    // a new child
-    //
-    ENodeChildrenItr pos   = node->children.find( value );
-    ElementNode*     child = NULL;
+SymbolTable& MarkovData::symbols()
+{
+    return m_symbols;
+}
 
-    if ( pos == node->children.end() )
-    {
-        // element did not exist, so create a new element to store it
-        child = new ElementNode( value );
+std::string MarkovData::valueOf( const ElementNode& node ) const
+{
+    return m_symbols.name( node.value );
+}
 
-        // add it
-        node->children.insert( ENodeChildren::value_type(value, child) );
+size_t MarkovData::nodeCount() const
+{
+    return m_nodeCount;
+}
 
-        // update parent summation as well
-        node->weightsum += 1;
+size_t MarkovData::memoryUsage() const
+{
+    return sizeof(MarkovData) + m_arena.memoryUsage() +
+           m_symbols.memoryUsage();
+}
 
-        // debug
-        DEBUGLOG << "Inserting (CREATE) value: '" << value << "'" ENDLOG;
-    }
-    else
-    {
-        child = pos->second;
+ElementNode* MarkovData::insertAt( ElementNode* node, Symbol value )
+{
+    assert( node != 0 );
 
-        // element exists
-        node->weightsum += 1;
-        
-        // debug
-        DEBUGLOG << "Inserting (EXIST) value: '" << value << "'" ENDLOG;
-    }
+    ElementNode * child = childFor( node, value );
+
+    // update parent summation as well
+    node->weightsum += 1;
 
     assert( child != 0 );
     assert( child != node );
     return child;
 }
 
-
-ElementNode* MarkovData::getNodeFor( const MarkovChain& chain,
-                                           ElementNode* node,
-                                           size_t depth )
+/**
+ * Finds the child of a node holding a symbol. If the node has no such child
+ * then a new child with no weight is added
+ */
+ElementNode* MarkovData::childFor( ElementNode* node, Symbol value )
 {
-    ElementNode * result = NULL;
+    assert( node != 0 );
 
-    if ( depth == chain.size() )
-    {
-        // This is the node to return
-        result = node;
-    }
-    else
+    uint32_t pos = node->lowerBound( value );
+
+    if ( pos == node->childCount || node->children[pos].value != value )
     {
-        // We still haven't found the end of the chain. Keep
-        // recursively looking for it (if it exists)
-        const std::string& value = chain[depth];
-        ENodeChildrenItr pos     = node->children.find( value );
-        
-        if ( pos != node->children.end() )
+        // Make room for the new child, doubling the size of the node's
+        // child array when it is full
+        if ( node->childCount == node->childCapacity )
         {
-            result = getNodeFor( chain, pos->second, depth+1 );
+            uint32_t capacity  = ( node->childCapacity == 0 ?
+                                   1 : node->childCapacity * 2 );
+            ElementNode * children = m_arena.allocate( capacity );
+
+            if ( node->childCount > 0 )
+            {
+                memcpy( children,
+                        node->children,
+                        node->childCount * sizeof(ElementNode) );
+            }
+
+            m_arena.release( node->children, node->childCapacity );
+
+            node->children      = children;
+            node->childCapacity = capacity;
         }
+
+        // Shift the larger children over to keep the array sorted
+        memmove( node->children + pos + 1,
+                 node->children + pos,
+                 ( node->childCount - pos ) * sizeof(ElementNode) );
+
+        node->children[pos] = ElementNode( value );
+        node->childCount   += 1;
+        m_nodeCount        += 1;
     }
 
-    return result;
+    return &node->children[pos];
 }
 
-void debugDumpHelper( const ElementNode& e,
-                      size_t indent,
-                      std::ostringstream& str )
+/**
+ * Merges another model into this one. The other model's words are interned
+ * into this model's symbol table, and then the other tree is walked adding
+ * its weights to the matching nodes here. Merging models trained on
+ * separate parts of a text gives the same model as training on the whole
+ * text at once.
+ */
+void MarkovData::merge( const MarkovData& other )
 {
-    ENodeChildrenConstItr itr = e.children.begin();
+    assert( other.m_depth == m_depth );
+
+    std::vector<Symbol> symbolMap( other.m_symbols.size() );
+
+    for ( size_t i = 0; i < symbolMap.size(); ++i )
+    {
+        symbolMap[i] = m_symbols.intern( other.m_symbols.name( i ) );
+    }
+
+    mergeAt( &m_root, other.m_root, symbolMap );
+}
 
+void MarkovData::mergeAt( ElementNode* node,
+                          const ElementNode& other,
+                          const std::vector<Symbol>& symbolMap )
+{
+    node->weightsum += other.weightsum;
+
+    for ( uint32_t i = 0; i < other.childCount; ++i )
+    {
+        const ElementNode& otherChild = other.children[i];
+        ElementNode * child = childFor( node, symbolMap[otherChild.value] );
+
+        mergeAt( child, otherChild, symbolMap );
+    }
+}
+
+void MarkovData::debugDump( const ElementNode& e,
+                            size_t indent,
+                            std::ostream& str ) const
+{
     // Print the node
     for ( size_t i = 0; i < indent; ++i ) { str << "\t"; }
-    str << "- " << e.weightsum << ", " << e.children.size();
-    str << ": " << e.value     << std::endl;
+    str << "- " << e.weightsum << ", " << e.childCount;
+    str << ": " << valueOf( e ) << std::endl;
 
     // Print all of the children
-    for ( ; itr != e.children.end(); ++itr )
+    for ( uint32_t i = 0; i < e.childCount; ++i )
     {
-        debugDumpHelper( *itr->second, indent+1, str );
+        debugDump( e.children[i], indent+1, str );
     }
 }
 
 std::string MarkovData::debugDumpToString() const
 {
     std::ostringstream ss;
-    debugDumpHelper( m_root, 0, ss );
+    debugDump( m_root, 0, ss );
     return ss.str();
 }
-
@@ -31,16 +31,30 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <cassert>
 
 #include "markov.h"
 #include "elementnode.h"
+#include "nodearena.h"
+#include "symboltable.h"
 
+/**
+ * Stores the n-gram tree of a markov model. Each chain inserted into the
+ * model is interned into the model's symbol table, and then walked down the
+ * tree from the root one symbol at a time.
+ *
+ * Nodes are stored inline in their parent's sorted child array, so a node
+ * pointer returned by getNodeFor is only valid until the next insert.
+ */
 class MarkovData
 {
 public:
     MarkovData( size_t depth );
+    MarkovData( MarkovData&& other );
+
+    size_t depth() const;
+
+    const ElementNode& root() const;
 
     int childrenAtRoot() const;
 
@@ -48,21 +62,52 @@ public:
 
     void insert( const std::vector<std::string>& chain );
 
+    void insert( const Symbol * pChain, size_t length );
+
+    // Add every chain from another model of the same depth into this one
+    void merge( const MarkovData& other );
+
     ElementNode* getNodeFor( const MarkovChain& chain );
 
+    const SymbolTable& symbols() const;
+
+    SymbolTable& symbols();
+
+    // Get the word that a node stands for
+    std::string valueOf( const ElementNode& node ) const;
+
+    // Number of nodes in the tree, not counting the root
+    size_t nodeCount() const;
+
+    // Number of bytes used by the tree and its symbol table
+    size_t memoryUsage() const;
+
     std::string debugDumpToString() const;
 
 protected:
-    ElementNode* insertAt( ElementNode* node, const std::string& value );
+    ElementNode* insertAt( ElementNode* node, Symbol value );
 
-    ElementNode* getNodeFor( const MarkovChain& chain,
-                             ElementNode* node,
-                             size_t depth );
+    ElementNode* childFor( ElementNode* node, Symbol value );
+
+    void mergeAt( ElementNode* node,
+                  const ElementNode& other,
+                  const std::vector<Symbol>& symbolMap );
+
+    void debugDump( const ElementNode& node,
+                    size_t indent,
+                    std::ostream& str ) const;
+
+private:
+    MarkovData( const MarkovData& );
+    MarkovData& operator = ( const MarkovData& );
 
 private:
 
     size_t      m_depth;
     ElementNode m_root;
+    NodeArena   m_arena;
+    SymbolTable m_symbols;
+    size_t      m_nodeCount;
 };
 
 #endif
@@ -27,42 +27,301 @@
  * policies, either expressed or implied, of Scott MacDonald.
  */
 #include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
 #include <cassert>
-#include <iostream>
+#include <cctype>
+
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include "logging.h"
 #include "markov.h"
 #include "markovdata.h"
 #include "elementnode.h"
+#include "symboltable.h"
 #include "markovfactory.h"
 
-MarkovData MarkovFactory::createFromLetters( 
+namespace
+{
+    bool isSpace( char c )
+    {
+        return isspace( static_cast<unsigned char>( c ) ) != 0;
+    }
+}
+
+const size_t MarkovFactory::MIN_SHARD_SIZE;
+
+MarkovData MarkovFactory::createFromWords(
+        size_t depth,
+        const std::string& input,
+        size_t numThreads )
+{
+    return train( TOKEN_WORDS, depth, input.data(), input.size(), numThreads );
+}
+
+MarkovData MarkovFactory::createFromWords(
+        size_t depth,
+        const char * pText,
+        size_t length,
+        size_t numThreads )
+{
+    return train( TOKEN_WORDS, depth, pText, length, numThreads );
+}
+
+MarkovData MarkovFactory::createFromWordsFile(
+        size_t depth,
+        const std::string& filename,
+        size_t numThreads )
+{
+    return trainFile( TOKEN_WORDS, depth, filename, numThreads );
+}
+
+MarkovData MarkovFactory::createFromLetters(
+        size_t depth,
+        const std::string& input,
+        size_t numThreads )
+{
+    return train( TOKEN_LETTERS, depth, input.data(), input.size(), numThreads );
+}
+
+MarkovData MarkovFactory::createFromLetters(
+        size_t depth,
+        const char * pText,
+        size_t length,
+        size_t numThreads )
+{
+    return train( TOKEN_LETTERS, depth, pText, length, numThreads );
+}
+
+MarkovData MarkovFactory::createFromLettersFile(
         size_t depth,
-        const std::string& input )
+        const std::string& filename,
+        size_t numThreads )
+{
+    return trainFile( TOKEN_LETTERS, depth, filename, numThreads );
+}
+
+/**
+ * Maps a text file into memory and trains a model from it, without ever
+ * copying the file's contents
+ */
+MarkovData MarkovFactory::trainFile( TokenMode mode,
+                                     size_t depth,
+                                     const std::string& filename,
+                                     size_t numThreads )
+{
+    boost::iostreams::mapped_file_source file;
+
+    try
+    {
+        file.open( filename );
+    }
+    catch ( const std::exception& e )
+    {
+        ERRORLOG << "Could not map training file " << filename
+                 << ": " << e.what() ENDLOG;
+        return MarkovData( depth-1 );
+    }
+
+    return train( mode, depth, file.data(), file.size(), numThreads );
+}
+
+MarkovData MarkovFactory::train( TokenMode mode,
+                                 size_t depth,
+                                 const char * pText,
+                                 size_t length,
+                                 size_t numThreads )
+{
+    assert( depth > 1 );
+    assert( pText != NULL || length == 0 );
+
+    if ( numThreads == 0 )
+    {
+        numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+
+    // Don't bother splitting small texts into lots of tiny shards
+    size_t numShards = std::min( numThreads, length / MIN_SHARD_SIZE + 1 );
+
+    //
+    // Find where each shard starts. Word shards are moved forward so they
+    // start at the beginning of a word, which means no word is ever split
+    // across two shards
+    //
+    std::vector<size_t> shardStarts( numShards + 1, length );
+
+    for ( size_t i = 0; i < numShards; ++i )
+    {
+        size_t start = ( length / numShards ) * i;
+
+        if ( mode == TOKEN_WORDS )
+        {
+            while ( start > 0 && start < length && !isSpace( pText[start-1] ) )
+            {
+                ++start;
+            }
+        }
+
+        shardStarts[i] = std::max( start, i > 0 ? shardStarts[i-1] : 0 );
+    }
+
+    //
+    // Train a model on each shard
+    //
+    std::vector< std::unique_ptr<MarkovData> > shards;
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < numShards; ++i )
+    {
+        shards.push_back( std::unique_ptr<MarkovData>(
+                    new MarkovData( depth-1 ) ) );
+    }
+
+    for ( size_t i = 1; i < numShards; ++i )
+    {
+        threads.push_back( std::thread( &MarkovFactory::trainShard,
+                                        shards[i].get(),
+                                        mode,
+                                        pText,
+                                        length,
+                                        shardStarts[i],
+                                        shardStarts[i+1] ) );
+    }
+
+    trainShard( shards[0].get(), mode, pText, length,
+                shardStarts[0], shardStarts[1] );
+
+    for ( size_t i = 0; i < threads.size(); ++i )
+    {
+        threads[i].join();
+    }
+
+    //
+    // Merge the shard models together in pairs, with every pair in a round
+    // merged on its own thread
+    //
+    for ( size_t step = 1; step < numShards; step *= 2 )
+    {
+        threads.clear();
+
+        for ( size_t i = 0; i + step < numShards; i += step * 2 )
+        {
+            threads.push_back( std::thread( &MarkovFactory::mergeShards,
+                                            shards[i].get(),
+                                            shards[i+step].get() ) );
+        }
+
+        for ( size_t i = 0; i < threads.size(); ++i )
+        {
+            threads[i].join();
+        }
+
+        for ( size_t i = 0; i + step < numShards; i += step * 2 )
+        {
+            shards[i+step].reset();
+        }
+    }
+
+    return std::move( *shards[0] );
+}
+
+/**
+ * Trains a model on one shard of the text. Every chain whose first token
+ * starts inside the shard is added to the model, even when the rest of the
+ * chain runs past the end of the shard
+ */
+void MarkovFactory::trainShard( MarkovData * pData,
+                                TokenMode mode,
+                                const char * pText,
+                                size_t length,
+                                size_t shardStart,
+                                size_t shardEnd )
 {
-    MarkovData  data( depth-1 );        // bug :(
-    MarkovChain currentChain;
+    const size_t chainLength = pData->depth() + 1;
+    SymbolTable& symbols     = pData->symbols();
 
-    // pre-size our chain
-    currentChain.resize( depth );
+    Symbol window[10];
+    size_t windowStarts[10];
+    size_t windowSize = 0;
 
-    // walk through the string, and create as many chain-pairs as possible
-    for ( size_t i = 0; i <= (input.size()-depth); ++i )
+    // Letters are looked up by their character code instead of hashing
+    Symbol letterSymbols[256];
+    std::fill( letterSymbols, letterSymbols + 256, SymbolTable::INVALID_SYMBOL );
+
+    size_t pos = shardStart;
+
+    while ( pos < length )
     {
-        std::cout << "START: ";
+        //
+        // Read the next token
+        //
+        size_t tokenStart = pos;
+        Symbol symbol     = SymbolTable::INVALID_SYMBOL;
 
-        // create a chain
-        for ( size_t c = 0; c < depth; ++c )
+        if ( mode == TOKEN_LETTERS )
         {
-            currentChain[c] = input[i + c];
-            std::cout << currentChain[c] << " ";
+            unsigned char c = static_cast<unsigned char>( pText[pos] );
+
+            if ( letterSymbols[c] == SymbolTable::INVALID_SYMBOL )
+            {
+                letterSymbols[c] = symbols.intern( pText + pos, 1 );
+            }
+
+            symbol = letterSymbols[c];
+            pos   += 1;
         }
+        else
+        {
+            while ( tokenStart < length && isSpace( pText[tokenStart] ) )
+            {
+                ++tokenStart;
+            }
+
+            if ( tokenStart == length )
+            {
+                break;
+            }
 
-        std::cout << std::endl;
+            pos = tokenStart;
 
-        // add it
-        data.insert( currentChain );
+            while ( pos < length && !isSpace( pText[pos] ) )
+            {
+                ++pos;
+            }
+
+            symbol = symbols.intern( pText + tokenStart, pos - tokenStart );
+        }
+
+        //
+        // Slide the token into the window, and add the window to the model
+        // once it is full
+        //
+        if ( windowSize == chainLength )
+        {
+            std::copy( window + 1, window + chainLength, window );
+            std::copy( windowStarts + 1, windowStarts + chainLength, windowStarts );
+            windowSize -= 1;
+        }
+
+        window[windowSize]       = symbol;
+        windowStarts[windowSize] = tokenStart;
+        windowSize              += 1;
+
+        if ( windowSize == chainLength )
+        {
+            if ( windowStarts[0] >= shardEnd )
+            {
+                break;
+            }
+
+            pData->insert( window, chainLength );
+        }
     }
+}
 
-    return data;
+void MarkovFactory::mergeShards( MarkovData * pData, MarkovData * pOther )
+{
+    pData->merge( *pOther );
 }
@@ -33,18 +33,81 @@
 #include "markov.h"
 #include "elementnode.h"
 
+class MarkovData;
+
+/**
+ * Trains markov models from text. Training is spread over several threads
+ * by splitting the text into shards, training a separate model on each
+ * shard and then merging the shard models together. A chain that starts in
+ * one shard is allowed to read past the end of that shard, so the chains
+ * spanning shard boundaries are counted exactly once.
+ *
+ * Passing zero as the number of threads uses one thread per core.
+ */
 class MarkovFactory
 {
 public:
     static MarkovData createFromWords(
             size_t depth,
-            const std::string& input );
+            const std::string& input,
+            size_t numThreads = 0 );
+
+    static MarkovData createFromWords(
+            size_t depth,
+            const char * pText,
+            size_t length,
+            size_t numThreads = 0 );
+
+    static MarkovData createFromWordsFile(
+            size_t depth,
+            const std::string& filename,
+            size_t numThreads = 0 );
 
     static MarkovData createFromLetters(
             size_t depth,
-            const std::string& input );
+            const std::string& input,
+            size_t numThreads = 0 );
+
+    static MarkovData createFromLetters(
+            size_t depth,
+            const char * pText,
+            size_t length,
+            size_t numThreads = 0 );
+
+    static MarkovData createFromLettersFile(
+            size_t depth,
+            const std::string& filename,
+            size_t numThreads = 0 );
+
+    // Smallest amount of text given to a training thread
+    static const size_t MIN_SHARD_SIZE = 64 * 1024;
 
 private:
+    enum TokenMode
+    {
+        TOKEN_WORDS,
+        TOKEN_LETTERS
+    };
+
+    static MarkovData train( TokenMode mode,
+                             size_t depth,
+                             const char * pText,
+                             size_t length,
+                             size_t numThreads );
+
+    static MarkovData trainFile( TokenMode mode,
+                                 size_t depth,
+                                 const std::string& filename,
+                                 size_t numThreads );
+
+    static void trainShard( MarkovData * pData,
+                            TokenMode mode,
+                            const char * pText,
+                            size_t length,
+                            size_t shardStart,
+                            size_t shardEnd );
+
+    static void mergeShards( MarkovData * pData, MarkovData * pOther );
 };
 
 #endif
@@ -0,0 +1,667 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cassert>
+
+#include "logging.h"
+#include "markov.h"
+#include "markovmodel.h"
+#include "markovdata.h"
+#include "elementnode.h"
+
+namespace
+{
+    uint64_t splitmix64( uint64_t& state )
+    {
+        uint64_t z = ( state += 0x9E3779B97F4A7C15ull );
+        z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+        z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+        return z ^ ( z >> 31 );
+    }
+
+    uint64_t rotateLeft( uint64_t x, int k )
+    {
+        return ( x << k ) | ( x >> ( 64 - k ) );
+    }
+
+    const char     MODEL_MAGIC[8]  = { 'M', 'A', 'R', 'K', 'O', 'V', 'D', 'B' };
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    size_t alignSection( size_t offset )
+    {
+        return ( offset + 7 ) & ~static_cast<size_t>( 7 );
+    }
+
+    bool sectionFits( uint64_t offset, uint64_t size, uint64_t imageSize )
+    {
+        return offset % 4 == 0 && offset <= imageSize &&
+               size <= imageSize - offset;
+    }
+
+    template<typename T>
+    void copySection( char * pDest, const std::vector<T>& source )
+    {
+        if (! source.empty() )
+        {
+            memcpy( pDest, &source[0], source.size() * sizeof(T) );
+        }
+    }
+}
+
+MarkovRandom::MarkovRandom( uint64_t seed, uint64_t stream )
+{
+    // Mix the stream number into the seed before expanding it, so that
+    // neighboring streams start from unrelated states
+    uint64_t mix = seed;
+    mix ^= splitmix64( stream );
+
+    for ( size_t i = 0; i < 4; ++i )
+    {
+        m_state[i] = splitmix64( mix );
+    }
+}
+
+uint32_t MarkovRandom::next()
+{
+    uint64_t result = rotateLeft( m_state[1] * 5, 7 ) * 9;
+    uint64_t t      = m_state[1] << 17;
+
+    m_state[2] ^= m_state[0];
+    m_state[3] ^= m_state[1];
+    m_state[1] ^= m_state[2];
+    m_state[0] ^= m_state[3];
+    m_state[2] ^= t;
+    m_state[3]  = rotateLeft( m_state[3], 45 );
+
+    return static_cast<uint32_t>( result >> 32 );
+}
+
+uint32_t MarkovRandom::nextBelow( uint32_t bound )
+{
+    // Scale a 32 bit random value into the range instead of using modulo,
+    // which avoids a division per sample
+    return static_cast<uint32_t>(
+            ( static_cast<uint64_t>( next() ) * bound ) >> 32 );
+}
+
+const uint32_t MarkovModel::FILE_VERSION;
+
+/**
+ * Creates an empty model
+ */
+MarkovModel::MarkovModel()
+    : m_image(),
+      m_file(),
+      m_pHeader( NULL ),
+      m_pNodes( NULL ),
+      m_pCumulativeWeights( NULL ),
+      m_pSymbolOffsets( NULL ),
+      m_pSymbolHashes( NULL ),
+      m_pSlots( NULL ),
+      m_pText( NULL )
+{
+    build( MarkovData( 1 ) );
+}
+
+/**
+ * Creates a model from a trained markov tree
+ */
+MarkovModel::MarkovModel( const MarkovData& data )
+    : m_image(),
+      m_file(),
+      m_pHeader( NULL ),
+      m_pNodes( NULL ),
+      m_pCumulativeWeights( NULL ),
+      m_pSymbolOffsets( NULL ),
+      m_pSymbolHashes( NULL ),
+      m_pSlots( NULL ),
+      m_pText( NULL )
+{
+    build( data );
+}
+
+/**
+ * Writes the model to a file. The file is a copy of the model's memory, so
+ * it can be loaded again by mapping it
+ */
+bool MarkovModel::save( const std::string& filename ) const
+{
+    std::ofstream output( filename.c_str(), std::ios::binary );
+    size_t imageSize = m_pHeader->textOffset + m_pHeader->textSize;
+
+    output.write( reinterpret_cast<const char*>( m_pHeader ), imageSize );
+    output.close();
+
+    if ( output.fail() )
+    {
+        ERRORLOG << "Could not write markov model to " << filename ENDLOG;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps a saved model file into memory and samples from it in place. The
+ * current model is left untouched if the file cannot be loaded
+ */
+bool MarkovModel::load( const std::string& filename )
+{
+    boost::iostreams::mapped_file_source file;
+
+    try
+    {
+        file.open( filename );
+    }
+    catch ( const std::exception& e )
+    {
+        ERRORLOG << "Could not map markov model " << filename
+                 << ": " << e.what() ENDLOG;
+        return false;
+    }
+
+    if (! attach( file.data(), file.size() ) )
+    {
+        ERRORLOG << "Markov model file is corrupt or unsupported: "
+                 << filename ENDLOG;
+        return false;
+    }
+
+    // The model now points into the mapped file, so the in memory copy is
+    // no longer needed
+    m_file = file;
+    std::vector<uint64_t>().swap( m_image );
+
+    return true;
+}
+
+bool MarkovModel::isMapped() const
+{
+    return m_file.is_open();
+}
+
+size_t MarkovModel::depth() const
+{
+    return m_pHeader->depth;
+}
+
+size_t MarkovModel::nodeCount() const
+{
+    return m_pHeader->nodeCount;
+}
+
+size_t MarkovModel::symbolCount() const
+{
+    return m_pHeader->symbolCount;
+}
+
+Symbol MarkovModel::findSymbol( const std::string& word ) const
+{
+    uint32_t hash = SymbolTable::hashOf( word.data(), word.size() );
+    size_t   mask = m_pHeader->slotCount - 1;
+    size_t   slot = hash & mask;
+
+    // Linear probe the symbol hash table, which was written out as is from
+    // the symbol table the model was built from
+    while ( m_pSlots[slot] != SymbolTable::INVALID_SYMBOL )
+    {
+        Symbol symbol = m_pSlots[slot];
+        size_t start  = m_pSymbolOffsets[symbol];
+        size_t length = m_pSymbolOffsets[symbol + 1] - start;
+
+        if ( m_pSymbolHashes[symbol] == hash &&
+             length == word.size() &&
+             memcmp( m_pText + start, word.data(), length ) == 0 )
+        {
+            return symbol;
+        }
+
+        slot = ( slot + 1 ) & mask;
+    }
+
+    return SymbolTable::INVALID_SYMBOL;
+}
+
+std::string MarkovModel::symbolName( Symbol symbol ) const
+{
+    if ( symbol >= m_pHeader->symbolCount )
+    {
+        return std::string();
+    }
+
+    return std::string( m_pText + m_pSymbolOffsets[symbol],
+                        m_pText + m_pSymbolOffsets[symbol + 1] );
+}
+
+const MarkovModel::Node& MarkovModel::root() const
+{
+    return m_pNodes[0];
+}
+
+/**
+ * Lays out a trained markov tree and its symbol table in memory, in the
+ * same format that is used for model files
+ */
+void MarkovModel::build( const MarkovData& data )
+{
+    const SymbolTable& symbols = data.symbols();
+
+    MarkovModelHeader header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, MODEL_MAGIC, sizeof(header.magic) );
+
+    header.version     = FILE_VERSION;
+    header.byteOrder   = BYTE_ORDER_MARK;
+    header.depth       = static_cast<uint32_t>( data.depth() );
+    header.nodeCount   = static_cast<uint32_t>( data.nodeCount() + 1 );
+    header.symbolCount = static_cast<uint32_t>( symbols.size() );
+    header.slotCount   = static_cast<uint32_t>( symbols.slots().size() );
+    header.textSize    = static_cast<uint32_t>( symbols.text().size() );
+
+    //
+    // Work out where each section goes. Every section starts on an eight
+    // byte boundary
+    //
+    size_t offset = alignSection( sizeof(header) );
+
+    header.nodesOffset = offset;
+    offset = alignSection( offset + header.nodeCount * sizeof(Node) );
+
+    header.weightsOffset = offset;
+    offset = alignSection( offset + header.nodeCount * sizeof(uint32_t) );
+
+    header.symbolOffsetsOffset = offset;
+    offset = alignSection( offset + ( header.symbolCount + 1 ) * sizeof(uint32_t) );
+
+    header.symbolHashesOffset = offset;
+    offset = alignSection( offset + header.symbolCount * sizeof(uint32_t) );
+
+    header.slotsOffset = offset;
+    offset = alignSection( offset + header.slotCount * sizeof(Symbol) );
+
+    header.textOffset = offset;
+    offset = alignSection( offset + header.textSize );
+
+    //
+    // Copy the header and symbol table into the image
+    //
+    std::vector<uint64_t> image( offset / sizeof(uint64_t), 0 );
+    char * pImage = reinterpret_cast<char*>( &image[0] );
+
+    memcpy( pImage, &header, sizeof(header) );
+
+    copySection( pImage + header.symbolOffsetsOffset, symbols.offsets() );
+    copySection( pImage + header.symbolHashesOffset, symbols.hashes() );
+    copySection( pImage + header.slotsOffset, symbols.slots() );
+    copySection( pImage + header.textOffset, symbols.text() );
+
+    //
+    // Lay the tree out breadth first. The source nodes are queued in the
+    // same order as they are written to the flattened array, so the node
+    // at a queue position is also the node at that array index
+    //
+    Node *     pNodes   = reinterpret_cast<Node*>( pImage + header.nodesOffset );
+    uint32_t * pWeights = reinterpret_cast<uint32_t*>( pImage + header.weightsOffset );
+
+    std::vector<const ElementNode*> queue;
+    queue.reserve( header.nodeCount );
+
+    const ElementNode& root = data.root();
+    Node rootNode = { root.value, root.weightsum, 0, 0 };
+
+    queue.push_back( &root );
+    pNodes[0]   = rootNode;
+    pWeights[0] = root.weightsum;
+
+    for ( size_t i = 0; i < queue.size(); ++i )
+    {
+        const ElementNode * pSource = queue[i];
+        uint32_t cumulative = 0;
+
+        pNodes[i].firstChild = static_cast<uint32_t>( queue.size() );
+        pNodes[i].childCount = pSource->childCount;
+
+        for ( uint32_t c = 0; c < pSource->childCount; ++c )
+        {
+            const ElementNode& child = pSource->children[c];
+            Node node = { child.value, child.weightsum, 0, 0 };
+
+            cumulative += child.weightsum;
+
+            pNodes[queue.size()]   = node;
+            pWeights[queue.size()] = cumulative;
+            queue.push_back( &child );
+        }
+    }
+
+    assert( queue.size() == header.nodeCount );
+
+    bool attached = attach( pImage, offset );
+    assert( attached );
+    (void) attached;
+
+    m_file.close();
+    m_image.swap( image );
+}
+
+/**
+ * Checks that a model image is well formed, and then points the model at
+ * its sections. The model is not changed if the image is bad
+ */
+bool MarkovModel::attach( const char * pImage, size_t imageSize )
+{
+    if ( pImage == NULL || imageSize < sizeof(MarkovModelHeader) )
+    {
+        return false;
+    }
+
+    const MarkovModelHeader * pHeader =
+        reinterpret_cast<const MarkovModelHeader*>( pImage );
+
+    if ( memcmp( pHeader->magic, MODEL_MAGIC, sizeof(pHeader->magic) ) != 0 ||
+         pHeader->version   != FILE_VERSION ||
+         pHeader->byteOrder != BYTE_ORDER_MARK )
+    {
+        return false;
+    }
+
+    // Make sure every section fits inside of the image
+    uint64_t nodeCount   = pHeader->nodeCount;
+    uint64_t symbolCount = pHeader->symbolCount;
+    uint64_t slotCount   = pHeader->slotCount;
+
+    if (! ( sectionFits( pHeader->nodesOffset, nodeCount * sizeof(Node), imageSize ) &&
+            sectionFits( pHeader->weightsOffset, nodeCount * 4, imageSize ) &&
+            sectionFits( pHeader->symbolOffsetsOffset, ( symbolCount + 1 ) * 4, imageSize ) &&
+            sectionFits( pHeader->symbolHashesOffset, symbolCount * 4, imageSize ) &&
+            sectionFits( pHeader->slotsOffset, slotCount * 4, imageSize ) &&
+            sectionFits( pHeader->textOffset, pHeader->textSize, imageSize ) ) )
+    {
+        return false;
+    }
+
+    // The symbol hash table must have a free slot and be a power of two in
+    // size, or lookups would never terminate
+    if ( nodeCount == 0 || slotCount <= symbolCount ||
+         ( slotCount & ( slotCount - 1 ) ) != 0 )
+    {
+        return false;
+    }
+
+    const Node * pNodes = reinterpret_cast<const Node*>(
+            pImage + pHeader->nodesOffset );
+    const uint32_t * pWeights = reinterpret_cast<const uint32_t*>(
+            pImage + pHeader->weightsOffset );
+    const uint32_t * pSymbolOffsets = reinterpret_cast<const uint32_t*>(
+            pImage + pHeader->symbolOffsetsOffset );
+    const Symbol * pSlots = reinterpret_cast<const Symbol*>(
+            pImage + pHeader->slotsOffset );
+
+    // Every node's children must come after it in the node array, and every
+    // child must be a known symbol. Each run of cumulative weights has to
+    // climb to a non zero total, otherwise sampling a child would run off
+    // the end of the run
+    for ( uint64_t i = 0; i < nodeCount; ++i )
+    {
+        const Node& node = pNodes[i];
+
+        if ( ( i > 0 && node.value >= symbolCount ) ||
+             static_cast<uint64_t>( node.firstChild ) + node.childCount > nodeCount )
+        {
+            return false;
+        }
+
+        if ( node.childCount == 0 )
+        {
+            continue;
+        }
+
+        if ( node.firstChild <= i )
+        {
+            return false;
+        }
+
+        const uint32_t * pFirst = pWeights + node.firstChild;
+        const uint32_t * pLast  = pFirst + node.childCount;
+
+        if ( *( pLast - 1 ) == 0 ||
+             std::adjacent_find( pFirst, pLast, std::greater<uint32_t>() ) != pLast )
+        {
+            return false;
+        }
+    }
+
+    // Symbol text offsets must never go backwards, and the hash table can
+    // only hold empty slots or known symbols
+    if ( pSymbolOffsets[symbolCount] != pHeader->textSize ||
+         std::adjacent_find( pSymbolOffsets,
+                             pSymbolOffsets + symbolCount + 1,
+                             std::greater<uint32_t>() ) != pSymbolOffsets + symbolCount + 1 )
+    {
+        return false;
+    }
+
+    for ( uint64_t i = 0; i < slotCount; ++i )
+    {
+        if ( pSlots[i] != SymbolTable::INVALID_SYMBOL && pSlots[i] >= symbolCount )
+        {
+            return false;
+        }
+    }
+
+    m_pHeader            = pHeader;
+    m_pNodes             = pNodes;
+    m_pCumulativeWeights = pWeights;
+    m_pSymbolOffsets     = pSymbolOffsets;
+    m_pSymbolHashes      = reinterpret_cast<const uint32_t*>(
+            pImage + pHeader->symbolHashesOffset );
+    m_pSlots             = pSlots;
+    m_pText              = pImage + pHeader->textOffset;
+
+    return true;
+}
+
+const MarkovModel::Node* MarkovModel::findNode( const Symbol * pChain,
+                                                size_t length ) const
+{
+    const Node * pNode = m_pNodes;
+
+    for ( size_t i = 0; i < length; ++i )
+    {
+        const Node * pFirst = m_pNodes + pNode->firstChild;
+        const Node * pLast  = pFirst + pNode->childCount;
+        Symbol value        = pChain[i];
+
+        // Binary search the children for the next symbol in the chain
+        while ( pFirst < pLast )
+        {
+            const Node * pMiddle = pFirst + ( pLast - pFirst ) / 2;
+
+            if ( pMiddle->value < value )
+            {
+                pFirst = pMiddle + 1;
+            }
+            else
+            {
+                pLast = pMiddle;
+            }
+        }
+
+        if ( pFirst == m_pNodes + pNode->firstChild + pNode->childCount ||
+             pFirst->value != value )
+        {
+            return NULL;
+        }
+
+        pNode = pFirst;
+    }
+
+    return pNode;
+}
+
+const MarkovModel::Node& MarkovModel::sampleChild( const Node& node,
+                                                   MarkovRandom& random ) const
+{
+    assert( node.childCount > 0 );
+
+    const uint32_t * pFirst = m_pCumulativeWeights + node.firstChild;
+    const uint32_t * pLast  = pFirst + node.childCount;
+
+    // Pick a point in the node's total weight, and find the first child
+    // whose cumulative weight passes it
+    uint32_t target = random.nextBelow( *( pLast - 1 ) );
+    const uint32_t * pChosen = std::upper_bound( pFirst, pLast, target );
+
+    assert( pChosen != pLast );
+    return m_pNodes[ pChosen - m_pCumulativeWeights ];
+}
+
+/**
+ * Generates a sequence of symbols. Each symbol is chosen using the longest
+ * run of previous symbols the model knows about, up to the model's depth.
+ * When the model has never seen the previous symbols it backs off to
+ * shorter runs, and eventually starts over from the root.
+ */
+SymbolChain MarkovModel::generateSymbols( size_t length,
+                                          MarkovRandom& random ) const
+{
+    SymbolChain chain;
+    chain.reserve( length );
+
+    if ( m_pNodes[0].childCount == 0 )
+    {
+        return chain;
+    }
+
+    while ( chain.size() < length )
+    {
+        size_t context     = std::min<size_t>( chain.size(), m_pHeader->depth );
+        const Node * pNode = NULL;
+
+        for ( ; pNode == NULL; --context )
+        {
+            pNode = findNode( chain.data() + chain.size() - context, context );
+
+            if ( pNode != NULL && pNode->childCount == 0 )
+            {
+                pNode = NULL;
+            }
+
+            if ( context == 0 )
+            {
+                break;
+            }
+        }
+
+        assert( pNode != NULL );
+        chain.push_back( sampleChild( *pNode, random ).value );
+    }
+
+    return chain;
+}
+
+MarkovChain MarkovModel::generate( size_t length, MarkovRandom& random ) const
+{
+    SymbolChain symbols = generateSymbols( length, random );
+    MarkovChain chain( symbols.size() );
+
+    for ( size_t i = 0; i < symbols.size(); ++i )
+    {
+        chain[i] = symbolName( symbols[i] );
+    }
+
+    return chain;
+}
+
+/**
+ * Generates a batch of sequences, spread across several threads. Every
+ * sequence is generated from its own random stream, so the results for a
+ * seed are the same no matter how many threads are used.
+ *
+ * \param  numSequences  Number of sequences to generate
+ * \param  length        Length of each sequence
+ * \param  seed          Seed for the random streams
+ * \param  numThreads    Number of threads to use, or zero to use one per core
+ * \return               The generated sequences
+ */
+std::vector<MarkovChain> MarkovModel::generate( size_t numSequences,
+                                                size_t length,
+                                                uint64_t seed,
+                                                size_t numThreads ) const
+{
+    std::vector<MarkovChain> results( numSequences );
+
+    if ( numThreads == 0 )
+    {
+        numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+
+    numThreads = std::max<size_t>( 1, std::min( numThreads, numSequences ) );
+
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 1; i < numThreads; ++i )
+    {
+        threads.push_back( std::thread( &MarkovModel::generateWorker,
+                                        this,
+                                        &results,
+                                        length,
+                                        seed,
+                                        i,
+                                        numThreads ) );
+    }
+
+    generateWorker( &results, length, seed, 0, numThreads );
+
+    for ( size_t i = 0; i < threads.size(); ++i )
+    {
+        threads[i].join();
+    }
+
+    return results;
+}
+
+void MarkovModel::generateWorker( std::vector<MarkovChain> * pResults,
+                                  size_t length,
+                                  uint64_t seed,
+                                  size_t firstSequence,
+                                  size_t stride ) const
+{
+    for ( size_t i = firstSequence; i < pResults->size(); i += stride )
+    {
+        MarkovRandom random( seed, i );
+        (*pResults)[i] = generate( length, random );
+    }
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#ifndef MARKOV_MODEL_H
+#define MARKOV_MODEL_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "markov.h"
+#include "symboltable.h"
+
+class MarkovData;
+
+/**
+ * Small, fast random number generator used when sampling from a markov
+ * model (xoshiro256**). Each generator is seeded with a seed and a stream
+ * number, and generators with different stream numbers produce independent
+ * sequences. This lets every generated sequence have its own generator, so
+ * the output for a seed does not depend on how the work was split between
+ * threads.
+ */
+class MarkovRandom
+{
+public:
+    explicit MarkovRandom( uint64_t seed, uint64_t stream = 0 );
+
+    // Get the next random 32 bit value
+    uint32_t next();
+
+    // Get a random value in the range [0, bound)
+    uint32_t nextBelow( uint32_t bound );
+
+private:
+    uint64_t m_state[4];
+};
+
+/**
+ * Header at the start of a saved markov model file. Every section of the
+ * file is stored as a flat array in host byte order, and is found through
+ * the byte offsets in this header
+ */
+struct MarkovModelHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t depth;
+    uint32_t nodeCount;
+    uint32_t symbolCount;
+    uint32_t slotCount;
+    uint32_t textSize;
+    uint32_t reserved;
+    uint64_t nodesOffset;
+    uint64_t weightsOffset;
+    uint64_t symbolOffsetsOffset;
+    uint64_t symbolHashesOffset;
+    uint64_t slotsOffset;
+    uint64_t textOffset;
+};
+
+/**
+ * An immutable markov model that has been flattened for fast generation.
+ * The n-gram tree of a trained MarkovData is laid out breadth first in one
+ * array, with each node's children stored next to each other and sorted by
+ * symbol. Alongside the nodes is a cumulative weight array, so choosing a
+ * weighted random child is a binary search over the children instead of a
+ * linear scan.
+ *
+ * The model's in memory layout is exactly the layout of its file on disk.
+ * Saving a model writes its memory out as is, and loading a model maps the
+ * file into memory and samples from it directly with no deserialization.
+ * Several processes loading the same model file share one copy of it
+ * through the page cache.
+ *
+ * A model is safe to sample from several threads at once.
+ */
+class MarkovModel
+{
+public:
+    // Current version of the model file format
+    static const uint32_t FILE_VERSION = 1;
+
+    /**
+     * A node in the flattened tree. The root is always the first node
+     */
+    struct Node
+    {
+        Symbol   value;
+        uint32_t weight;
+        uint32_t firstChild;
+        uint32_t childCount;
+    };
+
+    MarkovModel();
+    explicit MarkovModel( const MarkovData& data );
+
+    // Write the model to a file
+    bool save( const std::string& filename ) const;
+
+    // Map a saved model file into memory, replacing the current model
+    bool load( const std::string& filename );
+
+    // Checks if the model is being read from a mapped file
+    bool isMapped() const;
+
+    size_t depth() const;
+
+    size_t nodeCount() const;
+
+    size_t symbolCount() const;
+
+    // Get the symbol for a word, or INVALID_SYMBOL if it is not in the model
+    Symbol findSymbol( const std::string& word ) const;
+
+    // Get the word that a symbol stands for
+    std::string symbolName( Symbol symbol ) const;
+
+    const Node& root() const;
+
+    // Get the node at the end of a chain of symbols, or NULL if the chain
+    // is not in the model
+    const Node* findNode( const Symbol * pChain, size_t length ) const;
+
+    // Choose one of a node's children, weighted by how often each child
+    // followed the node. The node must have children
+    const Node& sampleChild( const Node& node, MarkovRandom& random ) const;
+
+    // Generate a sequence of symbols
+    SymbolChain generateSymbols( size_t length, MarkovRandom& random ) const;
+
+    // Generate a sequence of words
+    MarkovChain generate( size_t length, MarkovRandom& random ) const;
+
+    // Generate many sequences of words on several threads
+    std::vector<MarkovChain> generate( size_t numSequences,
+                                       size_t length,
+                                       uint64_t seed,
+                                       size_t numThreads = 0 ) const;
+
+protected:
+    void generateWorker( std::vector<MarkovChain> * pResults,
+                         size_t length,
+                         uint64_t seed,
+                         size_t firstSequence,
+                         size_t stride ) const;
+
+    void build( const MarkovData& data );
+    bool attach( const char * pImage, size_t imageSize );
+
+private:
+    MarkovModel( const MarkovModel& );
+    MarkovModel& operator = ( const MarkovModel& );
+
+private:
+    std::vector<uint64_t> m_image;
+    boost::iostreams::mapped_file_source m_file;
+    const MarkovModelHeader * m_pHeader;
+    const Node *     m_pNodes;
+    const uint32_t * m_pCumulativeWeights;
+    const uint32_t * m_pSymbolOffsets;
+    const uint32_t * m_pSymbolHashes;
+    const Symbol *   m_pSlots;
+    const char *     m_pText;
+};
+
+#endif
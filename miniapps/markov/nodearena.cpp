@@ -0,0 +1,148 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#include <vector>
+#include <cassert>
+
+#include "nodearena.h"
+#include "elementnode.h"
+
+const uint32_t NodeArena::NODES_PER_BLOCK;
+const uint32_t NodeArena::CAPACITY_CLASS_COUNT;
+
+NodeArena::NodeArena()
+    : m_blocks(),
+      m_pCurrentBlock( NULL ),
+      m_currentBlockUsed( 0 ),
+      m_bytesAllocated( 0 )
+{
+    for ( uint32_t i = 0; i < CAPACITY_CLASS_COUNT; ++i )
+    {
+        m_freeLists[i] = NULL;
+    }
+}
+
+NodeArena::NodeArena( NodeArena&& other )
+    : m_blocks(),
+      m_pCurrentBlock( other.m_pCurrentBlock ),
+      m_currentBlockUsed( other.m_currentBlockUsed ),
+      m_bytesAllocated( other.m_bytesAllocated )
+{
+    m_blocks.swap( other.m_blocks );
+
+    for ( uint32_t i = 0; i < CAPACITY_CLASS_COUNT; ++i )
+    {
+        m_freeLists[i]       = other.m_freeLists[i];
+        other.m_freeLists[i] = NULL;
+    }
+
+    other.m_pCurrentBlock    = NULL;
+    other.m_currentBlockUsed = 0;
+    other.m_bytesAllocated   = 0;
+}
+
+NodeArena::~NodeArena()
+{
+    for ( size_t i = 0; i < m_blocks.size(); ++i )
+    {
+        delete[] m_blocks[i];
+    }
+}
+
+ElementNode* NodeArena::allocate( uint32_t capacity )
+{
+    assert( capacity > 0 );
+    assert( ( capacity & ( capacity - 1 ) ) == 0 );
+
+    uint32_t      sizeClass = capacityClass( capacity );
+    ElementNode * pNodes    = m_freeLists[sizeClass];
+
+    if ( pNodes != NULL )
+    {
+        // Reuse an array that was released earlier. The next free array in
+        // the list is stored in the first node's child pointer
+        m_freeLists[sizeClass] = pNodes->children;
+    }
+    else if ( capacity > NODES_PER_BLOCK / 4 )
+    {
+        // Large arrays get a block of their own, so they don't waste most
+        // of a shared block
+        pNodes = new ElementNode[capacity];
+
+        m_blocks.push_back( pNodes );
+        m_bytesAllocated += capacity * sizeof(ElementNode);
+    }
+    else
+    {
+        if ( m_pCurrentBlock == NULL ||
+             m_currentBlockUsed + capacity > NODES_PER_BLOCK )
+        {
+            m_pCurrentBlock    = new ElementNode[NODES_PER_BLOCK];
+            m_currentBlockUsed = 0;
+
+            m_blocks.push_back( m_pCurrentBlock );
+            m_bytesAllocated += NODES_PER_BLOCK * sizeof(ElementNode);
+        }
+
+        pNodes = m_pCurrentBlock + m_currentBlockUsed;
+        m_currentBlockUsed += capacity;
+    }
+
+    return pNodes;
+}
+
+void NodeArena::release( ElementNode * pNodes, uint32_t capacity )
+{
+    if ( pNodes == NULL )
+    {
+        return;
+    }
+
+    uint32_t sizeClass = capacityClass( capacity );
+
+    pNodes->children       = m_freeLists[sizeClass];
+    m_freeLists[sizeClass] = pNodes;
+}
+
+size_t NodeArena::memoryUsage() const
+{
+    return m_bytesAllocated + m_blocks.capacity() * sizeof(ElementNode*);
+}
+
+uint32_t NodeArena::capacityClass( uint32_t capacity )
+{
+    uint32_t sizeClass = 0;
+
+    while ( ( 1u << sizeClass ) < capacity )
+    {
+        ++sizeClass;
+    }
+
+    assert( sizeClass < CAPACITY_CLASS_COUNT );
+    return sizeClass;
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#ifndef MARKOV_NODE_ARENA_H
+#define MARKOV_NODE_ARENA_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "elementnode.h"
+
+/**
+ * Allocates the child arrays for a markov model's nodes. Nodes are carved
+ * out of large blocks rather than allocated one at a time on the heap, and
+ * every array's capacity is a power of two. When an array grows, the old
+ * array is put on a free list for its capacity and handed out to the next
+ * node that needs an array of that size.
+ *
+ * All of the memory is released at once when the arena is destroyed.
+ */
+class NodeArena
+{
+public:
+    // Number of nodes in each block allocated by the arena
+    static const uint32_t NODES_PER_BLOCK = 4096;
+
+    NodeArena();
+    NodeArena( NodeArena&& other );
+    ~NodeArena();
+
+    // Allocate an array of nodes. Capacity must be a power of two
+    ElementNode* allocate( uint32_t capacity );
+
+    // Return an array of nodes so it can be reused
+    void release( ElementNode * pNodes, uint32_t capacity );
+
+    // Number of bytes allocated from the heap by the arena
+    size_t memoryUsage() const;
+
+private:
+    NodeArena( const NodeArena& );
+    NodeArena& operator = ( const NodeArena& );
+
+    static uint32_t capacityClass( uint32_t capacity );
+
+private:
+    static const uint32_t CAPACITY_CLASS_COUNT = 32;
+
+    std::vector<ElementNode*> m_blocks;
+    ElementNode * m_freeLists[CAPACITY_CLASS_COUNT];
+    ElementNode * m_pCurrentBlock;
+    uint32_t      m_currentBlockUsed;
+    size_t        m_bytesAllocated;
+};
+
+#endif
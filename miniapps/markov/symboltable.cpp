@@ -0,0 +1,213 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+
+#include "symboltable.h"
+
+namespace
+{
+    // Number of hash slots a new table starts with. Must be a power of two
+    const size_t INITIAL_SLOT_COUNT = 64;
+}
+
+const Symbol SymbolTable::INVALID_SYMBOL;
+
+SymbolTable::SymbolTable()
+    : m_text(),
+      m_offsets( 1, 0 ),
+      m_hashes(),
+      m_slots( INITIAL_SLOT_COUNT, INVALID_SYMBOL )
+{
+}
+
+Symbol SymbolTable::intern( const std::string& word )
+{
+    return intern( word.data(), word.size() );
+}
+
+Symbol SymbolTable::intern( const char * pWord, size_t length )
+{
+    uint32_t hash = hashOf( pWord, length );
+    size_t   slot = findSlot( pWord, length, hash );
+
+    if ( m_slots[slot] != INVALID_SYMBOL )
+    {
+        return m_slots[slot];
+    }
+
+    //
+    // The word is not in the table yet. Append its text to the end of the
+    // character buffer and give it the next symbol id
+    //
+    Symbol symbol = static_cast<Symbol>( m_hashes.size() );
+    assert( symbol != INVALID_SYMBOL );
+
+    m_text.insert( m_text.end(), pWord, pWord + length );
+    m_offsets.push_back( static_cast<uint32_t>( m_text.size() ) );
+    m_hashes.push_back( hash );
+
+    m_slots[slot] = symbol;
+
+    // Keep the load factor under one half so probe sequences stay short
+    if ( m_hashes.size() * 2 > m_slots.size() )
+    {
+        rehash( m_slots.size() * 2 );
+    }
+
+    return symbol;
+}
+
+Symbol SymbolTable::find( const std::string& word ) const
+{
+    return find( word.data(), word.size() );
+}
+
+Symbol SymbolTable::find( const char * pWord, size_t length ) const
+{
+    return m_slots[ findSlot( pWord, length, hashOf( pWord, length ) ) ];
+}
+
+std::string SymbolTable::name( Symbol symbol ) const
+{
+    if ( symbol >= size() )
+    {
+        return std::string();
+    }
+
+    const char * pText = m_text.empty() ? NULL : &m_text[0];
+
+    return std::string( pText + m_offsets[symbol],
+                        pText + m_offsets[symbol + 1] );
+}
+
+size_t SymbolTable::size() const
+{
+    return m_hashes.size();
+}
+
+size_t SymbolTable::memoryUsage() const
+{
+    return m_text.capacity()    * sizeof(char)     +
+           m_offsets.capacity() * sizeof(uint32_t) +
+           m_hashes.capacity()  * sizeof(uint32_t) +
+           m_slots.capacity()   * sizeof(Symbol);
+}
+
+const std::vector<char>& SymbolTable::text() const
+{
+    return m_text;
+}
+
+const std::vector<uint32_t>& SymbolTable::offsets() const
+{
+    return m_offsets;
+}
+
+const std::vector<uint32_t>& SymbolTable::hashes() const
+{
+    return m_hashes;
+}
+
+const std::vector<Symbol>& SymbolTable::slots() const
+{
+    return m_slots;
+}
+
+/**
+ * Linear probes the hash table for a word. Returns the slot holding the
+ * word's symbol, or the empty slot where the word would be inserted
+ */
+size_t SymbolTable::findSlot( const char * pWord,
+                              size_t length,
+                              uint32_t hash ) const
+{
+    size_t mask = m_slots.size() - 1;
+    size_t slot = hash & mask;
+
+    while ( m_slots[slot] != INVALID_SYMBOL )
+    {
+        Symbol symbol = m_slots[slot];
+
+        if ( m_hashes[symbol] == hash &&
+             m_offsets[symbol + 1] - m_offsets[symbol] == length &&
+             memcmp( &m_text[0] + m_offsets[symbol], pWord, length ) == 0 )
+        {
+            break;
+        }
+
+        slot = ( slot + 1 ) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Rebuilds the hash table with a new number of slots. Every word's hash is
+ * kept alongside it, so the text does not need to be hashed again
+ */
+void SymbolTable::rehash( size_t slotCount )
+{
+    assert( ( slotCount & ( slotCount - 1 ) ) == 0 );
+
+    std::vector<Symbol> slots( slotCount, INVALID_SYMBOL );
+    size_t mask = slotCount - 1;
+
+    for ( size_t symbol = 0; symbol < m_hashes.size(); ++symbol )
+    {
+        size_t slot = m_hashes[symbol] & mask;
+
+        while ( slots[slot] != INVALID_SYMBOL )
+        {
+            slot = ( slot + 1 ) & mask;
+        }
+
+        slots[slot] = static_cast<Symbol>( symbol );
+    }
+
+    m_slots.swap( slots );
+}
+
+/**
+ * FNV-1a hash of a word
+ */
+uint32_t SymbolTable::hashOf( const char * pWord, size_t length )
+{
+    uint32_t hash = 2166136261u;
+
+    for ( size_t i = 0; i < length; ++i )
+    {
+        hash ^= static_cast<uint8_t>( pWord[i] );
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
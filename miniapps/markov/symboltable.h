@@ -0,0 +1,92 @@
+/**
+ * Copyright 2010 Scott MacDonald. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SCOTT MACDONALD ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN
+ * NO EVENT SHALL <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Scott MacDonald.
+ */
+#ifndef MARKOV_SYMBOL_TABLE_H
+#define MARKOV_SYMBOL_TABLE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "markov.h"
+
+/**
+ * Interns the words used by a markov model, and maps each unique word to a
+ * 32 bit symbol id. Symbol ids are handed out in the order that words are
+ * first seen, starting from zero.
+ *
+ * Every word's text is packed end to end into one shared character buffer
+ * and looked up through an open addressed hash table of symbol ids, which
+ * keeps the overhead per unique word down to a few bytes.
+ */
+class SymbolTable
+{
+public:
+    // Symbol value that is never assigned to a word
+    static const Symbol INVALID_SYMBOL = 0xFFFFFFFF;
+
+    SymbolTable();
+
+    // Get the symbol for a word, adding the word if it is not in the table
+    Symbol intern( const std::string& word );
+    Symbol intern( const char * pWord, size_t length );
+
+    // Get the symbol for a word, or INVALID_SYMBOL if it is not in the table
+    Symbol find( const std::string& word ) const;
+    Symbol find( const char * pWord, size_t length ) const;
+
+    // Get the word that a symbol stands for
+    std::string name( Symbol symbol ) const;
+
+    // Number of unique words in the table
+    size_t size() const;
+
+    // Number of bytes allocated by the table
+    size_t memoryUsage() const;
+
+    // Raw table contents, used when writing the table to a file
+    const std::vector<char>&     text() const;
+    const std::vector<uint32_t>& offsets() const;
+    const std::vector<uint32_t>& hashes() const;
+    const std::vector<Symbol>&   slots() const;
+
+    // Hash function used to place words in the table
+    static uint32_t hashOf( const char * pWord, size_t length );
+
+protected:
+    size_t findSlot( const char * pWord, size_t length, uint32_t hash ) const;
+    void rehash( size_t slotCount );
+
+private:
+    std::vector<char>     m_text;
+    std::vector<uint32_t> m_offsets;
+    std::vector<uint32_t> m_hashes;
+    std::vector<Symbol>   m_slots;
+};
+
+#endif
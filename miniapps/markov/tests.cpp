@@ -28,14 +28,25 @@
  */
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <unordered_map>
+#include <map>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
 #include <googletest/googletest.h>
 #include <cassert>
 
+#include <boost/filesystem.hpp>
+
 #include "markov.h"
 #include "markovdata.h"
 #include "elementnode.h"
+#include "nodearena.h"
+#include "symboltable.h"
 #include "markovfactory.h"
+#include "markovmodel.h"
 #include "logging.h"
 
 std::ostream& operator << ( std::ostream& os, const MarkovChain& chain )
@@ -82,10 +93,10 @@ bool testSubchain( MarkovData& data, const MarkovChain& chain,
         return false;
     }
 
-    if ( node->children.size() != childcount )
+    if ( node->childCount != childcount )
     {
         ERRORLOG << "Chain had unexpect child count "
-                 << node->children.size()
+                 << node->childCount
                  << ": " << chain ENDLOG;
         return false;
     }
@@ -93,6 +104,81 @@ bool testSubchain( MarkovData& data, const MarkovChain& chain,
     return true;
 }
 
+void collectChains( const MarkovData& data,
+                    const ElementNode& node,
+                    const std::string& prefix,
+                    std::map<std::string, size_t>& chains )
+{
+    for ( uint32_t i = 0; i < node.childCount; ++i )
+    {
+        const ElementNode& child = node.children[i];
+        std::string chain = prefix + "|" + data.valueOf( child );
+
+        chains[chain] = child.weightsum;
+        collectChains( data, child, chain, chains );
+    }
+}
+
+/**
+ * Returns every chain stored in a model along with its weight, in a form
+ * that does not depend on the order words were interned in
+ */
+std::map<std::string, size_t> allChains( const MarkovData& data )
+{
+    std::map<std::string, size_t> chains;
+    collectChains( data, data.root(), "", chains );
+    return chains;
+}
+
+/**
+ * Builds a long text out of pseudo random words
+ */
+std::string makeRandomText( size_t numWords, unsigned int seed )
+{
+    const char * words[] = { "the", "cat", "sat", "on", "a", "mat",
+                             "and", "dog", "ran", "far", "away", "home" };
+    std::string text;
+    unsigned int state = seed;
+
+    for ( size_t i = 0; i < numWords; ++i )
+    {
+        state = state * 1103515245 + 12345;
+        text += words[ ( state >> 16 ) % 12 ];
+        text += ( i % 17 == 16 ? "\n" : " " );
+    }
+
+    return text;
+}
+
+/**
+ * Creates a uniquely named temporary directory for tests that write files,
+ * and removes it along with everything in it once the test is done
+ */
+class TempDirectory
+{
+public:
+    TempDirectory()
+        : m_path( boost::filesystem::temp_directory_path() /
+                  boost::filesystem::unique_path( "markov-%%%%-%%%%" ) )
+    {
+        boost::filesystem::create_directories( m_path );
+    }
+
+    ~TempDirectory()
+    {
+        boost::system::error_code error;
+        boost::filesystem::remove_all( m_path, error );
+    }
+
+    std::string file( const std::string& name ) const
+    {
+        return ( m_path / name ).string();
+    }
+
+private:
+    boost::filesystem::path m_path;
+};
+
 bool isEqual( const MarkovChain& lhs,
               const MarkovChain& rhs ) 
 {
@@ -180,13 +266,96 @@ TEST(MarkovTree,TwoLengthChainsCanBeNotEqual)
 //===========================================================================
 TEST(MarkovTree,BasicNodeCreation)
 {
-    ElementNode node("_root");
+    SymbolTable symbols;
+    ElementNode node( symbols.intern("_root") );
 
-    EXPECT_EQ( node.value, "_root" );
+    EXPECT_EQ( symbols.name( node.value ), "_root" );
     EXPECT_EQ( node.weightsum, (unsigned int) 0 );
     EXPECT_FALSE( node.hasChildren() );
 }
 
+//===========================================================================
+// Symbol table and node arena tests
+//===========================================================================
+TEST(MarkovStorage,SymbolTableInternsWordsOnce)
+{
+    SymbolTable symbols;
+
+    Symbol apple = symbols.intern( "apple" );
+    Symbol peach = symbols.intern( "peach" );
+
+    EXPECT_EQ( (Symbol) 0, apple );
+    EXPECT_EQ( (Symbol) 1, peach );
+    EXPECT_EQ( apple, symbols.intern( "apple" ) );
+    EXPECT_EQ( (size_t) 2, symbols.size() );
+
+    EXPECT_EQ( "apple", symbols.name( apple ) );
+    EXPECT_EQ( "peach", symbols.name( peach ) );
+}
+
+TEST(MarkovStorage,SymbolTableFindDoesNotIntern)
+{
+    SymbolTable symbols;
+    symbols.intern( "bear" );
+
+    EXPECT_EQ( (Symbol) 0, symbols.find( "bear" ) );
+    EXPECT_EQ( SymbolTable::INVALID_SYMBOL, symbols.find( "bears" ) );
+    EXPECT_EQ( SymbolTable::INVALID_SYMBOL, symbols.find( "" ) );
+    EXPECT_EQ( (size_t) 1, symbols.size() );
+}
+
+TEST(MarkovStorage,SymbolTableSurvivesRehashing)
+{
+    SymbolTable symbols;
+
+    for ( int i = 0; i < 5000; ++i )
+    {
+        std::ostringstream ss;
+        ss << "word" << i;
+
+        EXPECT_EQ( (Symbol) i, symbols.intern( ss.str() ) );
+    }
+
+    EXPECT_EQ( (Symbol) 1234, symbols.find( "word1234" ) );
+    EXPECT_EQ( "word4999", symbols.name( 4999 ) );
+}
+
+TEST(MarkovStorage,NodeArenaReusesReleasedArrays)
+{
+    NodeArena arena;
+
+    ElementNode * a = arena.allocate( 4 );
+    ElementNode * b = arena.allocate( 4 );
+    EXPECT_TRUE( a != b );
+
+    arena.release( a, 4 );
+    EXPECT_EQ( a, arena.allocate( 4 ) );
+    EXPECT_TRUE( a != arena.allocate( 4 ) );
+}
+
+TEST(MarkovStorage,ChildrenAreSortedBySymbol)
+{
+    MarkovData data(1);
+
+    data.insert( MC2(c,x) ); data.insert( MC2(a,x) );
+    data.insert( MC2(b,x) ); data.insert( MC2(d,x) );
+    data.insert( MC2(b,x) );
+
+    EXPECT_EQ( 4, data.childrenAtRoot() );
+    EXPECT_EQ( (size_t) 8, data.nodeCount() );
+
+    // Look up every child, which also checks the sort order since lookups
+    // are a binary search
+    EXPECT_TRUE( testSubchain( data, MC1(a), 1, 1 ) );
+    EXPECT_TRUE( testSubchain( data, MC1(b), 2, 1 ) );
+    EXPECT_TRUE( testSubchain( data, MC1(c), 1, 1 ) );
+    EXPECT_TRUE( testSubchain( data, MC1(d), 1, 1 ) );
+
+    ElementNode * node = data.getNodeFor( MC2(b,x) );
+    ASSERT_TRUE( node != NULL );
+    EXPECT_EQ( "x", data.valueOf( *node ) );
+}
+
 //===========================================================================
 // Basic markov data tests
 //===========================================================================
@@ -397,3 +566,400 @@ TEST(MarkovChain, InsertBasicLetterString)
     EXPECT_TRUE( testSubchain( data, MC3(C,B,A), 1, 0 ) );
     EXPECT_TRUE( testSubchain( data, MC3(B,A,D), 1, 0 ) );
 }
+
+//===========================================================================
+// Markov model generation tests
+//===========================================================================
+TEST(MarkovModel,FlattensTreeBreadthFirst)
+{
+    MarkovData data(1);
+
+    data.insert( MC2(a,b) ); data.insert( MC2(a,c) );
+    data.insert( MC2(b,c) );
+
+    MarkovModel model( data );
+
+    EXPECT_EQ( (size_t) 6, model.nodeCount() );
+    EXPECT_EQ( (uint32_t) 3, model.root().weight );
+    EXPECT_EQ( (uint32_t) 2, model.root().childCount );
+
+    Symbol chain[2] = { model.findSymbol( "a" ),
+                        model.findSymbol( "c" ) };
+
+    const MarkovModel::Node * node = model.findNode( chain, 2 );
+    ASSERT_TRUE( node != NULL );
+    EXPECT_EQ( "c", model.symbolName( node->value ) );
+    EXPECT_EQ( (uint32_t) 1, node->weight );
+
+    chain[1] = model.findSymbol( "a" );
+    EXPECT_TRUE( NULL == model.findNode( chain, 2 ) );
+}
+
+TEST(MarkovModel,SamplesChildrenByWeight)
+{
+    MarkovData data(1);
+
+    data.insert( MC2(a,b) ); data.insert( MC2(a,b) );
+    data.insert( MC2(a,b) ); data.insert( MC2(a,c) );
+
+    MarkovModel  model( data );
+    MarkovRandom random( 42 );
+
+    Symbol a = model.findSymbol( "a" );
+    Symbol b = model.findSymbol( "b" );
+
+    const MarkovModel::Node * node = model.findNode( &a, 1 );
+    ASSERT_TRUE( node != NULL );
+
+    const int samples = 40000;
+    int bCount = 0;
+
+    for ( int i = 0; i < samples; ++i )
+    {
+        if ( model.sampleChild( *node, random ).value == b )
+        {
+            bCount += 1;
+        }
+    }
+
+    // b should be picked three quarters of the time
+    EXPECT_NEAR( 0.75, bCount / static_cast<double>( samples ), 0.01 );
+}
+
+TEST(MarkovModel,GeneratedTextFollowsChains)
+{
+    MarkovData data(1);
+
+    data.insert( MC2(a,b) ); data.insert( MC2(b,c) );
+    data.insert( MC2(c,a) );
+
+    MarkovModel  model( data );
+    MarkovRandom random( 7 );
+
+    MarkovChain text = model.generate( 20, random );
+    ASSERT_EQ( (size_t) 20, text.size() );
+
+    for ( size_t i = 1; i < text.size(); ++i )
+    {
+        MarkovChain pair;
+        pair.push_back( text[i-1] );
+        pair.push_back( text[i] );
+
+        EXPECT_TRUE( NULL != data.getNodeFor( pair ) ) << toString( pair );
+    }
+}
+
+TEST(MarkovModel,GenerationBacksOffAtDeadEnds)
+{
+    MarkovData data(1);
+    data.insert( MC2(a,b) );
+
+    MarkovModel  model( data );
+    MarkovRandom random( 3 );
+
+    // Nothing ever follows b, so generation must start over from the root
+    EXPECT_TRUE( isEqual( MarkovChain({"a","b","a","b","a"}),
+                          model.generate( 5, random ) ) );
+}
+
+TEST(MarkovModel,BatchedGenerationIsIndependentOfThreadCount)
+{
+    MarkovData data = MarkovFactory::createFromLetters( 3, "ABCACBADABBACCAD" );
+    MarkovModel model( data );
+
+    std::vector<MarkovChain> single = model.generate( 64, 12, 1234, 1 );
+    std::vector<MarkovChain> multi  = model.generate( 64, 12, 1234, 4 );
+
+    ASSERT_EQ( (size_t) 64, single.size() );
+    ASSERT_EQ( (size_t) 64, multi.size() );
+
+    for ( size_t i = 0; i < single.size(); ++i )
+    {
+        EXPECT_EQ( (size_t) 12, single[i].size() );
+        EXPECT_TRUE( isEqual( single[i], multi[i] ) );
+    }
+
+    // Different sequences come from different random streams
+    EXPECT_FALSE( single[0] == single[1] && single[1] == single[2] );
+}
+
+//===========================================================================
+// Training tests
+//===========================================================================
+TEST(MarkovTraining,CreateFromWords)
+{
+    MarkovData data = MarkovFactory::createFromWords( 2, "the cat  sat\non the mat" );
+
+    EXPECT_EQ( 5, data.weightSumAtRoot() );
+    EXPECT_TRUE( testSubchain( data, MC1(the),     2, 2 ) );
+    EXPECT_TRUE( testSubchain( data, MC2(the,cat), 1, 0 ) );
+    EXPECT_TRUE( testSubchain( data, MC2(the,mat), 1, 0 ) );
+    EXPECT_TRUE( testSubchain( data, MC2(sat,on),  1, 0 ) );
+    EXPECT_TRUE( NULL == data.getNodeFor( MC1(mat) ) );
+}
+
+TEST(MarkovTraining,TextShorterThanChainIsEmpty)
+{
+    MarkovData words   = MarkovFactory::createFromWords( 3, "two words" );
+    MarkovData letters = MarkovFactory::createFromLetters( 3, "ab" );
+
+    EXPECT_EQ( 0, words.weightSumAtRoot() );
+    EXPECT_EQ( 0, letters.weightSumAtRoot() );
+}
+
+TEST(MarkovTraining,MergeAddsWeights)
+{
+    MarkovData a(1);
+    MarkovData b(1);
+    MarkovData both(1);
+
+    a.insert( MC2(x,y) );    both.insert( MC2(x,y) );
+    a.insert( MC2(y,z) );    both.insert( MC2(y,z) );
+    b.insert( MC2(z,x) );    both.insert( MC2(z,x) );
+    b.insert( MC2(x,y) );    both.insert( MC2(x,y) );
+    b.insert( MC2(x,w) );    both.insert( MC2(x,w) );
+
+    a.merge( b );
+
+    EXPECT_EQ( 5, a.weightSumAtRoot() );
+    EXPECT_EQ( both.nodeCount(), a.nodeCount() );
+    EXPECT_TRUE( allChains( both ) == allChains( a ) );
+    EXPECT_TRUE( testSubchain( a, MC1(x), 3, 2 ) );
+}
+
+TEST(MarkovTraining,ShardedWordTrainingMatchesSerial)
+{
+    std::string text = makeRandomText( 200000, 5 );
+    ASSERT_GT( text.size(), MarkovFactory::MIN_SHARD_SIZE * 4 );
+
+    MarkovData serial   = MarkovFactory::createFromWords( 3, text, 1 );
+    MarkovData parallel = MarkovFactory::createFromWords( 3, text, 7 );
+
+    EXPECT_EQ( serial.weightSumAtRoot(), parallel.weightSumAtRoot() );
+    EXPECT_EQ( serial.nodeCount(), parallel.nodeCount() );
+    EXPECT_TRUE( allChains( serial ) == allChains( parallel ) );
+}
+
+TEST(MarkovTraining,ShardedLetterTrainingMatchesSerial)
+{
+    std::string text = makeRandomText( 100000, 9 );
+
+    MarkovData serial   = MarkovFactory::createFromLetters( 4, text, 1 );
+    MarkovData parallel = MarkovFactory::createFromLetters( 4, text, 5 );
+
+    EXPECT_EQ( (int) text.size() - 3, serial.weightSumAtRoot() );
+    EXPECT_EQ( serial.weightSumAtRoot(), parallel.weightSumAtRoot() );
+    EXPECT_TRUE( allChains( serial ) == allChains( parallel ) );
+}
+
+TEST(MarkovTraining,CreateFromWordsFile)
+{
+    TempDirectory temp;
+    std::string filename = temp.file( "training.txt" );
+    std::string text     = makeRandomText( 1000, 3 );
+
+    std::ofstream output( filename.c_str(), std::ios::binary );
+    output << text;
+    output.close();
+    ASSERT_TRUE( output.good() );
+
+    MarkovData fromFile   = MarkovFactory::createFromWordsFile( 2, filename, 2 );
+    MarkovData fromString = MarkovFactory::createFromWords( 2, text, 1 );
+
+    EXPECT_EQ( 999, fromFile.weightSumAtRoot() );
+    EXPECT_TRUE( allChains( fromString ) == allChains( fromFile ) );
+}
+
+//===========================================================================
+// Model file tests
+//===========================================================================
+TEST(MarkovModelFile,EmptyModelGeneratesNothing)
+{
+    MarkovModel  model;
+    MarkovRandom random( 1 );
+
+    EXPECT_EQ( (size_t) 1, model.nodeCount() );
+    EXPECT_TRUE( model.generate( 10, random ).empty() );
+}
+
+TEST(MarkovModelFile,SavedModelLoadsMapped)
+{
+    TempDirectory temp;
+    std::string filename = temp.file( "model.mkv" );
+
+    MarkovData  data = MarkovFactory::createFromWords( 3, makeRandomText( 5000, 11 ) );
+    MarkovModel original( data );
+
+    ASSERT_TRUE( original.save( filename ) );
+    EXPECT_FALSE( original.isMapped() );
+
+    MarkovModel loaded;
+    ASSERT_TRUE( loaded.load( filename ) );
+    EXPECT_TRUE( loaded.isMapped() );
+
+    EXPECT_EQ( original.depth(), loaded.depth() );
+    EXPECT_EQ( original.nodeCount(), loaded.nodeCount() );
+    EXPECT_EQ( original.symbolCount(), loaded.symbolCount() );
+    EXPECT_EQ( original.findSymbol( "dog" ), loaded.findSymbol( "dog" ) );
+    EXPECT_EQ( "dog", loaded.symbolName( loaded.findSymbol( "dog" ) ) );
+    EXPECT_EQ( SymbolTable::INVALID_SYMBOL, loaded.findSymbol( "cow" ) );
+
+    // Sampling from the mapped file gives the same text as sampling from
+    // the model it was saved from
+    std::vector<MarkovChain> expected = original.generate( 16, 30, 99, 1 );
+    std::vector<MarkovChain> actual   = loaded.generate( 16, 30, 99, 2 );
+
+    for ( size_t i = 0; i < expected.size(); ++i )
+    {
+        EXPECT_TRUE( isEqual( expected[i], actual[i] ) );
+    }
+}
+
+TEST(MarkovModelFile,CorruptFileIsRejected)
+{
+    TempDirectory temp;
+    std::string filename = temp.file( "corrupt.mkv" );
+
+    MarkovData  data = MarkovFactory::createFromLetters( 2, "ABCACBAD" );
+    MarkovModel original( data );
+    ASSERT_TRUE( original.save( filename ) );
+
+    // Chop the end off of the file
+    std::ifstream input( filename.c_str(), std::ios::binary );
+    std::string contents( ( std::istreambuf_iterator<char>( input ) ),
+                          std::istreambuf_iterator<char>() );
+    input.close();
+
+    std::ofstream output( filename.c_str(), std::ios::binary );
+    output.write( contents.data(), contents.size() / 2 );
+    output.close();
+    ASSERT_TRUE( output.good() );
+
+    MarkovModel loaded( data );
+    EXPECT_FALSE( loaded.load( filename ) );
+    EXPECT_FALSE( loaded.isMapped() );
+    EXPECT_EQ( original.nodeCount(), loaded.nodeCount() );
+
+    EXPECT_FALSE( loaded.load( temp.file( "missing.mkv" ) ) );
+}
+
+/**
+ * Saves a model, applies a corruption to the saved image and then writes it
+ * back out so it can be loaded. Returns true if the corrupted image loaded;
+ * a failure to save or rewrite the image fails the test instead
+ */
+template<typename Corruption>
+bool loadCorruptedModel( const MarkovModel& original, Corruption corrupt )
+{
+    TempDirectory temp;
+    std::string filename = temp.file( "corrupted.mkv" );
+
+    if (! original.save( filename ) )
+    {
+        ADD_FAILURE() << "Could not save the model to corrupt";
+        return true;
+    }
+
+    std::ifstream input( filename.c_str(), std::ios::binary );
+    std::string image( ( std::istreambuf_iterator<char>( input ) ),
+                       std::istreambuf_iterator<char>() );
+    input.close();
+
+    MarkovModelHeader header;
+    memcpy( &header, image.data(), sizeof(header) );
+    corrupt( header, &image[0] );
+
+    std::ofstream output( filename.c_str(), std::ios::binary );
+    output.write( image.data(), image.size() );
+    output.close();
+
+    if (! output.good() )
+    {
+        ADD_FAILURE() << "Could not write the corrupted model";
+        return true;
+    }
+
+    MarkovModel loaded;
+    return loaded.load( filename );
+}
+
+TEST(MarkovModelFile,CorruptImagesAreRejected)
+{
+    MarkovData  data = MarkovFactory::createFromLetters( 2, "ABCACBADDBCA" );
+    MarkovModel original( data );
+
+    typedef MarkovModel::Node Node;
+
+    // Sanity check that an untouched image loads
+    EXPECT_TRUE( loadCorruptedModel( original,
+        []( MarkovModelHeader&, char * ) {} ) );
+
+    // Child range of a non root node runs past the end of the nodes
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Node * pNodes = reinterpret_cast<Node*>( pImage + h.nodesOffset );
+            pNodes[1].childCount = h.nodeCount;
+        } ) );
+
+    // Child range points back at the root
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Node * pNodes = reinterpret_cast<Node*>( pImage + h.nodesOffset );
+            pNodes[1].firstChild = 0;
+            pNodes[1].childCount = 1;
+        } ) );
+
+    // Node holds a symbol that is not in the symbol table
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Node * pNodes = reinterpret_cast<Node*>( pImage + h.nodesOffset );
+            pNodes[ h.nodeCount - 1 ].value = h.symbolCount;
+        } ) );
+
+    // Hash table slot holds a symbol that is not in the symbol table
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Symbol * pSlots = reinterpret_cast<Symbol*>( pImage + h.slotsOffset );
+            *std::find_if( pSlots, pSlots + h.slotCount, []( Symbol s )
+                           { return s != SymbolTable::INVALID_SYMBOL; } ) = h.symbolCount;
+        } ) );
+
+    // Symbol text offsets go backwards
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            uint32_t * pOffsets = reinterpret_cast<uint32_t*>( pImage + h.symbolOffsetsOffset );
+            std::swap( pOffsets[0], pOffsets[1] );
+        } ) );
+
+    // The root's children have a total weight of zero
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Node *     pNodes   = reinterpret_cast<Node*>( pImage + h.nodesOffset );
+            uint32_t * pWeights = reinterpret_cast<uint32_t*>( pImage + h.weightsOffset );
+            std::fill( pWeights + pNodes[0].firstChild,
+                       pWeights + pNodes[0].firstChild + pNodes[0].childCount, 0 );
+        } ) );
+
+    // The root's cumulative weights go backwards
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            Node *     pNodes   = reinterpret_cast<Node*>( pImage + h.nodesOffset );
+            uint32_t * pWeights = reinterpret_cast<uint32_t*>( pImage + h.weightsOffset );
+            pWeights[ pNodes[0].firstChild ] = pWeights[ pNodes[0].firstChild + 1 ] + 1;
+        } ) );
+
+    // Header claims more text than the image holds
+    EXPECT_FALSE( loadCorruptedModel( original,
+        []( MarkovModelHeader& h, char * pImage )
+        {
+            h.textSize += 1;
+            memcpy( pImage, &h, sizeof(h) );
+        } ) );
+}
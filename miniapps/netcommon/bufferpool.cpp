@@ -0,0 +1,72 @@
+#include <cassert>
+
+#include "bufferpool.h"
+
+BufferPool::BufferPool( std::size_t bufferSize, std::size_t maxFree )
+    : m_free(),
+      m_bufferSize( bufferSize ),
+      m_maxFree( maxFree ),
+      m_inUse( 0 )
+{
+    m_free.reserve( maxFree );
+}
+
+BufferPool::~BufferPool()
+{
+    assert( m_inUse == 0 && "Buffers still in use when the pool was destroyed" );
+
+    for ( std::size_t i = 0; i < m_free.size(); ++i )
+    {
+        delete[] m_free[i];
+    }
+}
+
+char * BufferPool::acquire()
+{
+    char * pBuffer = NULL;
+
+    if ( m_free.empty() )
+    {
+        pBuffer = new char[m_bufferSize];
+    }
+    else
+    {
+        pBuffer = m_free.back();
+        m_free.pop_back();
+    }
+
+    m_inUse += 1;
+    return pBuffer;
+}
+
+void BufferPool::release( char * pBuffer )
+{
+    assert( pBuffer != NULL );
+    assert( m_inUse > 0 );
+
+    m_inUse -= 1;
+
+    if ( m_free.size() < m_maxFree )
+    {
+        m_free.push_back( pBuffer );
+    }
+    else
+    {
+        delete[] pBuffer;
+    }
+}
+
+std::size_t BufferPool::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+std::size_t BufferPool::inUse() const
+{
+    return m_inUse;
+}
+
+std::size_t BufferPool::freeCount() const
+{
+    return m_free.size();
+}
@@ -0,0 +1,57 @@
+#ifndef NETCOMMON_BUFFERPOOL_H
+#define NETCOMMON_BUFFERPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Hands out fixed size receive buffers and keeps the ones that are given
+ * back for reuse, so reading from a socket doesn't allocate. Connections
+ * only hold a buffer while they have data in it, which lets thousands of
+ * mostly idle connections share a handful of buffers.
+ *
+ * A pool is not thread safe. Give each io_service its own pool.
+ */
+class BufferPool
+{
+public:
+    /**
+     * \param  bufferSize  Size of every buffer in the pool, in bytes
+     * \param  maxFree     Most unused buffers kept around for reuse
+     */
+    BufferPool( std::size_t bufferSize, std::size_t maxFree );
+    ~BufferPool();
+
+    /**
+     * Takes a buffer of bufferSize() bytes from the pool
+     */
+    char * acquire();
+
+    /**
+     * Returns a buffer taken from this pool
+     */
+    void release( char * pBuffer );
+
+    std::size_t bufferSize() const;
+
+    /**
+     * Number of buffers currently taken out of the pool
+     */
+    std::size_t inUse() const;
+
+    /**
+     * Number of buffers waiting in the pool to be reused
+     */
+    std::size_t freeCount() const;
+
+private:
+    BufferPool( const BufferPool& );
+    BufferPool& operator = ( const BufferPool& );
+
+    std::vector<char*> m_free;
+    std::size_t m_bufferSize;
+    std::size_t m_maxFree;
+    std::size_t m_inUse;
+};
+
+#endif
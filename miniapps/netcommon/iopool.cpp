@@ -0,0 +1,68 @@
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <boost/asio.hpp>
+
+#include "iopool.h"
+
+IoServicePool::IoServicePool( std::size_t poolSize )
+    : m_services(),
+      m_work(),
+      m_next( 0 )
+{
+    if ( poolSize == 0 )
+    {
+        throw std::runtime_error( "io_service pool size must be above zero" );
+    }
+
+    for ( std::size_t i = 0; i < poolSize; ++i )
+    {
+        IoServicePtr service( new boost::asio::io_service( 1 ) );
+
+        // Keep the io_service running when it has nothing to do
+        m_work.push_back( WorkPtr( new boost::asio::io_service::work( *service ) ) );
+        m_services.push_back( service );
+    }
+}
+
+void IoServicePool::run()
+{
+    std::vector<std::thread> threads;
+
+    for ( std::size_t i = 0; i < m_services.size(); ++i )
+    {
+        IoServicePtr service = m_services[i];
+        threads.push_back( std::thread( [service]() { service->run(); } ) );
+    }
+
+    for ( std::size_t i = 0; i < threads.size(); ++i )
+    {
+        threads[i].join();
+    }
+}
+
+void IoServicePool::stop()
+{
+    for ( std::size_t i = 0; i < m_services.size(); ++i )
+    {
+        m_services[i]->stop();
+    }
+}
+
+std::size_t IoServicePool::size() const
+{
+    return m_services.size();
+}
+
+boost::asio::io_service& IoServicePool::at( std::size_t index )
+{
+    return *m_services.at( index );
+}
+
+std::size_t IoServicePool::next()
+{
+    std::size_t index = m_next;
+    m_next = ( m_next + 1 ) % m_services.size();
+
+    return index;
+}
@@ -0,0 +1,46 @@
+#ifndef NETCOMMON_IOPOOL_H
+#define NETCOMMON_IOPOOL_H
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * A pool of io_services, each run by exactly one thread. Everything that
+ * belongs to one io_service (sockets, timers, per connection state) is only
+ * ever touched from that io_service's thread, so none of it needs locking.
+ * Work is spread across the pool by giving each new connection to one of
+ * the io_services.
+ */
+class IoServicePool
+{
+public:
+    explicit IoServicePool( std::size_t poolSize );
+
+    // Run every io_service on its own thread, and wait until they stop
+    void run();
+
+    // Stop every io_service. Safe to call from any thread
+    void stop();
+
+    std::size_t size() const;
+
+    // The io_service at a position in the pool
+    boost::asio::io_service& at( std::size_t index );
+
+    // Picks the io_service to use next, going round the pool in turn
+    std::size_t next();
+
+private:
+    IoServicePool( const IoServicePool& );
+    IoServicePool& operator = ( const IoServicePool& );
+
+    typedef boost::shared_ptr<boost::asio::io_service> IoServicePtr;
+    typedef boost::shared_ptr<boost::asio::io_service::work> WorkPtr;
+
+    std::vector<IoServicePtr> m_services;
+    std::vector<WorkPtr> m_work;
+    std::size_t m_next;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include <stdexcept>
+#include <boost/asio.hpp>
+
+#include "listener.h"
+
+using boost::asio::ip::tcp;
+
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+    ReusePort;
+#endif
+
+bool canSharePort()
+{
+#ifdef SO_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+}
+
+AcceptorPtr openListener( boost::asio::io_service& ioService,
+                          const tcp::endpoint& endpoint,
+                          bool sharePort )
+{
+    AcceptorPtr acceptor( new tcp::acceptor( ioService ) );
+
+    acceptor->open( endpoint.protocol() );
+    acceptor->set_option( tcp::acceptor::reuse_address( true ) );
+
+    if ( sharePort )
+    {
+#ifdef SO_REUSEPORT
+        acceptor->set_option( ReusePort( true ) );
+#else
+        throw std::runtime_error( "SO_REUSEPORT is not supported" );
+#endif
+    }
+
+    acceptor->bind( endpoint );
+    acceptor->listen( boost::asio::socket_base::max_connections );
+
+    return acceptor;
+}
@@ -0,0 +1,25 @@
+#ifndef NETCOMMON_LISTENER_H
+#define NETCOMMON_LISTENER_H
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> AcceptorPtr;
+
+/**
+ * True if several listening sockets can be bound to the same port at once
+ * (SO_REUSEPORT), with the kernel sharing new connections out between
+ * them. Servers use that to give each io_service in a pool a listener of
+ * its own.
+ */
+bool canSharePort();
+
+/**
+ * Opens a socket listening on the given endpoint. If sharePort is set the
+ * socket is opened with SO_REUSEPORT, which requires canSharePort()
+ */
+AcceptorPtr openListener( boost::asio::io_service& ioService,
+                          const boost::asio::ip::tcp::endpoint& endpoint,
+                          bool sharePort );
+
+#endif
@@ -0,0 +1,31 @@
+#include "options.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+bool parseNumber( const char * text,
+                  uint64_t minValue,
+                  uint64_t maxValue,
+                  uint64_t& value )
+{
+    // strtoull happily skips spaces and negates a leading minus sign, so
+    // insist on a digit up front
+    if ( text == NULL || ! isdigit( static_cast<unsigned char>( text[0] ) ) )
+    {
+        return false;
+    }
+
+    char * pEnd = NULL;
+    errno       = 0;
+
+    unsigned long long parsed = strtoull( text, &pEnd, 10 );
+
+    if ( errno != 0 || *pEnd != '\0' || parsed < minValue || parsed > maxValue )
+    {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
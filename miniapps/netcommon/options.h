@@ -0,0 +1,22 @@
+#ifndef NETCOMMON_OPTIONS_H
+#define NETCOMMON_OPTIONS_H
+
+#include <stdint.h>
+
+/**
+ * Parses a decimal number given on the command line. The whole string must
+ * be digits, so signs, spaces, trailing junk and values too big to fit are
+ * all rejected, as is anything outside of [minValue, maxValue]
+ *
+ * \param  text      Text to parse
+ * \param  minValue  Smallest value that is accepted
+ * \param  maxValue  Largest value that is accepted
+ * \param  value     Receives the parsed value
+ * \return           True if the text was a number in range
+ */
+bool parseNumber( const char * text,
+                  uint64_t minValue,
+                  uint64_t maxValue,
+                  uint64_t& value );
+
+#endif
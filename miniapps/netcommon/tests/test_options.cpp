@@ -0,0 +1,44 @@
+#include "options.h"
+
+#include <googletest/googletest.h>
+
+TEST(Options,ParsesNumbersInRange)
+{
+    uint64_t value = 0;
+
+    EXPECT_TRUE( parseNumber( "1", 1, 65535, value ) );
+    EXPECT_EQ( 1u, value );
+
+    EXPECT_TRUE( parseNumber( "65535", 1, 65535, value ) );
+    EXPECT_EQ( 65535u, value );
+
+    EXPECT_TRUE( parseNumber( "18446744073709551615", 0, UINT64_MAX, value ) );
+    EXPECT_EQ( UINT64_MAX, value );
+}
+
+TEST(Options,RejectsNumbersOutOfRange)
+{
+    uint64_t value = 42;
+
+    EXPECT_FALSE( parseNumber( "0", 1, 65535, value ) );
+    EXPECT_FALSE( parseNumber( "65536", 1, 65535, value ) );
+    EXPECT_FALSE( parseNumber( "18446744073709551616", 0, UINT64_MAX, value ) );
+
+    // Nothing is written unless the number is good
+    EXPECT_EQ( 42u, value );
+}
+
+TEST(Options,RejectsAnythingButDigits)
+{
+    uint64_t value = 0;
+
+    EXPECT_FALSE( parseNumber( "", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "-1", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "+1", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( " 1", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "1 ", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "12abc", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "abc", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( "0x10", 0, 100, value ) );
+    EXPECT_FALSE( parseNumber( NULL, 0, 100, value ) );
+}
@@ -0,0 +1,302 @@
+#include "wire.h"
+#include "bufferpool.h"
+
+#include <googletest/googletest.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace
+{
+    const std::size_t TEST_BUFFER_SIZE = 1024;
+
+    struct SentMessage
+    {
+        uint16_t type;
+        std::string payload;
+    };
+
+    /**
+     * Flattens a batch into the bytes that would go out on the socket
+     */
+    std::string flatten( const WriteBatch& batch )
+    {
+        std::string bytes;
+        const std::vector<boost::asio::const_buffer>& buffers = batch.buffers();
+
+        for ( std::size_t i = 0; i < buffers.size(); ++i )
+        {
+            bytes.append( static_cast<const char*>( buffers[i].data() ),
+                          buffers[i].size() );
+        }
+
+        return bytes;
+    }
+
+    /**
+     * Feeds bytes to a decoder in chunks, collecting every message decoded
+     */
+    FrameDecoder::Result feed( FrameDecoder& decoder,
+                               const char * pData,
+                               std::size_t size,
+                               std::size_t chunkSize,
+                               std::vector<SentMessage>& received )
+    {
+        std::size_t offset = 0;
+
+        while ( offset < size )
+        {
+            boost::asio::mutable_buffer space = decoder.prepare();
+            std::size_t count = std::min( std::min( chunkSize, size - offset ),
+                                          space.size() );
+
+            memcpy( space.data(), pData + offset, count );
+            decoder.commit( count );
+            offset += count;
+
+            MessageView view;
+            FrameDecoder::Result result;
+
+            while ( ( result = decoder.next( view ) ) == FrameDecoder::MESSAGE )
+            {
+                SentMessage message = { view.type,
+                                        std::string( view.pPayload, view.size ) };
+                received.push_back( message );
+            }
+
+            if ( result == FrameDecoder::BAD_FRAME )
+            {
+                return result;
+            }
+
+            decoder.releaseIfEmpty();
+        }
+
+        return FrameDecoder::NEED_MORE;
+    }
+}
+
+TEST(Wire, EncodesHeaderBigEndian)
+{
+    char header[WIRE_HEADER_SIZE];
+    encodeWireHeader( header, 0x01020304, 0x0506 );
+
+    const char expected[WIRE_HEADER_SIZE] = { 1, 2, 3, 4, 5, 6, 0, 0 };
+    EXPECT_EQ( 0, memcmp( expected, header, WIRE_HEADER_SIZE ) );
+}
+
+TEST(Wire, DecodesMessagesInPlace)
+{
+    BufferPool pool( TEST_BUFFER_SIZE, 4 );
+    FrameDecoder decoder( pool );
+    WriteBatch batch;
+
+    batch.add( 7, boost::asio::buffer( "hello", 5 ) );
+    batch.add( 9, boost::asio::const_buffer() );
+
+    std::string bytes = flatten( batch );
+    EXPECT_EQ( 2u * WIRE_HEADER_SIZE + 5u, bytes.size() );
+    EXPECT_EQ( bytes.size(), batch.byteCount() );
+
+    boost::asio::mutable_buffer space = decoder.prepare();
+    memcpy( space.data(), bytes.data(), bytes.size() );
+    decoder.commit( bytes.size() );
+
+    MessageView view;
+
+    ASSERT_EQ( FrameDecoder::MESSAGE, decoder.next( view ) );
+    EXPECT_EQ( 7, view.type );
+    EXPECT_EQ( std::string( "hello" ), std::string( view.pPayload, view.size ) );
+    EXPECT_EQ( static_cast<const char*>( space.data() ) + WIRE_HEADER_SIZE,
+               view.pPayload );
+
+    ASSERT_EQ( FrameDecoder::MESSAGE, decoder.next( view ) );
+    EXPECT_EQ( 9, view.type );
+    EXPECT_EQ( 0u, view.size );
+
+    EXPECT_EQ( FrameDecoder::NEED_MORE, decoder.next( view ) );
+}
+
+TEST(Wire, ReleasesBufferOnlyWhenEmpty)
+{
+    BufferPool pool( TEST_BUFFER_SIZE, 4 );
+    FrameDecoder decoder( pool );
+
+    char header[WIRE_HEADER_SIZE];
+    encodeWireHeader( header, 3, 1 );
+
+    boost::asio::mutable_buffer space = decoder.prepare();
+    memcpy( space.data(), header, WIRE_HEADER_SIZE );
+    decoder.commit( WIRE_HEADER_SIZE );
+
+    MessageView view;
+    EXPECT_EQ( FrameDecoder::NEED_MORE, decoder.next( view ) );
+
+    decoder.releaseIfEmpty();
+    EXPECT_EQ( 1u, pool.inUse() );
+
+    space = decoder.prepare();
+    memcpy( space.data(), "abc", 3 );
+    decoder.commit( 3 );
+
+    EXPECT_EQ( FrameDecoder::MESSAGE, decoder.next( view ) );
+    decoder.releaseIfEmpty();
+
+    EXPECT_EQ( 0u, pool.inUse() );
+    EXPECT_EQ( 1u, pool.freeCount() );
+}
+
+TEST(Wire, RejectsOversizedAndReservedFrames)
+{
+    BufferPool pool( TEST_BUFFER_SIZE, 4 );
+    MessageView view;
+
+    {
+        FrameDecoder decoder( pool );
+        char header[WIRE_HEADER_SIZE];
+        encodeWireHeader( header, TEST_BUFFER_SIZE, 1 );
+
+        memcpy( decoder.prepare().data(), header, WIRE_HEADER_SIZE );
+        decoder.commit( WIRE_HEADER_SIZE );
+
+        EXPECT_EQ( FrameDecoder::BAD_FRAME, decoder.next( view ) );
+        EXPECT_EQ( FrameDecoder::BAD_FRAME, decoder.next( view ) );
+    }
+
+    {
+        FrameDecoder decoder( pool );
+        char header[WIRE_HEADER_SIZE];
+        encodeWireHeader( header, 0, 1 );
+        header[7] = 1;
+
+        memcpy( decoder.prepare().data(), header, WIRE_HEADER_SIZE );
+        decoder.commit( WIRE_HEADER_SIZE );
+
+        EXPECT_EQ( FrameDecoder::BAD_FRAME, decoder.next( view ) );
+    }
+
+    EXPECT_EQ( 0u, pool.inUse() );
+}
+
+TEST(Wire, WriteBatchStopsWhenFull)
+{
+    WriteBatch batch( 2 );
+
+    EXPECT_TRUE( batch.empty() );
+    EXPECT_TRUE( batch.add( 1, boost::asio::buffer( "a", 1 ) ) );
+    EXPECT_TRUE( batch.add( 2, boost::asio::buffer( "b", 1 ) ) );
+    EXPECT_TRUE( batch.full() );
+    EXPECT_FALSE( batch.add( 3, boost::asio::buffer( "c", 1 ) ) );
+    EXPECT_EQ( 2u, batch.messageCount() );
+
+    batch.clear();
+    EXPECT_TRUE( batch.empty() );
+    EXPECT_EQ( 0u, batch.buffers().size() );
+}
+
+/**
+ * Random messages, batched and then split back up at random points, must
+ * come out of the decoder exactly as they went in
+ */
+TEST(Wire, FuzzRoundTrip)
+{
+    std::mt19937 random( 1234 );
+    BufferPool pool( TEST_BUFFER_SIZE, 4 );
+
+    for ( int round = 0; round < 500; ++round )
+    {
+        FrameDecoder decoder( pool );
+        std::vector<SentMessage> sent;
+        std::string stream;
+
+        std::size_t count = 1 + random() % 64;
+
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            // Mostly small messages, with the occasional one at the limit
+            std::size_t size = ( random() % 8 == 0 ? decoder.maxPayload()
+                                                   : random() % 48 );
+            SentMessage message;
+
+            message.type = static_cast<uint16_t>( random() );
+            message.payload.resize( size );
+
+            for ( std::size_t j = 0; j < size; ++j )
+            {
+                message.payload[j] = static_cast<char>( random() );
+            }
+
+            sent.push_back( message );
+        }
+
+        WriteBatch batch( 8 );
+
+        for ( std::size_t i = 0; i < sent.size(); ++i )
+        {
+            if ( batch.full() )
+            {
+                stream += flatten( batch );
+                batch.clear();
+            }
+
+            batch.add( sent[i].type, boost::asio::buffer( sent[i].payload ) );
+        }
+
+        stream += flatten( batch );
+
+        std::vector<SentMessage> received;
+        std::size_t chunkSize = 1 + random() % ( 2 * TEST_BUFFER_SIZE );
+
+        ASSERT_EQ( FrameDecoder::NEED_MORE,
+                   feed( decoder, stream.data(), stream.size(), chunkSize, received ) );
+        ASSERT_EQ( sent.size(), received.size() );
+
+        for ( std::size_t i = 0; i < sent.size(); ++i )
+        {
+            EXPECT_EQ( sent[i].type, received[i].type );
+            EXPECT_EQ( sent[i].payload, received[i].payload );
+        }
+
+        EXPECT_EQ( 0u, decoder.buffered() );
+    }
+
+    EXPECT_EQ( 0u, pool.inUse() );
+}
+
+/**
+ * Random bytes must never get the decoder to read past what it was given
+ * or hand out a message bigger than its buffer
+ */
+TEST(Wire, FuzzGarbage)
+{
+    std::mt19937 random( 5678 );
+    BufferPool pool( TEST_BUFFER_SIZE, 4 );
+
+    for ( int round = 0; round < 500; ++round )
+    {
+        FrameDecoder decoder( pool );
+        std::string garbage( 1 + random() % ( 4 * TEST_BUFFER_SIZE ), '\0' );
+
+        for ( std::size_t i = 0; i < garbage.size(); ++i )
+        {
+            garbage[i] = static_cast<char>( random() );
+        }
+
+        // Make some of the headers plausible so the decoder gets further
+        if ( round % 2 == 0 )
+        {
+            encodeWireHeader( &garbage[0], random() % TEST_BUFFER_SIZE, 1 );
+        }
+
+        std::vector<SentMessage> received;
+        feed( decoder, garbage.data(), garbage.size(), 1 + random() % 64, received );
+
+        for ( std::size_t i = 0; i < received.size(); ++i )
+        {
+            EXPECT_LE( received[i].payload.size(), decoder.maxPayload() );
+        }
+    }
+
+    EXPECT_EQ( 0u, pool.inUse() );
+}
@@ -0,0 +1,216 @@
+#include <cstring>
+#include <cassert>
+
+#include "wire.h"
+#include "bufferpool.h"
+
+namespace
+{
+    uint32_t readUint32( const char * pIn )
+    {
+        const unsigned char * p = reinterpret_cast<const unsigned char*>( pIn );
+        return ( static_cast<uint32_t>( p[0] ) << 24 ) |
+               ( static_cast<uint32_t>( p[1] ) << 16 ) |
+               ( static_cast<uint32_t>( p[2] ) <<  8 ) |
+               ( static_cast<uint32_t>( p[3] ) );
+    }
+
+    uint16_t readUint16( const char * pIn )
+    {
+        const unsigned char * p = reinterpret_cast<const unsigned char*>( pIn );
+        return static_cast<uint16_t>( ( p[0] << 8 ) | p[1] );
+    }
+}
+
+void encodeWireHeader( char * pOut, uint32_t payloadLength, uint16_t type )
+{
+    pOut[0] = static_cast<char>( payloadLength >> 24 );
+    pOut[1] = static_cast<char>( payloadLength >> 16 );
+    pOut[2] = static_cast<char>( payloadLength >> 8 );
+    pOut[3] = static_cast<char>( payloadLength );
+    pOut[4] = static_cast<char>( type >> 8 );
+    pOut[5] = static_cast<char>( type );
+    pOut[6] = 0;
+    pOut[7] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// FrameDecoder
+///////////////////////////////////////////////////////////////////////////
+FrameDecoder::FrameDecoder( BufferPool& pool )
+    : m_pool( pool ),
+      m_pBuffer( NULL ),
+      m_begin( 0 ),
+      m_end( 0 ),
+      m_bad( false )
+{
+    assert( pool.bufferSize() > WIRE_HEADER_SIZE );
+}
+
+FrameDecoder::~FrameDecoder()
+{
+    if ( m_pBuffer != NULL )
+    {
+        m_pool.release( m_pBuffer );
+    }
+}
+
+boost::asio::mutable_buffer FrameDecoder::prepare()
+{
+    if ( m_pBuffer == NULL )
+    {
+        m_pBuffer = m_pool.acquire();
+        m_begin   = 0;
+        m_end     = 0;
+    }
+    else if ( m_begin > 0 )
+    {
+        // Slide the start of the partly received message to the front to
+        // make room for the rest of it
+        memmove( m_pBuffer, m_pBuffer + m_begin, m_end - m_begin );
+
+        m_end  -= m_begin;
+        m_begin = 0;
+    }
+
+    return boost::asio::mutable_buffer( m_pBuffer + m_end,
+                                        m_pool.bufferSize() - m_end );
+}
+
+void FrameDecoder::commit( std::size_t bytes )
+{
+    assert( m_pBuffer != NULL );
+    assert( m_end + bytes <= m_pool.bufferSize() );
+
+    m_end += bytes;
+}
+
+FrameDecoder::Result FrameDecoder::next( MessageView& message )
+{
+    if ( m_bad )
+    {
+        return BAD_FRAME;
+    }
+
+    std::size_t available = m_end - m_begin;
+
+    if ( available < WIRE_HEADER_SIZE )
+    {
+        return NEED_MORE;
+    }
+
+    const char * pHeader = m_pBuffer + m_begin;
+    uint32_t length      = readUint32( pHeader );
+
+    // A frame that could never fit in the buffer, or with reserved bits
+    // set, means the stream has lost its place or isn't speaking the
+    // protocol at all
+    if ( length > maxPayload() || pHeader[6] != 0 || pHeader[7] != 0 )
+    {
+        m_bad = true;
+        return BAD_FRAME;
+    }
+
+    if ( available < WIRE_HEADER_SIZE + length )
+    {
+        return NEED_MORE;
+    }
+
+    message.type     = readUint16( pHeader + 4 );
+    message.pPayload = pHeader + WIRE_HEADER_SIZE;
+    message.size     = length;
+
+    m_begin += WIRE_HEADER_SIZE + length;
+    return MESSAGE;
+}
+
+void FrameDecoder::releaseIfEmpty()
+{
+    if ( m_pBuffer != NULL && m_begin == m_end )
+    {
+        m_pool.release( m_pBuffer );
+
+        m_pBuffer = NULL;
+        m_begin   = 0;
+        m_end     = 0;
+    }
+}
+
+std::size_t FrameDecoder::buffered() const
+{
+    return m_end - m_begin;
+}
+
+std::size_t FrameDecoder::maxPayload() const
+{
+    return m_pool.bufferSize() - WIRE_HEADER_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// WriteBatch
+///////////////////////////////////////////////////////////////////////////
+WriteBatch::WriteBatch( std::size_t maxMessages )
+    : m_headers( maxMessages * WIRE_HEADER_SIZE ),
+      m_buffers(),
+      m_maxMessages( maxMessages ),
+      m_messageCount( 0 ),
+      m_byteCount( 0 )
+{
+    m_buffers.reserve( maxMessages * 2 );
+}
+
+bool WriteBatch::add( uint16_t type, const boost::asio::const_buffer& payload )
+{
+    if ( full() )
+    {
+        return false;
+    }
+
+    std::size_t size = boost::asio::buffer_size( payload );
+    char * pHeader   = &m_headers[m_messageCount * WIRE_HEADER_SIZE];
+
+    encodeWireHeader( pHeader, static_cast<uint32_t>( size ), type );
+    m_buffers.push_back( boost::asio::const_buffer( pHeader, WIRE_HEADER_SIZE ) );
+
+    if ( size > 0 )
+    {
+        m_buffers.push_back( payload );
+    }
+
+    m_messageCount += 1;
+    m_byteCount    += WIRE_HEADER_SIZE + size;
+
+    return true;
+}
+
+const std::vector<boost::asio::const_buffer>& WriteBatch::buffers() const
+{
+    return m_buffers;
+}
+
+std::size_t WriteBatch::messageCount() const
+{
+    return m_messageCount;
+}
+
+std::size_t WriteBatch::byteCount() const
+{
+    return m_byteCount;
+}
+
+bool WriteBatch::empty() const
+{
+    return m_messageCount == 0;
+}
+
+bool WriteBatch::full() const
+{
+    return m_messageCount == m_maxMessages;
+}
+
+void WriteBatch::clear()
+{
+    m_buffers.clear();
+    m_messageCount = 0;
+    m_byteCount    = 0;
+}
@@ -0,0 +1,162 @@
+#ifndef NETCOMMON_WIRE_H
+#define NETCOMMON_WIRE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+class BufferPool;
+
+/**
+ * Binary wire protocol shared by the network miniapps.
+ *
+ * Every message is sent as a frame made of an eight byte header followed
+ * by the message's payload:
+ *
+ *   bytes 0-3  payload length, big endian
+ *   bytes 4-5  message type, big endian
+ *   bytes 6-7  reserved, must be zero
+ *
+ * What the type and payload mean is up to each application.
+ */
+const std::size_t WIRE_HEADER_SIZE = 8;
+
+/**
+ * Writes a frame header for a payload of the given length
+ */
+void encodeWireHeader( char * pOut, uint32_t payloadLength, uint16_t type );
+
+/**
+ * A received message. The payload is not copied out of the receive
+ * buffer, so a view is only good until the decoder that produced it is
+ * next asked to prepare() or release() its buffer.
+ */
+struct MessageView
+{
+    uint16_t type;
+    const char * pPayload;
+    std::size_t size;
+};
+
+/**
+ * Splits a stream of bytes read from a socket back up into messages.
+ *
+ * Reads go straight into a buffer borrowed from a BufferPool, and messages
+ * are decoded in place in that buffer. Once every complete message has
+ * been taken out the buffer can be handed back to the pool, and only a
+ * connection part way through receiving a message needs to keep one. A
+ * frame has to fit in a single buffer, so the pool's buffer size sets the
+ * largest payload that can be received.
+ *
+ * Typical use:
+ *
+ *   socket.read_some( decoder.prepare() ) -> decoder.commit( bytes )
+ *   while ( decoder.next( view ) == FrameDecoder::MESSAGE ) { ... }
+ *   decoder.releaseIfEmpty()
+ */
+class FrameDecoder
+{
+public:
+    enum Result
+    {
+        MESSAGE,        // a message was decoded
+        NEED_MORE,      // the rest of the next message hasn't arrived yet
+        BAD_FRAME       // the stream is corrupt and must be dropped
+    };
+
+    explicit FrameDecoder( BufferPool& pool );
+    ~FrameDecoder();
+
+    /**
+     * Gets a buffer to read more bytes into, taking one from the pool if
+     * needed. Any views from earlier calls to next() are invalidated
+     */
+    boost::asio::mutable_buffer prepare();
+
+    /**
+     * Marks bytes as having been read into the buffer from prepare()
+     */
+    void commit( std::size_t bytes );
+
+    /**
+     * Decodes the next complete message. Once BAD_FRAME is returned every
+     * later call returns it too
+     */
+    Result next( MessageView& message );
+
+    /**
+     * Hands the buffer back to the pool if it has nothing left in it.
+     * Invalidates any views from earlier calls to next()
+     */
+    void releaseIfEmpty();
+
+    /**
+     * Number of bytes received that are not part of a decoded message yet
+     */
+    std::size_t buffered() const;
+
+    /**
+     * Largest payload that can be received
+     */
+    std::size_t maxPayload() const;
+
+private:
+    FrameDecoder( const FrameDecoder& );
+    FrameDecoder& operator = ( const FrameDecoder& );
+
+    BufferPool& m_pool;
+    char * m_pBuffer;
+    std::size_t m_begin;        // start of the first undecoded byte
+    std::size_t m_end;          // end of the bytes received
+    bool m_bad;
+};
+
+/**
+ * Gathers several messages into one scattered write, so a burst of small
+ * messages goes out in one writev rather than one write each.
+ *
+ * Payloads are not copied. The batch only points at them, so they have to
+ * stay alive until the write has finished. Headers are kept in storage
+ * owned by the batch that is sized up front and never moves.
+ */
+class WriteBatch
+{
+public:
+    /**
+     * \param  maxMessages  Most messages in one batch. Each takes two of
+     *                      the iovecs in the write
+     */
+    explicit WriteBatch( std::size_t maxMessages = 32 );
+
+    /**
+     * Adds a message to the batch
+     *
+     * \return  False if the batch is full, and the message wasn't added
+     */
+    bool add( uint16_t type, const boost::asio::const_buffer& payload );
+
+    /**
+     * The buffers to pass to write() or async_write()
+     */
+    const std::vector<boost::asio::const_buffer>& buffers() const;
+
+    std::size_t messageCount() const;
+    std::size_t byteCount() const;
+    bool empty() const;
+    bool full() const;
+
+    /**
+     * Empties the batch once it has been written
+     */
+    void clear();
+
+private:
+    std::vector<char> m_headers;
+    std::vector<boost::asio::const_buffer> m_buffers;
+    std::size_t m_maxMessages;
+    std::size_t m_messageCount;
+    std::size_t m_byteCount;
+};
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * Loopback throughput benchmark for the wire protocol. One thread sends
+ * messages of a fixed size as fast as it can and another decodes them,
+ * for a range of message sizes, both one message per write and batched.
+ */
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+
+#include "wire.h"
+#include "bufferpool.h"
+
+using boost::asio::ip::tcp;
+
+namespace
+{
+    const std::size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+    const uint16_t BENCH_MESSAGE_TYPE = 42;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct RunResult
+    {
+        uint64_t messages;
+        uint64_t bytes;
+        double seconds;
+        bool valid;
+    };
+
+    void sendMessages( tcp::socket& socket,
+                       std::size_t size,
+                       std::size_t batchSize,
+                       double seconds )
+    {
+        std::string payload( size, 'x' );
+        WriteBatch batch( batchSize );
+
+        Clock::time_point end = Clock::now() +
+            std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>( seconds ) );
+
+        // Check the clock every so often rather than after every write
+        while ( Clock::now() < end )
+        {
+            for ( int i = 0; i < 64; ++i )
+            {
+                while ( batch.add( BENCH_MESSAGE_TYPE, boost::asio::buffer( payload ) ) )
+                {
+                }
+
+                boost::asio::write( socket, batch.buffers() );
+                batch.clear();
+            }
+        }
+
+        socket.shutdown( tcp::socket::shutdown_send );
+    }
+
+    RunResult receiveMessages( tcp::socket& socket, std::size_t size )
+    {
+        BufferPool pool( RECEIVE_BUFFER_SIZE, 1 );
+        FrameDecoder decoder( pool );
+        RunResult result = { 0, 0, 0.0, true };
+
+        Clock::time_point start = Clock::now();
+        boost::system::error_code error;
+
+        while ( true )
+        {
+            std::size_t bytes = socket.read_some( decoder.prepare(), error );
+
+            if ( error )
+            {
+                break;
+            }
+
+            decoder.commit( bytes );
+            result.bytes += bytes;
+
+            MessageView view;
+            FrameDecoder::Result status;
+
+            while ( ( status = decoder.next( view ) ) == FrameDecoder::MESSAGE )
+            {
+                result.messages += 1;
+                result.valid    &= ( view.type == BENCH_MESSAGE_TYPE && view.size == size );
+            }
+
+            if ( status == FrameDecoder::BAD_FRAME )
+            {
+                result.valid = false;
+                break;
+            }
+
+            decoder.releaseIfEmpty();
+        }
+
+        result.valid  &= ( error == boost::asio::error::eof && decoder.buffered() == 0 );
+        result.seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+        return result;
+    }
+
+    RunResult runOnce( std::size_t size, std::size_t batchSize, double seconds )
+    {
+        boost::asio::io_service ioService;
+        tcp::acceptor acceptor( ioService,
+            tcp::endpoint( boost::asio::ip::address_v4::loopback(), 0 ) );
+
+        tcp::socket sender( ioService );
+        tcp::socket receiver( ioService );
+
+        sender.connect( acceptor.local_endpoint() );
+        acceptor.accept( receiver );
+
+        RunResult result;
+        std::thread reader( [&]() { result = receiveMessages( receiver, size ); } );
+
+        sendMessages( sender, size, batchSize, seconds );
+        reader.join();
+
+        return result;
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    std::vector<std::size_t> sizes;
+    std::vector<std::size_t> batches;
+    double seconds = 2.0;
+
+    if ( argc % 2 == 0 )
+    {
+        std::cerr << "Usage: wirebench [--size BYTES]... [--batch N]... "
+                  << "[--seconds N]" << std::endl;
+        return 1;
+    }
+
+    for ( int i = 1; i + 1 < argc; i += 2 )
+    {
+        if ( strcmp( argv[i], "--size" ) == 0 )
+        {
+            sizes.push_back( static_cast<std::size_t>( atol( argv[i + 1] ) ) );
+        }
+        else if ( strcmp( argv[i], "--batch" ) == 0 )
+        {
+            batches.push_back( static_cast<std::size_t>( atol( argv[i + 1] ) ) );
+        }
+        else if ( strcmp( argv[i], "--seconds" ) == 0 )
+        {
+            seconds = atof( argv[i + 1] );
+        }
+    }
+
+    if ( sizes.empty() )
+    {
+        std::size_t defaultSizes[] = { 16, 64, 256, 1024, 8192 };
+        sizes.assign( defaultSizes, defaultSizes + 5 );
+    }
+
+    if ( batches.empty() )
+    {
+        batches.push_back( 1 );
+        batches.push_back( 32 );
+    }
+
+    std::cout << std::setw(8)  << "size"
+              << std::setw(8)  << "batch"
+              << std::setw(14) << "msgs/sec"
+              << std::setw(12) << "MB/sec" << std::endl;
+
+    bool allValid = true;
+
+    for ( std::size_t i = 0; i < sizes.size(); ++i )
+    {
+        for ( std::size_t j = 0; j < batches.size(); ++j )
+        {
+            if ( sizes[i] > RECEIVE_BUFFER_SIZE - WIRE_HEADER_SIZE || batches[j] == 0 )
+            {
+                continue;
+            }
+
+            RunResult result = runOnce( sizes[i], batches[j], seconds );
+            allValid &= result.valid;
+
+            std::cout << std::setw(8)  << sizes[i]
+                      << std::setw(8)  << batches[j]
+                      << std::fixed << std::setprecision( 0 )
+                      << std::setw(14) << result.messages / result.seconds
+                      << std::setprecision( 1 )
+                      << std::setw(12) << result.bytes / result.seconds / ( 1024 * 1024 )
+                      << ( result.valid ? "" : "  CORRUPT" )
+                      << std::endl;
+        }
+    }
+
+    return ( allValid ? 0 : 1 );
+}
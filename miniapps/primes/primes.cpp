@@ -28,35 +28,215 @@
  */
 
 #include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include <cmath>
-#include <memory.h>
+#include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <stdint.h>
+#include <sys/time.h>
+
+/**
+ * Number of primes found up to a limit, and the largest of them
+ */
+struct PrimeCount
+{
+    PrimeCount()
+        : primes( 0 ),
+          largest( 0 )
+    {
+    }
+
+    uint64_t primes;
+    uint64_t largest;
+};
 
 bool isPrime( long );
-void findPrimesUpTo( long );
+bool parseNumber( const char *, uint64_t, uint64_t& );
+void printUsage( std::ostream&, const char * );
+PrimeCount findPrimesUpTo( long );
+PrimeCount countPrimesUpTo( uint64_t, unsigned int );
+void printResults( uint64_t, const PrimeCount& );
+void runBenchmark( unsigned int );
 
-int main( int , char** )
+//
+// The segmented sieve only stores odd numbers, one bit each. A segment is
+// sized to fit in the L1 data cache so that crossing off multiples never
+// leaves the cache. Segments are handed to the worker threads in blocks,
+// and a worker carries each sieving prime's next multiple from one segment
+// to the next within its block.
+//
+const uint64_t SEGMENT_BYTES      = 32 * 1024;
+const uint64_t SEGMENT_WORDS      = SEGMENT_BYTES / sizeof(uint64_t);
+const uint64_t SEGMENT_BITS       = SEGMENT_BYTES * 8;
+const uint64_t SEGMENT_SPAN       = SEGMENT_BITS * 2;
+const uint64_t SEGMENTS_PER_BLOCK = 64;
+const uint64_t BLOCK_SPAN         = SEGMENT_SPAN * SEGMENTS_PER_BLOCK;
+
+//
+// Multiples of the smallest primes take the most work to cross off, but
+// they repeat every 3*5*7*11*13 odd numbers. Each segment starts out as a
+// copy of that pattern instead of all ones, and sieving starts at 17.
+//
+const uint32_t PRESIEVE_PRIMES[] = { 3, 5, 7, 11, 13 };
+const uint64_t PRESIEVE_PERIOD   = 3 * 5 * 7 * 11 * 13;
+
+//
+// Largest limits that can be asked for. The segmented sieve's arithmetic
+// stays well clear of overflow up to 10^15, and its sieving primes fit in
+// 32 bits. The simple sieve needs a byte for every number, so it is kept
+// to something that can be allocated
+//
+const uint64_t MAX_LIMIT        = 1000000000000000ull;
+const uint64_t MAX_SIMPLE_LIMIT = 1ull << 32;
+const uint64_t MAX_THREADS      = 1024;
+
+/**
+ * Usage: primes [limit] [--threads N] [--simple] [--bench]
+ */
+int main( int argc, char** argv )
 {
-    findPrimesUpTo( 100000000 );
+    uint64_t limit          = 100000000;
+    unsigned int numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+    bool useSimple          = false;
+    bool useBenchmark       = false;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        uint64_t value = 0;
+
+        if ( strcmp( argv[i], "--help" ) == 0 || strcmp( argv[i], "-h" ) == 0 )
+        {
+            printUsage( std::cout, argv[0] );
+            return 0;
+        }
+        else if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc )
+        {
+            if (! parseNumber( argv[++i], MAX_THREADS, value ) || value == 0 )
+            {
+                std::cerr << "Thread count must be between 1 and "
+                          << MAX_THREADS << ": " << argv[i] << std::endl;
+                printUsage( std::cerr, argv[0] );
+                return 1;
+            }
+
+            numThreads = static_cast<unsigned int>( value );
+        }
+        else if ( strcmp( argv[i], "--simple" ) == 0 )
+        {
+            useSimple = true;
+        }
+        else if ( strcmp( argv[i], "--bench" ) == 0 )
+        {
+            useBenchmark = true;
+        }
+        else if ( parseNumber( argv[i], MAX_LIMIT, value ) )
+        {
+            limit = value;
+        }
+        else
+        {
+            std::cerr << "Limit must be a number no larger than "
+                      << MAX_LIMIT << ": " << argv[i] << std::endl;
+            printUsage( std::cerr, argv[0] );
+            return 1;
+        }
+    }
+
+    if ( useSimple && limit > MAX_SIMPLE_LIMIT )
+    {
+        std::cerr << "The simple sieve only goes up to "
+                  << MAX_SIMPLE_LIMIT << std::endl;
+        return 1;
+    }
+
+    if ( useBenchmark )
+    {
+        runBenchmark( numThreads );
+        return 0;
+    }
+
+    std::cout << " --- Generating table of primes" << std::endl;
+
+    PrimeCount result = ( useSimple ? findPrimesUpTo( limit )
+                                    : countPrimesUpTo( limit, numThreads ) );
+
+    printResults( limit, result );
 //    std::cout << ( isPrime( 29 ) ? "yes" : "no" ) << std::endl;
 }
 
-void findPrimesUpTo( long value )
+void printUsage( std::ostream& stream, const char * program )
+{
+    stream << "Usage: " << program
+           << " [limit] [--threads N] [--simple] [--bench]" << std::endl;
+}
+
+/**
+ * Parses a non negative decimal number. The whole string must be digits,
+ * so signs, trailing junk and values that do not fit are all rejected
+ *
+ * \param  text      Text to parse
+ * \param  maxValue  Largest value that is accepted
+ * \param  value     Receives the parsed value
+ * \return           True if the text was a number no larger than maxValue
+ */
+bool parseNumber( const char * text, uint64_t maxValue, uint64_t& value )
+{
+    // strtoull happily skips spaces and negates a leading minus sign, so
+    // insist on a digit up front
+    if (! isdigit( static_cast<unsigned char>( text[0] ) ) )
+    {
+        return false;
+    }
+
+    char * pEnd = NULL;
+    errno       = 0;
+
+    unsigned long long parsed = strtoull( text, &pEnd, 10 );
+
+    if ( errno != 0 || *pEnd != '\0' || parsed > maxValue )
+    {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+void printResults( uint64_t limit, const PrimeCount& result )
 {
-    char * primesfield = new char[ value ];
+    // One is neither prime nor composite
+    uint64_t composites = ( limit > 1 ? limit - 1 - result.primes : 0 );
+
+    std::cout << "Found " << result.primes << " primes and "
+              << composites << " composites. Largest prime was "
+              << result.largest
+              << std::endl;
+}
+
+/**
+ * Original sieve, with one byte for every number up to the limit. Kept
+ * around to benchmark the segmented sieve against
+ */
+PrimeCount findPrimesUpTo( long value )
+{
+    char * primesfield = new char[ value + 1 ];
 
     //
     // Set all but 0 and 1 to prime status
     //
-    memset( primesfield, 1, sizeof(char) * value );
+    memset( primesfield, 1, sizeof(char) * ( value + 1 ) );
     primesfield[0] = 0;
-    primesfield[1] = 1;
+    primesfield[1] = 0;
 
     long max = value + 1;
     long inc = 0;
 
-    std::cout << " --- Generating table of primes" << std::endl;
-
     for ( long current = 2; current * current < max; current += inc )
     {
         //
@@ -89,36 +269,338 @@ void findPrimesUpTo( long value )
     //
     // Search for how many primes where generated
     //
-    std::cout << " --- Generating results" << std::endl;
-
-    long primesFound     = 0;
-    long compositesFound = 0;
-    long maxPrimeFound   = 0;
+    PrimeCount result;
 
-    for ( int i = 1; i < max; ++i )
+    for ( long i = 1; i < max; ++i )
     {
         if ( primesfield[i] == 1 )
         {
             // found a prime
-            primesFound++;
-            maxPrimeFound = i;
-//            std::cout << i << ", ";
+            result.primes++;
+            result.largest = i;
         }
-        else
+    }
+
+    delete[] primesfield;
+    return result;
+}
+
+/**
+ * Finds the odd primes up to and including limit with a plain sieve. These
+ * are the primes used to cross off multiples in the segmented sieve
+ */
+std::vector<uint32_t> findSievingPrimes( uint64_t limit )
+{
+    std::vector<char> composite( limit + 1, 0 );
+    std::vector<uint32_t> primes;
+
+    for ( uint64_t i = 3; i <= limit; i += 2 )
+    {
+        if ( composite[i] )
+        {
+            continue;
+        }
+
+        primes.push_back( static_cast<uint32_t>( i ) );
+
+        for ( uint64_t j = i * i; j <= limit; j += 2 * i )
+        {
+            composite[j] = 1;
+        }
+    }
+
+    return primes;
+}
+
+/**
+ * Builds the presieve pattern, with bit i set if 1 + 2i has no factor in
+ * PRESIEVE_PRIMES. The pattern is repeated out to one period longer than
+ * a segment, so any segment can be copied out of it starting at any phase
+ */
+std::vector<uint64_t> buildPresievePattern()
+{
+    uint64_t length = PRESIEVE_PERIOD + SEGMENT_BITS + 64;
+    std::vector<uint64_t> pattern( length / 64 + 1, ~0ull );
+
+    for ( std::size_t i = 0; i < sizeof(PRESIEVE_PRIMES) / sizeof(uint32_t); ++i )
+    {
+        uint64_t p = PRESIEVE_PRIMES[i];
+
+        // Bit ( p - 1 ) / 2 is p itself, and odd multiples are p bits apart
+        for ( uint64_t j = ( p - 1 ) / 2; j < pattern.size() * 64; j += p )
         {
-            compositesFound++;
+            pattern[ j / 64 ] &= ~( 1ull << ( j % 64 ) );
         }
     }
 
-    std::cout << std::endl;
+    return pattern;
+}
+
+/**
+ * Sieves every segment in the number range [ lo, hi ), where lo is odd,
+ * and adds the primes found to the result
+ *
+ * \param  lo       First number in the block. Must be odd
+ * \param  hi       One past the last number in the block
+ * \param  primes   Odd sieving primes, up to at least sqrt( hi )
+ * \param  pattern  Presieve pattern from buildPresievePattern()
+ * \param  bits     Segment buffer, holding SEGMENT_WORDS words
+ * \param  next     Next multiple of each sieving prime, filled in here
+ * \param  result   Running count of primes found by this worker
+ */
+void sieveBlock( uint64_t lo,
+                 uint64_t hi,
+                 const std::vector<uint32_t>& primes,
+                 const std::vector<uint64_t>& pattern,
+                 std::vector<uint64_t>& bits,
+                 std::vector<uint64_t>& next,
+                 PrimeCount& result )
+{
+    // Skip the primes that are already in the presieve pattern
+    std::size_t firstPrime = 0;
+
+    while ( firstPrime < primes.size() &&
+            primes[firstPrime] <= PRESIEVE_PRIMES[4] )
+    {
+        ++firstPrime;
+    }
 
     //
-    // All done
+    // Work out the first odd multiple of each prime that needs crossing off
+    // in this block. Anything below p^2 has a smaller prime factor, and has
+    // already been crossed off by that
     //
-    std::cout << "Found " << primesFound << " primes and "
-              << compositesFound << " composites. Largest prime was "
-              << maxPrimeFound
+    for ( std::size_t i = firstPrime; i < primes.size(); ++i )
+    {
+        uint64_t p     = primes[i];
+        uint64_t start = p * p;
+
+        if ( start < lo )
+        {
+            start = ( lo + p - 1 ) / p * p;
+            start += ( start % 2 == 0 ? p : 0 );
+        }
+
+        next[i] = start;
+    }
+
+    for ( uint64_t segLo = lo; segLo < hi; segLo += SEGMENT_SPAN )
+    {
+        uint64_t segHi = std::min( segLo + SEGMENT_SPAN, hi );
+        uint64_t count = ( segHi - segLo + 1 ) / 2;  // odd numbers in segment
+        uint64_t words = ( count + 63 ) / 64;
+
+        //
+        // Copy the presieve pattern in, starting at this segment's phase
+        //
+        uint64_t phase = ( ( segLo - 1 ) / 2 ) % PRESIEVE_PERIOD;
+        uint64_t shift = phase % 64;
+        const uint64_t * pSource = &pattern[ phase / 64 ];
+
+        for ( uint64_t w = 0; w < words; ++w )
+        {
+            bits[w] = ( shift == 0 ? pSource[w]
+                                   : ( pSource[w] >> shift ) |
+                                     ( pSource[w + 1] << ( 64 - shift ) ) );
+        }
+
+        //
+        // Cross off the odd multiples of each prime. Odd multiples are 2p
+        // apart, which is p bits
+        //
+        for ( std::size_t i = firstPrime; i < primes.size(); ++i )
+        {
+            uint64_t p = primes[i];
+
+            if ( p * p >= segHi )
+            {
+                break;
+            }
+
+            uint64_t j = ( next[i] - segLo ) / 2;
+
+            for ( ; j < count; j += p )
+            {
+                bits[ j / 64 ] &= ~( 1ull << ( j % 64 ) );
+            }
+
+            next[i] = segLo + 2 * j;
+        }
+
+        // The presieve primes crossed themselves off, one is not prime,
+        // and bits past the end of the range are unused
+        if ( segLo == 1 )
+        {
+            for ( std::size_t i = 0; i < sizeof(PRESIEVE_PRIMES) / sizeof(uint32_t); ++i )
+            {
+                bits[0] |= 1ull << ( ( PRESIEVE_PRIMES[i] - 1 ) / 2 );
+            }
+
+            bits[0] &= ~1ull;
+        }
+
+        if ( count % 64 != 0 )
+        {
+            bits[ words - 1 ] &= ( 1ull << ( count % 64 ) ) - 1;
+        }
+
+        //
+        // Count what is left, and remember the highest prime in the segment
+        //
+        for ( uint64_t w = 0; w < words; ++w )
+        {
+            result.primes += __builtin_popcountll( bits[w] );
+        }
+
+        for ( uint64_t w = words; w > 0; --w )
+        {
+            if ( bits[ w - 1 ] != 0 )
+            {
+                uint64_t bit    = ( w - 1 ) * 64 + 63 - __builtin_clzll( bits[ w - 1 ] );
+                result.largest  = std::max( result.largest, segLo + 2 * bit );
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Counts the primes up to and including limit with a segmented sieve of
+ * Eratosthenes. Memory use depends only on sqrt( limit ) and the number of
+ * threads, so limits up to 10^12 and beyond can be sieved.
+ *
+ * \param  limit       Largest number to check
+ * \param  numThreads  Number of worker threads to sieve with
+ */
+PrimeCount countPrimesUpTo( uint64_t limit, unsigned int numThreads )
+{
+    PrimeCount total;
+
+    if ( limit < 2 )
+    {
+        return total;
+    }
+
+    uint64_t root = static_cast<uint64_t>( sqrt( static_cast<double>( limit ) ) );
+
+    while ( root * root > limit )           { --root; }
+    while ( ( root + 1 ) * ( root + 1 ) <= limit ) { ++root; }
+
+    const std::vector<uint32_t> primes  = findSievingPrimes( root );
+    const std::vector<uint64_t> pattern = buildPresievePattern();
+
+    uint64_t end       = limit + 1;
+    uint64_t numBlocks = ( end - 1 + BLOCK_SPAN - 1 ) / BLOCK_SPAN;
+
+    std::atomic<uint64_t> nextBlock( 0 );
+    std::vector<PrimeCount> results( numThreads );
+    std::vector<std::thread> workers;
+
+    for ( unsigned int t = 0; t < numThreads; ++t )
+    {
+        workers.push_back( std::thread( [&, t]()
+        {
+            std::vector<uint64_t> bits( SEGMENT_WORDS );
+            std::vector<uint64_t> next( primes.size() );
+
+            for (;;)
+            {
+                uint64_t block = nextBlock.fetch_add( 1 );
+
+                if ( block >= numBlocks )
+                {
+                    break;
+                }
+
+                uint64_t lo = 1 + block * BLOCK_SPAN;
+                uint64_t hi = std::min( lo + BLOCK_SPAN, end );
+
+                sieveBlock( lo, hi, primes, pattern, bits, next, results[t] );
+            }
+        } ) );
+    }
+
+    for ( unsigned int t = 0; t < numThreads; ++t )
+    {
+        workers[t].join();
+
+        total.primes += results[t].primes;
+        total.largest = std::max( total.largest, results[t].largest );
+    }
+
+    // Two is the only even prime, and is not stored in the sieve
+    total.primes += 1;
+    total.largest = std::max<uint64_t>( total.largest, 2 );
+
+    return total;
+}
+
+double now()
+{
+    timeval tv;
+    gettimeofday( &tv, NULL );
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Times the original sieve against the segmented sieve with one thread and
+ * with numThreads threads, and checks that they all agree
+ */
+void runBenchmark( unsigned int numThreads )
+{
+    const uint64_t SIMPLE_MAX = 100000000;
+
+    std::cout << std::setw(14) << "limit"
+              << std::setw(12) << "primes"
+              << std::setw(12) << "simple (s)"
+              << std::setw(14) << "1 thread (s)"
+              << std::setw(10) << numThreads << " threads (s)"
               << std::endl;
+
+    for ( uint64_t limit = 1000000; limit <= 10000000000ull; limit *= 10 )
+    {
+        double simpleTime = 0.0;
+        PrimeCount simple;
+
+        if ( limit <= SIMPLE_MAX )
+        {
+            double start = now();
+            simple       = findPrimesUpTo( limit );
+            simpleTime   = now() - start;
+        }
+
+        double start      = now();
+        PrimeCount single = countPrimesUpTo( limit, 1 );
+        double singleTime = now() - start;
+
+        start               = now();
+        PrimeCount threaded = countPrimesUpTo( limit, numThreads );
+        double threadedTime = now() - start;
+
+        bool matched = single.primes == threaded.primes &&
+                       single.largest == threaded.largest &&
+                       ( limit > SIMPLE_MAX || ( simple.primes == single.primes &&
+                                                 simple.largest == single.largest ) );
+
+        std::cout << std::setw(14) << limit
+                  << std::setw(12) << single.primes
+                  << std::fixed << std::setprecision(3);
+
+        if ( limit <= SIMPLE_MAX )
+        {
+            std::cout << std::setw(12) << simpleTime;
+        }
+        else
+        {
+            std::cout << std::setw(12) << "-";
+        }
+
+        std::cout << std::setw(14) << singleTime
+                  << std::setw(22) << threadedTime
+                  << ( matched ? "" : "  MISMATCH" )
+                  << std::endl;
+    }
 }
 
 bool isPrime( long value )
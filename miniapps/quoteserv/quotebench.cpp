@@ -0,0 +1,406 @@
+/**
+ * Benchmark client for quoteserv. Opens a number of connections and has
+ * each one keep asking for quotes, with a fixed number of requests in
+ * flight per connection, and reports how many quotes per second the
+ * server answered.
+ */
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include "iopool.h"
+#include "options.h"
+
+using boost::asio::ip::tcp;
+using namespace boost::asio;
+
+namespace
+{
+    // Most requests a client may keep in flight, and most connection
+    // attempts each io_service has waiting at once
+    const std::size_t MAX_PIPELINE = 64;
+    const std::size_t MAX_PENDING_CONNECTS = 256;
+
+    // Largest values the command line options accept
+    const uint64_t MAX_CONNECTIONS = 1000000;
+    const uint64_t MAX_SECONDS     = 86400;
+    const uint64_t MAX_THREADS     = 1024;
+
+    const char REQUESTS[MAX_PIPELINE + 1] =
+        "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"
+        "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n";
+
+    typedef std::chrono::steady_clock Clock;
+}
+
+/**
+ * Settings and state shared by the whole benchmark
+ */
+struct Benchmark
+{
+    Benchmark()
+        : connections( 1000 ),
+          pipeline( 1 ),
+          seconds( 10 ),
+          threads( 1 ),
+          connected( 0 ),
+          failed( 0 ),
+          answered( 0 ),
+          bytes( 0 )
+    {
+    }
+
+    tcp::endpoint endpoint;
+    std::size_t connections;
+    std::size_t pipeline;
+    std::size_t seconds;
+    std::size_t threads;
+
+    std::atomic<std::size_t> connected;
+    std::atomic<std::size_t> failed;
+    std::atomic<uint64_t> answered;
+    std::atomic<uint64_t> bytes;
+};
+
+/**
+ * One client that keeps asking for quotes for as long as it is connected
+ */
+class BenchClient : public boost::enable_shared_from_this<BenchClient>
+{
+public:
+    typedef boost::shared_ptr<BenchClient> pointer;
+
+    BenchClient( io_service& ioService, Benchmark& bench )
+        : m_socket( ioService ),
+          m_bench( bench ),
+          m_owed( 0 ),
+          m_writing( false )
+    {
+    }
+
+    tcp::socket& socket()
+    {
+        return m_socket;
+    }
+
+    void start()
+    {
+        boost::system::error_code error;
+        m_socket.set_option( tcp::no_delay( true ), error );
+
+        // The server sends a quote on connect without being asked, which
+        // makes up the first of the requests kept in flight
+        m_owed = m_bench.pipeline - 1;
+
+        sendRequests();
+        startRead();
+    }
+
+    void stop()
+    {
+        boost::system::error_code error;
+        m_socket.close( error );
+    }
+
+private:
+    void startRead()
+    {
+        m_socket.async_read_some(
+            buffer( m_input, sizeof( m_input ) ),
+            boost::bind( &BenchClient::handleRead,
+                         shared_from_this(),
+                         boost::asio::placeholders::error,
+                         boost::asio::placeholders::bytes_transferred )
+        );
+    }
+
+    void handleRead( const boost::system::error_code& error,
+                     size_t bytesTransferred )
+    {
+        if ( error )
+        {
+            return;
+        }
+
+        std::size_t quotes = std::count( m_input, m_input + bytesTransferred, '\n' );
+
+        m_bench.answered.fetch_add( quotes, std::memory_order_relaxed );
+        m_bench.bytes.fetch_add( bytesTransferred, std::memory_order_relaxed );
+
+        // Replace every answered request with a new one
+        m_owed += quotes;
+        sendRequests();
+
+        startRead();
+    }
+
+    void sendRequests()
+    {
+        if ( m_writing || m_owed == 0 )
+        {
+            return;
+        }
+
+        std::size_t count = std::min( m_owed, MAX_PIPELINE );
+
+        m_owed   -= count;
+        m_writing = true;
+
+        boost::asio::async_write(
+            m_socket,
+            buffer( REQUESTS, count ),
+            boost::bind( &BenchClient::handleWrite,
+                         shared_from_this(),
+                         boost::asio::placeholders::error ) );
+    }
+
+    void handleWrite( const boost::system::error_code& error )
+    {
+        m_writing = false;
+
+        if ( ! error )
+        {
+            sendRequests();
+        }
+    }
+
+private:
+    tcp::socket m_socket;
+    Benchmark& m_bench;
+    std::size_t m_owed;
+    bool m_writing;
+    char m_input[4096];
+};
+
+/**
+ * Opens one io_service's share of the connections, keeping no more than
+ * MAX_PENDING_CONNECTS of them in progress at once
+ */
+class Connector
+{
+public:
+    Connector( io_service& ioService, Benchmark& bench, std::size_t count )
+        : m_ioService( ioService ),
+          m_bench( bench ),
+          m_clients(),
+          m_remaining( count )
+    {
+    }
+
+    void start()
+    {
+        for ( std::size_t i = 0; i < MAX_PENDING_CONNECTS; ++i )
+        {
+            connectNext();
+        }
+    }
+
+    void stop()
+    {
+        for ( std::size_t i = 0; i < m_clients.size(); ++i )
+        {
+            m_clients[i]->stop();
+        }
+    }
+
+private:
+    void connectNext()
+    {
+        if ( m_remaining == 0 )
+        {
+            return;
+        }
+
+        m_remaining -= 1;
+
+        BenchClient::pointer client( new BenchClient( m_ioService, m_bench ) );
+        m_clients.push_back( client );
+
+        client->socket().async_connect( m_bench.endpoint,
+            boost::bind( &Connector::handleConnect,
+                         this,
+                         client,
+                         boost::asio::placeholders::error ) );
+    }
+
+    void handleConnect( BenchClient::pointer client,
+                        const boost::system::error_code& error )
+    {
+        if ( error )
+        {
+            m_bench.failed.fetch_add( 1 );
+        }
+        else
+        {
+            client->start();
+            m_bench.connected.fetch_add( 1 );
+        }
+
+        connectNext();
+    }
+
+private:
+    io_service& m_ioService;
+    Benchmark& m_bench;
+    std::vector<BenchClient::pointer> m_clients;
+    std::size_t m_remaining;
+};
+
+void printUsage()
+{
+    std::cerr << "Usage: quotebench [--host ADDR] [--port N] [--connections N] "
+              << "[--pipeline N] [--seconds N] [--threads N]" << std::endl;
+}
+
+/**
+ * Parses the value of a numeric option, complaining if it isn't a number
+ * between minValue and maxValue
+ */
+bool parseOption( const char * name,
+                  const char * text,
+                  uint64_t minValue,
+                  uint64_t maxValue,
+                  uint64_t& value )
+{
+    if ( ! parseNumber( text, minValue, maxValue, value ) )
+    {
+        std::cerr << name << " must be between " << minValue << " and "
+                  << maxValue << ": " << text << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main( int argc, char* argv[] )
+{
+    Benchmark bench;
+    std::string host    = "127.0.0.1";
+    unsigned short port = 4200;
+
+    bench.threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( i + 1 >= argc )
+        {
+            printUsage();
+            return 1;
+        }
+
+        const char * name = argv[i];
+        const char * text = argv[i + 1];
+        uint64_t value    = 0;
+
+        if ( strcmp( name, "--host" ) == 0 )
+        {
+            host = text;
+        }
+        else if ( strcmp( name, "--port" ) == 0 && parseOption( name, text, 1, 65535, value ) )
+        {
+            port = static_cast<unsigned short>( value );
+        }
+        else if ( strcmp( name, "--connections" ) == 0 &&
+                  parseOption( name, text, 1, MAX_CONNECTIONS, value ) )
+        {
+            bench.connections = value;
+        }
+        else if ( strcmp( name, "--pipeline" ) == 0 && parseOption( name, text, 1, MAX_PIPELINE, value ) )
+        {
+            bench.pipeline = value;
+        }
+        else if ( strcmp( name, "--seconds" ) == 0 && parseOption( name, text, 1, MAX_SECONDS, value ) )
+        {
+            bench.seconds = value;
+        }
+        else if ( strcmp( name, "--threads" ) == 0 && parseOption( name, text, 1, MAX_THREADS, value ) )
+        {
+            bench.threads = value;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+
+        ++i;
+    }
+
+    boost::system::error_code error;
+    ip::address address = ip::address::from_string( host, error );
+
+    if ( error )
+    {
+        std::cerr << "--host must be an IP address: " << host << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    bench.endpoint = tcp::endpoint( address, port );
+
+    IoServicePool pool( bench.threads );
+    std::vector<boost::shared_ptr<Connector> > connectors;
+
+    for ( std::size_t i = 0; i < bench.threads; ++i )
+    {
+        std::size_t count = bench.connections / bench.threads
+                          + ( i < bench.connections % bench.threads ? 1 : 0 );
+
+        boost::shared_ptr<Connector> connector(
+            new Connector( pool.at( i ), bench, count ) );
+
+        connectors.push_back( connector );
+        pool.at( i ).post( boost::bind( &Connector::start, connector ) );
+    }
+
+    std::thread runner( boost::bind( &IoServicePool::run, &pool ) );
+
+    while ( bench.connected + bench.failed < bench.connections )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    }
+
+    std::cout << "Connected " << bench.connected << " clients ("
+              << bench.failed << " failed)" << std::endl;
+
+    // Warm up for a second, then count what the server answers
+    std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+
+    uint64_t answeredBefore = bench.answered;
+    uint64_t bytesBefore    = bench.bytes;
+    Clock::time_point start = Clock::now();
+
+    std::this_thread::sleep_for( std::chrono::seconds( bench.seconds ) );
+
+    uint64_t answered = bench.answered - answeredBefore;
+    uint64_t bytes    = bench.bytes - bytesBefore;
+    double elapsed    = std::chrono::duration<double>( Clock::now() - start ).count();
+
+    for ( std::size_t i = 0; i < connectors.size(); ++i )
+    {
+        pool.at( i ).post( boost::bind( &Connector::stop, connectors[i] ) );
+    }
+
+    pool.stop();
+    runner.join();
+
+    std::cout << "Quotes answered: " << answered << " in " << std::fixed
+              << std::setprecision( 2 ) << elapsed << "s" << std::endl;
+    std::cout << "Requests/sec: " << std::setprecision( 0 )
+              << answered / elapsed << " ("
+              << std::setprecision( 1 ) << bytes / elapsed / ( 1024 * 1024 )
+              << " MB/s)" << std::endl;
+
+    return 0;
+}
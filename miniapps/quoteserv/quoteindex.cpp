@@ -0,0 +1,109 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "quoteindex.h"
+
+QuoteIndex::QuoteIndex()
+    : m_pData( NULL ),
+      m_dataSize( 0 ),
+      m_quotes()
+{
+}
+
+QuoteIndex::~QuoteIndex()
+{
+    unload();
+}
+
+bool QuoteIndex::load( const std::string& filepath )
+{
+    unload();
+
+    int fd = open( filepath.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if ( fstat( fd, &info ) != 0 || info.st_size == 0 )
+    {
+        close( fd );
+        return false;
+    }
+
+    // The mapping keeps the file alive, so the descriptor can go
+    void * pData = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( pData == MAP_FAILED )
+    {
+        return false;
+    }
+
+    m_pData    = static_cast<const char*>( pData );
+    m_dataSize = static_cast<std::size_t>( info.st_size );
+
+    //
+    // Find the start and end of every line
+    //
+    const char * pEnd  = m_pData + m_dataSize;
+    const char * pLine = m_pData;
+
+    while ( pLine < pEnd )
+    {
+        const char * pNewline = static_cast<const char*>(
+            memchr( pLine, '\n', pEnd - pLine ) );
+        const char * pLineEnd = ( pNewline != NULL ? pNewline : pEnd );
+
+        std::size_t length = pLineEnd - pLine;
+
+        if ( length > 0 && pLine[length - 1] == '\r' )
+        {
+            length -= 1;
+        }
+
+        if ( length > 0 )
+        {
+            QuoteSpan span = { static_cast<std::size_t>( pLine - m_pData ), length };
+            m_quotes.push_back( span );
+        }
+
+        pLine = pLineEnd + 1;
+    }
+
+    return ( ! m_quotes.empty() );
+}
+
+std::size_t QuoteIndex::size() const
+{
+    return m_quotes.size();
+}
+
+boost::asio::const_buffer QuoteIndex::quote( std::size_t index ) const
+{
+    assert( index < m_quotes.size() );
+
+    const QuoteSpan& span = m_quotes[index];
+    return boost::asio::const_buffer( m_pData + span.offset, span.length );
+}
+
+void QuoteIndex::unload()
+{
+    if ( m_pData != NULL )
+    {
+        munmap( const_cast<char*>( m_pData ), m_dataSize );
+    }
+
+    m_pData    = NULL;
+    m_dataSize = 0;
+    m_quotes.clear();
+}
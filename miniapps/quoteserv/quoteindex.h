@@ -0,0 +1,59 @@
+#ifndef QUOTESERV_QUOTEINDEX_H
+#define QUOTESERV_QUOTEINDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+/**
+ * A read only list of quotes, one per line of a text file.
+ *
+ * The file is mapped into memory as it is and never copied. Loading it
+ * just records where each quote starts and how long it is, and a quote
+ * is handed out as a buffer pointing straight into the mapped file, which
+ * can be passed to a gathered socket write as is. Nothing changes after
+ * load() returns, so any number of threads can share one index without
+ * locking.
+ */
+class QuoteIndex
+{
+public:
+    QuoteIndex();
+    ~QuoteIndex();
+
+    /**
+     * Maps a quote file into memory and indexes it. Blank lines are
+     * skipped and line endings are not part of the quotes
+     *
+     * \return  True if the file was loaded and has at least one quote
+     */
+    bool load( const std::string& filepath );
+
+    /**
+     * Number of quotes in the index
+     */
+    std::size_t size() const;
+
+    /**
+     * The text of a quote, without its line ending
+     */
+    boost::asio::const_buffer quote( std::size_t index ) const;
+
+private:
+    QuoteIndex( const QuoteIndex& );
+    QuoteIndex& operator = ( const QuoteIndex& );
+
+    void unload();
+
+    struct QuoteSpan
+    {
+        std::size_t offset;
+        std::size_t length;
+    };
+
+    const char * m_pData;
+    std::size_t m_dataSize;
+    std::vector<QuoteSpan> m_quotes;
+};
+
+#endif
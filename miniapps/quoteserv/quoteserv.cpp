@@ -2,83 +2,352 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include "quoteindex.h"
+#include "iopool.h"
+#include "listener.h"
+#include "options.h"
 
 using boost::asio::ip::tcp;
+using namespace boost::asio;
 
 const int PORT = 4200;
 
-typedef std::vector<std::string> QuoteList;
+namespace
+{
+    // Most quotes sent back in one gathered write
+    const std::size_t MAX_QUOTES_PER_WRITE = 64;
+
+    const char LINE_END[] = "\r\n";
+
+    // How long to wait before accepting again after accept fails, which
+    // usually means the process is out of file descriptors
+    const long ACCEPT_RETRY_MS = 100;
 
-bool loadQuoteList( const std::string& file, QuoteList& output );
+    // Most io_service threads that can be asked for
+    const uint64_t MAX_THREADS = 1024;
+}
 
-int main()
+/**
+ * A client asking for quotes. Like the classic quote of the day service a
+ * quote is sent as soon as the client connects, and after that the client
+ * gets another quote for every newline it sends. Requests that arrive
+ * together are answered together with a single gathered write.
+ *
+ * Quotes are never copied: the write is made of buffers that point into
+ * the memory mapped quote file, with a shared line ending between them.
+ * The connection doesn't read any more requests while it is writing, so a
+ * client that stops reading only holds up itself.
+ */
+class QuoteConnection : public boost::enable_shared_from_this<QuoteConnection>
 {
-    //
-    // Load quote list
-    //
-    QuoteList quotes;
+public:
+    typedef boost::shared_ptr<QuoteConnection> pointer;
 
-    if (! loadQuoteList( "quotes.txt", quotes ) )
+    static pointer create( io_service& ioService,
+                           const QuoteIndex& quotes,
+                           unsigned int seed )
     {
-        std::cerr << "Failed to load list of quotes. Exiting." << std::endl;
-        return 1;
+        return pointer( new QuoteConnection( ioService, quotes, seed ) );
     }
 
-    //
-    // Enter server mode
-    //
-    try
+    tcp::socket& socket()
     {
-        boost::asio::io_service io_service;
+        return m_socket;
+    }
 
-        // Listen for connections on requested port
-        tcp::acceptor acceptor( io_service, tcp::endpoint(tcp::v4(),PORT) );
+    void start()
+    {
+        boost::system::error_code error;
+        m_socket.set_option( tcp::no_delay( true ), error );
+
+        m_pending = 1;
+        sendQuotes();
+    }
+
+private:
+    QuoteConnection( io_service& ioService,
+                     const QuoteIndex& quotes,
+                     unsigned int seed )
+        : m_socket( ioService ),
+          m_quotes( quotes ),
+          m_random( seed ),
+          m_gathered(),
+          m_pending( 0 )
+    {
+        m_gathered.reserve( MAX_QUOTES_PER_WRITE * 2 );
+    }
+
+    void startRead()
+    {
+        m_socket.async_read_some(
+            buffer( m_input, sizeof( m_input ) ),
+            boost::bind( &QuoteConnection::handleRead,
+                         shared_from_this(),
+                         boost::asio::placeholders::error,
+                         boost::asio::placeholders::bytes_transferred )
+        );
+    }
 
-        // Handle requests as they come in (one at a time)
-        while ( true )
+    void handleRead( const boost::system::error_code& error,
+                     size_t bytesTransferred )
+    {
+        if ( error )
         {
-            tcp::socket socket( io_service );
-            accetor.accept( socket );
+            return;
+        }
 
-            std::string message = "hello there";
+        m_pending += std::count( m_input, m_input + bytesTransferred, '\n' );
 
-            boost::system::error_code ignored_error;
-            boost::asio::write(
-                    socket,
-                    boost::asio::buffer(message),
-                    boost::asio::transfer_all(),
-                    ignored_error
-            );
+        if ( m_pending > 0 )
+        {
+            sendQuotes();
+        }
+        else
+        {
+            startRead();
+        }
+    }
+
+    void sendQuotes()
+    {
+        std::size_t count = std::min( m_pending, MAX_QUOTES_PER_WRITE );
+        m_gathered.clear();
 
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            m_gathered.push_back( m_quotes.quote( m_random() % m_quotes.size() ) );
+            m_gathered.push_back( buffer( LINE_END, sizeof( LINE_END ) - 1 ) );
         }
+
+        m_pending -= count;
+
+        boost::asio::async_write(
+            m_socket,
+            m_gathered,
+            boost::bind( &QuoteConnection::handleWrite,
+                         shared_from_this(),
+                         boost::asio::placeholders::error )
+        );
     }
-    catch ( std::exception& e )
+
+    void handleWrite( const boost::system::error_code& error )
     {
-        std::cerr << "FATAL EXCEPTION: " << e.what() << std::endl;
+        if ( error )
+        {
+            return;
+        }
+
+        if ( m_pending > 0 )
+        {
+            sendQuotes();
+        }
+        else
+        {
+            startRead();
+        }
     }
 
-    return 0;
-}
+private:
+    tcp::socket m_socket;
+    const QuoteIndex& m_quotes;
+    std::minstd_rand m_random;
+    std::vector<const_buffer> m_gathered;
+    std::size_t m_pending;
+    char m_input[512];
+};
+
+/**
+ * Accepts clients and spreads them across the io_service pool, with one
+ * listener per io_service where the platform lets them share a port. A
+ * listener whose accept fails waits a moment before trying again, rather
+ * than spinning while the process is out of file descriptors
+ */
+class QuoteServer
+{
+public:
+    QuoteServer( IoServicePool& pool, const QuoteIndex& quotes, unsigned short port )
+        : m_pool( pool ),
+          m_quotes( quotes ),
+          m_acceptors(),
+          m_retryTimers(),
+          m_seeds()
+    {
+        tcp::endpoint endpoint( tcp::v4(), port );
+        std::size_t listeners = ( canSharePort() ? m_pool.size() : 1 );
+
+        for ( std::size_t i = 0; i < listeners; ++i )
+        {
+            m_acceptors.push_back(
+                openListener( m_pool.at( i ), endpoint, canSharePort() ) );
+            m_retryTimers.push_back( TimerPtr( new deadline_timer( m_pool.at( i ) ) ) );
+            m_seeds.push_back( static_cast<unsigned int>( time( NULL ) + i * 7919 ) );
 
+            startAccept( i );
+        }
+    }
+
+private:
+    void startAccept( std::size_t listener )
+    {
+        std::size_t shard = ( canSharePort() ? listener : m_pool.next() );
 
-bool loadQuoteList( const std::string& filepath, QuoteList& output )
+        // Each listener is only used by one thread, so its seed needs no lock
+        QuoteConnection::pointer connection =
+            QuoteConnection::create( m_pool.at( shard ),
+                                     m_quotes,
+                                     m_seeds[listener]++ );
+
+        m_acceptors[listener]->async_accept( connection->socket(),
+            boost::bind( &QuoteServer::handleAccept,
+                         this,
+                         listener,
+                         shard,
+                         connection,
+                         boost::asio::placeholders::error )
+        );
+    }
+
+    void handleAccept( std::size_t listener,
+                       std::size_t shard,
+                       QuoteConnection::pointer newConnection,
+                       const boost::system::error_code& error )
+    {
+        if ( error == boost::asio::error::operation_aborted )
+        {
+            return;
+        }
+        else if ( error )
+        {
+            std::cerr << "Failed to accept connection: "
+                      << error.message() << std::endl;
+
+            m_retryTimers[listener]->expires_from_now(
+                boost::posix_time::milliseconds( ACCEPT_RETRY_MS ) );
+            m_retryTimers[listener]->async_wait(
+                boost::bind( &QuoteServer::handleRetry,
+                             this,
+                             listener,
+                             boost::asio::placeholders::error ) );
+            return;
+        }
+        else
+        {
+            m_pool.at( shard ).post(
+                boost::bind( &QuoteConnection::start, newConnection ) );
+        }
+
+        startAccept( listener );
+    }
+
+    void handleRetry( std::size_t listener, const boost::system::error_code& error )
+    {
+        if ( error != boost::asio::error::operation_aborted )
+        {
+            startAccept( listener );
+        }
+    }
+
+private:
+    typedef boost::shared_ptr<deadline_timer> TimerPtr;
+
+    IoServicePool& m_pool;
+    const QuoteIndex& m_quotes;
+    std::vector<AcceptorPtr> m_acceptors;
+    std::vector<TimerPtr> m_retryTimers;
+    std::vector<unsigned int> m_seeds;
+};
+
+void printUsage()
 {
-    std::ifstream file( filepath.c_str(), std::ios_base::in );
-    std::string line;
+    std::cerr << "Usage: quoteserv [--file QUOTES] [--port N] [--threads N]"
+              << std::endl;
+}
+
+int main( int argc, char* argv[] )
+{
+    std::string quoteFile = "quotes.txt";
+    unsigned short port   = PORT;
+    std::size_t threads   = std::thread::hardware_concurrency();
+    uint64_t value        = 0;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--file" ) == 0 && i + 1 < argc )
+        {
+            quoteFile = argv[++i];
+        }
+        else if ( strcmp( argv[i], "--port" ) == 0 && i + 1 < argc )
+        {
+            if ( ! parseNumber( argv[++i], 1, 65535, value ) )
+            {
+                std::cerr << "Port must be between 1 and 65535: " << argv[i] << std::endl;
+                printUsage();
+                return 1;
+            }
+
+            port = static_cast<unsigned short>( value );
+        }
+        else if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc )
+        {
+            if ( ! parseNumber( argv[++i], 1, MAX_THREADS, value ) )
+            {
+                std::cerr << "Thread count must be between 1 and "
+                          << MAX_THREADS << ": " << argv[i] << std::endl;
+                printUsage();
+                return 1;
+            }
+
+            threads = static_cast<std::size_t>( value );
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
 
-    // Did the file open?
-    if ( filepath.good() == false )
+    //
+    // Load quote list
+    //
+    QuoteIndex quotes;
+
+    if (! quotes.load( quoteFile ) )
     {
-        return false;
+        std::cerr << "Failed to load list of quotes. Exiting." << std::endl;
+        return 1;
     }
 
-    // Read each line and append to quote list
-    //  (not very efficient, but we do this once on startup)
-    while ( std::getline( file, line, '\n' ) )
+    //
+    // Enter server mode
+    //
+    try
+    {
+        IoServicePool pool( std::max<std::size_t>( threads, 1 ) );
+        QuoteServer server( pool, quotes, port );
+
+        signal_set signals( pool.at( 0 ), SIGINT, SIGTERM );
+        signals.async_wait( boost::bind( &IoServicePool::stop, &pool ) );
+
+        std::cout << "quoteserv serving " << quotes.size() << " quotes on port "
+                  << port << " with " << pool.size() << " threads" << std::endl;
+
+        pool.run();
+    }
+    catch ( std::exception& e )
     {
-        output.push_back( line );
+        std::cerr << "FATAL EXCEPTION: " << e.what() << std::endl;
+        return 1;
     }
 
-    return true;
+    return 0;
 }
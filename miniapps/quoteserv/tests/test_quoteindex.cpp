@@ -0,0 +1,108 @@
+#include "quoteindex.h"
+
+#include <googletest/googletest.h>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace
+{
+    /**
+     * A file in the temp directory holding the given text, removed again
+     * when it goes out of scope
+     */
+    class TempFile
+    {
+    public:
+        explicit TempFile( const std::string& text )
+            : m_path( "/tmp/quoteindex-XXXXXX" )
+        {
+            int fd = mkstemp( &m_path[0] );
+
+            if ( fd < 0 ||
+                 write( fd, text.data(), text.size() ) != static_cast<ssize_t>( text.size() ) )
+            {
+                ADD_FAILURE() << "Could not write test file " << m_path;
+            }
+
+            if ( fd >= 0 )
+            {
+                close( fd );
+            }
+        }
+
+        ~TempFile()
+        {
+            unlink( m_path.c_str() );
+        }
+
+        const std::string& path() const { return m_path; }
+
+    private:
+        std::string m_path;
+    };
+
+    std::string quoteText( const QuoteIndex& quotes, std::size_t index )
+    {
+        boost::asio::const_buffer quote = quotes.quote( index );
+        return std::string( static_cast<const char*>( quote.data() ), quote.size() );
+    }
+}
+
+TEST(QuoteIndex,SkipsBlankLines)
+{
+    TempFile file( "one\n\ntwo\n\n\nthree\n" );
+    QuoteIndex quotes;
+
+    ASSERT_TRUE( quotes.load( file.path() ) );
+    ASSERT_EQ( 3u, quotes.size() );
+    EXPECT_EQ( "one", quoteText( quotes, 0 ) );
+    EXPECT_EQ( "two", quoteText( quotes, 1 ) );
+    EXPECT_EQ( "three", quoteText( quotes, 2 ) );
+}
+
+TEST(QuoteIndex,StripsCarriageReturns)
+{
+    TempFile file( "one\r\n\r\ntwo \r\n" );
+    QuoteIndex quotes;
+
+    ASSERT_TRUE( quotes.load( file.path() ) );
+    ASSERT_EQ( 2u, quotes.size() );
+    EXPECT_EQ( "one", quoteText( quotes, 0 ) );
+    EXPECT_EQ( "two ", quoteText( quotes, 1 ) );
+}
+
+TEST(QuoteIndex,LastLineNeedsNoNewline)
+{
+    TempFile file( "one\ntwo" );
+    QuoteIndex quotes;
+
+    ASSERT_TRUE( quotes.load( file.path() ) );
+    ASSERT_EQ( 2u, quotes.size() );
+    EXPECT_EQ( "two", quoteText( quotes, 1 ) );
+}
+
+TEST(QuoteIndex,FilesWithoutQuotesFailToLoad)
+{
+    TempFile empty( "" ), blank( "\n\r\n\n" );
+    QuoteIndex quotes;
+
+    EXPECT_FALSE( quotes.load( empty.path() ) );
+    EXPECT_EQ( 0u, quotes.size() );
+
+    EXPECT_FALSE( quotes.load( blank.path() ) );
+    EXPECT_EQ( 0u, quotes.size() );
+
+    EXPECT_FALSE( quotes.load( empty.path() + "-missing" ) );
+}
+
+TEST(QuoteIndex,LoadingAgainReplacesTheQuotes)
+{
+    TempFile first( "a\nb\nc\n" ), second( "d\n" );
+    QuoteIndex quotes;
+
+    ASSERT_TRUE( quotes.load( first.path() ) );
+    ASSERT_TRUE( quotes.load( second.path() ) );
+    ASSERT_EQ( 1u, quotes.size() );
+    EXPECT_EQ( "d", quoteText( quotes, 0 ) );
+}
@@ -1,157 +1,988 @@
-#include <common/geom/point.h>
-#include <common/geom/vector.h>
+/**
+ * Builds meshes for chunks of cubes, and benchmarks three ways of doing it:
+ *
+ *  1. naive:  all six faces of every solid cube
+ *  2. culled: only faces that touch an empty cube
+ *  3. greedy: culled faces, with coplanar faces of the same material merged
+ *             into as few rectangles as possible
+ *
+ * Meshes are written into reusable vertex buffers, and the greedy mesher
+ * also runs on a pool of worker threads that only remeshes chunks that have
+ * been edited since they were last built.
+ *
+ * Usage: cubechunk [threads] [frames]
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <stdexcept>
+#include <stdint.h>
 
-typedef size_t Material;
+typedef uint16_t Material;
 
-struct Face
+const Material EMPTY_MATERIAL = 0;
+const int CHUNK_SIZE          = 32;
+const int PADDED_SIZE         = CHUNK_SIZE + 2;
+
+//
+// Faces are numbered by axis and direction
+// 0. -x --> left
+// 1. +x --> right
+// 2. -y --> bottom
+// 3. +y --> top
+// 4. -z --> back
+// 5. +z --> front
+//
+const int FACE_COUNT = 6;
+
+struct CubeVertex
 {
-    Face( size_t a, size_t b, size_t c )
-        : a(a), b(b), c(c)
+    float    x, y, z;
+    float    u, v;          // in cubes, so textures repeat across merged faces
+    Material material;
+    uint8_t  face;
+    uint8_t  padding;
+};
+
+/**
+ * Growable vertex and index buffers that keep their storage between builds.
+ * Once a buffer has been used for a couple of chunks it has room for a
+ * typical mesh, and building into it again does not allocate
+ */
+class MeshBuffer
+{
+public:
+    MeshBuffer( size_t quadCapacity = 4096 )
+        : m_vertices( quadCapacity * 4 ),
+          m_indices( quadCapacity * 6 ),
+          m_quadCount( 0 )
     {
     }
 
-    size_t operator []( size_t index ) const
+    void clear()
     {
-        assert( index < 3 );
+        m_quadCount = 0;
+    }
 
-        switch( index )
+    /**
+     * Appends a quad and returns its four vertices to be filled in. They
+     * are drawn as the triangles (0, 1, 2) and (0, 2, 3)
+     */
+    CubeVertex * addQuad()
+    {
+        if ( ( m_quadCount + 1 ) * 4 > m_vertices.size() )
         {
-            case 0:
-                return a;
-            case 1:
-                return b;
-            case 2:
-                return c;
+            m_vertices.resize( m_vertices.size() * 2 + 4 );
+            m_indices.resize( m_indices.size() * 2 + 6 );
         }
+
+        uint32_t   base = static_cast<uint32_t>( m_quadCount * 4 );
+        uint32_t * pIdx = &m_indices[ m_quadCount * 6 ];
+
+        pIdx[0] = base;     pIdx[1] = base + 1; pIdx[2] = base + 2;
+        pIdx[3] = base;     pIdx[4] = base + 2; pIdx[5] = base + 3;
+
+        return &m_vertices[ m_quadCount++ * 4 ];
+    }
+
+    size_t quadCount() const
+    {
+        return m_quadCount;
+    }
+
+    size_t triangleCount() const
+    {
+        return m_quadCount * 2;
     }
 
-    size_t a;
-    size_t b;
-    size_t c;
+    size_t vertexCount() const
+    {
+        return m_quadCount * 4;
+    }
+
+    const CubeVertex * vertices() const
+    {
+        return &m_vertices[0];
+    }
+
+    const uint32_t * indices() const
+    {
+        return &m_indices[0];
+    }
+
+    /**
+     * Returns the number of bytes the mesh takes up on the GPU
+     */
+    size_t meshBytes() const
+    {
+        return m_quadCount * ( 4 * sizeof(CubeVertex) + 6 * sizeof(uint32_t) );
+    }
+
+private:
+    std::vector<CubeVertex> m_vertices;
+    std::vector<uint32_t>   m_indices;
+    size_t                  m_quadCount;
 };
 
-struct FaceList
+/**
+ * A copy of a chunk's cubes along with a one cube border taken from its
+ * neighbours, which is everything needed to decide which faces are
+ * visible. Meshing a copy lets the world keep being edited while a worker
+ * thread builds the mesh
+ */
+struct PaddedChunk
 {
-    void add( const Face& f )
+    Material at( int x, int y, int z ) const
     {
-        faces.push_back( f );
+        return cubes[ ( ( z + 1 ) * PADDED_SIZE + ( y + 1 ) ) * PADDED_SIZE + ( x + 1 ) ];
     }
 
-    std::vector<Face> faces;
+    Material cubes[ PADDED_SIZE * PADDED_SIZE * PADDED_SIZE ];
 };
 
-struct Cube
+/**
+ * Emits a w x h quad lying in the plane at position 'plane' along axis d.
+ * a and b are its lowest corner along the other two axes
+ */
+void emitQuad( MeshBuffer& mesh,
+               int face, int plane, int a, int b, int w, int h,
+               Material material )
+{
+    const int d = face / 2;
+    const int u = ( d + 1 ) % 3;
+    const int v = ( d + 2 ) % 3;
+
+    // Corners go counter clockwise when seen from the front of the face.
+    // Since u x v points along +d, a negative face has to flip the order
+    int corners[4][2] = { { a, b }, { a + w, b }, { a + w, b + h }, { a, b + h } };
+    int order[4]      = { 0, 1, 2, 3 };
+
+    if ( face % 2 == 0 )
+    {
+        order[1] = 3;
+        order[3] = 1;
+    }
+
+    CubeVertex * pVerts = mesh.addQuad();
+
+    for ( int i = 0; i < 4; ++i )
+    {
+        float pos[3];
+
+        pos[d] = static_cast<float>( plane );
+        pos[u] = static_cast<float>( corners[ order[i] ][0] );
+        pos[v] = static_cast<float>( corners[ order[i] ][1] );
+
+        pVerts[i].x        = pos[0];
+        pVerts[i].y        = pos[1];
+        pVerts[i].z        = pos[2];
+        pVerts[i].u        = static_cast<float>( corners[ order[i] ][0] - a );
+        pVerts[i].v        = static_cast<float>( corners[ order[i] ][1] - b );
+        pVerts[i].material = material;
+        pVerts[i].face     = static_cast<uint8_t>( face );
+        pVerts[i].padding  = 0;
+    }
+}
+
+/**
+ * Emits every face of every solid cube, the way the old CubePos table
+ * based builder did
+ */
+void buildNaiveMesh( const PaddedChunk& chunk, MeshBuffer& mesh )
+{
+    mesh.clear();
+
+    for ( int z = 0; z < CHUNK_SIZE; ++z )
+    for ( int y = 0; y < CHUNK_SIZE; ++y )
+    for ( int x = 0; x < CHUNK_SIZE; ++x )
+    {
+        Material material = chunk.at( x, y, z );
+
+        if ( material == EMPTY_MATERIAL )
+        {
+            continue;
+        }
+
+        for ( int face = 0; face < FACE_COUNT; ++face )
+        {
+            int pos[3] = { x, y, z };
+            int d = face / 2;
+
+            emitQuad( mesh, face, pos[d] + face % 2,
+                      pos[ ( d + 1 ) % 3 ], pos[ ( d + 2 ) % 3 ], 1, 1, material );
+        }
+    }
+}
+
+/**
+ * Emits only the faces of solid cubes that are next to an empty cube
+ */
+void buildCulledMesh( const PaddedChunk& chunk, MeshBuffer& mesh )
 {
-    Point    pos;
-    Material mat;
+    static const int STEP[FACE_COUNT][3] =
+        { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+
+    mesh.clear();
+
+    for ( int z = 0; z < CHUNK_SIZE; ++z )
+    for ( int y = 0; y < CHUNK_SIZE; ++y )
+    for ( int x = 0; x < CHUNK_SIZE; ++x )
+    {
+        Material material = chunk.at( x, y, z );
+
+        if ( material == EMPTY_MATERIAL )
+        {
+            continue;
+        }
+
+        for ( int face = 0; face < FACE_COUNT; ++face )
+        {
+            if ( chunk.at( x + STEP[face][0], y + STEP[face][1], z + STEP[face][2] ) !=
+                 EMPTY_MATERIAL )
+            {
+                continue;
+            }
+
+            int pos[3] = { x, y, z };
+            int d = face / 2;
+
+            emitQuad( mesh, face, pos[d] + face % 2,
+                      pos[ ( d + 1 ) % 3 ], pos[ ( d + 2 ) % 3 ], 1, 1, material );
+        }
+    }
+}
+
+/**
+ * Emits the same visible faces as buildCulledMesh, but merges neighbouring
+ * faces that share a plane, direction and material into rectangles.
+ *
+ * Each slice of the chunk is turned into a mask of the visible faces on it,
+ * and rectangles are pulled out of the mask greedily: grow as wide as
+ * possible, then as tall as every row allows, then clear what was used
+ */
+void buildGreedyMesh( const PaddedChunk& chunk, MeshBuffer& mesh )
+{
+    // Walk the padded cubes directly: the offset of cube (0, 0, 0) and how
+    // far apart neighbours along each axis are
+    static const int ORIGIN    = ( PADDED_SIZE + 1 ) * PADDED_SIZE + 1;
+    static const int STRIDE[3] = { 1, PADDED_SIZE, PADDED_SIZE * PADDED_SIZE };
+
+    Material mask[ CHUNK_SIZE * CHUNK_SIZE ];
+
+    mesh.clear();
+
+    for ( int face = 0; face < FACE_COUNT; ++face )
+    {
+        const int d    = face / 2;
+        const int u    = ( d + 1 ) % 3;
+        const int v    = ( d + 2 ) % 3;
+        const int step = ( face % 2 == 0 ? -1 : 1 );
+
+        for ( int slice = 0; slice < CHUNK_SIZE; ++slice )
+        {
+            bool anyVisible = false;
+
+            for ( int b = 0; b < CHUNK_SIZE; ++b )
+            {
+                const Material * pCube = chunk.cubes + ORIGIN + slice * STRIDE[d] +
+                                         b * STRIDE[v];
+                const int across       = STRIDE[u];
+                const int neighbour    = step * STRIDE[d];
+
+                for ( int a = 0; a < CHUNK_SIZE; ++a, pCube += across )
+                {
+                    bool visible = ( *pCube != EMPTY_MATERIAL &&
+                                     pCube[neighbour] == EMPTY_MATERIAL );
+
+                    mask[ b * CHUNK_SIZE + a ] = ( visible ? *pCube : EMPTY_MATERIAL );
+                    anyVisible |= visible;
+                }
+            }
+
+            if ( ! anyVisible )
+            {
+                continue;
+            }
+
+            for ( int b = 0; b < CHUNK_SIZE; ++b )
+            {
+                for ( int a = 0; a < CHUNK_SIZE; )
+                {
+                    Material material = mask[ b * CHUNK_SIZE + a ];
+
+                    if ( material == EMPTY_MATERIAL )
+                    {
+                        ++a;
+                        continue;
+                    }
+
+                    int w = 1;
+
+                    while ( a + w < CHUNK_SIZE && mask[ b * CHUNK_SIZE + a + w ] == material )
+                    {
+                        ++w;
+                    }
+
+                    int h = 1;
+
+                    for ( ; b + h < CHUNK_SIZE; ++h )
+                    {
+                        const Material * pRow = &mask[ ( b + h ) * CHUNK_SIZE + a ];
+                        int k = 0;
+
+                        while ( k < w && pRow[k] == material )
+                        {
+                            ++k;
+                        }
+
+                        if ( k < w )
+                        {
+                            break;
+                        }
+                    }
+
+                    emitQuad( mesh, face, slice + face % 2, a, b, w, h, material );
+
+                    for ( int row = 0; row < h; ++row )
+                    {
+                        std::fill( &mask[ ( b + row ) * CHUNK_SIZE + a ],
+                                   &mask[ ( b + row ) * CHUNK_SIZE + a + w ],
+                                   EMPTY_MATERIAL );
+                    }
+
+                    a += w;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * A world made of CHUNK_SIZE^3 chunks. Every edit bumps the version of the
+ * chunk it lands in, and of any neighbouring chunk whose border faces it
+ * could change, and adds them to a list of chunks needing a new mesh
+ */
+class CubeWorld
+{
+public:
+    CubeWorld( int chunksWide, int chunksHigh, int chunksDeep )
+        : m_chunksWide( chunksWide ),
+          m_chunksHigh( chunksHigh ),
+          m_chunksDeep( chunksDeep ),
+          m_cubes( static_cast<size_t>( chunksWide ) * chunksHigh * chunksDeep *
+                   CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE, EMPTY_MATERIAL ),
+          m_versions( chunkCount(), 0 ),
+          m_dirty( chunkCount(), false ),
+          m_dirtyList()
+    {
+    }
+
+    size_t chunkCount() const
+    {
+        return static_cast<size_t>( m_chunksWide ) * m_chunksHigh * m_chunksDeep;
+    }
+
+    int width() const  { return m_chunksWide * CHUNK_SIZE; }
+    int height() const { return m_chunksHigh * CHUNK_SIZE; }
+    int depth() const  { return m_chunksDeep * CHUNK_SIZE; }
+
+    /**
+     * Returns the material at a position, treating everything outside of
+     * the world as empty
+     */
+    Material get( int x, int y, int z ) const
+    {
+        if ( x < 0 || y < 0 || z < 0 || x >= width() || y >= height() || z >= depth() )
+        {
+            return EMPTY_MATERIAL;
+        }
+
+        return m_cubes[ cubeIndex( x, y, z ) ];
+    }
+
+    void set( int x, int y, int z, Material material )
+    {
+        assert( x >= 0 && y >= 0 && z >= 0 );
+        assert( x < width() && y < height() && z < depth() );
+
+        Material& cube = m_cubes[ cubeIndex( x, y, z ) ];
+
+        if ( cube == material )
+        {
+            return;
+        }
+
+        cube = material;
+
+        // A cube on the edge of its chunk is part of its neighbour's border
+        for ( int dz = -1; dz <= 1; ++dz )
+        for ( int dy = -1; dy <= 1; ++dy )
+        for ( int dx = -1; dx <= 1; ++dx )
+        {
+            int cx = ( x + dx ) / CHUNK_SIZE;
+            int cy = ( y + dy ) / CHUNK_SIZE;
+            int cz = ( z + dz ) / CHUNK_SIZE;
+
+            if ( x + dx >= 0 && y + dy >= 0 && z + dz >= 0 &&
+                 cx < m_chunksWide && cy < m_chunksHigh && cz < m_chunksDeep )
+            {
+                touchChunk( chunkIndex( cx, cy, cz ) );
+            }
+        }
+    }
+
+    /**
+     * Returns the current version of a chunk
+     */
+    uint32_t version( size_t chunk ) const
+    {
+        return m_versions[chunk];
+    }
+
+    /**
+     * Moves the list of chunks edited since the last call into 'chunks'
+     */
+    void takeDirtyChunks( std::vector<size_t>& chunks )
+    {
+        chunks.clear();
+        chunks.swap( m_dirtyList );
+
+        for ( size_t i = 0; i < chunks.size(); ++i )
+        {
+            m_dirty[ chunks[i] ] = false;
+        }
+    }
+
+    /**
+     * Copies a chunk, and a one cube border around it, for meshing
+     */
+    void copyChunk( size_t chunk, PaddedChunk& out ) const
+    {
+        int cx = static_cast<int>( chunk % m_chunksWide ) * CHUNK_SIZE;
+        int cy = static_cast<int>( ( chunk / m_chunksWide ) % m_chunksHigh ) * CHUNK_SIZE;
+        int cz = static_cast<int>( chunk / ( m_chunksWide * m_chunksHigh ) ) * CHUNK_SIZE;
+
+        Material * pOut = out.cubes;
+
+        for ( int z = -1; z <= CHUNK_SIZE; ++z )
+        {
+            for ( int y = -1; y <= CHUNK_SIZE; ++y )
+            {
+                *pOut++ = get( cx - 1, cy + y, cz + z );
+
+                // The middle of each row comes straight out of the world
+                if ( cy + y >= 0 && cy + y < height() && cz + z >= 0 && cz + z < depth() )
+                {
+                    memcpy( pOut, &m_cubes[ cubeIndex( cx, cy + y, cz + z ) ],
+                            CHUNK_SIZE * sizeof(Material) );
+                }
+                else
+                {
+                    std::fill( pOut, pOut + CHUNK_SIZE, EMPTY_MATERIAL );
+                }
+
+                pOut += CHUNK_SIZE;
+                *pOut++ = get( cx + CHUNK_SIZE, cy + y, cz + z );
+            }
+        }
+    }
+
+private:
+    size_t cubeIndex( int x, int y, int z ) const
+    {
+        return ( static_cast<size_t>( z ) * height() + y ) * width() + x;
+    }
+
+    size_t chunkIndex( int cx, int cy, int cz ) const
+    {
+        return ( static_cast<size_t>( cz ) * m_chunksHigh + cy ) * m_chunksWide + cx;
+    }
+
+    void touchChunk( size_t chunk )
+    {
+        m_versions[chunk]++;
+
+        if ( ! m_dirty[chunk] )
+        {
+            m_dirty[chunk] = true;
+            m_dirtyList.push_back( chunk );
+        }
+    }
+
+    int m_chunksWide;
+    int m_chunksHigh;
+    int m_chunksDeep;
+    std::vector<Material> m_cubes;
+    std::vector<uint32_t> m_versions;
+    std::vector<bool>     m_dirty;
+    std::vector<size_t>   m_dirtyList;
 };
 
-struct CubeVertex
+/**
+ * One chunk's worth of meshing work. Jobs, along with their buffers, are
+ * recycled rather than freed once the mesh has been handed off
+ */
+struct MeshJob
 {
-    Vec3 pos;
-    Vec2 texuv;
+    size_t      chunk;
+    uint32_t    version;
+    PaddedChunk cubes;
+    MeshBuffer  mesh;
 };
 
-//
-// Cube positions
-// TODO: rearrange these to fit correct builder pattern
-// (ABCD, not ADCB)
-// [AB
-// DC] --> ADCB
-//
-// xyz
-// 1. right
-// 2. left
-// 3. back
-// 4. front
-// 5. top
-// 6. bottom
-Vec3 CubePos[6][4] =
-{
-    { /* right */
-        Vec3( 1.0f, 1.0f, 0.0f ),
-        Vec3( 1.0f, 0.0f, 0.0f ),
-        Vec3( 1.0f, 0.0f,-1.0f ),
-        Vec3( 1.0f, 1.0f,-1.0f )
-    },
-    { /* left */
-        Vec3( 0.0f, 1.0f,-1.0f ),
-        Vec3( 0.0f, 0.0f,-1.0f ),
-        Vec3( 0.0f, 0.0f, 0.0f ),
-        Vec3( 0.0f, 1.0f, 0.0f )
-    },
-    { /* back */
-        Vec3( 1.0f, 1.0f,-1.0f ),
-        Vec3( 1.0f, 0.0f,-1.0f ),
-        Vec3( 0.0f, 0.0f,-1.0f ),
-        Vec3( 0.0f, 1.0f,-1.0f )
-    },
-    { /* front */
-        Vec3( 0.0f, 1.0f, 0.0f ),
-        Vec3( 0.0f, 0.0f, 0.0f ),
-        Vec3( 1.0f, 0.0f, 0.0f ),
-        Vec3( 1.0f, 1.0f, 0.0f )
-    },
-    { /* top */
-        Vec3( 1.0f, 1.0f, 0.0f ),
-        Vec3( 1.0f, 1.0f,-1.0f ),
-        Vec3( 0.0f, 1.0f,-1.0f ),
-        Vec3( 0.0f, 1.0f, 0.0f )
-    },
-    { /* bottom */
-        Vec3( 0.0f, 0.0f, 0.0f ),
-        Vec3( 0.0f, 0.0f,-1.0f ),
-        Vec3( 1.0f, 0.0f,-1.0f ),
-        Vec3( 1.0f, 0.0f, 0.0f )
+/**
+ * Builds greedy meshes on a pool of worker threads. The owner (usually the
+ * render thread) submits dirty chunks with dispatch() and picks up finished
+ * meshes with collect(); nothing else about the world is shared with the
+ * workers
+ */
+class ChunkMeshPool
+{
+public:
+    ChunkMeshPool( size_t threadCount )
+        : m_stopping( false ),
+          m_busy( 0 )
+    {
+        // With no workers waitUntilIdle() would never return
+        if ( threadCount == 0 )
+        {
+            throw std::invalid_argument( "ChunkMeshPool needs at least one thread" );
+        }
+
+        for ( size_t i = 0; i < threadCount; ++i )
+        {
+            m_threads.push_back( std::thread( &ChunkMeshPool::workerMain, this ) );
+        }
+    }
+
+    ~ChunkMeshPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stopping = true;
+        }
+
+        m_workReady.notify_all();
+
+        for ( size_t i = 0; i < m_threads.size(); ++i )
+        {
+            m_threads[i].join();
+        }
+    }
+
+    /**
+     * Queues a mesh rebuild for every chunk edited since the last dispatch.
+     * Returns the number of chunks queued
+     */
+    size_t dispatch( CubeWorld& world )
+    {
+        world.takeDirtyChunks( m_dirtyChunks );
+
+        for ( size_t i = 0; i < m_dirtyChunks.size(); ++i )
+        {
+            std::unique_ptr<MeshJob> job( takeSpareJob() );
+
+            job->chunk   = m_dirtyChunks[i];
+            job->version = world.version( job->chunk );
+            world.copyChunk( job->chunk, job->cubes );
+
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_pending.push_back( std::move( job ) );
+            m_workReady.notify_one();
+        }
+
+        return m_dirtyChunks.size();
+    }
+
+    /**
+     * Moves finished meshes into 'finished'. Meshes for chunks that were
+     * edited again after they were queued are dropped, since a newer
+     * rebuild is already on its way. Hand jobs back with recycle() once the
+     * mesh has been uploaded
+     */
+    void collect( const CubeWorld& world, std::vector< std::unique_ptr<MeshJob> >& finished )
+    {
+        std::deque< std::unique_ptr<MeshJob> > done;
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            done.swap( m_finished );
+        }
+
+        for ( size_t i = 0; i < done.size(); ++i )
+        {
+            if ( done[i]->version == world.version( done[i]->chunk ) )
+            {
+                finished.push_back( std::move( done[i] ) );
+            }
+            else
+            {
+                recycle( std::move( done[i] ) );
+            }
+        }
+    }
+
+    void recycle( std::unique_ptr<MeshJob> job )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_spare.push_back( std::move( job ) );
     }
+
+    /**
+     * Blocks until every queued job has been built
+     */
+    void waitUntilIdle()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        while ( ! m_pending.empty() || m_busy > 0 )
+        {
+            m_workDone.wait( lock );
+        }
+    }
+
+private:
+    MeshJob * takeSpareJob()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        if ( m_spare.empty() )
+        {
+            return new MeshJob;
+        }
+
+        MeshJob * pJob = m_spare.back().release();
+        m_spare.pop_back();
+
+        return pJob;
+    }
+
+    void workerMain()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        while ( true )
+        {
+            while ( m_pending.empty() && ! m_stopping )
+            {
+                m_workReady.wait( lock );
+            }
+
+            if ( m_stopping )
+            {
+                return;
+            }
+
+            std::unique_ptr<MeshJob> job( std::move( m_pending.front() ) );
+            m_pending.pop_front();
+            m_busy++;
+
+            lock.unlock();
+            buildGreedyMesh( job->cubes, job->mesh );
+            lock.lock();
+
+            m_finished.push_back( std::move( job ) );
+            m_busy--;
+            m_workDone.notify_all();
+        }
+    }
+
+    std::vector<std::thread>               m_threads;
+    std::mutex                             m_mutex;
+    std::condition_variable                m_workReady;
+    std::condition_variable                m_workDone;
+    std::deque< std::unique_ptr<MeshJob> > m_pending;
+    std::deque< std::unique_ptr<MeshJob> > m_finished;
+    std::vector< std::unique_ptr<MeshJob> > m_spare;
+    std::vector<size_t>                    m_dirtyChunks;
+    bool                                   m_stopping;
+    size_t                                 m_busy;
 };
 
 //
-// Directional mapper
-// (in game space)
-// 1. +x --> right
-// 2. -x --> left
-// 3. +y --> back
-// 4. -y --> front
-// 5. +z --> top
-// 6. -z --> bottom
+// Benchmark
 //
-Vec3 axes[6] = { Vec3( 1.0f, 0.0f, 0.0f ),
-                    Vec3(-1.0f, 0.0f, 0.0f ),
-                    Vec3( 0.0f, 1.0f, 0.0f ),
-                    Vec3( 0.0f,-1.0f, 0.0f ),
-                    Vec3( 0.0f, 0.0f, 1.0f ),
-                    Vec3( 0.0f, 0.0f,-1.0f ) };
+typedef std::chrono::steady_clock Clock;
 
-int main( int argc, char* argv[] )
+double elapsedMs( Clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+/**
+ * Rolling hills of stone, dirt and grass, with a few caves cut out
+ */
+void generateTerrain( CubeWorld& world )
+{
+    for ( int z = 0; z < world.depth(); ++z )
+    {
+        for ( int x = 0; x < world.width(); ++x )
+        {
+            int ground = static_cast<int>( world.height() * 0.5 +
+                                           10.0 * sin( x * 0.031 ) +
+                                           8.0 * cos( z * 0.047 ) +
+                                           4.0 * sin( ( x + z ) * 0.11 ) );
+
+            for ( int y = 0; y < ground && y < world.height(); ++y )
+            {
+                bool cave = ( sin( x * 0.09 ) * cos( y * 0.13 ) * sin( z * 0.07 ) > 0.35 );
+
+                if ( ! cave )
+                {
+                    world.set( x, y, z, y + 1 == ground ? 3 : ( y + 4 >= ground ? 2 : 1 ) );
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Returns the total area of every quad in a mesh, in cube faces
+ */
+size_t meshArea( const MeshBuffer& mesh )
 {
-    
+    size_t area = 0;
+
+    for ( size_t q = 0; q < mesh.quadCount(); ++q )
+    {
+        const CubeVertex * v = mesh.vertices() + q * 4;
+
+        float du = fabs( v[1].u - v[0].u ) + fabs( v[3].u - v[0].u );
+        float dv = fabs( v[1].v - v[0].v ) + fabs( v[3].v - v[0].v );
+
+        area += static_cast<size_t>( du * dv + 0.5f );
+    }
+
+    return area;
 }
 
+void printUsage( std::ostream& stream, const char * program )
+{
+    stream << "Usage: " << program << " [threads] [frames]" << std::endl;
+}
 
-void build( const std::vector<Cube>& cubes )
+/**
+ * Parses a non negative decimal number. The whole string must be digits,
+ * so signs, trailing junk and values that do not fit are all rejected
+ *
+ * \param  text      Text to parse
+ * \param  maxValue  Largest value that is accepted
+ * \param  value     Receives the parsed value
+ * \return           True if the text was a number no larger than maxValue
+ */
+bool parseNumber( const char * text, uint64_t maxValue, uint64_t& value )
 {
-    std::vector<CubeVertex> vertices;
-    std::unordered_set<Point, bool> cubeCache;
-    std::unordered_set<CubeVertex, size_t> vertexCache;
-    std::unordered_set<Material, FaceList> facegroups;
+    // strtoull happily skips spaces and negates a leading minus sign, so
+    // insist on a digit up front
+    if (! isdigit( static_cast<unsigned char>( text[0] ) ) )
+    {
+        return false;
+    }
+
+    char * pEnd = NULL;
+    errno       = 0;
+
+    unsigned long long parsed = strtoull( text, &pEnd, 10 );
 
-    for ( size_t index = 0; index < cubes.size(); ++index )
+    if ( errno != 0 || *pEnd != '\0' || parsed > maxValue )
     {
-        const Cube& cube = cubes[i];
-        Point pos        = cube.pos;
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
 
-        //
-        //// Check each side of the cube to see if it has neighbors
-        //
-        for ( int k = 0; k < 6; ++k )
+//
+// Largest thread and frame counts that can be asked for
+//
+const uint64_t MAX_THREADS = 1024;
+const uint64_t MAX_FRAMES  = 1000000;
+
+int main( int argc, char* argv[] )
+{
+    size_t threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+    int frames         = 20;
+    uint64_t value     = 0;
+
+    if ( argc > 3 )
+    {
+        printUsage( std::cerr, argv[0] );
+        return 1;
+    }
+
+    if ( argc > 1 )
+    {
+        if (! parseNumber( argv[1], MAX_THREADS, value ) || value == 0 )
         {
-            Point np = Point( pos[0] + axes[k][0],
-                              pos[1] + axes[k][1],
-                              pos[2] + axes[k][2] );
+            std::cerr << "Thread count must be between 1 and "
+                      << MAX_THREADS << ": " << argv[1] << std::endl;
+            printUsage( std::cerr, argv[0] );
+            return 1;
         }
-        
-        if ( hasCubeAt( 
+
+        threadCount = static_cast<size_t>( value );
     }
+
+    if ( argc > 2 )
+    {
+        if (! parseNumber( argv[2], MAX_FRAMES, value ) || value == 0 )
+        {
+            std::cerr << "Frame count must be between 1 and "
+                      << MAX_FRAMES << ": " << argv[2] << std::endl;
+            printUsage( std::cerr, argv[0] );
+            return 1;
+        }
+
+        frames = static_cast<int>( value );
     }
+
+    CubeWorld world( 8, 4, 8 );
+    generateTerrain( world );
+
+    std::vector<size_t> chunks;
+    world.takeDirtyChunks( chunks );
+
+    std::cout << "World of " << world.chunkCount() << " chunks ("
+              << CHUNK_SIZE << "^3 cubes each)" << std::endl << std::endl;
+
+    //
+    // Single threaded comparison of the three meshers
+    //
+    typedef void (*Mesher)( const PaddedChunk&, MeshBuffer& );
+
+    const char * names[] = { "naive", "culled", "greedy" };
+    Mesher meshers[]     = { buildNaiveMesh, buildCulledMesh, buildGreedyMesh };
+
+    std::unique_ptr<PaddedChunk> padded( new PaddedChunk );
+    MeshBuffer mesh, culled;
+    bool areasMatch = true;
+
+    std::cout << std::setw(8) << "mesher" << std::setw(14) << "triangles"
+              << std::setw(14) << "tris/chunk" << std::setw(12) << "ms/chunk"
+              << std::setw(12) << "mesh MB" << std::endl;
+
+    for ( int m = 0; m < 3; ++m )
+    {
+        size_t triangles = 0, bytes = 0;
+        double ms = 0.0;
+
+        for ( size_t c = 0; c < world.chunkCount(); ++c )
+        {
+            world.copyChunk( c, *padded );
+
+            Clock::time_point start = Clock::now();
+            meshers[m]( *padded, mesh );
+            ms += elapsedMs( start );
+
+            triangles += mesh.triangleCount();
+            bytes     += mesh.meshBytes();
+
+            // Merged faces must cover exactly the faces the culled mesher found
+            if ( meshers[m] == buildGreedyMesh )
+            {
+                buildCulledMesh( *padded, culled );
+                areasMatch &= ( meshArea( mesh ) == culled.quadCount() );
+            }
+        }
+
+        std::cout << std::setw(8) << names[m]
+                  << std::setw(14) << triangles
+                  << std::setw(14) << triangles / world.chunkCount()
+                  << std::fixed << std::setprecision( 3 )
+                  << std::setw(12) << ms / world.chunkCount()
+                  << std::setprecision( 1 )
+                  << std::setw(12) << bytes / ( 1024.0 * 1024.0 ) << std::endl;
+    }
+
+    if ( ! areasMatch )
+    {
+        std::cerr << "ERROR: greedy mesh does not cover the visible faces" << std::endl;
+        return 1;
+    }
+
+    //
+    // Worker pool: build everything once, then remesh only what gets edited
+    //
+    ChunkMeshPool pool( threadCount );
+    std::vector< std::unique_ptr<MeshJob> > finished;
+
+    // Mark everything dirty by touching a cube in every chunk
+    for ( int z = 0; z < world.depth(); z += CHUNK_SIZE )
+    for ( int y = 0; y < world.height(); y += CHUNK_SIZE )
+    for ( int x = 0; x < world.width(); x += CHUNK_SIZE )
+    {
+        Material m = world.get( x + 5, y + 5, z + 5 );
+        world.set( x + 5, y + 5, z + 5, m == EMPTY_MATERIAL ? 4 : EMPTY_MATERIAL );
+    }
+
+    Clock::time_point start = Clock::now();
+    size_t queued = pool.dispatch( world );
+    pool.waitUntilIdle();
+    pool.collect( world, finished );
+    double fullMs = elapsedMs( start );
+
+    std::cout << std::endl << "Pool of " << threadCount << " thread(s): "
+              << queued << " chunks in " << std::setprecision( 1 ) << fullMs << " ms ("
+              << std::setprecision( 3 ) << fullMs / queued << " ms/chunk)" << std::endl;
+
+    for ( size_t i = 0; i < finished.size(); ++i )
+    {
+        pool.recycle( std::move( finished[i] ) );
+    }
+
+    finished.clear();
+
+    std::mt19937 random( 47 );
+    size_t remeshed = 0;
+    double editMs   = 0.0;
+
+    for ( int frame = 0; frame < frames; ++frame )
+    {
+        // A player digging and building in one spot
+        int cx = random() % world.width(), cy = world.height() / 2, cz = random() % world.depth();
+
+        for ( int i = 0; i < 50; ++i )
+        {
+            int x = std::min( world.width() - 1, cx + static_cast<int>( random() % 6 ) );
+            int y = std::min( world.height() - 1, cy + static_cast<int>( random() % 6 ) );
+            int z = std::min( world.depth() - 1, cz + static_cast<int>( random() % 6 ) );
+
+            world.set( x, y, z, world.get( x, y, z ) == EMPTY_MATERIAL ? 1 : EMPTY_MATERIAL );
+        }
+
+        start = Clock::now();
+        remeshed += pool.dispatch( world );
+        pool.waitUntilIdle();
+        pool.collect( world, finished );
+        editMs += elapsedMs( start );
+
+        for ( size_t i = 0; i < finished.size(); ++i )
+        {
+            pool.recycle( std::move( finished[i] ) );
+        }
+
+        finished.clear();
+    }
+
+    std::cout << "Edits: " << std::setprecision( 1 )
+              << static_cast<double>( remeshed ) / frames << " of "
+              << world.chunkCount() << " chunks remeshed per frame, "
+              << std::setprecision( 2 ) << editMs / frames << " ms/frame" << std::endl;
+
+    return 0;
 }
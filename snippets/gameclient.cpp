@@ -87,8 +87,9 @@ class GameClient
                     break;
                 }
 
+                // The world marks the chunk (and any neighbour sharing the
+                // cube's border) dirty, and the renderer remeshes it
                 world.destroyCube( c );
-                updateGeometryForCube( cid );
                 recalculateLightingFor( cid );
                 break;
 
@@ -103,7 +104,6 @@ class GameClient
                 }
 
                 world.addCube( pos );
-                updateGeometryForCube( cid );
                 recalculateLightFor( cid );
             }
 
@@ -130,6 +130,18 @@ class Renderer
 {
     void renderWorld()
     {
+        // Hand chunks edited since the last frame to the mesh workers, and
+        // upload whatever meshes they have finished since then. Meshing
+        // never happens on this thread (see oneoffs/cubechunk.cpp)
+        meshPool.dispatch( world );
+        meshPool.collect( world, finishedMeshes );
+
+        foreach( MeshJob job : finishedMeshes )
+        {
+            chunkGeometryData[ job.chunk ] = uploadToGpu( job.mesh );
+            meshPool.recycle( job );
+        }
+
         // Search for all visible world chunks
         ChunkId[] visibleChunks = world.getVisibleChunks( playerCam );
         GeometryData[] geoms;
@@ -138,7 +150,7 @@ class Renderer
         // of pointers to their geometry data
         foreach( ChunkId id : visibleChunks )
         {
-            GeometryData* data = getCachedChunkOrRebuild( id );
+            GeometryData* data = getCachedChunkMesh( id );
             geoms += data;
         }
 
@@ -180,34 +192,25 @@ class Renderer
 
     /**
      * Returns a pointer to a chunk's geometric mesh for rendering and
-     * other nefarious purposes. This method will look up the chunk id.
-     * If the chunk was already built and cached, it will be returned.
-     * Otherwise it will have to be compiled before being cached and returned
+     * other nefarious purposes. A chunk that was edited keeps drawing its
+     * old mesh until the workers finish the new one, and a chunk that has
+     * never been meshed yet draws nothing
      */
-    GeometryData * getCachedChunkOrRebuild( ChunkId id )
+    GeometryData * getCachedChunkMesh( ChunkId id )
     {
         if ( chunkGeometryData.has(id) )
         {
-            // Already cached, return it
             return chunkGeometryData.get( id );
         }
-        else
-        {
-            // Get the actual chunk data from the world storage class
-            // Then use the chunk builder class to create a mesh to store
-            ChunkData chunk = world.getChunkData( id );
-            MeshChunkBuilder builder( chunk );
-            GeometryData * geom = builder.compile();
-
-            // Cache the compiled mesh
-            chunkGeometryData.add( id, geom );
-            return geoms;
-        }
+
+        return NULL;
     }
 
 private:
     // renderer stuff
     std::map<ChunkId, GeometryData*> chunkGeometryData;
+    ChunkMeshPool meshPool;
+    MeshJob[] finishedMeshes;
 };
 
 
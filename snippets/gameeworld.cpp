@@ -33,9 +33,18 @@
 /////////////////////////////////////////////////////////////////////////////
 #ifndef SCOTT_WORKBENCH_GAMEWORLD_H
 #define SCOTT_WORKBENCH_GAMEWORLD_H
-#define GAMEWORLD_VERSION 2
+#define GAMEWORLD_VERSION 3
 
 #include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 const int MATERIAL_NULL = 0;
 class CubeWorld;
@@ -102,14 +111,13 @@ struct MaterialId
 struct CubeData
 {
     CubeData();
-    CubeData( const MaterialId& mat )
-        : m_material( mat )
+    CubeData( int mat );
+
+    bool operator == ( const CubeData& rhs ) const
     {
+        return material == rhs.material;
     }
 
-    BaseMaterialId baseMaterial() const { return 12; }
-    SubMaterialId  subMaterial()  const { return 22; }
-
     //---------------------------------------------------------------------
     // Helper methods
     //---------------------------------------------------------------------
@@ -118,12 +126,112 @@ struct CubeData
     //---------------------------------------------------------------------
     // Base data
     //---------------------------------------------------------------------
-    MaterialId m_material;
+    int material;
 };
 
-typedef TCubeGrid<CubeData>     OctreeChunk;
-typedef TCubeGridNode<CubeData> OctreeCubeNode;
+typedef TVoxelOctree<CubeData> OctreeChunk;
+
+/**
+ * Position of a chunk in the world, in chunks rather than cubes
+ */
+struct ChunkCoord
+{
+    ChunkCoord( int x_, int y_, int z_ )
+        : x(x_), y(y_), z(z_)
+    {
+    }
+
+    bool operator == ( const ChunkCoord& rhs ) const
+    {
+        return x == rhs.x && y == rhs.y && z == rhs.z;
+    }
+
+    int x;
+    int y;
+    int z;
+};
 
+struct ChunkCoordHash
+{
+    size_t operator()( const ChunkCoord& c ) const
+    {
+        return static_cast<size_t>( c.x ) * 73856093u ^
+               static_cast<size_t>( c.y ) * 19349663u ^
+               static_cast<size_t>( c.z ) * 83492791u;
+    }
+};
+
+/**
+ * Somewhere to keep chunks that have been unloaded from the world. Chunks
+ * are handed over in the linear form written by TVoxelOctree::serialize.
+ * The world calls the store from its streaming thread only
+ */
+class ChunkStore
+{
+public:
+    enum Result
+    {
+        OK,             // the chunk was loaded or saved
+        ABSENT,         // the chunk has never been saved
+        FAILED          // the store could not be read from or written to
+    };
+
+    virtual ~ChunkStore() { }
+
+    /**
+     * Fills bytes with a chunk that was saved earlier. Returns ABSENT if
+     * the chunk has never been saved, and FAILED if it could not be read
+     */
+    virtual Result load( const ChunkCoord& coord, std::vector<unsigned char>& bytes ) = 0;
+
+    /**
+     * Saves a chunk, returning OK or FAILED
+     */
+    virtual Result save( const ChunkCoord& coord, const std::vector<unsigned char>& bytes ) = 0;
+};
+
+/**
+ * Chunk store that keeps everything in memory. Stands in for a save file
+ */
+class MemoryChunkStore : public ChunkStore
+{
+public:
+    virtual Result load( const ChunkCoord& coord, std::vector<unsigned char>& bytes );
+    virtual Result save( const ChunkCoord& coord, const std::vector<unsigned char>& bytes );
+
+    size_t savedCount() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<ChunkCoord, std::vector<unsigned char>, ChunkCoordHash> m_chunks;
+};
+
+/**
+ * Stores the cubes of a game world in chunks. Only chunks around the focus
+ * point (usually the player) are kept in memory. Chunks are kept in a hash
+ * map keyed by chunk coordinate, so memory scales with the loaded area
+ * rather than with the size of the world.
+ *
+ * Loading and saving happen on a streaming thread. setFocus() queues the
+ * chunks that came into range and unloads those that went out of range,
+ * and update() takes in chunks that finished loading. Touching a chunk
+ * that is not loaded yet blocks until it is.
+ *
+ * Chunks that have not been used for a while are kept compressed in
+ * memory and expanded again on their next use.
+ *
+ * Nothing is thrown away when the store fails. A chunk that can't be
+ * saved keeps its bytes in memory until it is loaded again, a chunk that
+ * can't be loaded is retried the next time it is used, and a chunk that
+ * can't be expanded stays compressed. Each failure adds to errorCount().
+ *
+ * Each thread remembers the chunk it used last, so a run of get/set calls
+ * in the same chunk skips the hash map lookup. The const get() and exists()
+ * can be called from several threads at once, compressed chunks included:
+ * a chunk is expanded under a lock by whichever reader gets to it first.
+ * Anything else, including the non-const get(), must not run at the same
+ * time as another call.
+ */
 class CubeWorld
 {
 public:
@@ -132,29 +240,37 @@ public:
      * depth.
      *
      * To store these cubes, the cube world will instantiate cubechunks of
-     * dimension dim.
+     * dimension dim. Unloaded chunks are kept in pStore, or in memory if no
+     * store is given.
      */
-    CubeWorld( size_t chunkDim, size_t rows, size_t cols, size_t depth );
+    CubeWorld( size_t chunkDim,
+               size_t rows,
+               size_t cols,
+               size_t depth,
+               ChunkStore * pStore = NULL );
 
     /**
-     * Cube world destructor
+     * Cube world destructor. Saves every modified chunk before returning.
+     * Chunks the store fails to save here are lost
      */
     ~CubeWorld();
 
     /**
-     * Places a cube in the world
+     * Places a cube in the world. Returns false if the chunk holding the
+     * cube could not be loaded or expanded
      */
-    void set( const CubeData& value, const Point& pt );
+    bool set( const CubeData& value, const Point& pt );
 
     /**
      * Returns a cube from the world. It will return null cube if you request
-     * a location that does not exist.
+     * a location in a chunk that is not loaded.
      */
     CubeData get( const Point& pt ) const;
 
     /**
-     * Returns a cube from the world. This method (non-const) will return a new
-     * cube (type empty) if there was no cube in the specified position
+     * Returns a cube from the world. This method (non-const) will load the
+     * chunk holding the cube if it was not loaded already, and returns a
+     * null cube if that fails
      */
     CubeData get( const Point& pt );
 
@@ -164,11 +280,58 @@ public:
     bool exists( const Point& pt ) const;
 
     /**
-     * Returns the number of chunks instantiated by this cube world
-     * FIXME: Make it work
+     * Moves the area of the world kept in memory. Chunks within radius
+     * chunks of the point are queued for loading, and chunks that are more
+     * than one chunk further away than that are unloaded
+     */
+    void setFocus( const Point& pt, size_t radius );
+
+    /**
+     * Takes in chunks that finished loading, and compresses chunks that
+     * have gone unused for coldAge() calls to update()
+     */
+    void update();
+
+    /**
+     * Blocks until every queued load and save has finished
+     */
+    void flush();
+
+    size_t coldAge() const { return m_coldAge; }
+
+    void setColdAge( size_t updates ) { m_coldAge = updates; }
+
+    /**
+     * Returns the number of chunks in memory, compressed or not
      */
     size_t chunkCount() const;
 
+    /**
+     * Returns the number of chunks in memory that are compressed
+     */
+    size_t compressedChunkCount() const;
+
+    /**
+     * Returns the number of chunks queued to be loaded
+     */
+    size_t loadingChunkCount() const;
+
+    /**
+     * Returns the amount of memory used by chunks
+     */
+    size_t memoryUsed() const;
+
+    /**
+     * Returns the number of chunk loads, saves and expansions that failed
+     */
+    size_t errorCount() const { return m_errorCount; }
+
+    /**
+     * Returns the number of chunks that failed to save, and are being
+     * kept in memory until they are loaded again
+     */
+    size_t unsavedChunkCount() const;
+
     /**
      * Returns the number of chunks that comprise this cube world. Note that
      * the number returned is not the number of chunks instantiated, rather
@@ -193,25 +356,79 @@ public:
     size_t depth() const { return m_depth; }
 
 private:
-    OctreeChunk* findChunk( const Point& p ) const;
+    struct Chunk
+    {
+        Chunk( const ChunkCoord& c )
+            : coord( c ), cubes( NULL ), lastUsed( 0 ), modified( false )
+        {
+        }
+
+        ~Chunk() { delete cubes.load(); }
+
+        ChunkCoord                 coord;
+        std::atomic<OctreeChunk*>  cubes;        // NULL while compressed
+        std::vector<unsigned char> compressed;
+        std::atomic<size_t>        lastUsed;     // touched by const readers too
+        bool                       modified;     // needs saving when unloaded
+    };
 
-    OctreeChunk* findChunk( const Point& p, bool createIfNotFound );
+    struct StreamRequest
+    {
+        bool                       save;
+        ChunkCoord                 coord;
+        std::vector<unsigned char> bytes;
+        ChunkStore::Result         result;
+        bool                       unsaved;    // bytes never made it to the store
+    };
 
-    size_t chunkOffset( const Point& p ) const;
+    typedef std::unordered_map< ChunkCoord, std::unique_ptr<Chunk>, ChunkCoordHash > ChunkMap;
 
     /**
-     * Converts a point into a cube's local space
+     * Returns the loaded chunk holding a point, or NULL if it isn't loaded
      */
-    Point calcRelativeChunkPoint( const Point& p ) const;
+    Chunk* findChunk( const Point& p ) const;
 
     /**
-     * Instantiates a cube chunk
+     * Returns the chunk holding a point, waiting for it to load if needed
      */
-    OctreeChunk* createChunk( const Point& p );
+    Chunk* findChunk( const Point& p, bool loadIfNotFound );
+
+    /**
+     * Returns a chunk's cubes, expanding them if it was compressed. Returns
+     * NULL, and leaves the chunk compressed, if its bytes are corrupt.
+     * Safe to call from several readers at once
+     */
+    OctreeChunk* cubesOf( Chunk& chunk ) const;
+
+    ChunkCoord chunkCoord( const Point& p ) const;
+
+    bool isInWorld( const ChunkCoord& coord ) const;
+
+    /**
+     * Converts a point into a cube's local space
+     */
+    Point calcRelativeChunkPoint( const Point& p ) const;
+
+    void requestLoad( const ChunkCoord& coord );
+
+    ChunkMap::iterator unloadChunk( ChunkMap::iterator itr );
+
+    void takeLoadedChunks();
+
+    void waitForChunk( const ChunkCoord& coord );
+
+    void streamerMain();
 
     void checkPointBounds( const Point& p ) const;
 
-    std::vector<OctreeChunk*> m_chunks;
+    ChunkMap m_chunks;
+
+    /**
+     * Lookup cache validation. The id is unique to each world, and the
+     * generation changes whenever a chunk is added or removed
+     */
+    size_t m_worldId;
+    size_t m_generation;
 
     size_t m_chunkDim;
 
@@ -246,14 +463,40 @@ private:
     size_t m_chunkDepth;
 
     /**
-     * Number of total possible chunks
+     * Count of update() calls, used to find cold chunks
+     */
+    size_t m_clock;
+    size_t m_coldAge;
+
+    mutable std::atomic<size_t> m_errorCount;
+
+    /**
+     * Held while expanding a compressed chunk, or looking at the bytes of
+     * one, since const readers may be expanding chunks at the same time
      */
-    size_t m_totalChunks;
+    mutable std::mutex m_expandMutex;
+
+    //
+    // Streaming thread. Requests are handled in order, so a chunk that is
+    // unloaded and then loaded again is always saved before it is read
+    //
+    std::unique_ptr<ChunkStore> m_ownedStore;
+    ChunkStore *                m_pStore;
+    std::unordered_set<ChunkCoord, ChunkCoordHash> m_loading;
+
+    mutable std::mutex        m_mutex;
+    std::condition_variable   m_requestReady;
+    std::condition_variable   m_requestDone;
+    std::deque<StreamRequest> m_requests;
+    std::deque<StreamRequest> m_loaded;
 
     /**
-     * Number of chunks instantiated
+     * Chunks the store failed to save, handed back on their next load
      */
-    size_t m_createdChunkCount;
+    std::unordered_map<ChunkCoord, std::vector<unsigned char>, ChunkCoordHash> m_unsaved;
+    bool                      m_streamerBusy;
+    bool                      m_stopping;
+    std::thread               m_streamer;
 };
 
 
@@ -283,16 +526,77 @@ CubeData CubeData::CreateNullCube()
     return CubeData();
 }
 
-CubeWorld::CubeWorld( size_t chunkDims, size_t rows, size_t cols, size_t depth )
-    : m_chunkDim( chunkDims ),
+ChunkStore::Result MemoryChunkStore::load( const ChunkCoord& coord,
+                                          std::vector<unsigned char>& bytes )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto itr = m_chunks.find( coord );
+
+    if ( itr == m_chunks.end() )
+    {
+        return ABSENT;
+    }
+
+    bytes = itr->second;
+    return OK;
+}
+
+ChunkStore::Result MemoryChunkStore::save( const ChunkCoord& coord,
+                                          const std::vector<unsigned char>& bytes )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_chunks.erase( coord );
+    m_chunks.insert( std::make_pair( coord, bytes ) );
+    return OK;
+}
+
+size_t MemoryChunkStore::savedCount() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_chunks.size();
+}
+
+namespace
+{
+    std::atomic<size_t> gNextWorldId( 1 );
+
+    /**
+     * The last chunk looked up by this thread
+     */
+    struct ChunkLookupCache
+    {
+        size_t       worldId;
+        size_t       generation;
+        ChunkCoord   coord;
+        const void * pChunk;
+    };
+
+    thread_local ChunkLookupCache tChunkCache = { 0, 0, ChunkCoord( 0, 0, 0 ), NULL };
+}
+
+CubeWorld::CubeWorld( size_t chunkDims,
+                      size_t rows,
+                      size_t cols,
+                      size_t depth,
+                      ChunkStore * pStore )
+    : m_chunks(),
+      m_worldId( gNextWorldId++ ),
+      m_generation( 0 ),
+      m_chunkDim( chunkDims ),
       m_cols( cols ),
       m_rows( rows ),
       m_depth( depth ),
       m_chunkCols( cols / chunkDims ),
       m_chunkRows( rows / chunkDims ),
       m_chunkDepth( depth / chunkDims ),
-      m_totalChunks( cols/chunkDims + rows/chunkDims + depth/chunkDims ),
-      m_createdChunkCount( 0 )
+      m_clock( 0 ),
+      m_coldAge( 60 ),
+      m_errorCount( 0 ),
+      m_ownedStore( pStore == NULL ? new MemoryChunkStore : NULL ),
+      m_pStore( pStore == NULL ? m_ownedStore.get() : pStore ),
+      m_loading(),
+      m_streamerBusy( false ),
+      m_stopping( false )
 {
     //
     // Ensure that the given cols, rows and depth values are evenly divisble
@@ -302,52 +606,48 @@ CubeWorld::CubeWorld( size_t chunkDims, size_t rows, size_t cols, size_t depth )
     assert( cols  % chunkDims == 0 );
     assert( depth % chunkDims == 0 );
 
-    //
-    // Calculate number of chunks that need to be created, and then initialize
-    // the chunk cache to be all NULL
-    //
-    float cd      = static_cast<float>(chunkDims);
-    m_totalChunks = ceil( static_cast<float>(cols)  / cd ) *
-                    ceil( static_cast<float>(rows)  / cd ) *
-                    ceil( static_cast<float>(depth) / cd );
-
-    std::cout << m_totalChunks << std::endl;
+    m_streamer = std::thread( &CubeWorld::streamerMain, this );
+}
 
-    //
-    // Set up chunk cache
-    //
-    m_chunks.reserve( m_totalChunks );
+CubeWorld::~CubeWorld()
+{
+    // Wait for queued loads, so nothing is left half loaded, then save
+    // everything that was changed
+    flush();
 
-    for ( size_t i = 0; i < m_totalChunks; ++i )
+    for ( ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); )
     {
-        m_chunks[i] = NULL;
+        itr = unloadChunk( itr );
     }
-}
 
-CubeWorld::~CubeWorld()
-{
-    for ( size_t i = 0; i < m_chunks.size(); ++i )
     {
-        delete m_chunks[i];
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stopping = true;
     }
+
+    m_requestReady.notify_all();
+    m_streamer.join();
 }
 
-void CubeWorld::set( const CubeData& value, const Point& pt )
+bool CubeWorld::set( const CubeData& value, const Point& pt )
 {
     // sanity
     checkPointBounds( pt );
 
     // Find the chunk that holds the cube
-    OctreeChunk * chunk = m_chunks[ chunkOffset(pt) ];
+    Chunk * chunk       = findChunk( pt, true );
+    OctreeChunk * cubes = ( chunk != NULL ? cubesOf( *chunk ) : NULL );
 
-    if ( chunk == NULL )
+    if ( cubes == NULL )
     {
-        chunk = createChunk( pt );
+        return false;
     }
 
     // Assign the value
-    assert( chunk != NULL );
-    chunk->set( value, calcRelativeChunkPoint(pt) );
+    cubes->set( value, calcRelativeChunkPoint(pt) );
+    chunk->modified = true;
+
+    return true;
 }
 
 CubeData CubeWorld::get( const Point& pt ) const
@@ -357,15 +657,16 @@ CubeData CubeWorld::get( const Point& pt ) const
     // Find the chunk that holds the cube, and query the chunk for
     // the associated cube data. If no such cube chunk exists, then
     // simply return a null cube
-    OctreeChunk * chunk = findChunk( pt );
+    Chunk * chunk       = findChunk( pt );
+    OctreeChunk * cubes = ( chunk != NULL ? cubesOf( *chunk ) : NULL );
 
-    if ( chunk == NULL )
+    if ( cubes == NULL )
     {
         return CubeData::CreateNullCube();
     }
     else
     {
-        return chunk->get( calcRelativeChunkPoint( pt ) );
+        return cubes->get( calcRelativeChunkPoint( pt ) );
     }
 }
 
@@ -376,9 +677,15 @@ CubeData CubeWorld::get( const Point& pt )
 
     // Find the chunk that holds the cube, and query the
     // chunk for the associated cube data
-    OctreeChunk * chunk = findChunk( pt, true );
+    Chunk * chunk       = findChunk( pt, true );
+    OctreeChunk * cubes = ( chunk != NULL ? cubesOf( *chunk ) : NULL );
+
+    if ( cubes == NULL )
+    {
+        return CubeData::CreateNullCube();
+    }
 
-    return chunk->get( calcRelativeChunkPoint(pt) );
+    return cubes->get( calcRelativeChunkPoint(pt) );
 }
 
 bool CubeWorld::exists( const Point& pt ) const
@@ -387,11 +694,12 @@ bool CubeWorld::exists( const Point& pt ) const
     checkPointBounds( pt );
 
     // Does there exist a pointer to the requested cube?
-    OctreeChunk * chunk = findChunk( pt );
+    Chunk * chunk       = findChunk( pt );
+    OctreeChunk * cubes = ( chunk != NULL ? cubesOf( *chunk ) : NULL );
 
-    if ( chunk )
+    if ( cubes )
     {
-        return chunk->exists( calcRelativeChunkPoint(pt) );
+        return cubes->exists( calcRelativeChunkPoint(pt) );
     }
     else
     {
@@ -399,9 +707,128 @@ bool CubeWorld::exists( const Point& pt ) const
     }
 }
 
+void CubeWorld::setFocus( const Point& pt, size_t radius )
+{
+    ChunkCoord center = chunkCoord( pt );
+    int r             = static_cast<int>( radius );
+
+    // Unload chunks that are out of range. The extra chunk of slack stops
+    // chunks on the edge from being loaded and unloaded over and over as
+    // the focus moves back and forth
+    for ( ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); )
+    {
+        const ChunkCoord& c = itr->first;
+
+        if ( abs( c.x - center.x ) > r + 1 ||
+             abs( c.y - center.y ) > r + 1 ||
+             abs( c.z - center.z ) > r + 1 )
+        {
+            itr = unloadChunk( itr );
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+
+    for ( int z = center.z - r; z <= center.z + r; ++z )
+    {
+        for ( int y = center.y - r; y <= center.y + r; ++y )
+        {
+            for ( int x = center.x - r; x <= center.x + r; ++x )
+            {
+                ChunkCoord coord( x, y, z );
+
+                if ( isInWorld( coord ) &&
+                     m_chunks.find( coord ) == m_chunks.end() &&
+                     m_loading.count( coord ) == 0 )
+                {
+                    requestLoad( coord );
+                }
+            }
+        }
+    }
+}
+
+void CubeWorld::update()
+{
+    takeLoadedChunks();
+    m_clock++;
+
+    for ( ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr )
+    {
+        Chunk& chunk        = *itr->second;
+        OctreeChunk * cubes = chunk.cubes.load();
+
+        if ( cubes && m_clock - chunk.lastUsed.load( std::memory_order_relaxed ) >= m_coldAge )
+        {
+            chunk.compressed.clear();
+            cubes->serialize( chunk.compressed );
+
+            chunk.cubes = NULL;
+            delete cubes;
+        }
+    }
+}
+
+void CubeWorld::flush()
+{
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        while ( ! m_requests.empty() || m_streamerBusy )
+        {
+            m_requestDone.wait( lock );
+        }
+    }
+
+    takeLoadedChunks();
+}
+
 size_t CubeWorld::chunkCount() const
 {
-    return m_createdChunkCount;
+    return m_chunks.size();
+}
+
+size_t CubeWorld::compressedChunkCount() const
+{
+    std::lock_guard<std::mutex> lock( m_expandMutex );
+    size_t count = 0;
+
+    for ( ChunkMap::const_iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr )
+    {
+        count += ( itr->second->cubes.load() ? 0 : 1 );
+    }
+
+    return count;
+}
+
+size_t CubeWorld::loadingChunkCount() const
+{
+    return m_loading.size();
+}
+
+size_t CubeWorld::memoryUsed() const
+{
+    std::lock_guard<std::mutex> lock( m_expandMutex );
+    size_t total = 0;
+
+    for ( ChunkMap::const_iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr )
+    {
+        const Chunk& chunk        = *itr->second;
+        const OctreeChunk * cubes = chunk.cubes.load();
+
+        total += sizeof(Chunk) + chunk.compressed.capacity();
+        total += ( cubes ? sizeof(OctreeChunk) + cubes->memoryUsed() : 0 );
+    }
+
+    return total;
+}
+
+size_t CubeWorld::unsavedChunkCount() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_unsaved.size();
 }
 
 size_t CubeWorld::maxChunkCount() const
@@ -409,35 +836,103 @@ size_t CubeWorld::maxChunkCount() const
     return m_chunkCols * m_chunkRows * m_chunkDepth;
 }
 
-OctreeChunk* CubeWorld::findChunk( const Point& p ) const
+CubeWorld::Chunk* CubeWorld::findChunk( const Point& p ) const
 {
-    return m_chunks[ chunkOffset(p) ];
+    ChunkCoord coord = chunkCoord( p );
+    Chunk * pChunk   = NULL;
+
+    // Repeated lookups in the same chunk are by far the most common case
+    if ( tChunkCache.worldId == m_worldId &&
+         tChunkCache.generation == m_generation &&
+         tChunkCache.coord == coord )
+    {
+        pChunk = static_cast<Chunk*>( const_cast<void*>( tChunkCache.pChunk ) );
+    }
+    else
+    {
+        ChunkMap::const_iterator itr = m_chunks.find( coord );
+        pChunk = ( itr != m_chunks.end() ? itr->second.get() : NULL );
+
+        ChunkLookupCache cache = { m_worldId, m_generation, coord, pChunk };
+        tChunkCache = cache;
+    }
+
+    // Relaxed, since readers on other threads may be touching it too and
+    // update() only needs a rough age
+    if ( pChunk != NULL )
+    {
+        pChunk->lastUsed.store( m_clock, std::memory_order_relaxed );
+    }
+
+    return pChunk;
 }
 
-OctreeChunk* CubeWorld::findChunk( const Point& p, bool createIfNotFound )
+CubeWorld::Chunk* CubeWorld::findChunk( const Point& p, bool loadIfNotFound )
 {
-    OctreeChunk* chunk = m_chunks[ chunkOffset(p) ];
+    Chunk * chunk = findChunk( p );
 
-    if ( createIfNotFound && chunk == NULL )
+    if ( chunk == NULL && loadIfNotFound )
     {
-        chunk = createChunk( p );
+        ChunkCoord coord = chunkCoord( p );
+
+        if ( m_loading.count( coord ) == 0 )
+        {
+            requestLoad( coord );
+        }
+
+        waitForChunk( coord );
+        chunk = findChunk( p );
     }
 
     return chunk;
 }
 
-size_t CubeWorld::chunkOffset( const Point& p ) const
+OctreeChunk* CubeWorld::cubesOf( Chunk& chunk ) const
 {
-    // not sure if correct
-    const int& OCD = m_chunkDim;
+    OctreeChunk * cubes = chunk.cubes.load( std::memory_order_acquire );
 
-    size_t r = (p.z / OCD) * m_chunkCols * m_chunkRows +
-               (p.y / OCD) * m_chunkCols               +
-               (p.x / OCD);
+    if ( cubes != NULL )
+    {
+        return cubes;
+    }
+
+    // Another reader may be expanding the same chunk, so check again once
+    // the lock is held
+    std::lock_guard<std::mutex> lock( m_expandMutex );
+    cubes = chunk.cubes.load( std::memory_order_relaxed );
+
+    if ( cubes == NULL )
+    {
+        std::unique_ptr<OctreeChunk> expanded( new OctreeChunk( m_chunkDim ) );
+
+        // Keep the bytes of a corrupt chunk, rather than saving an empty
+        // chunk over it when it is unloaded
+        if ( ! expanded->deserialize( chunk.compressed ) || expanded->dim() != m_chunkDim )
+        {
+            m_errorCount++;
+            return NULL;
+        }
 
-    assert( r < m_totalChunks );
+        std::vector<unsigned char>().swap( chunk.compressed );
 
-    return r;
+        cubes = expanded.release();
+        chunk.cubes.store( cubes, std::memory_order_release );
+    }
+
+    return cubes;
+}
+
+ChunkCoord CubeWorld::chunkCoord( const Point& p ) const
+{
+    const int OCD = static_cast<int>( m_chunkDim );
+    return ChunkCoord( p.x / OCD, p.y / OCD, p.z / OCD );
+}
+
+bool CubeWorld::isInWorld( const ChunkCoord& c ) const
+{
+    return c.x >= 0 && static_cast<size_t>( c.x ) < m_chunkCols &&
+           c.y >= 0 && static_cast<size_t>( c.y ) < m_chunkRows &&
+           c.z >= 0 && static_cast<size_t>( c.z ) < m_chunkDepth;
 }
 
 Point CubeWorld::calcRelativeChunkPoint( const Point& p ) const
@@ -447,22 +942,169 @@ Point CubeWorld::calcRelativeChunkPoint( const Point& p ) const
                   p.z % m_chunkDim );
 }
 
-/**
-  * Instantiates a cube chunk
-  */
-OctreeChunk* CubeWorld::createChunk( const Point& p )
+void CubeWorld::requestLoad( const ChunkCoord& coord )
 {
-    int offset = chunkOffset( p );
+    StreamRequest request = { false, coord, std::vector<unsigned char>(), ChunkStore::OK, false };
+    m_loading.insert( coord );
 
-    // Make sure it hasn't been created already
-    assert( m_chunks[offset] == NULL );
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_requests.push_back( std::move( request ) );
+    m_requestReady.notify_one();
+}
 
-    // Create it
-    OctreeChunk* chunk  = new OctreeChunk( m_chunkDim );
+CubeWorld::ChunkMap::iterator CubeWorld::unloadChunk( ChunkMap::iterator itr )
+{
+    Chunk& chunk = *itr->second;
 
-    m_chunks[offset] = chunk;
+    if ( chunk.modified )
+    {
+        StreamRequest request = { true, chunk.coord, std::vector<unsigned char>(), ChunkStore::OK, false };
 
-    return chunk;
+        OctreeChunk * cubes = chunk.cubes.load();
+
+        if ( cubes )
+        {
+            cubes->serialize( request.bytes );
+        }
+        else
+        {
+            request.bytes.swap( chunk.compressed );
+        }
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_requests.push_back( std::move( request ) );
+        m_requestReady.notify_one();
+    }
+
+    m_generation++;
+    return m_chunks.erase( itr );
+}
+
+void CubeWorld::takeLoadedChunks()
+{
+    std::deque<StreamRequest> loaded;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        loaded.swap( m_loaded );
+    }
+
+    for ( size_t i = 0; i < loaded.size(); ++i )
+    {
+        m_loading.erase( loaded[i].coord );
+
+        // Leave a chunk that failed to load out of the world, so it is
+        // loaded again next time instead of starting out empty
+        if ( loaded[i].result == ChunkStore::FAILED )
+        {
+            m_errorCount++;
+            continue;
+        }
+
+        // Saved chunks come back compressed, and are only expanded once
+        // something actually looks inside of them
+        std::unique_ptr<Chunk> chunk( new Chunk( loaded[i].coord ) );
+        chunk->lastUsed = m_clock;
+        chunk->modified = loaded[i].unsaved;
+
+        if ( loaded[i].result == ChunkStore::ABSENT )
+        {
+            chunk->cubes = new OctreeChunk( m_chunkDim );
+        }
+        else
+        {
+            chunk->compressed.swap( loaded[i].bytes );
+        }
+
+        m_chunks.insert( std::make_pair( loaded[i].coord, std::move( chunk ) ) );
+    }
+
+    if ( ! loaded.empty() )
+    {
+        m_generation++;
+    }
+}
+
+void CubeWorld::waitForChunk( const ChunkCoord& coord )
+{
+    while ( true )
+    {
+        takeLoadedChunks();
+
+        if ( m_loading.count( coord ) == 0 )
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        while ( m_loaded.empty() )
+        {
+            m_requestDone.wait( lock );
+        }
+    }
+}
+
+void CubeWorld::streamerMain()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    while ( true )
+    {
+        while ( m_requests.empty() && ! m_stopping )
+        {
+            m_requestReady.wait( lock );
+        }
+
+        if ( m_requests.empty() )
+        {
+            return;
+        }
+
+        StreamRequest request( std::move( m_requests.front() ) );
+        m_requests.pop_front();
+        m_streamerBusy = true;
+
+        // A chunk that failed to save is handed back as is, since the
+        // store only has an older copy of it (if any)
+        auto unsaved = ( request.save ? m_unsaved.end() : m_unsaved.find( request.coord ) );
+
+        if ( unsaved != m_unsaved.end() )
+        {
+            request.bytes.swap( unsaved->second );
+            request.result  = ChunkStore::OK;
+            request.unsaved = true;
+            m_unsaved.erase( unsaved );
+        }
+        else
+        {
+            lock.unlock();
+
+            if ( request.save )
+            {
+                request.result = m_pStore->save( request.coord, request.bytes );
+            }
+            else
+            {
+                request.result = m_pStore->load( request.coord, request.bytes );
+            }
+
+            lock.lock();
+        }
+
+        if ( ! request.save )
+        {
+            m_loaded.push_back( std::move( request ) );
+        }
+        else if ( request.result != ChunkStore::OK )
+        {
+            m_errorCount++;
+            m_unsaved[ request.coord ].swap( request.bytes );
+        }
+
+        m_streamerBusy = false;
+        m_requestDone.notify_all();
+    }
 }
 
 void CubeWorld::checkPointBounds( const Point& p ) const
@@ -489,9 +1131,6 @@ void CubeWorld::checkPointBounds( const Point& p ) const
 //     smart pointer that points directly to data stored in the cube.
 //     Actually, how about forcing the engine to re-store a cube? That way
 //     he can edit it on his own time, and maybe allow better threading
-//
-//   - LRU cache so we can quickly find the last N cubes without having
-//     to look up cube constantly
 
 /////////////////////////////////////////////////////////////////////////////
 // Material tests
@@ -541,7 +1180,7 @@ TEST(GameWorld,GameWorldSetSingleCube)
     w.set( CubeData(42), Point( 2, 3, 5 ) );
 
     CubeData data = w.get( Point( 2, 3, 5 ) );
- //   EXPECT_EQ( 42, data.
+    EXPECT_EQ( 42, data.material );
 }
 
 TEST(GameWorld,SimpleTravelAllCubesAndVerify)
@@ -593,3 +1232,272 @@ TEST(GameWorld,SimpleTravelAllCubesAndVerify)
     }
 
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// Streaming
+/////////////////////////////////////////////////////////////////////////////
+TEST(GameWorld,LoadsChunksAroundFocus)
+{
+    // 8x8x8 chunks of 4x4x4 cubes
+    CubeWorld w( 4, 32, 32, 32 );
+
+    w.setFocus( Point( 16, 16, 16 ), 1 );
+    EXPECT_EQ( static_cast<size_t>(27), w.loadingChunkCount() );
+
+    w.flush();
+    EXPECT_EQ( static_cast<size_t>(27), w.chunkCount() );
+    EXPECT_EQ( static_cast<size_t>( 0), w.loadingChunkCount() );
+
+    // Chunks past the edge of the world are not loaded
+    w.setFocus( Point( 0, 0, 0 ), 1 );
+    w.flush();
+    EXPECT_EQ( static_cast<size_t>(8), w.chunkCount() );
+
+    // Chunks one past the radius are kept around
+    w.setFocus( Point( 8, 8, 8 ), 1 );
+    w.flush();
+    EXPECT_EQ( static_cast<size_t>(8 + 27 - 1), w.chunkCount() );
+
+    // Moving far enough away unloads everything that was out of range
+    w.setFocus( Point( 31, 31, 31 ), 1 );
+    w.flush();
+    EXPECT_EQ( static_cast<size_t>(8), w.chunkCount() );
+}
+
+TEST(GameWorld,UnloadedChunksAreSavedAndReloaded)
+{
+    MemoryChunkStore store;
+
+    {
+        CubeWorld w( 4, 32, 32, 32, &store );
+
+        w.setFocus( Point( 0, 0, 0 ), 1 );
+        w.set( CubeData( 7 ), Point( 1, 2, 3 ) );
+        w.set( CubeData( 8 ), Point( 5, 2, 3 ) );
+
+        // Unloading only saves the chunks that were changed
+        w.setFocus( Point( 31, 31, 31 ), 1 );
+        w.flush();
+        EXPECT_EQ( static_cast<size_t>(2), store.savedCount() );
+        EXPECT_EQ( MATERIAL_NULL, static_cast<const CubeWorld&>( w ).get( Point( 1, 2, 3 ) ).material );
+
+        // Reading it again brings it straight back
+        EXPECT_EQ( 7, w.get( Point( 1, 2, 3 ) ).material );
+        w.set( CubeData( 9 ), Point( 30, 30, 30 ) );
+    }
+
+    // Everything changed is saved when the world goes away
+    CubeWorld w( 4, 32, 32, 32, &store );
+
+    EXPECT_EQ( 7, w.get( Point( 1, 2, 3 ) ).material );
+    EXPECT_EQ( 8, w.get( Point( 5, 2, 3 ) ).material );
+    EXPECT_EQ( 9, w.get( Point( 30, 30, 30 ) ).material );
+    EXPECT_TRUE( w.exists( Point( 30, 30, 30 ) ) );
+    EXPECT_FALSE( w.exists( Point( 30, 30, 31 ) ) );
+}
+
+TEST(GameWorld,ColdChunksAreCompressed)
+{
+    CubeWorld w( 8, 32, 32, 32 );
+    w.setColdAge( 2 );
+
+    for ( int z = 0; z < 32; ++z )
+        for ( int y = 0; y < 16; ++y )
+            for ( int x = 0; x < 32; ++x )
+                w.set( CubeData( 1 + ( x + y + z ) % 3 ), Point( x, y, z ) );
+
+    size_t before = w.memoryUsed();
+    EXPECT_EQ( static_cast<size_t>(0), w.compressedChunkCount() );
+
+    w.update();
+    w.update();
+    EXPECT_EQ( w.chunkCount(), w.compressedChunkCount() );
+    EXPECT_LT( w.memoryUsed(), before );
+
+    // Using a chunk expands it again, and keeps it warm
+    EXPECT_EQ( 1 + ( 3 + 4 + 5 ) % 3, w.get( Point( 3, 4, 5 ) ).material );
+    EXPECT_EQ( w.chunkCount() - 1, w.compressedChunkCount() );
+
+    w.update();
+    EXPECT_EQ( w.chunkCount() - 1, w.compressedChunkCount() );
+}
+
+TEST(GameWorld,ConcurrentReadersExpandCompressedChunks)
+{
+    CubeWorld w( 8, 32, 32, 32 );
+    w.setColdAge( 1 );
+
+    for ( int z = 0; z < 16; ++z )
+        for ( int y = 0; y < 16; ++y )
+            for ( int x = 0; x < 16; ++x )
+                w.set( CubeData( 1 + ( x + y + z ) % 3 ), Point( x, y, z ) );
+
+    w.update();
+    ASSERT_EQ( w.chunkCount(), w.compressedChunkCount() );
+
+    // Every reader walks the same compressed chunks, so they race to
+    // expand them. Run under ThreadSanitizer to check for data races
+    const CubeWorld& reader = w;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> wrong( 0 );
+
+    for ( int t = 0; t < 4; ++t )
+    {
+        threads.push_back( std::thread( [&reader, &wrong, t]()
+        {
+            for ( int i = 0; i < 16 * 16 * 16; ++i )
+            {
+                int x = ( i + t * 5 ) % 16, y = ( i / 16 ) % 16, z = i / 256;
+
+                if ( reader.get( Point( x, y, z ) ).material != 1 + ( x + y + z ) % 3 ||
+                     ! reader.exists( Point( x, y, z ) ) )
+                {
+                    wrong++;
+                }
+            }
+        } ) );
+    }
+
+    for ( size_t i = 0; i < threads.size(); ++i )
+    {
+        threads[i].join();
+    }
+
+    EXPECT_EQ( static_cast<size_t>(0), wrong.load() );
+    EXPECT_EQ( static_cast<size_t>(0), w.compressedChunkCount() );
+    EXPECT_EQ( static_cast<size_t>(0), w.errorCount() );
+}
+
+TEST(GameWorld,LookupCacheFollowsUnloads)
+{
+    CubeWorld w( 4, 32, 32, 32 );
+
+    w.set( CubeData( 3 ), Point( 1, 1, 1 ) );
+    EXPECT_EQ( 3, w.get( Point( 1, 1, 1 ) ).material );
+
+    // Unload the cached chunk, then read through the same cache slot
+    w.setFocus( Point( 31, 31, 31 ), 0 );
+    EXPECT_EQ( MATERIAL_NULL, static_cast<const CubeWorld&>( w ).get( Point( 1, 1, 1 ) ).material );
+    EXPECT_EQ( 3, w.get( Point( 1, 1, 1 ) ).material );
+
+    // A second world must not pick up the first one's cached chunk
+    CubeWorld other( 4, 32, 32, 32 );
+    EXPECT_EQ( MATERIAL_NULL, other.get( Point( 1, 1, 1 ) ).material );
+}
+
+/**
+ * Chunk store that can be told to fail, standing in for a full disk or a
+ * damaged save file
+ */
+class FailingChunkStore : public MemoryChunkStore
+{
+public:
+    FailingChunkStore()
+        : failLoads( false ), failSaves( false ), corruptLoads( false )
+    {
+    }
+
+    virtual Result load( const ChunkCoord& coord, std::vector<unsigned char>& bytes )
+    {
+        if ( failLoads )
+        {
+            return FAILED;
+        }
+
+        Result result = MemoryChunkStore::load( coord, bytes );
+
+        if ( result == OK && corruptLoads )
+        {
+            bytes.resize( bytes.size() / 2 );
+        }
+
+        return result;
+    }
+
+    virtual Result save( const ChunkCoord& coord, const std::vector<unsigned char>& bytes )
+    {
+        return ( failSaves ? FAILED : MemoryChunkStore::save( coord, bytes ) );
+    }
+
+    std::atomic<bool> failLoads;
+    std::atomic<bool> failSaves;
+    std::atomic<bool> corruptLoads;
+};
+
+TEST(GameWorld,FailedSavesKeepTheChunk)
+{
+    FailingChunkStore store;
+    CubeWorld w( 4, 32, 32, 32, &store );
+
+    w.set( CubeData( 7 ), Point( 1, 2, 3 ) );
+
+    store.failSaves = true;
+    w.setFocus( Point( 31, 31, 31 ), 0 );
+    w.flush();
+
+    EXPECT_EQ( static_cast<size_t>(1), w.errorCount() );
+    EXPECT_EQ( static_cast<size_t>(1), w.unsavedChunkCount() );
+    EXPECT_EQ( static_cast<size_t>(0), store.savedCount() );
+
+    // The chunk comes back from memory, and is saved again once the
+    // store works
+    EXPECT_EQ( 7, w.get( Point( 1, 2, 3 ) ).material );
+    EXPECT_EQ( static_cast<size_t>(0), w.unsavedChunkCount() );
+
+    store.failSaves = false;
+    w.setFocus( Point( 31, 31, 31 ), 0 );
+    w.flush();
+
+    EXPECT_EQ( static_cast<size_t>(1), store.savedCount() );
+    EXPECT_EQ( static_cast<size_t>(1), w.errorCount() );
+}
+
+TEST(GameWorld,FailedLoadsAreRetried)
+{
+    FailingChunkStore store;
+
+    {
+        CubeWorld w( 4, 32, 32, 32, &store );
+        w.set( CubeData( 7 ), Point( 1, 2, 3 ) );
+    }
+
+    store.failLoads = true;
+    CubeWorld w( 4, 32, 32, 32, &store );
+
+    // A chunk that could not be read is not mistaken for a new, empty one
+    EXPECT_EQ( MATERIAL_NULL, w.get( Point( 1, 2, 3 ) ).material );
+    EXPECT_FALSE( w.set( CubeData( 8 ), Point( 1, 2, 3 ) ) );
+    EXPECT_EQ( static_cast<size_t>(2), w.errorCount() );
+    EXPECT_EQ( static_cast<size_t>(0), w.chunkCount() );
+
+    store.failLoads = false;
+    EXPECT_EQ( 7, w.get( Point( 1, 2, 3 ) ).material );
+}
+
+TEST(GameWorld,CorruptChunksStayCompressed)
+{
+    FailingChunkStore store;
+
+    {
+        CubeWorld w( 4, 32, 32, 32, &store );
+        w.set( CubeData( 7 ), Point( 1, 2, 3 ) );
+    }
+
+    store.corruptLoads = true;
+
+    {
+        CubeWorld w( 4, 32, 32, 32, &store );
+
+        EXPECT_EQ( MATERIAL_NULL, w.get( Point( 1, 2, 3 ) ).material );
+        EXPECT_FALSE( w.exists( Point( 1, 2, 3 ) ) );
+        EXPECT_FALSE( w.set( CubeData( 8 ), Point( 1, 2, 3 ) ) );
+        EXPECT_EQ( static_cast<size_t>(3), w.errorCount() );
+        EXPECT_EQ( static_cast<size_t>(1), w.compressedChunkCount() );
+    }
+
+    // Nothing was saved over the good copy in the store
+    store.corruptLoads = false;
+    CubeWorld w( 4, 32, 32, 32, &store );
+
+    EXPECT_EQ( 7, w.get( Point( 1, 2, 3 ) ).material );
+}
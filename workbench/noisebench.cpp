@@ -0,0 +1,175 @@
+/**
+ * Benchmarks math/perlin.h by filling terrain sized grids of fractal
+ * noise, and reports the speed in samples per second.
+ *
+ * Each grid is filled three ways: one fbm() call per sample, with a single
+ * call to the batched fill functions, and with the batched functions split
+ * into bands of rows across threads. The batched results are checked
+ * against the per sample ones.
+ *
+ * Usage: noisebench [size] [octaves] [threads]
+ */
+#include <math/perlin.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const float STEP = 0.013f;
+    const float TOLERANCE = 1e-4f;
+
+    double elapsedSec( Clock::time_point start )
+    {
+        return std::chrono::duration<double>( Clock::now() - start ).count();
+    }
+
+    std::size_t countMismatches( const std::vector<float>& a, const std::vector<float>& b )
+    {
+        std::size_t mismatches = 0;
+
+        for ( std::size_t i = 0; i < a.size(); ++i )
+        {
+            mismatches += ( std::fabs( a[i] - b[i] ) > TOLERANCE ? 1 : 0 );
+        }
+
+        return mismatches;
+    }
+
+    void report( const char * name, double samples, double singleSec,
+                 double batchSec, double threadedSec, unsigned int threads )
+    {
+        std::cout << name << " (Msamples/sec): "
+                  << std::setw( 8 ) << samples / singleSec / 1e6 << " one at a time, "
+                  << std::setw( 8 ) << samples / batchSec / 1e6 << " batched, "
+                  << std::setw( 8 ) << samples / threadedSec / 1e6 << " on "
+                  << threads << " threads" << std::endl;
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    unsigned int size    = ( argc > 1 ? atoi( argv[1] ) : 128 );
+    unsigned int octaves = ( argc > 2 ? atoi( argv[2] ) : 4 );
+    unsigned int threads = ( argc > 3 ? atoi( argv[3] ) :
+                             std::max( 2u, std::thread::hardware_concurrency() ) );
+
+    PerlinNoise perlin( 2012 );
+    std::size_t mismatches = 0;
+    std::vector<std::thread> workers;
+
+    // 2D grids cover a bigger area so they take long enough to measure
+    unsigned int side2D = size * 16;
+
+    // Samples count every octave, since that is the work being done
+    std::cout << std::fixed << std::setprecision( 1 )
+              << side2D << "^2 and " << size << "^3 grids, " << octaves << " octaves" << std::endl;
+
+    //
+    // 2D
+    //
+    std::vector<float> single( side2D * side2D ), batched( single.size() ), tiled( single.size() );
+    double samples = static_cast<double>( single.size() ) * octaves;
+
+    Clock::time_point start = Clock::now();
+
+    for ( unsigned int r = 0; r < side2D; ++r )
+    {
+        for ( unsigned int c = 0; c < side2D; ++c )
+        {
+            single[ r * side2D + c ] = perlin.fbm( c * STEP, r * STEP, octaves );
+        }
+    }
+
+    double singleSec = elapsedSec( start );
+
+    start = Clock::now();
+    perlin.fillNoise2D( &batched[0], side2D, side2D, Vec2( 0.0f, 0.0f ), STEP, octaves );
+    double batchSec = elapsedSec( start );
+
+    start = Clock::now();
+
+    for ( unsigned int t = 0; t < threads; ++t )
+    {
+        unsigned int first = side2D * t / threads;
+        unsigned int last  = side2D * ( t + 1 ) / threads;
+
+        workers.push_back( std::thread( [&, first, last]()
+        {
+            perlin.fillNoise2D( &tiled[ first * side2D ], side2D, last - first,
+                                Vec2( 0.0f, first * STEP ), STEP, octaves );
+        } ) );
+    }
+
+    std::for_each( workers.begin(), workers.end(), []( std::thread& t ) { t.join(); } );
+    workers.clear();
+
+    double threadedSec = elapsedSec( start );
+
+    report( "2D perlin", samples, singleSec, batchSec, threadedSec, threads );
+    mismatches += countMismatches( single, batched ) + countMismatches( single, tiled );
+
+    //
+    // 3D
+    //
+    single.assign( static_cast<std::size_t>( size ) * size * size, 0.0f );
+    batched.assign( single.size(), 0.0f );
+    tiled.assign( single.size(), 0.0f );
+    samples = static_cast<double>( single.size() ) * octaves;
+
+    start = Clock::now();
+
+    for ( unsigned int s = 0; s < size; ++s )
+    {
+        for ( unsigned int r = 0; r < size; ++r )
+        {
+            for ( unsigned int c = 0; c < size; ++c )
+            {
+                single[ ( s * size + r ) * size + c ] =
+                    perlin.fbm( c * STEP, r * STEP, s * STEP, octaves );
+            }
+        }
+    }
+
+    singleSec = elapsedSec( start );
+
+    start = Clock::now();
+    perlin.fillNoise3D( &batched[0], size, size, size, Vec3( 0.0f, 0.0f, 0.0f ), STEP, octaves );
+    batchSec = elapsedSec( start );
+
+    start = Clock::now();
+
+    for ( unsigned int t = 0; t < threads; ++t )
+    {
+        unsigned int first = size * t / threads;
+        unsigned int last  = size * ( t + 1 ) / threads;
+
+        workers.push_back( std::thread( [&, first, last]()
+        {
+            perlin.fillNoise3D( &tiled[ first * size * size ], size, size, last - first,
+                                Vec3( 0.0f, 0.0f, first * STEP ), STEP, octaves );
+        } ) );
+    }
+
+    std::for_each( workers.begin(), workers.end(), []( std::thread& t ) { t.join(); } );
+    threadedSec = elapsedSec( start );
+
+    report( "3D perlin", samples, singleSec, batchSec, threadedSec, threads );
+    mismatches += countMismatches( single, batched ) + countMismatches( single, tiled );
+
+    if ( mismatches > 0 )
+    {
+        std::cout << "ERROR: " << mismatches << " samples did not match fbm()" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -32,10 +32,12 @@
 /////////////////////////////////////////////////////////////////////////////
 #ifndef SCOTT_WORKBENCH_OCTREE_H
 #define SCOTT_WORKBENCH_OCTREE_H
-#define OCTREE_VERSION 2
+#define OCTREE_VERSION 3
 
 #include <cstdlib>
 #include <ostream>
+#include <vector>
+#include <stdint.h>
 
 #define OCTREE_DEBUG
 
@@ -59,6 +61,26 @@ std::ostream& operator << ( std::ostream& os, const Point& p )
     return os;
 }
 
+/**
+ * An axis aligned box of cubes, given as its lowest corner and its size
+ * along each axis
+ */
+struct Box
+{
+    Box( int x_, int y_, int z_, int width_, int height_, int depth_ )
+        : x(x_), y(y_), z(z_),
+          width(width_), height(height_), depth(depth_)
+    {
+    }
+
+    int x;
+    int y;
+    int z;
+    int width;
+    int height;
+    int depth;
+};
+
 /**
  * An octree node is a structure that stores position and value data in an
  * octree. This node struture is internal to the octree class, and should not
@@ -210,6 +232,156 @@ private:
     TCubeGridNode<T> * m_root;
 };
 
+/**
+ * Sparse voxel octree. Like TCubeGrid it stores one value for every cube
+ * in a dim x dim x dim volume, but any subtree whose cubes all hold the
+ * same value is collapsed into a single leaf. A solid or empty region
+ * costs one node, no matter how many cubes it covers.
+ *
+ * Nodes live in one pool. The eight children of a node are allocated
+ * together as a block, ordered the same way as TCubeGrid::calcChildOffset,
+ * and blocks freed by a collapse are reused by the next split. Nodes are
+ * referred to by their index in the pool rather than by pointer.
+ *
+ * Cubes that hold the empty value (passed to the constructor) are treated
+ * as not existing. T must be comparable with ==, and must be trivially
+ * copyable to be serialized.
+ */
+template<typename T>
+class TVoxelOctree
+{
+public:
+    /**
+     * Creates a new voxel octree covering a volume of dim x dim x dim
+     * cubes, all of which start out holding the empty value
+     */
+    TVoxelOctree( size_t dim, const T& emptyValue = T() );
+
+    /**
+     * Returns the dimensions of the volume
+     */
+    size_t dim() const
+    {
+        return m_dim;
+    }
+
+    /**
+     * Returns the height of the octree, which is the number of levels
+     * between the root and a single cube
+     */
+    size_t treeHeight() const
+    {
+        return m_height;
+    }
+
+    /**
+     * Returns the number of live nodes in the octree
+     */
+    size_t nodeCount() const;
+
+    /**
+     * Returns the amount of memory consumed by the octree's node pool
+     */
+    size_t memoryUsed() const;
+
+    /**
+     * Places a value at the requested point in the grid
+     */
+    void set( const T& value, const Point& pt );
+
+    /**
+     * Retrieves the value at the requested point in the grid
+     */
+    T get( const Point& pt ) const;
+
+    /**
+     * Tests if there is a non-empty value at the requested point
+     */
+    bool exists( const Point& pt ) const;
+
+    /**
+     * Sets every cube inside of the box to the given value. This works on
+     * whole subtrees at a time, so filling a large aligned region only
+     * touches the nodes along its edges
+     */
+    void fill( const Box& box, const T& value );
+
+    /**
+     * Visits every non-empty region inside of the box. The visitor is
+     * called as visitor( region, value ) once for each leaf that overlaps
+     * the box, with the leaf's region clipped to the box, rather than once
+     * per cube
+     */
+    template<typename Visitor>
+    void forEachInBox( const Box& box, Visitor& visitor ) const;
+
+    /**
+     * Empties the octree, and releases all of its nodes
+     */
+    void clear();
+
+    /**
+     * Writes the octree out in a linear form: the dimension as four little
+     * endian bytes, followed by every node in depth first order. A leaf
+     * is written as a zero byte followed by the raw bytes of its value and
+     * a branch is written as a one byte followed by its eight children
+     */
+    void serialize( std::vector<unsigned char>& out ) const;
+
+    /**
+     * Replaces the contents of the octree with a linear form written by
+     * serialize(). Returns false, leaving the octree empty, if the data was
+     * truncated or malformed. Nodes come back in depth first order
+     */
+    bool deserialize( const std::vector<unsigned char>& in );
+
+private:
+    static const uint32_t NO_CHILDREN = 0xFFFFFFFF;
+    static const size_t MAX_HEIGHT    = 30;
+
+    struct Node
+    {
+        uint32_t children;      // index of first child, or NO_CHILDREN
+        T value;                // value of every cube under a leaf
+    };
+
+    /**
+     * Returns the index of a new block of eight leaf nodes holding value
+     */
+    uint32_t allocateBlock( const T& value );
+
+    /**
+     * Releases all of a node's descendants, turning it into a leaf
+     */
+    void freeChildren( uint32_t index );
+
+    /**
+     * Collapses a branch node into a leaf if all of its children are
+     * leaves holding the same value. Returns true if it collapsed
+     */
+    bool tryCollapse( uint32_t index );
+
+    void fillNode( uint32_t index, int x, int y, int z, int size,
+                   const Box& box, const T& value );
+
+    template<typename Visitor>
+    void visitNode( uint32_t index, int x, int y, int z, int size,
+                    const Box& box, Visitor& visitor ) const;
+
+    void writeNode( uint32_t index, std::vector<unsigned char>& out ) const;
+
+    bool readNode( uint32_t index, size_t depth,
+                   const std::vector<unsigned char>& in, size_t& offset );
+
+    void checkPointBounds( const Point& pt ) const;
+
+    size_t                m_dim;
+    size_t                m_height;
+    T                     m_empty;
+    std::vector<Node>     m_nodes;
+    std::vector<uint32_t> m_freeBlocks;
+};
+
 // #include <octree.inc> // brings in template implementation
 #endif
 
@@ -413,6 +585,446 @@ int TCubeGrid<T>::calcChildOffset( int x, int y, int z, int size ) const
            (   (( x >> size ) & 1) << 0 ) );
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// TVoxelOctree implementation
+/////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+template<typename T>
+TVoxelOctree<T>::TVoxelOctree( size_t dim, const T& emptyValue )
+    : m_dim( dim ),
+      m_height( 0 ),
+      m_empty( emptyValue ),
+      m_nodes(),
+      m_freeBlocks()
+{
+    // Make sure dimensions were power of two
+    assert( dim > 0 && (dim & -dim ) == dim );
+
+    while ( ( static_cast<size_t>( 1 ) << m_height ) < dim )
+    {
+        m_height++;
+    }
+
+    assert( m_height <= MAX_HEIGHT );
+    clear();
+}
+
+template<typename T>
+size_t TVoxelOctree<T>::nodeCount() const
+{
+    return m_nodes.size() - m_freeBlocks.size() * OCTREE_CHILD_COUNT;
+}
+
+template<typename T>
+size_t TVoxelOctree<T>::memoryUsed() const
+{
+    return m_nodes.capacity() * sizeof(Node) +
+           m_freeBlocks.capacity() * sizeof(uint32_t);
+}
+
+template<typename T>
+void TVoxelOctree<T>::clear()
+{
+    Node root = { NO_CHILDREN, m_empty };
+
+    m_nodes.assign( 1, root );
+    m_freeBlocks.clear();
+}
+
+template<typename T>
+void TVoxelOctree<T>::set( const T& value, const Point& pt )
+{
+    checkPointBounds( pt );
+
+    // Remember the path down so we can collapse on the way back up
+    uint32_t path[ MAX_HEIGHT ];
+    uint32_t index = 0;
+    size_t depth   = 0;
+
+    for ( int level = static_cast<int>( m_height ) - 1; level >= 0; --level )
+    {
+        if ( m_nodes[index].children == NO_CHILDREN )
+        {
+            // A leaf already holding this value needs no change at all
+            if ( m_nodes[index].value == value )
+            {
+                return;
+            }
+
+            uint32_t block = allocateBlock( m_nodes[index].value );
+            m_nodes[index].children = block;
+        }
+
+        path[depth++] = index;
+        index = m_nodes[index].children +
+                ( ( ( ( pt.z >> level ) & 1 ) << 2 ) |
+                  ( ( ( pt.y >> level ) & 1 ) << 1 ) |
+                  ( ( ( pt.x >> level ) & 1 ) << 0 ) );
+    }
+
+    m_nodes[index].value = value;
+
+    // Once a parent fails to collapse, none of its ancestors can either
+    while ( depth > 0 && tryCollapse( path[--depth] ) )
+    {
+    }
+}
+
+template<typename T>
+T TVoxelOctree<T>::get( const Point& pt ) const
+{
+    checkPointBounds( pt );
+
+    const Node * node = &m_nodes[0];
+    int level = static_cast<int>( m_height ) - 1;
+
+    while ( node->children != NO_CHILDREN )
+    {
+        node = &m_nodes[ node->children +
+                         ( ( ( ( pt.z >> level ) & 1 ) << 2 ) |
+                           ( ( ( pt.y >> level ) & 1 ) << 1 ) |
+                           ( ( ( pt.x >> level ) & 1 ) << 0 ) ) ];
+        level--;
+    }
+
+    return node->value;
+}
+
+template<typename T>
+bool TVoxelOctree<T>::exists( const Point& pt ) const
+{
+    return !( get( pt ) == m_empty );
+}
+
+template<typename T>
+void TVoxelOctree<T>::fill( const Box& box, const T& value )
+{
+    if ( box.width > 0 && box.height > 0 && box.depth > 0 )
+    {
+        fillNode( 0, 0, 0, 0, static_cast<int>( m_dim ), box, value );
+    }
+}
+
+template<typename T>
+template<typename Visitor>
+void TVoxelOctree<T>::forEachInBox( const Box& box, Visitor& visitor ) const
+{
+    if ( box.width > 0 && box.height > 0 && box.depth > 0 )
+    {
+        visitNode( 0, 0, 0, 0, static_cast<int>( m_dim ), box, visitor );
+    }
+}
+
+template<typename T>
+void TVoxelOctree<T>::serialize( std::vector<unsigned char>& out ) const
+{
+    static_assert( std::is_trivially_copyable<T>::value,
+                   "Only trivially copyable values can be serialized" );
+
+    uint32_t dim = static_cast<uint32_t>( m_dim );
+
+    out.push_back( static_cast<unsigned char>( dim ) );
+    out.push_back( static_cast<unsigned char>( dim >> 8 ) );
+    out.push_back( static_cast<unsigned char>( dim >> 16 ) );
+    out.push_back( static_cast<unsigned char>( dim >> 24 ) );
+
+    writeNode( 0, out );
+}
+
+template<typename T>
+bool TVoxelOctree<T>::deserialize( const std::vector<unsigned char>& in )
+{
+    static_assert( std::is_trivially_copyable<T>::value,
+                   "Only trivially copyable values can be serialized" );
+
+    if ( in.size() < 4 )
+    {
+        return false;
+    }
+
+    uint32_t dim = static_cast<uint32_t>( in[0] )         |
+                   ( static_cast<uint32_t>( in[1] ) << 8 )  |
+                   ( static_cast<uint32_t>( in[2] ) << 16 ) |
+                   ( static_cast<uint32_t>( in[3] ) << 24 );
+    size_t height = 0;
+
+    while ( height <= MAX_HEIGHT && ( static_cast<size_t>( 1 ) << height ) < dim )
+    {
+        height++;
+    }
+
+    if ( dim == 0 || height > MAX_HEIGHT || ( static_cast<size_t>( 1 ) << height ) != dim )
+    {
+        return false;
+    }
+
+    m_dim    = dim;
+    m_height = height;
+    clear();
+
+    size_t offset = 4;
+
+    if ( ! readNode( 0, 0, in, offset ) || offset != in.size() )
+    {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+uint32_t TVoxelOctree<T>::allocateBlock( const T& value )
+{
+    Node leaf = { NO_CHILDREN, value };
+    uint32_t block;
+
+    if ( m_freeBlocks.empty() )
+    {
+        block = static_cast<uint32_t>( m_nodes.size() );
+        m_nodes.resize( m_nodes.size() + OCTREE_CHILD_COUNT, leaf );
+    }
+    else
+    {
+        block = m_freeBlocks.back();
+        m_freeBlocks.pop_back();
+
+        std::fill( m_nodes.begin() + block,
+                   m_nodes.begin() + block + OCTREE_CHILD_COUNT,
+                   leaf );
+    }
+
+    return block;
+}
+
+template<typename T>
+void TVoxelOctree<T>::freeChildren( uint32_t index )
+{
+    uint32_t block = m_nodes[index].children;
+
+    if ( block != NO_CHILDREN )
+    {
+        for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+        {
+            freeChildren( block + i );
+        }
+
+        m_freeBlocks.push_back( block );
+        m_nodes[index].children = NO_CHILDREN;
+    }
+}
+
+template<typename T>
+bool TVoxelOctree<T>::tryCollapse( uint32_t index )
+{
+    uint32_t block = m_nodes[index].children;
+    const T& first = m_nodes[block].value;
+
+    for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+    {
+        const Node& child = m_nodes[block + i];
+
+        if ( child.children != NO_CHILDREN || !( child.value == first ) )
+        {
+            return false;
+        }
+    }
+
+    m_nodes[index].value    = first;
+    m_nodes[index].children = NO_CHILDREN;
+    m_freeBlocks.push_back( block );
+
+    return true;
+}
+
+template<typename T>
+void TVoxelOctree<T>::fillNode( uint32_t index,
+                                int x, int y, int z, int size,
+                                const Box& box,
+                                const T& value )
+{
+    // Skip nodes that are entirely outside of the box
+    if ( box.x >= x + size || box.x + box.width  <= x ||
+         box.y >= y + size || box.y + box.height <= y ||
+         box.z >= z + size || box.z + box.depth  <= z )
+    {
+        return;
+    }
+
+    // A node entirely inside of the box becomes a single leaf
+    if ( box.x <= x && box.x + box.width  >= x + size &&
+         box.y <= y && box.y + box.height >= y + size &&
+         box.z <= z && box.z + box.depth  >= z + size )
+    {
+        freeChildren( index );
+        m_nodes[index].value = value;
+        return;
+    }
+
+    if ( m_nodes[index].children == NO_CHILDREN )
+    {
+        if ( m_nodes[index].value == value )
+        {
+            return;
+        }
+
+        uint32_t block = allocateBlock( m_nodes[index].value );
+        m_nodes[index].children = block;
+    }
+
+    uint32_t block = m_nodes[index].children;
+    int half       = size / 2;
+
+    for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+    {
+        fillNode( block + i,
+                  x + ( ( i >> 0 ) & 1 ) * half,
+                  y + ( ( i >> 1 ) & 1 ) * half,
+                  z + ( ( i >> 2 ) & 1 ) * half,
+                  half,
+                  box,
+                  value );
+    }
+
+    tryCollapse( index );
+}
+
+template<typename T>
+template<typename Visitor>
+void TVoxelOctree<T>::visitNode( uint32_t index,
+                                 int x, int y, int z, int size,
+                                 const Box& box,
+                                 Visitor& visitor ) const
+{
+    if ( box.x >= x + size || box.x + box.width  <= x ||
+         box.y >= y + size || box.y + box.height <= y ||
+         box.z >= z + size || box.z + box.depth  <= z )
+    {
+        return;
+    }
+
+    const Node& node = m_nodes[index];
+
+    if ( node.children == NO_CHILDREN )
+    {
+        if ( !( node.value == m_empty ) )
+        {
+            int minX = std::max( x, box.x ), maxX = std::min( x + size, box.x + box.width );
+            int minY = std::max( y, box.y ), maxY = std::min( y + size, box.y + box.height );
+            int minZ = std::max( z, box.z ), maxZ = std::min( z + size, box.z + box.depth );
+
+            visitor( Box( minX, minY, minZ, maxX - minX, maxY - minY, maxZ - minZ ),
+                     node.value );
+        }
+
+        return;
+    }
+
+    int half = size / 2;
+
+    for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+    {
+        visitNode( node.children + i,
+                   x + ( ( i >> 0 ) & 1 ) * half,
+                   y + ( ( i >> 1 ) & 1 ) * half,
+                   z + ( ( i >> 2 ) & 1 ) * half,
+                   half,
+                   box,
+                   visitor );
+    }
+}
+
+template<typename T>
+void TVoxelOctree<T>::writeNode( uint32_t index,
+                                 std::vector<unsigned char>& out ) const
+{
+    const Node& node = m_nodes[index];
+
+    if ( node.children == NO_CHILDREN )
+    {
+        const unsigned char * bytes =
+            reinterpret_cast<const unsigned char*>( &node.value );
+
+        out.push_back( 0 );
+        out.insert( out.end(), bytes, bytes + sizeof(T) );
+    }
+    else
+    {
+        out.push_back( 1 );
+
+        for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+        {
+            writeNode( node.children + i, out );
+        }
+    }
+}
+
+template<typename T>
+bool TVoxelOctree<T>::readNode( uint32_t index,
+                                size_t depth,
+                                const std::vector<unsigned char>& in,
+                                size_t& offset )
+{
+    if ( offset >= in.size() )
+    {
+        return false;
+    }
+
+    unsigned char tag = in[offset++];
+
+    if ( tag == 0 )
+    {
+        if ( in.size() - offset < sizeof(T) )
+        {
+            return false;
+        }
+
+        memcpy( &m_nodes[index].value, &in[offset], sizeof(T) );
+        offset += sizeof(T);
+
+        return true;
+    }
+    else if ( tag != 1 || depth >= m_height )
+    {
+        return false;
+    }
+
+    // Children are appended in the order they are read, which leaves the
+    // pool in depth first order
+    uint32_t block = allocateBlock( m_empty );
+    m_nodes[index].children = block;
+
+    for ( int i = 0; i < OCTREE_CHILD_COUNT; ++i )
+    {
+        if ( ! readNode( block + i, depth + 1, in, offset ) )
+        {
+            return false;
+        }
+    }
+
+    // Keep the octree canonical even if the writer didn't collapse
+    tryCollapse( index );
+    return true;
+}
+
+#ifdef OCTREE_DEBUG
+template<typename T>
+void TVoxelOctree<T>::checkPointBounds( const Point& pt ) const
+{
+    assert( pt.x >= 0 && static_cast<size_t>(pt.x) < m_dim );
+    assert( pt.y >= 0 && static_cast<size_t>(pt.y) < m_dim );
+    assert( pt.z >= 0 && static_cast<size_t>(pt.z) < m_dim );
+}
+#else
+template<typename T>
+void TVoxelOctree<T>::checkPointBounds( const Point& ) const
+{
+}
+#endif
+
 /////////////////////////////////////////////////////////////////////////////
 // Unit Tests
 /////////////////////////////////////////////////////////////////////////////
@@ -597,3 +1209,345 @@ TEST(TCubeGrid,TCubeGridCubeSetDoesExist)
     EXPECT_TRUE( tree.exists( Point(0, 0, 0) ) );
 }
 
+
+///////////////////////////////////////////////////////////////////////////
+// TVoxelOctree
+///////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <random>
+
+typedef TVoxelOctree<int> Voxels;
+
+namespace
+{
+    /**
+     * Flat reference volume to check the octree against
+     */
+    struct FlatVolume
+    {
+        FlatVolume( int dim_ ) : dim( dim_ ), cells( dim_ * dim_ * dim_, 0 ) {}
+
+        int& at( int x, int y, int z ) { return cells[ ( z * dim + y ) * dim + x ]; }
+
+        void fill( const Box& b, int value )
+        {
+            for ( int z = b.z; z < b.z + b.depth; ++z )
+                for ( int y = b.y; y < b.y + b.height; ++y )
+                    for ( int x = b.x; x < b.x + b.width; ++x )
+                        at( x, y, z ) = value;
+        }
+
+        int dim;
+        std::vector<int> cells;
+    };
+
+    Box randomBox( std::mt19937& random, int dim )
+    {
+        int x = random() % dim, y = random() % dim, z = random() % dim;
+
+        return Box( x, y, z,
+                    1 + random() % ( dim - x ),
+                    1 + random() % ( dim - y ),
+                    1 + random() % ( dim - z ) );
+    }
+
+    void expectSameAs( Voxels& voxels, FlatVolume& flat )
+    {
+        for ( int z = 0; z < flat.dim; ++z )
+            for ( int y = 0; y < flat.dim; ++y )
+                for ( int x = 0; x < flat.dim; ++x )
+                    ASSERT_EQ( flat.at( x, y, z ), voxels.get( Point( x, y, z ) ) );
+    }
+
+    struct CountVisitor
+    {
+        CountVisitor() : cubes( 0 ), sum( 0 ) {}
+
+        void operator()( const Box& region, int value )
+        {
+            long long volume = static_cast<long long>( region.width ) *
+                               region.height * region.depth;
+            cubes += volume;
+            sum   += volume * value;
+        }
+
+        long long cubes;
+        long long sum;
+    };
+
+    /**
+     * Cubes of a rolling terrain: solid below a height field and empty
+     * above it
+     */
+    std::vector<Point> rollingTerrain( int dim )
+    {
+        std::vector<Point> solid;
+
+        for ( int z = 0; z < dim; ++z )
+        {
+            for ( int x = 0; x < dim; ++x )
+            {
+                int ground = static_cast<int>( dim / 4 +
+                    dim / 8 * ( sin( x * 0.05 ) + cos( z * 0.07 ) ) );
+
+                for ( int y = 0; y < ground; ++y )
+                {
+                    solid.push_back( Point( x, y, z ) );
+                }
+            }
+        }
+
+        return solid;
+    }
+}
+
+TEST(TVoxelOctree,StartsAsOneEmptyLeaf)
+{
+    Voxels voxels( 64 );
+
+    EXPECT_EQ( (size_t) 6, voxels.treeHeight() );
+    EXPECT_EQ( (size_t) 1, voxels.nodeCount() );
+    EXPECT_EQ( 0, voxels.get( Point( 5, 6, 7 ) ) );
+    EXPECT_FALSE( voxels.exists( Point( 5, 6, 7 ) ) );
+}
+
+TEST(TVoxelOctree,SetAndGetEveryCube)
+{
+    const int dim = 16;
+    Voxels voxels( dim );
+    int c = 1;
+
+    for ( int z = 0; z < dim; ++z )
+        for ( int y = 0; y < dim; ++y )
+            for ( int x = 0; x < dim; ++x )
+                voxels.set( c++, Point( x, y, z ) );
+
+    c = 1;
+
+    for ( int z = 0; z < dim; ++z )
+        for ( int y = 0; y < dim; ++y )
+            for ( int x = 0; x < dim; ++x )
+                ASSERT_EQ( c++, voxels.get( Point( x, y, z ) ) );
+
+    EXPECT_TRUE( voxels.exists( Point( 0, 0, 0 ) ) );
+}
+
+TEST(TVoxelOctree,CollapsesHomogeneousSubtrees)
+{
+    Voxels voxels( 64 );
+
+    voxels.set( 3, Point( 0, 0, 0 ) );
+    EXPECT_EQ( (size_t) 1 + 6 * 8, voxels.nodeCount() );
+
+    // Filling in the rest of the 2x2x2 block collapses one level
+    for ( int i = 1; i < 8; ++i )
+    {
+        voxels.set( 3, Point( i & 1, ( i >> 1 ) & 1, ( i >> 2 ) & 1 ) );
+    }
+
+    EXPECT_EQ( (size_t) 1 + 5 * 8, voxels.nodeCount() );
+
+    // Setting it back to empty collapses everything
+    voxels.fill( Box( 0, 0, 0, 2, 2, 2 ), 0 );
+    EXPECT_EQ( (size_t) 1, voxels.nodeCount() );
+
+    // Blocks are reused rather than allocated again
+    size_t memory = voxels.memoryUsed();
+    voxels.set( 4, Point( 63, 63, 63 ) );
+    EXPECT_EQ( memory, voxels.memoryUsed() );
+}
+
+TEST(TVoxelOctree,FillMatchesPerCubeSets)
+{
+    const int dim = 32;
+    std::mt19937 random( 45 );
+
+    Voxels voxels( dim );
+    FlatVolume flat( dim );
+
+    for ( int i = 0; i < 200; ++i )
+    {
+        Box box   = randomBox( random, dim );
+        int value = random() % 4;
+
+        voxels.fill( box, value );
+        flat.fill( box, value );
+
+        // Single cube edits mixed in with the boxes
+        Point pt( random() % dim, random() % dim, random() % dim );
+        voxels.set( value + 1, pt );
+        flat.at( pt.x, pt.y, pt.z ) = value + 1;
+    }
+
+    expectSameAs( voxels, flat );
+
+    // Filling the whole volume leaves a single leaf
+    voxels.fill( Box( 0, 0, 0, dim, dim, dim ), 7 );
+    EXPECT_EQ( (size_t) 1, voxels.nodeCount() );
+    EXPECT_EQ( 7, voxels.get( Point( 31, 0, 17 ) ) );
+}
+
+TEST(TVoxelOctree,ForEachInBoxVisitsNonEmptyRegions)
+{
+    const int dim = 32;
+    std::mt19937 random( 46 );
+
+    Voxels voxels( dim );
+    FlatVolume flat( dim );
+
+    for ( int i = 0; i < 50; ++i )
+    {
+        Box box   = randomBox( random, dim );
+        int value = random() % 3;
+
+        voxels.fill( box, value );
+        flat.fill( box, value );
+    }
+
+    for ( int i = 0; i < 50; ++i )
+    {
+        Box box = randomBox( random, dim );
+        CountVisitor visitor;
+        long long cubes = 0, sum = 0;
+
+        voxels.forEachInBox( box, visitor );
+
+        for ( int z = box.z; z < box.z + box.depth; ++z )
+            for ( int y = box.y; y < box.y + box.height; ++y )
+                for ( int x = box.x; x < box.x + box.width; ++x )
+                {
+                    cubes += ( flat.at( x, y, z ) != 0 ? 1 : 0 );
+                    sum   += flat.at( x, y, z );
+                }
+
+        EXPECT_EQ( cubes, visitor.cubes );
+        EXPECT_EQ( sum, visitor.sum );
+    }
+}
+
+TEST(TVoxelOctree,SerializeRoundTrip)
+{
+    const int dim = 32;
+    std::mt19937 random( 47 );
+
+    Voxels voxels( dim );
+    FlatVolume flat( dim );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        Box box   = randomBox( random, dim );
+        int value = random() % 5;
+
+        voxels.fill( box, value );
+        flat.fill( box, value );
+    }
+
+    std::vector<unsigned char> bytes;
+    voxels.serialize( bytes );
+
+    Voxels copy( 2 );
+    ASSERT_TRUE( copy.deserialize( bytes ) );
+    EXPECT_EQ( (size_t) dim, copy.dim() );
+    EXPECT_EQ( voxels.nodeCount(), copy.nodeCount() );
+    expectSameAs( copy, flat );
+
+    // Truncated, padded or otherwise broken data is rejected
+    std::vector<unsigned char> broken( bytes.begin(), bytes.end() - 1 );
+    EXPECT_FALSE( copy.deserialize( broken ) );
+    EXPECT_EQ( (size_t) 1, copy.nodeCount() );
+
+    broken = bytes;
+    broken.push_back( 0 );
+    EXPECT_FALSE( copy.deserialize( broken ) );
+
+    broken = bytes;
+    broken[4] = 2;
+    EXPECT_FALSE( copy.deserialize( broken ) );
+
+    broken = bytes;
+    broken[0] = 3;
+    EXPECT_FALSE( copy.deserialize( broken ) );
+}
+
+TEST(TVoxelOctree,MatchesCubeGridOnTerrain)
+{
+    const int dim = 32;
+    std::vector<Point> solid = rollingTerrain( dim );
+
+    Tree grid( dim );
+    Voxels voxels( dim );
+
+    for ( size_t i = 0; i < solid.size(); ++i )
+    {
+        grid.set( 1, solid[i] );
+        voxels.set( 1, solid[i] );
+    }
+
+    long long gridSum = 0, voxelSum = 0;
+
+    for ( size_t i = 0; i < solid.size(); ++i )
+    {
+        gridSum  += grid.get( solid[i] );
+        voxelSum += voxels.get( solid[i] );
+    }
+
+    EXPECT_EQ( gridSum, voxelSum );
+    EXPECT_EQ( static_cast<long long>( solid.size() ), voxelSum );
+
+    // The empty cubes above the ground agree too
+    for ( int z = 0; z < dim; ++z )
+        for ( int y = 0; y < dim; ++y )
+            for ( int x = 0; x < dim; ++x )
+                ASSERT_EQ( grid.get( Point( x, y, z ) ), voxels.get( Point( x, y, z ) ) );
+
+    // Solid ground collapses into far fewer nodes than it has cubes
+    EXPECT_LT( voxels.nodeCount(), solid.size() / 4 );
+}
+
+/**
+ * Compares memory per cube and set/get times against TCubeGrid on a big
+ * rolling terrain. It only reports numbers, so it is disabled; run it with
+ * --gtest_also_run_disabled_tests
+ */
+TEST(TVoxelOctree,DISABLED_CompareWithCubeGrid)
+{
+    typedef std::chrono::steady_clock Clock;
+    const int dim = 128;
+
+    std::vector<Point> solid = rollingTerrain( dim );
+
+    Tree grid( dim );
+    Voxels voxels( dim );
+
+    Clock::time_point start = Clock::now();
+    for ( size_t i = 0; i < solid.size(); ++i ) { grid.set( 1, solid[i] ); }
+    double gridSet = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+
+    start = Clock::now();
+    for ( size_t i = 0; i < solid.size(); ++i ) { voxels.set( 1, solid[i] ); }
+    double voxelSet = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+
+    long long gridSum = 0, voxelSum = 0;
+
+    start = Clock::now();
+    for ( size_t i = 0; i < solid.size(); ++i ) { gridSum += grid.get( solid[i] ); }
+    double gridGet = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+
+    start = Clock::now();
+    for ( size_t i = 0; i < solid.size(); ++i ) { voxelSum += voxels.get( solid[i] ); }
+    double voxelGet = std::chrono::duration<double, std::nano>( Clock::now() - start ).count();
+
+    EXPECT_EQ( gridSum, voxelSum );
+    EXPECT_EQ( static_cast<long long>( solid.size() ), voxelSum );
+
+    double count = static_cast<double>( solid.size() );
+
+    std::cout << solid.size() << " solid cubes in a " << dim << "^3 volume"
+              << std::endl
+              << "  TCubeGrid:    " << grid.memoryUsed() / count << " bytes/cube, "
+              << gridSet / count << " ns/set, " << gridGet / count << " ns/get"
+              << std::endl
+              << "  TVoxelOctree: " << voxels.memoryUsed() / count << " bytes/cube, "
+              << voxelSet / count << " ns/set, " << voxelGet / count << " ns/get"
+              << " (" << voxels.nodeCount() << " nodes)" << std::endl;
+}
@@ -0,0 +1,224 @@
+/**
+ * Benchmarks game2d/quadtree.h against a brute force scan, using a large
+ * number of points that all move a little every frame.
+ *
+ * Each frame every point takes a step and is moved in the quadtree, and
+ * then a set of radius and rectangle queries are run: one at a time, as a
+ * batch, and (for a few of them) by checking every point. The brute force
+ * answers are also used to check the quadtree's.
+ *
+ * Usage: quadtreebench [points] [frames] [queries]
+ */
+#include <game2d/quadtree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    typedef QuadTree<uint32_t> PointTree;
+    typedef std::chrono::steady_clock Clock;
+
+    const unsigned int WORLD_SIZE   = 16383;
+    const unsigned int QUERY_RADIUS = 48;
+    const unsigned int QUERY_SIDE   = 96;
+
+    // Queries checked by brute force each frame. Each one is a full scan
+    const std::size_t BRUTE_FORCE_QUERIES = 8;
+
+    struct Mover
+    {
+        int x, y;
+        int dx, dy;
+    };
+
+    double elapsedMs( Clock::time_point start )
+    {
+        return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+    }
+
+    void step( Mover& m )
+    {
+        m.x += m.dx;
+        m.y += m.dy;
+
+        if ( m.x < 0 || m.x > static_cast<int>( WORLD_SIZE ) ) { m.dx = -m.dx; m.x += 2 * m.dx; }
+        if ( m.y < 0 || m.y > static_cast<int>( WORLD_SIZE ) ) { m.dy = -m.dy; m.y += 2 * m.dy; }
+    }
+
+    std::size_t bruteForceRadius( const std::vector<Mover>& movers, const Point& c )
+    {
+        const long long r2 = static_cast<long long>( QUERY_RADIUS ) * QUERY_RADIUS;
+        std::size_t found  = 0;
+
+        for ( std::size_t i = 0; i < movers.size(); ++i )
+        {
+            long long dx = movers[i].x - static_cast<long long>( c.x() );
+            long long dy = movers[i].y - static_cast<long long>( c.y() );
+
+            found += ( dx * dx + dy * dy <= r2 ? 1 : 0 );
+        }
+
+        return found;
+    }
+
+    std::size_t bruteForceRect( const std::vector<Mover>& movers, const Rect& area )
+    {
+        const int x0 = area.left(), x1 = area.right();
+        const int y0 = area.top(),  y1 = area.bottom();
+        std::size_t found = 0;
+
+        for ( std::size_t i = 0; i < movers.size(); ++i )
+        {
+            found += ( movers[i].x >= x0 && movers[i].x <= x1 &&
+                       movers[i].y >= y0 && movers[i].y <= y1 ? 1 : 0 );
+        }
+
+        return found;
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    std::size_t pointCount = ( argc > 1 ? atol( argv[1] ) : 1000000 );
+    std::size_t frames     = ( argc > 2 ? atol( argv[2] ) : 10 );
+    std::size_t queryCount = ( argc > 3 ? atol( argv[3] ) : 10000 );
+
+    std::mt19937 random( 2012 );
+    std::uniform_int_distribution<int> coord( 0, WORLD_SIZE );
+    std::uniform_int_distribution<int> speed( -4, 4 );
+
+    std::vector<Mover> movers( pointCount );
+    std::vector<PointTree::ItemId> ids( pointCount );
+
+    //
+    // Build
+    //
+    Clock::time_point start = Clock::now();
+    PointTree tree( Rect( 0, 0, WORLD_SIZE, WORLD_SIZE ) );
+
+    for ( std::size_t i = 0; i < pointCount; ++i )
+    {
+        Mover m = { coord( random ), coord( random ), speed( random ), speed( random ) };
+
+        movers[i] = m;
+        ids[i]    = tree.insert( Point( m.x, m.y ), static_cast<uint32_t>( i ) );
+    }
+
+    tree.compact();
+
+    std::cout << "Built quadtree of " << pointCount << " points in "
+              << std::fixed << std::setprecision( 1 ) << elapsedMs( start )
+              << " ms (" << tree.nodeCount() << " nodes)" << std::endl;
+
+    double moveMs = 0.0, singleMs = 0.0, batchMs = 0.0, bruteMs = 0.0;
+    std::size_t mismatches = 0, found = 0;
+
+    std::vector<Point> centers( queryCount );
+    std::vector<Rect>  areas;
+    std::vector<PointTree::ItemId> results;
+    std::vector<PointTree::QueryRange> ranges;
+
+    for ( std::size_t frame = 0; frame < frames; ++frame )
+    {
+        //
+        // Move everything
+        //
+        start = Clock::now();
+
+        for ( std::size_t i = 0; i < pointCount; ++i )
+        {
+            step( movers[i] );
+            tree.move( ids[i], Point( movers[i].x, movers[i].y ) );
+        }
+
+        moveMs += elapsedMs( start );
+
+        areas.clear();
+
+        for ( std::size_t q = 0; q < queryCount; ++q )
+        {
+            centers[q] = Point( coord( random ), coord( random ) );
+            areas.push_back( Rect( coord( random ) % ( WORLD_SIZE - QUERY_SIDE ),
+                                   coord( random ) % ( WORLD_SIZE - QUERY_SIDE ),
+                                   QUERY_SIDE, QUERY_SIDE ) );
+        }
+
+        //
+        // Queries one at a time, in the order they were made
+        //
+        start = Clock::now();
+
+        for ( std::size_t q = 0; q < queryCount; ++q )
+        {
+            results.clear();
+            tree.queryRadius( centers[q], QUERY_RADIUS, results );
+            found += results.size();
+
+            results.clear();
+            tree.queryRect( areas[q], results );
+            found += results.size();
+        }
+
+        singleMs += elapsedMs( start );
+
+        //
+        // The same queries as a batch
+        //
+        start = Clock::now();
+
+        results.clear();
+        tree.queryRadii( centers, QUERY_RADIUS, results, ranges );
+        tree.queryRects( areas, results, ranges );
+
+        batchMs += elapsedMs( start );
+
+        //
+        // Brute force, checked against the quadtree
+        //
+        for ( std::size_t q = 0; q < std::min( BRUTE_FORCE_QUERIES, queryCount ); ++q )
+        {
+            start = Clock::now();
+            std::size_t expectedRadius = bruteForceRadius( movers, centers[q] );
+            std::size_t expectedRect   = bruteForceRect( movers, areas[q] );
+            bruteMs += elapsedMs( start );
+
+            results.clear();
+            tree.queryRadius( centers[q], QUERY_RADIUS, results );
+            std::size_t actualRadius = results.size();
+
+            results.clear();
+            tree.queryRect( areas[q], results );
+            std::size_t actualRect = results.size();
+
+            mismatches += ( expectedRadius != actualRadius ? 1 : 0 );
+            mismatches += ( expectedRect != actualRect ? 1 : 0 );
+        }
+    }
+
+    double queries = 2.0 * frames * queryCount;
+    double sampled = 2.0 * frames * std::min( BRUTE_FORCE_QUERIES, queryCount );
+
+    std::cout << std::setprecision( 2 )
+              << "Move all points:         " << moveMs / frames << " ms/frame" << std::endl
+              << "Tree queries:            " << 1000.0 * singleMs / queries << " us/query ("
+              << found / queries << " results each)" << std::endl
+              << "Tree queries (batched):  " << 1000.0 * batchMs / queries << " us/query" << std::endl
+              << "Brute force queries:     " << 1000.0 * bruteMs / sampled << " us/query" << std::endl
+              << "Speedup over brute force " << std::setprecision( 0 )
+              << ( bruteMs / sampled ) / ( batchMs / queries ) << "x" << std::endl;
+
+    if ( mismatches > 0 )
+    {
+        std::cout << "ERROR: " << mismatches << " queries did not match brute force"
+                  << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,11 +1,9 @@
 /////////////////////////////////////////////////////////////////////////////
 // HEADER
 /////////////////////////////////////////////////////////////////////////////
-#ifndef SCOTT_WORKBENCH_PERLIN_H
-#define SCOTT_WORKBENCH_PERLIN_H
-#define PERLIN_VERSION 0
-
-class Random;
+#ifndef SCOTT_WORKBENCH_SIMPLEX_H
+#define SCOTT_WORKBENCH_SIMPLEX_H
+#define SIMPLEX_VERSION 1
 
 /*
  * A speed-improved simplex noise algorithm for 2D, 3D and 4D in Java.
@@ -23,7 +21,6 @@ class Random;
  * attribution is appreciated.
  *
  */
-#include <math/vector.h>
 
 /**
  * SimplexNoise is a class that generates smooth noise in 2, 3 and 4
@@ -33,629 +30,969 @@ class Random;
  * example Java code from Stefan Gustavson (stegu@itn.liu.se). Additional
  * optimizations were added by Peter Eastman (peastman@drizzle.stanford.edu).
  *
- * The original source code was downloaded from: 
+ * The original source code was downloaded from:
  * http://www.itn.liu.se/~stegu/simplexnoise/SimplexNoise.java
+ *
+ * Instead of the fixed permutation of the original, the permutation table
+ * is shuffled from a seed. fillNoise2D and fillNoise3D fill whole grids of
+ * fractal noise, eight samples at a time with AVX2 when the compiler has
+ * it turned on. They never modify the generator, so threads can share one
+ * and each fill their own band of rows.
  */
 class SimplexNoise
 {
-private:
-    /**
-     * 2d noise
-     */
-    public static double noise ( double xin, double yin )
-    {
-        double n0, n1, n2; // Noise contributions from the three corners
-
-        // Skew the input space to determine which simplex cell we're in
-        double s = ( xin + yin ) * F2; // Hairy factor for 2D
-        int i    = floor( xin + s );
-        int j    = floor( yin + s );
-        double t = ( i + j ) * G2;
-
-        double X0 = i - t;      // Unskew the cell origin back to (x,y) space
-        double Y0 = j - t;
-        double x0 = xin - X0;   // The x,y distances from the cell origin
-        double y0 = yin - Y0;
-
-        // For the 2D case, the simplex shape is an equilateral triangle.
-        // Determine which simplex we are in.
-
-    int i1, j1; // Offsets for second (middle) corner of simplex in (i,j) coords
-
-    if(x0>y0) {i1=1; j1=0;} // lower triangle, XY order: (0,0)->(1,0)->(1,1)
-
-    else {i1=0; j1=1;}      // upper triangle, YX order: (0,0)->(0,1)->(1,1)
-
-    // A step of (1,0) in (i,j) means a step of (1-c,-c) in (x,y), and
-
-    // a step of (0,1) in (i,j) means a step of (-c,1-c) in (x,y), where
-
-    // c = (3-sqrt(3))/6
-
-    double x1 = x0 - i1 + G2; // Offsets for middle corner in (x,y) unskewed coords
-
-    double y1 = y0 - j1 + G2;
-
-    double x2 = x0 - 1.0 + 2.0 * G2; // Offsets for last corner in (x,y) unskewed coords
-
-    double y2 = y0 - 1.0 + 2.0 * G2;
-
-    // Work out the hashed gradient indices of the three simplex corners
-
-    int ii = i & 255;
-
-    int jj = j & 255;
-
-    int gi0 = permMod12[ii+perm[jj]];
-
-    int gi1 = permMod12[ii+i1+perm[jj+j1]];
+public:
+    explicit SimplexNoise( unsigned int seed );
+
+    float noise( float x, float y ) const;
+    float noise( float x, float y, float z ) const;
+    float noise( float x, float y, float z, float w ) const;
+
+    float fbm( float x, float y, unsigned int octaves ) const;
+    float fbm( float x, float y, float z, unsigned int octaves ) const;
+
+    void fillNoise2D( float * pGrid,
+                      unsigned int width,
+                      unsigned int height,
+                      float originX,
+                      float originY,
+                      float step,
+                      unsigned int octaves = 1 ) const;
+
+    void fillNoise3D( float * pGrid,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int depth,
+                      float originX,
+                      float originY,
+                      float originZ,
+                      float step,
+                      unsigned int octaves = 1 ) const;
 
-    int gi2 = permMod12[ii+1+perm[jj+1]];
+private:
+    static const unsigned int PERM_SIZE = 512;
 
-    // Calculate the contribution from the three corners
+    // Both tables repeat after 256 entries, and have four bytes of padding
+    // so the AVX2 code can load a whole int from any entry
+    unsigned char m_perm[PERM_SIZE + 4];
+    unsigned char m_permMod12[PERM_SIZE + 4];
+};
 
-    double t0 = 0.5 - x0*x0-y0*y0;
+#endif
 
-    if(t0<0) n0 = 0.0;
+/////////////////////////////////////////////////////////////////////////////
+// Implementation
+/////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
 
-    else {
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
-      t0 *= t0;
+namespace
+{
+    // Skewing and unskewing factors for 2, 3 and 4 dimensions
+    const float F2 = 0.36602540378f;    // 0.5 * ( sqrt(3) - 1 )
+    const float G2 = 0.21132486540f;    // ( 3 - sqrt(3) ) / 6
+    const float F3 = 1.0f / 3.0f;
+    const float G3 = 1.0f / 6.0f;
+    const float F4 = 0.30901699437f;    // ( sqrt(5) - 1 ) / 4
+    const float G4 = 0.13819660112f;    // ( 5 - sqrt(5) ) / 20
+
+    const float LACUNARITY = 2.0f;
+    const float GAIN       = 0.5f;
+
+    // The permutation table repeats after this many lattice cells
+    const float LATTICE_PERIOD = 256.0f;
+
+    // Gradients for 2D and 3D noise, the midpoints of the edges of a cube
+    const float GRAD3_X[12] = { 1,-1, 1,-1, 1,-1, 1,-1, 0, 0, 0, 0 };
+    const float GRAD3_Y[12] = { 1, 1,-1,-1, 0, 0, 0, 0, 1,-1, 1,-1 };
+    const float GRAD3_Z[12] = { 0, 0, 0, 0, 1, 1,-1,-1, 1, 1,-1,-1 };
+
+    const float GRAD4[32][4] =
+    {
+        { 0, 1, 1, 1}, { 0, 1, 1,-1}, { 0, 1,-1, 1}, { 0, 1,-1,-1},
+        { 0,-1, 1, 1}, { 0,-1, 1,-1}, { 0,-1,-1, 1}, { 0,-1,-1,-1},
+        { 1, 0, 1, 1}, { 1, 0, 1,-1}, { 1, 0,-1, 1}, { 1, 0,-1,-1},
+        {-1, 0, 1, 1}, {-1, 0, 1,-1}, {-1, 0,-1, 1}, {-1, 0,-1,-1},
+        { 1, 1, 0, 1}, { 1, 1, 0,-1}, { 1,-1, 0, 1}, { 1,-1, 0,-1},
+        {-1, 1, 0, 1}, {-1, 1, 0,-1}, {-1,-1, 0, 1}, {-1,-1, 0,-1},
+        { 1, 1, 1, 0}, { 1, 1,-1, 0}, { 1,-1, 1, 0}, { 1,-1,-1, 0},
+        {-1, 1, 1, 0}, {-1, 1,-1, 0}, {-1,-1, 1, 0}, {-1,-1,-1, 0}
+    };
 
-      n0 = t0 * t0 * dot(grad3[gi0], x0, y0);  // (x,y) of grad3 used for 2D gradient
+    /**
+     * Floors a skewed coordinate, and returns it along with the lattice
+     * cell it falls in wrapped into the period of the permutation table.
+     * The cell is wrapped while it is still a float, since far away
+     * coordinates (or a lot of octaves) do not fit in an int
+     */
+    inline float latticeCell( float a, int& cell )
+    {
+        float floored = std::floor( a );
+        float wrapped = floored - LATTICE_PERIOD * std::floor( floored * ( 1.0f / LATTICE_PERIOD ) );
 
+        cell = static_cast<int>( wrapped );
+        return floored;
     }
 
-    double t1 = 0.5 - x1*x1-y1*y1;
-
-    if(t1<0) n1 = 0.0;
-
-    else {
-
-      t1 *= t1;
+    /**
+     * Contribution of one simplex corner in 2D
+     */
+    inline float corner( float falloff, int gi, float x, float y )
+    {
+        float t = falloff - x * x - y * y;
 
-      n1 = t1 * t1 * dot(grad3[gi1], x1, y1);
+        if ( t < 0.0f )
+        {
+            return 0.0f;
+        }
 
+        t *= t;
+        return t * t * ( GRAD3_X[gi] * x + GRAD3_Y[gi] * y );
     }
 
-    double t2 = 0.5 - x2*x2-y2*y2;
-
-    if(t2<0) n2 = 0.0;
-
-    else {
-
-      t2 *= t2;
+    /**
+     * Contribution of one simplex corner in 3D
+     */
+    inline float corner( float falloff, int gi, float x, float y, float z )
+    {
+        float t = falloff - x * x - y * y - z * z;
 
-      n2 = t2 * t2 * dot(grad3[gi2], x2, y2);
+        if ( t < 0.0f )
+        {
+            return 0.0f;
+        }
 
+        t *= t;
+        return t * t * ( GRAD3_X[gi] * x + GRAD3_Y[gi] * y + GRAD3_Z[gi] * z );
     }
 
-    // Add contributions from each corner to get the final noise value.
-
-    // The result is scaled to return values in the interval [-1,1].
-
-    return 70.0 * (n0 + n1 + n2);
-
-  }
-
-
-
-
-
-  // 3D simplex noise
-
-  public static double noise(double xin, double yin, double zin) {
-
-    double n0, n1, n2, n3; // Noise contributions from the four corners
-
-    // Skew the input space to determine which simplex cell we're in
-
-    double s = (xin+yin+zin)*F3; // Very nice and simple skew factor for 3D
-
-    int i = fastfloor(xin+s);
-
-    int j = fastfloor(yin+s);
-
-    int k = fastfloor(zin+s);
-
-    double t = (i+j+k)*G3;
-
-    double X0 = i-t; // Unskew the cell origin back to (x,y,z) space
-
-    double Y0 = j-t;
-
-    double Z0 = k-t;
-
-    double x0 = xin-X0; // The x,y,z distances from the cell origin
-
-    double y0 = yin-Y0;
-
-    double z0 = zin-Z0;
-
-    // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
-
-    // Determine which simplex we are in.
-
-    int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
-
-    int i2, j2, k2; // Offsets for third corner of simplex in (i,j,k) coords
-
-    if(x0>=y0) {
-
-      if(y0>=z0)
-
-        { i1=1; j1=0; k1=0; i2=1; j2=1; k2=0; } // X Y Z order
-
-        else if(x0>=z0) { i1=1; j1=0; k1=0; i2=1; j2=0; k2=1; } // X Z Y order
-
-        else { i1=0; j1=0; k1=1; i2=1; j2=0; k2=1; } // Z X Y order
-
-      }
-
-    else { // x0<y0
-
-      if(y0<z0) { i1=0; j1=0; k1=1; i2=0; j2=1; k2=1; } // Z Y X order
+    /**
+     * Contribution of one simplex corner in 4D
+     */
+    inline float corner( int gi, float x, float y, float z, float w )
+    {
+        float t = 0.6f - x * x - y * y - z * z - w * w;
 
-      else if(x0<z0) { i1=0; j1=1; k1=0; i2=0; j2=1; k2=1; } // Y Z X order
+        if ( t < 0.0f )
+        {
+            return 0.0f;
+        }
 
-      else { i1=0; j1=1; k1=0; i2=1; j2=1; k2=0; } // Y X Z order
+        const float * g = GRAD4[gi];
 
+        t *= t;
+        return t * t * ( g[0] * x + g[1] * y + g[2] * z + g[3] * w );
     }
 
-    // A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
-
-    // a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
-
-    // a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
-
-    // c = 1/6.
-
-    double x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-
-    double y1 = y0 - j1 + G3;
-
-    double z1 = z0 - k1 + G3;
-
-    double x2 = x0 - i2 + 2.0*G3; // Offsets for third corner in (x,y,z) coords
-
-    double y2 = y0 - j2 + 2.0*G3;
-
-    double z2 = z0 - k2 + 2.0*G3;
-
-    double x3 = x0 - 1.0 + 3.0*G3; // Offsets for last corner in (x,y,z) coords
-
-    double y3 = y0 - 1.0 + 3.0*G3;
-
-    double z3 = z0 - 1.0 + 3.0*G3;
-
-    // Work out the hashed gradient indices of the four simplex corners
-
-    int ii = i & 255;
-
-    int jj = j & 255;
-
-    int kk = k & 255;
-
-    int gi0 = permMod12[ii+perm[jj+perm[kk]]];
-
-    int gi1 = permMod12[ii+i1+perm[jj+j1+perm[kk+k1]]];
+#ifdef __AVX2__
+    /**
+     * Eight lattice cells at once, the same as latticeCell
+     */
+    inline __m256 latticeCell8( __m256 a, __m256i& cell )
+    {
+        const __m256 period    = _mm256_set1_ps( LATTICE_PERIOD );
+        const __m256 invPeriod = _mm256_set1_ps( 1.0f / LATTICE_PERIOD );
 
-    int gi2 = permMod12[ii+i2+perm[jj+j2+perm[kk+k2]]];
+        __m256 floored = _mm256_floor_ps( a );
+        __m256 periods = _mm256_floor_ps( _mm256_mul_ps( floored, invPeriod ) );
 
-    int gi3 = permMod12[ii+1+perm[jj+1+perm[kk+1]]];
+        cell = _mm256_cvttps_epi32( _mm256_sub_ps( floored, _mm256_mul_ps( period, periods ) ) );
+        return floored;
+    }
 
-    // Calculate the contribution from the four corners
+    inline __m256i lookup8( const unsigned char * pTable, __m256i index )
+    {
+        __m256i value = _mm256_i32gather_epi32( reinterpret_cast<const int*>( pTable ),
+                                                index,
+                                                1 );
+        return _mm256_and_si256( value, _mm256_set1_epi32( 0xFF ) );
+    }
 
-    double t0 = 0.6 - x0*x0 - y0*y0 - z0*z0;
+    inline __m256 corner8( __m256 falloff, __m256i gi, __m256 x, __m256 y )
+    {
+        __m256 t = _mm256_sub_ps( _mm256_sub_ps( falloff, _mm256_mul_ps( x, x ) ),
+                                  _mm256_mul_ps( y, y ) );
+        t = _mm256_max_ps( t, _mm256_setzero_ps() );
+        t = _mm256_mul_ps( t, t );
 
-    if(t0<0) n0 = 0.0;
+        __m256 dot = _mm256_add_ps( _mm256_mul_ps( _mm256_i32gather_ps( GRAD3_X, gi, 4 ), x ),
+                                    _mm256_mul_ps( _mm256_i32gather_ps( GRAD3_Y, gi, 4 ), y ) );
 
-    else {
+        return _mm256_mul_ps( _mm256_mul_ps( t, t ), dot );
+    }
 
-      t0 *= t0;
+    inline __m256 corner8( __m256 falloff, __m256i gi, __m256 x, __m256 y, __m256 z )
+    {
+        __m256 t = _mm256_sub_ps( _mm256_sub_ps( _mm256_sub_ps( falloff, _mm256_mul_ps( x, x ) ),
+                                                 _mm256_mul_ps( y, y ) ),
+                                  _mm256_mul_ps( z, z ) );
+        t = _mm256_max_ps( t, _mm256_setzero_ps() );
+        t = _mm256_mul_ps( t, t );
+
+        __m256 dot = _mm256_add_ps(
+            _mm256_add_ps( _mm256_mul_ps( _mm256_i32gather_ps( GRAD3_X, gi, 4 ), x ),
+                           _mm256_mul_ps( _mm256_i32gather_ps( GRAD3_Y, gi, 4 ), y ) ),
+            _mm256_mul_ps( _mm256_i32gather_ps( GRAD3_Z, gi, 4 ), z ) );
+
+        return _mm256_mul_ps( _mm256_mul_ps( t, t ), dot );
+    }
 
-      n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
+    /**
+     * Eight samples of SimplexNoise::noise( x, y )
+     */
+    __m256 noise8( const unsigned char * pPerm,
+                   const unsigned char * pPermMod12,
+                   __m256 x,
+                   __m256 y )
+    {
+        const __m256 one     = _mm256_set1_ps( 1.0f );
+        const __m256 g2      = _mm256_set1_ps( G2 );
+        const __m256i one32  = _mm256_set1_epi32( 1 );
 
+        // Skew the input space to determine which simplex cell we're in
+        __m256i ii, jj;
+        __m256 s  = _mm256_mul_ps( _mm256_add_ps( x, y ), _mm256_set1_ps( F2 ) );
+        __m256 fi = latticeCell8( _mm256_add_ps( x, s ), ii );
+        __m256 fj = latticeCell8( _mm256_add_ps( y, s ), jj );
+        __m256 t  = _mm256_mul_ps( _mm256_add_ps( fi, fj ), g2 );
+
+        __m256 x0 = _mm256_sub_ps( x, _mm256_sub_ps( fi, t ) );
+        __m256 y0 = _mm256_sub_ps( y, _mm256_sub_ps( fj, t ) );
+
+        // Lower triangle when x0 > y0, upper triangle otherwise
+        __m256i lower = _mm256_castps_si256( _mm256_cmp_ps( x0, y0, _CMP_GT_OQ ) );
+        __m256i i1 = _mm256_and_si256( lower, one32 );
+        __m256i j1 = _mm256_sub_epi32( one32, i1 );
+
+        __m256 x1 = _mm256_add_ps( _mm256_sub_ps( x0, _mm256_cvtepi32_ps( i1 ) ), g2 );
+        __m256 y1 = _mm256_add_ps( _mm256_sub_ps( y0, _mm256_cvtepi32_ps( j1 ) ), g2 );
+        __m256 x2 = _mm256_add_ps( _mm256_sub_ps( x0, one ), _mm256_set1_ps( 2.0f * G2 ) );
+        __m256 y2 = _mm256_add_ps( _mm256_sub_ps( y0, one ), _mm256_set1_ps( 2.0f * G2 ) );
+
+        // Work out the hashed gradient indices of the three simplex corners
+        __m256i gi0 = lookup8( pPermMod12, _mm256_add_epi32( ii, lookup8( pPerm, jj ) ) );
+        __m256i gi1 = lookup8( pPermMod12, _mm256_add_epi32(
+            _mm256_add_epi32( ii, i1 ), lookup8( pPerm, _mm256_add_epi32( jj, j1 ) ) ) );
+        __m256i gi2 = lookup8( pPermMod12, _mm256_add_epi32(
+            _mm256_add_epi32( ii, one32 ), lookup8( pPerm, _mm256_add_epi32( jj, one32 ) ) ) );
+
+        const __m256 falloff = _mm256_set1_ps( 0.5f );
+        __m256 n = _mm256_add_ps( _mm256_add_ps( corner8( falloff, gi0, x0, y0 ),
+                                                 corner8( falloff, gi1, x1, y1 ) ),
+                                  corner8( falloff, gi2, x2, y2 ) );
+
+        return _mm256_mul_ps( _mm256_set1_ps( 70.0f ), n );
     }
 
-    double t1 = 0.6 - x1*x1 - y1*y1 - z1*z1;
+    /**
+     * Eight samples of SimplexNoise::noise( x, y, z )
+     */
+    __m256 noise8( const unsigned char * pPerm,
+                   const unsigned char * pPermMod12,
+                   __m256 x,
+                   __m256 y,
+                   __m256 z )
+    {
+        const __m256 one     = _mm256_set1_ps( 1.0f );
+        const __m256 g3      = _mm256_set1_ps( G3 );
+        const __m256i one32  = _mm256_set1_epi32( 1 );
+
+        __m256i ii, jj, kk;
+        __m256 s  = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( x, y ), z ),
+                                   _mm256_set1_ps( F3 ) );
+        __m256 fi = latticeCell8( _mm256_add_ps( x, s ), ii );
+        __m256 fj = latticeCell8( _mm256_add_ps( y, s ), jj );
+        __m256 fk = latticeCell8( _mm256_add_ps( z, s ), kk );
+        __m256 t  = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( fi, fj ), fk ), g3 );
+
+        __m256 x0 = _mm256_sub_ps( x, _mm256_sub_ps( fi, t ) );
+        __m256 y0 = _mm256_sub_ps( y, _mm256_sub_ps( fj, t ) );
+        __m256 z0 = _mm256_sub_ps( z, _mm256_sub_ps( fk, t ) );
+
+        // The six orderings of x0, y0 and z0 written as masks instead of
+        // the nested ifs of the scalar version
+        __m256i xy = _mm256_castps_si256( _mm256_cmp_ps( x0, y0, _CMP_GE_OQ ) );
+        __m256i yz = _mm256_castps_si256( _mm256_cmp_ps( y0, z0, _CMP_GE_OQ ) );
+        __m256i xz = _mm256_castps_si256( _mm256_cmp_ps( x0, z0, _CMP_GE_OQ ) );
+
+        __m256i i1 = _mm256_and_si256( _mm256_and_si256( xy, xz ), one32 );
+        __m256i j1 = _mm256_and_si256( _mm256_andnot_si256( xy, yz ), one32 );
+        __m256i k1 = _mm256_andnot_si256( _mm256_or_si256( xz, yz ), one32 );
+        __m256i i2 = _mm256_and_si256( _mm256_or_si256( xy, xz ), one32 );
+        __m256i j2 = _mm256_sub_epi32( one32, _mm256_andnot_si256( yz, _mm256_and_si256( xy, one32 ) ) );
+        __m256i k2 = _mm256_andnot_si256( _mm256_and_si256( xz, yz ), one32 );
+
+        __m256 x1 = _mm256_add_ps( _mm256_sub_ps( x0, _mm256_cvtepi32_ps( i1 ) ), g3 );
+        __m256 y1 = _mm256_add_ps( _mm256_sub_ps( y0, _mm256_cvtepi32_ps( j1 ) ), g3 );
+        __m256 z1 = _mm256_add_ps( _mm256_sub_ps( z0, _mm256_cvtepi32_ps( k1 ) ), g3 );
+
+        const __m256 twoG3 = _mm256_set1_ps( 2.0f * G3 );
+        __m256 x2 = _mm256_add_ps( _mm256_sub_ps( x0, _mm256_cvtepi32_ps( i2 ) ), twoG3 );
+        __m256 y2 = _mm256_add_ps( _mm256_sub_ps( y0, _mm256_cvtepi32_ps( j2 ) ), twoG3 );
+        __m256 z2 = _mm256_add_ps( _mm256_sub_ps( z0, _mm256_cvtepi32_ps( k2 ) ), twoG3 );
+
+        const __m256 threeG3 = _mm256_set1_ps( 3.0f * G3 );
+        __m256 x3 = _mm256_add_ps( _mm256_sub_ps( x0, one ), threeG3 );
+        __m256 y3 = _mm256_add_ps( _mm256_sub_ps( y0, one ), threeG3 );
+        __m256 z3 = _mm256_add_ps( _mm256_sub_ps( z0, one ), threeG3 );
+
+        #define SIMPLEX_HASH8(di,dj,dk)                                                   \
+            lookup8( pPermMod12, _mm256_add_epi32( _mm256_add_epi32( ii, di ),            \
+                lookup8( pPerm, _mm256_add_epi32( _mm256_add_epi32( jj, dj ),             \
+                    lookup8( pPerm, _mm256_add_epi32( kk, dk ) ) ) ) ) )
+
+        __m256i gi0 = SIMPLEX_HASH8( _mm256_setzero_si256(),
+                                     _mm256_setzero_si256(),
+                                     _mm256_setzero_si256() );
+        __m256i gi1 = SIMPLEX_HASH8( i1, j1, k1 );
+        __m256i gi2 = SIMPLEX_HASH8( i2, j2, k2 );
+        __m256i gi3 = SIMPLEX_HASH8( one32, one32, one32 );
+
+        #undef SIMPLEX_HASH8
+
+        const __m256 falloff = _mm256_set1_ps( 0.6f );
+        __m256 n = _mm256_add_ps(
+            _mm256_add_ps( _mm256_add_ps( corner8( falloff, gi0, x0, y0, z0 ),
+                                          corner8( falloff, gi1, x1, y1, z1 ) ),
+                           corner8( falloff, gi2, x2, y2, z2 ) ),
+            corner8( falloff, gi3, x3, y3, z3 ) );
+
+        return _mm256_mul_ps( _mm256_set1_ps( 32.0f ), n );
+    }
 
-    if(t1<0) n1 = 0.0;
+    /**
+     * X coordinates of eight samples in a row, starting at column col
+     */
+    inline __m256 columns8( float originX, float step, unsigned int col )
+    {
+        __m256i index = _mm256_add_epi32( _mm256_set1_epi32( static_cast<int>( col ) ),
+                                          _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
 
-    else {
+        return _mm256_add_ps( _mm256_set1_ps( originX ),
+                              _mm256_mul_ps( _mm256_cvtepi32_ps( index ),
+                                             _mm256_set1_ps( step ) ) );
+    }
+#endif
+}
 
-      t1 *= t1;
+/**
+ * Create a new noise generator
+ *
+ * \param  seed  Value used to shuffle the permutation table
+ */
+SimplexNoise::SimplexNoise( unsigned int seed )
+{
+    std::mt19937 rng( seed );
+    unsigned int half = PERM_SIZE / 2;
 
-      n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
+    for ( unsigned int i = 0; i < half; ++i )
+    {
+        m_perm[i] = static_cast<unsigned char>( i );
+    }
 
+    // Written out instead of std::shuffle so every standard library gives
+    // the same table for a seed
+    for ( unsigned int i = half - 1; i > 0; --i )
+    {
+        std::swap( m_perm[i], m_perm[ rng() % ( i + 1 ) ] );
     }
 
-    double t2 = 0.6 - x2*x2 - y2*y2 - z2*z2;
+    for ( unsigned int i = 0; i < PERM_SIZE; ++i )
+    {
+        m_perm[i]      = m_perm[ i & ( half - 1 ) ];
+        m_permMod12[i] = static_cast<unsigned char>( m_perm[i] % 12 );
+    }
 
-    if(t2<0) n2 = 0.0;
+    std::fill( m_perm + PERM_SIZE, m_perm + PERM_SIZE + 4, 0 );
+    std::fill( m_permMod12 + PERM_SIZE, m_permMod12 + PERM_SIZE + 4, 0 );
+}
 
-    else {
+/**
+ * 2D simplex noise, in the range [-1,1]
+ */
+float SimplexNoise::noise( float xin, float yin ) const
+{
+    // Skew the input space to determine which simplex cell we're in
+    int ii, jj;
+    float s  = ( xin + yin ) * F2;
+    float fi = latticeCell( xin + s, ii );
+    float fj = latticeCell( yin + s, jj );
+    float t  = ( fi + fj ) * G2;
+
+    float x0 = xin - ( fi - t );    // The x,y distances from the cell origin
+    float y0 = yin - ( fj - t );
+
+    // For the 2D case, the simplex shape is an equilateral triangle.
+    // Determine which simplex we are in: lower triangle, XY order
+    // (0,0)->(1,0)->(1,1) or upper triangle, YX order (0,0)->(0,1)->(1,1)
+    int i1 = ( x0 > y0 ? 1 : 0 );
+    int j1 = 1 - i1;
+
+    // A step of (1,0) in (i,j) means a step of (1-c,-c) in (x,y), and a
+    // step of (0,1) in (i,j) means a step of (-c,1-c) in (x,y), where
+    // c = (3-sqrt(3))/6
+    float x1 = x0 - i1 + G2;
+    float y1 = y0 - j1 + G2;
+    float x2 = x0 - 1.0f + 2.0f * G2;
+    float y2 = y0 - 1.0f + 2.0f * G2;
 
-      t2 *= t2;
+    // Work out the hashed gradient indices of the three simplex corners
+    int gi0 = m_permMod12[ ii + m_perm[jj] ];
+    int gi1 = m_permMod12[ ii + i1 + m_perm[jj + j1] ];
+    int gi2 = m_permMod12[ ii + 1 + m_perm[jj + 1] ];
 
-      n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
+    // Add contributions from each corner to get the final noise value.
+    // The result is scaled to return values in the interval [-1,1].
+    return 70.0f * ( corner( 0.5f, gi0, x0, y0 ) +
+                     corner( 0.5f, gi1, x1, y1 ) +
+                     corner( 0.5f, gi2, x2, y2 ) );
+}
 
+/**
+ * 3D simplex noise, in the range [-1,1]
+ */
+float SimplexNoise::noise( float xin, float yin, float zin ) const
+{
+    // Skew the input space to determine which simplex cell we're in
+    int ii, jj, kk;
+    float s  = ( xin + yin + zin ) * F3;
+    float fi = latticeCell( xin + s, ii );
+    float fj = latticeCell( yin + s, jj );
+    float fk = latticeCell( zin + s, kk );
+    float t  = ( fi + fj + fk ) * G3;
+
+    float x0 = xin - ( fi - t );    // The x,y,z distances from the cell origin
+    float y0 = yin - ( fj - t );
+    float z0 = zin - ( fk - t );
+
+    // For the 3D case, the simplex shape is a slightly irregular
+    // tetrahedron. Determine which simplex we are in.
+    int i1, j1, k1;     // Offsets for second corner of simplex in (i,j,k)
+    int i2, j2, k2;     // Offsets for third corner of simplex in (i,j,k)
+
+    if ( x0 >= y0 )
+    {
+        if ( y0 >= z0 )
+        {
+            i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0;     // X Y Z order
+        }
+        else if ( x0 >= z0 )
+        {
+            i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1;     // X Z Y order
+        }
+        else
+        {
+            i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1;     // Z X Y order
+        }
+    }
+    else
+    {
+        if ( y0 < z0 )
+        {
+            i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1;     // Z Y X order
+        }
+        else if ( x0 < z0 )
+        {
+            i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1;     // Y Z X order
+        }
+        else
+        {
+            i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0;     // Y X Z order
+        }
     }
 
-    double t3 = 0.6 - x3*x3 - y3*y3 - z3*z3;
-
-    if(t3<0) n3 = 0.0;
-
-    else {
-
-      t3 *= t3;
-
-      n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
+    // A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
+    // a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z),
+    // and a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in
+    // (x,y,z), where c = 1/6.
+    float x1 = x0 - i1 + G3;
+    float y1 = y0 - j1 + G3;
+    float z1 = z0 - k1 + G3;
+    float x2 = x0 - i2 + 2.0f * G3;
+    float y2 = y0 - j2 + 2.0f * G3;
+    float z2 = z0 - k2 + 2.0f * G3;
+    float x3 = x0 - 1.0f + 3.0f * G3;
+    float y3 = y0 - 1.0f + 3.0f * G3;
+    float z3 = z0 - 1.0f + 3.0f * G3;
 
-    }
+    // Work out the hashed gradient indices of the four simplex corners
+    int gi0 = m_permMod12[ ii + m_perm[ jj + m_perm[kk] ] ];
+    int gi1 = m_permMod12[ ii + i1 + m_perm[ jj + j1 + m_perm[kk + k1] ] ];
+    int gi2 = m_permMod12[ ii + i2 + m_perm[ jj + j2 + m_perm[kk + k2] ] ];
+    int gi3 = m_permMod12[ ii + 1 + m_perm[ jj + 1 + m_perm[kk + 1] ] ];
 
     // Add contributions from each corner to get the final noise value.
-
     // The result is scaled to stay just inside [-1,1]
+    return 32.0f * ( corner( 0.6f, gi0, x0, y0, z0 ) +
+                     corner( 0.6f, gi1, x1, y1, z1 ) +
+                     corner( 0.6f, gi2, x2, y2, z2 ) +
+                     corner( 0.6f, gi3, x3, y3, z3 ) );
+}
 
-    return 32.0*(n0 + n1 + n2 + n3);
-
-  }
-
-
-
-
-
-  // 4D simplex noise, better simplex rank ordering method 2012-03-09
-
-  public static double noise(double x, double y, double z, double w) {
-
-
-
-    double n0, n1, n2, n3, n4; // Noise contributions from the five corners
-
-    // Skew the (x,y,z,w) space to determine which cell of 24 simplices we're in
-
-    double s = (x + y + z + w) * F4; // Factor for 4D skewing
-
-    int i = fastfloor(x + s);
-
-    int j = fastfloor(y + s);
-
-    int k = fastfloor(z + s);
-
-    int l = fastfloor(w + s);
-
-    double t = (i + j + k + l) * G4; // Factor for 4D unskewing
-
-    double X0 = i - t; // Unskew the cell origin back to (x,y,z,w) space
-
-    double Y0 = j - t;
-
-    double Z0 = k - t;
-
-    double W0 = l - t;
-
-    double x0 = x - X0;  // The x,y,z,w distances from the cell origin
-
-    double y0 = y - Y0;
-
-    double z0 = z - Z0;
-
-    double w0 = w - W0;
-
-    // For the 4D case, the simplex is a 4D shape I won't even try to describe.
+/**
+ * 4D simplex noise, using the better simplex rank ordering from 2012-03-09
+ */
+float SimplexNoise::noise( float x, float y, float z, float w ) const
+{
+    // Skew the (x,y,z,w) space to determine which cell of 24 simplices
+    // we're in
+    int ii, jj, kk, ll;
+    float s  = ( x + y + z + w ) * F4;
+    float fi = latticeCell( x + s, ii );
+    float fj = latticeCell( y + s, jj );
+    float fk = latticeCell( z + s, kk );
+    float fl = latticeCell( w + s, ll );
+    float t  = ( fi + fj + fk + fl ) * G4;
+
+    float x0 = x - ( fi - t );
+    float y0 = y - ( fj - t );
+    float z0 = z - ( fk - t );
+    float w0 = w - ( fl - t );
 
     // To find out which of the 24 possible simplices we're in, we need to
-
-    // determine the magnitude ordering of x0, y0, z0 and w0.
-
-    // Six pair-wise comparisons are performed between each possible pair
-
-    // of the four coordinates, and the results are used to rank the numbers.
-
-    int rankx = 0;
-
-    int ranky = 0;
-
-    int rankz = 0;
-
-    int rankw = 0;
-
-    if(x0 > y0) rankx++; else ranky++;
-
-    if(x0 > z0) rankx++; else rankz++;
-
-    if(x0 > w0) rankx++; else rankw++;
-
-    if(y0 > z0) ranky++; else rankz++;
-
-    if(y0 > w0) ranky++; else rankw++;
-
-    if(z0 > w0) rankz++; else rankw++;
-
-    int i1, j1, k1, l1; // The integer offsets for the second simplex corner
-
-    int i2, j2, k2, l2; // The integer offsets for the third simplex corner
-
-    int i3, j3, k3, l3; // The integer offsets for the fourth simplex corner
-
-    // simplex[c] is a 4-vector with the numbers 0, 1, 2 and 3 in some order.
-
-    // Many values of c will never occur, since e.g. x>y>z>w makes x<z, y<w and x<w
-
-    // impossible. Only the 24 indices which have non-zero entries make any sense.
-
-    // We use a thresholding to set the coordinates in turn from the largest magnitude.
-
-    // Rank 3 denotes the largest coordinate.
-
-    i1 = rankx >= 3 ? 1 : 0;
-
-    j1 = ranky >= 3 ? 1 : 0;
-
-    k1 = rankz >= 3 ? 1 : 0;
-
-    l1 = rankw >= 3 ? 1 : 0;
-
-    // Rank 2 denotes the second largest coordinate.
-
-    i2 = rankx >= 2 ? 1 : 0;
-
-    j2 = ranky >= 2 ? 1 : 0;
-
-    k2 = rankz >= 2 ? 1 : 0;
-
-    l2 = rankw >= 2 ? 1 : 0;
-
-    // Rank 1 denotes the second smallest coordinate.
-
-    i3 = rankx >= 1 ? 1 : 0;
-
-    j3 = ranky >= 1 ? 1 : 0;
-
-    k3 = rankz >= 1 ? 1 : 0;
-
-    l3 = rankw >= 1 ? 1 : 0;
-
-    // The fifth corner has all coordinate offsets = 1, so no need to compute that.
-
-    double x1 = x0 - i1 + G4; // Offsets for second corner in (x,y,z,w) coords
-
-    double y1 = y0 - j1 + G4;
-
-    double z1 = z0 - k1 + G4;
-
-    double w1 = w0 - l1 + G4;
-
-    double x2 = x0 - i2 + 2.0*G4; // Offsets for third corner in (x,y,z,w) coords
-
-    double y2 = y0 - j2 + 2.0*G4;
-
-    double z2 = z0 - k2 + 2.0*G4;
-
-    double w2 = w0 - l2 + 2.0*G4;
-
-    double x3 = x0 - i3 + 3.0*G4; // Offsets for fourth corner in (x,y,z,w) coords
-
-    double y3 = y0 - j3 + 3.0*G4;
-
-    double z3 = z0 - k3 + 3.0*G4;
-
-    double w3 = w0 - l3 + 3.0*G4;
-
-    double x4 = x0 - 1.0 + 4.0*G4; // Offsets for last corner in (x,y,z,w) coords
-
-    double y4 = y0 - 1.0 + 4.0*G4;
-
-    double z4 = z0 - 1.0 + 4.0*G4;
-
-    double w4 = w0 - 1.0 + 4.0*G4;
+    // determine the magnitude ordering of x0, y0, z0 and w0. Six pair-wise
+    // comparisons are performed between each possible pair of the four
+    // coordinates, and the results are used to rank the numbers.
+    int rankx = 0, ranky = 0, rankz = 0, rankw = 0;
+
+    if ( x0 > y0 ) rankx++; else ranky++;
+    if ( x0 > z0 ) rankx++; else rankz++;
+    if ( x0 > w0 ) rankx++; else rankw++;
+    if ( y0 > z0 ) ranky++; else rankz++;
+    if ( y0 > w0 ) ranky++; else rankw++;
+    if ( z0 > w0 ) rankz++; else rankw++;
+
+    // The integer offsets of the second, third and fourth simplex corners.
+    // Rank 3 denotes the largest coordinate, rank 1 the second smallest.
+    // The fifth corner has all coordinate offsets = 1
+    int i1 = ( rankx >= 3 ), j1 = ( ranky >= 3 ), k1 = ( rankz >= 3 ), l1 = ( rankw >= 3 );
+    int i2 = ( rankx >= 2 ), j2 = ( ranky >= 2 ), k2 = ( rankz >= 2 ), l2 = ( rankw >= 2 );
+    int i3 = ( rankx >= 1 ), j3 = ( ranky >= 1 ), k3 = ( rankz >= 1 ), l3 = ( rankw >= 1 );
+
+    float x1 = x0 - i1 + G4,        y1 = y0 - j1 + G4;
+    float z1 = z0 - k1 + G4,        w1 = w0 - l1 + G4;
+    float x2 = x0 - i2 + 2.0f * G4, y2 = y0 - j2 + 2.0f * G4;
+    float z2 = z0 - k2 + 2.0f * G4, w2 = w0 - l2 + 2.0f * G4;
+    float x3 = x0 - i3 + 3.0f * G4, y3 = y0 - j3 + 3.0f * G4;
+    float z3 = z0 - k3 + 3.0f * G4, w3 = w0 - l3 + 3.0f * G4;
+    float x4 = x0 - 1.0f + 4.0f * G4, y4 = y0 - 1.0f + 4.0f * G4;
+    float z4 = z0 - 1.0f + 4.0f * G4, w4 = w0 - 1.0f + 4.0f * G4;
 
     // Work out the hashed gradient indices of the five simplex corners
+    int gi0 = m_perm[ii+m_perm[jj+m_perm[kk+m_perm[ll]]]] % 32;
+    int gi1 = m_perm[ii+i1+m_perm[jj+j1+m_perm[kk+k1+m_perm[ll+l1]]]] % 32;
+    int gi2 = m_perm[ii+i2+m_perm[jj+j2+m_perm[kk+k2+m_perm[ll+l2]]]] % 32;
+    int gi3 = m_perm[ii+i3+m_perm[jj+j3+m_perm[kk+k3+m_perm[ll+l3]]]] % 32;
+    int gi4 = m_perm[ii+1+m_perm[jj+1+m_perm[kk+1+m_perm[ll+1]]]] % 32;
 
-    int ii = i & 255;
-
-    int jj = j & 255;
-
-    int kk = k & 255;
-
-    int ll = l & 255;
-
-    int gi0 = perm[ii+perm[jj+perm[kk+perm[ll]]]] % 32;
-
-    int gi1 = perm[ii+i1+perm[jj+j1+perm[kk+k1+perm[ll+l1]]]] % 32;
-
-    int gi2 = perm[ii+i2+perm[jj+j2+perm[kk+k2+perm[ll+l2]]]] % 32;
-
-    int gi3 = perm[ii+i3+perm[jj+j3+perm[kk+k3+perm[ll+l3]]]] % 32;
-
-    int gi4 = perm[ii+1+perm[jj+1+perm[kk+1+perm[ll+1]]]] % 32;
-
-    // Calculate the contribution from the five corners
-
-    double t0 = 0.6 - x0*x0 - y0*y0 - z0*z0 - w0*w0;
-
-    if(t0<0) n0 = 0.0;
-
-    else {
-
-      t0 *= t0;
+    // Sum up and scale the result to cover the range [-1,1]
+    return 27.0f * ( corner( gi0, x0, y0, z0, w0 ) +
+                     corner( gi1, x1, y1, z1, w1 ) +
+                     corner( gi2, x2, y2, z2, w2 ) +
+                     corner( gi3, x3, y3, z3, w3 ) +
+                     corner( gi4, x4, y4, z4, w4 ) );
+}
 
-      n0 = t0 * t0 * dot(grad4[gi0], x0, y0, z0, w0);
+/**
+ * Fractal (fBm) noise made by adding up octaves of 2D noise. Each octave
+ * doubles the frequency and halves the amplitude of the one before it, and
+ * the sum is scaled back into the range of a single octave
+ */
+float SimplexNoise::fbm( float x, float y, unsigned int octaves ) const
+{
+    float total = 0.0f, range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
 
+    for ( unsigned int i = 0; i < std::max( octaves, 1u ); ++i )
+    {
+        total     += amplitude * noise( x * frequency, y * frequency );
+        range     += amplitude;
+        amplitude *= GAIN;
+        frequency *= LACUNARITY;
     }
 
-   double t1 = 0.6 - x1*x1 - y1*y1 - z1*z1 - w1*w1;
-
-    if(t1<0) n1 = 0.0;
-
-    else {
-
-      t1 *= t1;
+    return total / range;
+}
 
-      n1 = t1 * t1 * dot(grad4[gi1], x1, y1, z1, w1);
+/**
+ * Fractal (fBm) noise made by adding up octaves of 3D noise
+ */
+float SimplexNoise::fbm( float x, float y, float z, unsigned int octaves ) const
+{
+    float total = 0.0f, range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
 
+    for ( unsigned int i = 0; i < std::max( octaves, 1u ); ++i )
+    {
+        total     += amplitude * noise( x * frequency, y * frequency, z * frequency );
+        range     += amplitude;
+        amplitude *= GAIN;
+        frequency *= LACUNARITY;
     }
 
-   double t2 = 0.6 - x2*x2 - y2*y2 - z2*z2 - w2*w2;
-
-    if(t2<0) n2 = 0.0;
+    return total / range;
+}
 
-    else {
+/**
+ * Fills a row major grid of width by height samples, where the sample at
+ * column c and row r is fbm( originX + c * step, originY + r * step )
+ */
+void SimplexNoise::fillNoise2D( float * pGrid,
+                                unsigned int width,
+                                unsigned int height,
+                                float originX,
+                                float originY,
+                                float step,
+                                unsigned int octaves ) const
+{
+    octaves = std::max( octaves, 1u );
 
-      t2 *= t2;
+    for ( unsigned int row = 0; row < height; ++row )
+    {
+        float * pRow   = pGrid + static_cast<std::size_t>( row ) * width;
+        float sampleY  = originY + static_cast<float>( row ) * step;
+        unsigned int col = 0;
+
+#ifdef __AVX2__
+        for ( ; col + 8 <= width; col += 8 )
+        {
+            __m256 x = columns8( originX, step, col );
+            __m256 y = _mm256_set1_ps( sampleY );
+
+            __m256 total = _mm256_setzero_ps();
+            float range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
+
+            for ( unsigned int i = 0; i < octaves; ++i )
+            {
+                __m256 f = _mm256_set1_ps( frequency );
+                __m256 n = noise8( m_perm, m_permMod12,
+                                   _mm256_mul_ps( x, f ),
+                                   _mm256_mul_ps( y, f ) );
+
+                total      = _mm256_add_ps( total, _mm256_mul_ps( _mm256_set1_ps( amplitude ), n ) );
+                range     += amplitude;
+                amplitude *= GAIN;
+                frequency *= LACUNARITY;
+            }
+
+            _mm256_storeu_ps( pRow + col, _mm256_div_ps( total, _mm256_set1_ps( range ) ) );
+        }
+#endif
+
+        for ( ; col < width; ++col )
+        {
+            pRow[col] = fbm( originX + static_cast<float>( col ) * step, sampleY, octaves );
+        }
+    }
+}
 
-      n2 = t2 * t2 * dot(grad4[gi2], x2, y2, z2, w2);
+/**
+ * Fills a grid of width by height by depth samples. The sample at (c,r,s)
+ * is stored at index (s * height + r) * width + c
+ */
+void SimplexNoise::fillNoise3D( float * pGrid,
+                                unsigned int width,
+                                unsigned int height,
+                                unsigned int depth,
+                                float originX,
+                                float originY,
+                                float originZ,
+                                float step,
+                                unsigned int octaves ) const
+{
+    octaves = std::max( octaves, 1u );
 
+    for ( unsigned int slice = 0; slice < depth; ++slice )
+    {
+        float sampleZ = originZ + static_cast<float>( slice ) * step;
+
+        for ( unsigned int row = 0; row < height; ++row )
+        {
+            float * pRow = pGrid + ( static_cast<std::size_t>( slice ) * height + row ) * width;
+            float sampleY = originY + static_cast<float>( row ) * step;
+            unsigned int col = 0;
+
+#ifdef __AVX2__
+            for ( ; col + 8 <= width; col += 8 )
+            {
+                __m256 x = columns8( originX, step, col );
+                __m256 y = _mm256_set1_ps( sampleY );
+                __m256 z = _mm256_set1_ps( sampleZ );
+
+                __m256 total = _mm256_setzero_ps();
+                float range = 0.0f, amplitude = 1.0f, frequency = 1.0f;
+
+                for ( unsigned int i = 0; i < octaves; ++i )
+                {
+                    __m256 f = _mm256_set1_ps( frequency );
+                    __m256 n = noise8( m_perm, m_permMod12,
+                                       _mm256_mul_ps( x, f ),
+                                       _mm256_mul_ps( y, f ),
+                                       _mm256_mul_ps( z, f ) );
+
+                    total      = _mm256_add_ps( total, _mm256_mul_ps( _mm256_set1_ps( amplitude ), n ) );
+                    range     += amplitude;
+                    amplitude *= GAIN;
+                    frequency *= LACUNARITY;
+                }
+
+                _mm256_storeu_ps( pRow + col, _mm256_div_ps( total, _mm256_set1_ps( range ) ) );
+            }
+#endif
+
+            for ( ; col < width; ++col )
+            {
+                pRow[col] = fbm( originX + static_cast<float>( col ) * step,
+                                 sampleY,
+                                 sampleZ,
+                                 octaves );
+            }
+        }
     }
+}
 
-   double t3 = 0.6 - x3*x3 - y3*y3 - z3*z3 - w3*w3;
-
-    if(t3<0) n3 = 0.0;
+/////////////////////////////////////////////////////////////////////////////
+// Unit Tests
+/////////////////////////////////////////////////////////////////////////////
+#include <googletest/googletest.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
 
-    else {
+namespace
+{
+    // The 0.6 falloff of 3D noise does not quite reach zero at the edge of
+    // a simplex, so the noise jumps by a tiny amount there. Rounding can
+    // put a sample on either side of the edge
+    const float JUMP_3D = 5e-3f;
+}
 
-      t3 *= t3;
+TEST(SimplexNoise,SameSeedSameNoise)
+{
+    SimplexNoise a( 42 ), b( 42 ), c( 43 );
+    bool anyDifferent = false;
 
-      n3 = t3 * t3 * dot(grad4[gi3], x3, y3, z3, w3);
+    for ( int i = 0; i < 100; ++i )
+    {
+        float x = i * 0.37f, y = i * 0.11f, z = i * 0.73f;
 
+        EXPECT_EQ( a.noise( x, y, z ), b.noise( x, y, z ) );
+        anyDifferent = anyDifferent || ( a.noise( x, y, z ) != c.noise( x, y, z ) );
     }
 
-   double t4 = 0.6 - x4*x4 - y4*y4 - z4*z4 - w4*w4;
-
-    if(t4<0) n4 = 0.0;
+    EXPECT_TRUE( anyDifferent );
+}
 
-    else {
+TEST(SimplexNoise,StaysInRange)
+{
+    SimplexNoise simplex( 1 );
+    float biggest = 0.0f;
 
-      t4 *= t4;
+    for ( int i = 0; i < 20000; ++i )
+    {
+        float x = i * 0.0173f, y = i * 0.0291f - 50.0f, z = i * 0.0457f, w = i * 0.011f;
 
-      n4 = t4 * t4 * dot(grad4[gi4], x4, y4, z4, w4);
+        EXPECT_LE( std::fabs( simplex.noise( x, y ) ), 1.0f );
+        EXPECT_LE( std::fabs( simplex.noise( x, y, z ) ), 1.0f );
+        EXPECT_LE( std::fabs( simplex.noise( x, y, z, w ) ), 1.0f );
 
+        biggest = std::max( biggest, std::fabs( simplex.noise( x, y, z ) ) );
     }
 
-    // Sum up and scale the result to cover the range [-1,1]
+    // ... and actually covers most of it
+    EXPECT_GT( biggest, 0.5f );
+}
 
-    return 27.0 * (n0 + n1 + n2 + n3 + n4);
+TEST(SimplexNoise,FillNoise2DMatchesFbm)
+{
+    SimplexNoise simplex( 11 );
 
-  }
+    // Odd width so that the last few columns of a row are left over
+    const unsigned int WIDTH = 29, HEIGHT = 6;
+    std::vector<float> grid( WIDTH * HEIGHT );
 
+    simplex.fillNoise2D( &grid[0], WIDTH, HEIGHT, -3.2f, 7.9f, 0.13f, 3 );
 
+    for ( unsigned int r = 0; r < HEIGHT; ++r )
+    {
+        for ( unsigned int c = 0; c < WIDTH; ++c )
+        {
+            float expected = simplex.fbm( -3.2f + c * 0.13f, 7.9f + r * 0.13f, 3 );
+            EXPECT_NEAR( expected, grid[ r * WIDTH + c ], 1e-5f );
+        }
+    }
+}
 
-  // Inner class to speed upp gradient computations
+TEST(SimplexNoise,FillNoise3DMatchesFbm)
+{
+    SimplexNoise simplex( 12 );
 
-  // (array access is a lot slower than member access)
+    const unsigned int WIDTH = 35, HEIGHT = 7, DEPTH = 5;
+    std::vector<float> grid( WIDTH * HEIGHT * DEPTH );
 
-  private static class Grad
+    simplex.fillNoise3D( &grid[0], WIDTH, HEIGHT, DEPTH, 1.5f, -2.25f, 9.0f, 0.21f, 2 );
 
-  {
+    for ( unsigned int s = 0; s < DEPTH; ++s )
+    {
+        for ( unsigned int r = 0; r < HEIGHT; ++r )
+        {
+            for ( unsigned int c = 0; c < WIDTH; ++c )
+            {
+                float expected = simplex.fbm( 1.5f + c * 0.21f,
+                                              -2.25f + r * 0.21f,
+                                              9.0f + s * 0.21f,
+                                              2 );
+                EXPECT_NEAR( expected, grid[ ( s * HEIGHT + r ) * WIDTH + c ], JUMP_3D );
+            }
+        }
+    }
+}
 
-    double x, y, z, w;
+TEST(SimplexNoise,FillNoise3DCanBeTiled)
+{
+    SimplexNoise simplex( 13 );
 
+    const unsigned int WIDTH = 24, HEIGHT = 6, DEPTH = 8;
+    const float STEP = 0.05f;
 
+    std::vector<float> whole( WIDTH * HEIGHT * DEPTH ), tiled( whole.size() );
+    simplex.fillNoise3D( &whole[0], WIDTH, HEIGHT, DEPTH, 0.0f, 0.0f, 0.0f, STEP, 2 );
 
-    Grad(double x, double y, double z)
+    // Two bands of slices, the second starting where the first one left off
+    simplex.fillNoise3D( &tiled[0], WIDTH, HEIGHT, 3, 0.0f, 0.0f, 0.0f, STEP, 2 );
+    simplex.fillNoise3D( &tiled[ 3 * WIDTH * HEIGHT ], WIDTH, HEIGHT, DEPTH - 3,
+                         0.0f, 0.0f, 3 * STEP, STEP, 2 );
 
+    for ( std::size_t i = 0; i < whole.size(); ++i )
     {
-
-      this.x = x;
-
-      this.y = y;
-
-      this.z = z;
-
+        EXPECT_NEAR( whole[i], tiled[i], JUMP_3D );
     }
+}
 
+TEST(SimplexNoise,LargeCoordinatesStayFinite)
+{
+    SimplexNoise simplex( 14 );
 
+    // High octaves push the skewed lattice coordinates well past the range
+    // of an int, both near the origin and far away from it
+    const unsigned int WIDTH = 19, HEIGHT = 3, DEPTH = 2, OCTAVES = 16;
+    const float ORIGINS[] = { 123457.0f, -123457.0f, 4e9f, -4e9f };
 
-    Grad(double x, double y, double z, double w)
+    std::vector<float> grid2D( WIDTH * HEIGHT ), grid3D( WIDTH * HEIGHT * DEPTH );
 
+    for ( float origin : ORIGINS )
     {
-
-      this.x = x;
-
-      this.y = y;
-
-      this.z = z;
-
-      this.w = w;
-
+        simplex.fillNoise2D( &grid2D[0], WIDTH, HEIGHT, origin, origin, 0.37f, OCTAVES );
+        simplex.fillNoise3D( &grid3D[0], WIDTH, HEIGHT, DEPTH,
+                             origin, origin, origin, 0.37f, OCTAVES );
+
+        for ( unsigned int r = 0; r < HEIGHT; ++r )
+        {
+            for ( unsigned int c = 0; c < WIDTH; ++c )
+            {
+                float x = origin + c * 0.37f, y = origin + r * 0.37f;
+                float expected = simplex.fbm( x, y, OCTAVES );
+
+                ASSERT_TRUE( std::isfinite( expected ) );
+                EXPECT_LE( std::fabs( expected ), 1.0f );
+                EXPECT_NEAR( expected, grid2D[ r * WIDTH + c ], 1e-5f );
+
+                float w = simplex.noise( x, y, x, y );
+
+                ASSERT_TRUE( std::isfinite( w ) );
+                EXPECT_LE( std::fabs( w ), 1.0f );
+
+                for ( unsigned int s = 0; s < DEPTH; ++s )
+                {
+                    float z = origin + s * 0.37f;
+                    float expected3D = simplex.fbm( x, y, z, OCTAVES );
+
+                    ASSERT_TRUE( std::isfinite( expected3D ) );
+                    EXPECT_LE( std::fabs( expected3D ), 1.0f );
+                    EXPECT_NEAR( expected3D, grid3D[ ( s * HEIGHT + r ) * WIDTH + c ], JUMP_3D );
+                }
+            }
+        }
     }
-
-  }
-
 }
 
+/**
+ * Prints how fast a big grid fills one sample at a time, batched and split
+ * across threads. It takes seconds and only reports numbers, so it is
+ * disabled; run it with --gtest_also_run_disabled_tests
+ */
+TEST(SimplexNoise,DISABLED_Throughput)
+{
+    typedef std::chrono::steady_clock Clock;
 
+    const unsigned int SIZE = 128, OCTAVES = 4;
+    const float STEP = 0.03f;
+    const double samples = static_cast<double>( SIZE ) * SIZE * SIZE * OCTAVES;
 
-class SimplexNoise
-{
-public:
-private:
-    /**
-     * \input  prev  Point before a
-     * \input  a     The point a
-     * \input  b     The point b
-     * \input  next  Point after b
-     * \input  x     Amount to interpolate between a and b [0.0f,1.0f]
-     */
-    float cubicInterpolation( float prev, float a, float b, float next,
-                              float x ) const;
+    SimplexNoise simplex( 2012 );
+    std::vector<float> single( SIZE * SIZE * SIZE ), batched( single.size() ), tiled( single.size() );
 
-    float noise( int v ) const;
-};
+    // One call per sample
+    Clock::time_point start = Clock::now();
 
-/////////////////////////////////////////////////////////////////////////////
-// Implementation
-/////////////////////////////////////////////////////////////////////////////
-// CPP INCLUDES HERE
+    for ( unsigned int s = 0; s < SIZE; ++s )
+    {
+        for ( unsigned int r = 0; r < SIZE; ++r )
+        {
+            for ( unsigned int c = 0; c < SIZE; ++c )
+            {
+                single[ ( s * SIZE + r ) * SIZE + c ] =
+                    simplex.fbm( c * STEP, r * STEP, s * STEP, OCTAVES );
+            }
+        }
+    }
 
-float PerlinNoise::interpolation( float a, float b, float x )
-{
-    float ft = x * 3.1415927f;
-    float f  = ( 1.0f - cost(ft) ) * 0.5f;
+    double singleSec = std::chrono::duration<double>( Clock::now() - start ).count();
 
-    return a * ( 1.0f - f ) + b * f;
-}
+    // The whole grid at once
+    start = Clock::now();
+    simplex.fillNoise3D( &batched[0], SIZE, SIZE, SIZE, 0.0f, 0.0f, 0.0f, STEP, OCTAVES );
+    double batchSec = std::chrono::duration<double>( Clock::now() - start ).count();
 
-float PerlinNoise::cubicInterpolation( float prev,
-                                       float a,
-                                       float b,
-                                       float next,
-                                       float x ) const
-{
-    float p = ( next - b ) - ( prev - a );
-    float q = ( prev - a ) - p;
-    float r = b - prev;
-    float s = a;
+    // Slices split between threads
+    unsigned int threadCount = std::max( 2u, std::thread::hardware_concurrency() );
+    std::vector<std::thread> threads;
 
-    return (p * x * x * x) + (q * x * x) + (r * x) + s;
-}
+    start = Clock::now();
 
-/**
- * Returns a random floating point value between negative one  and one, 
- * using the input value as a seed. Each call to the method with the same
- * input value will result in the same output value.
- *
- * \param  v  Input value used to calculate random output
- * \return Random value from -1 to 1, generated from input number
- */
-float PerlinNoise::noise( int v  ) const
-{
-    const int PRIMES[3] = { 15731, 789221, 1376312589 };
+    for ( unsigned int t = 0; t < threadCount; ++t )
+    {
+        unsigned int first = SIZE * t / threadCount;
+        unsigned int last  = SIZE * ( t + 1 ) / threadCount;
+
+        threads.push_back( std::thread( [&, first, last]()
+        {
+            simplex.fillNoise3D( &tiled[ first * SIZE * SIZE ], SIZE, SIZE, last - first,
+                                 0.0f, 0.0f, first * STEP, STEP, OCTAVES );
+        } ) );
+    }
 
-    float x = ( v << 13 ) ^ x;
-    return ( 1.0f - ((x * ( x * x * PRIMES[0] + PRIMES[1] ) + PRIMES[2]) &
-                     7fffffff) /
-             1073741824.0 );
-}
+    for ( std::size_t t = 0; t < threads.size(); ++t )
+    {
+        threads[t].join();
+    }
 
-/////////////////////////////////////////////////////////////////////////////
-// Unit Tests
-/////////////////////////////////////////////////////////////////////////////
-#include <googletest/googletest.h>
+    double threadedSec = std::chrono::duration<double>( Clock::now() - start ).count();
 
-TEST(Template,DefaultTest)
-{
-    EXPECT_TRUE( true );
+    std::cout << "3D simplex, " << OCTAVES << " octaves (Msamples/sec): "
+              << samples / singleSec / 1e6 << " one at a time, "
+              << samples / batchSec / 1e6 << " batched, "
+              << samples / threadedSec / 1e6 << " batched on "
+              << threadCount << " threads" << std::endl;
+
+    for ( std::size_t i = 0; i < single.size(); i += 997 )
+    {
+        EXPECT_NEAR( single[i], batched[i], JUMP_3D );
+        EXPECT_NEAR( batched[i], tiled[i], JUMP_3D );
+    }
 }
@@ -0,0 +1,158 @@
+/**
+ * Benchmarks game2d/spatialhashgrid.h as the broad phase for a large
+ * number of rectangles that all move a little every tick.
+ *
+ * Each tick every rectangle takes a step, the grid is rebuilt from scratch
+ * and every overlapping pair is found, first on one thread and then split
+ * across several. The pairs touching a sample of the rectangles are
+ * checked against a brute force scan.
+ *
+ * Usage: spatialhashbench [rects] [ticks] [threads]
+ */
+#include <game2d/spatialhashgrid.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const unsigned int WORLD_SIZE = 16383;
+    const unsigned int MAX_SIDE   = 24;
+    const unsigned int CELL_SIZE  = 32;
+
+    // Rectangles whose pairs are checked by brute force each tick
+    const std::size_t BRUTE_FORCE_SAMPLES = 64;
+
+    struct Mover
+    {
+        int x, y;
+        int dx, dy;
+        unsigned int width, height;
+    };
+
+    double elapsedMs( Clock::time_point start )
+    {
+        return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+    }
+
+    void step( Mover& m )
+    {
+        const int limit = static_cast<int>( WORLD_SIZE - MAX_SIDE );
+
+        m.x += m.dx;
+        m.y += m.dy;
+
+        if ( m.x < 0 || m.x > limit ) { m.dx = -m.dx; m.x += 2 * m.dx; }
+        if ( m.y < 0 || m.y > limit ) { m.dy = -m.dy; m.y += 2 * m.dy; }
+    }
+
+    std::size_t countPairsWith( const std::vector<Rect>& rects, std::size_t object )
+    {
+        std::size_t found = 0;
+
+        for ( std::size_t i = 0; i < rects.size(); ++i )
+        {
+            found += ( i != object && rects[i].intersects( rects[object] ) ? 1 : 0 );
+        }
+
+        return found;
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    std::size_t rectCount = ( argc > 1 ? atol( argv[1] ) : 100000 );
+    std::size_t ticks     = ( argc > 2 ? atol( argv[2] ) : 20 );
+    unsigned int threads  = ( argc > 3 ? atoi( argv[3] ) :
+                              std::max( 2u, std::thread::hardware_concurrency() ) );
+
+    std::mt19937 random( 2012 );
+    std::uniform_int_distribution<int> coord( 0, WORLD_SIZE - MAX_SIDE );
+    std::uniform_int_distribution<int> speed( -4, 4 );
+    std::uniform_int_distribution<unsigned int> side( 1, MAX_SIDE );
+
+    std::vector<Mover> movers( rectCount );
+    std::vector<Rect> rects( rectCount, Rect( 0, 0, 0, 0 ) );
+
+    for ( std::size_t i = 0; i < rectCount; ++i )
+    {
+        Mover m = { coord( random ), coord( random ), speed( random ), speed( random ),
+                    side( random ), side( random ) };
+        movers[i] = m;
+    }
+
+    SpatialHashGrid grid( CELL_SIZE );
+    std::vector<SpatialHashGrid::Pair> pairs, threadedPairs;
+
+    double moveMs = 0.0, rebuildMs = 0.0, pairsMs = 0.0, threadedMs = 0.0;
+    std::size_t pairCount = 0, mismatches = 0;
+
+    for ( std::size_t tick = 0; tick < ticks; ++tick )
+    {
+        Clock::time_point start = Clock::now();
+
+        for ( std::size_t i = 0; i < rectCount; ++i )
+        {
+            step( movers[i] );
+            rects[i] = Rect( movers[i].x, movers[i].y, movers[i].width, movers[i].height );
+        }
+
+        moveMs += elapsedMs( start );
+
+        start = Clock::now();
+        grid.rebuild( rects );
+        rebuildMs += elapsedMs( start );
+
+        start = Clock::now();
+        grid.findPairs( pairs );
+        pairsMs += elapsedMs( start );
+
+        start = Clock::now();
+        grid.findPairs( threadedPairs, threads );
+        threadedMs += elapsedMs( start );
+
+        pairCount  += pairs.size();
+        mismatches += ( pairs.size() != threadedPairs.size() ? 1 : 0 );
+
+        // Every sampled rectangle should show up in as many pairs as a
+        // brute force scan finds for it
+        std::vector<std::size_t> seen( rectCount, 0 );
+
+        for ( std::size_t p = 0; p < pairs.size(); ++p )
+        {
+            seen[ pairs[p].first ]  += 1;
+            seen[ pairs[p].second ] += 1;
+        }
+
+        for ( std::size_t s = 0; s < std::min( BRUTE_FORCE_SAMPLES, rectCount ); ++s )
+        {
+            std::size_t object = ( s * 7919 ) % rectCount;
+            mismatches += ( countPairsWith( rects, object ) != seen[object] ? 1 : 0 );
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision( 2 )
+              << rectCount << " rects, " << grid.entryCount() << " grid entries, "
+              << pairCount / ticks << " pairs per tick" << std::endl
+              << "Move all rects:          " << moveMs / ticks << " ms/tick" << std::endl
+              << "Rebuild grid:            " << rebuildMs / ticks << " ms/tick" << std::endl
+              << "Find pairs:              " << pairsMs / ticks << " ms/tick" << std::endl
+              << "Find pairs (" << threads << " threads): " << threadedMs / ticks
+              << " ms/tick" << std::endl;
+
+    if ( mismatches > 0 )
+    {
+        std::cout << "ERROR: " << mismatches << " checks did not match" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,54 +1,590 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
 #include <vector>
+#include <stdint.h>
 
 /**
- * 3d bitfield volume. Allows you to represent a 3d volume (one bit data)
+ * 3d bitfield volume. Allows you to represent a 3d volume (one bit data).
+ * Bits are packed 64 to a word, which lets count and the boolean
+ * operations between volumes work on a whole word at a time
  */
 class Volume
 {
 public:
     Volume( size_t dim )
         : m_dim( dim ),
-          m_volume( new uint8_t[ dim * dim * dim / 8 ] )
+          m_words( dim * dim * dim / 64, 0 )
     {
-        assert( dim >= 4 );
-//        assert( Math::isPowerOfTwo( dim ) );
-
-        std::fill( m_volume,
-                   m_volume + ((dim * dim * dim / 8)),
-                   0 );
+        // A multiple of four keeps dim^3 a multiple of the word size
+        assert( dim >= 4 && dim % 4 == 0 );
     }
 
-    ~Volume()
+    size_t dim() const
     {
-        delete[] m_volume;
+        return m_dim;
     }
 
     bool isSet( size_t x, size_t y, size_t z ) const
     {
-        return m_volume[ offset(x,y,z) ];
+        return isSetAt( offset(x,y,z) );
     }
 
     void set( size_t x, size_t y, size_t z, bool flag=true )
     {
-        m_volume[ offset(x,y,z) ] = flag;
+        setAt( offset(x,y,z), flag );
     }
 
     void clear( size_t x, size_t y, size_t z )
     {
-        m_volume[ offset(x,y,z) ] = 0;
+        setAt( offset(x,y,z), false );
+    }
+
+    /**
+     * Tests the bit at a linear index, as calculated by offset()
+     */
+    bool isSetAt( size_t index ) const
+    {
+        assert( index < m_dim * m_dim * m_dim );
+        return ( ( m_words[ index / 64 ] >> ( index % 64 ) ) & 1 ) != 0;
+    }
+
+    /**
+     * Sets or clears the bit at a linear index, as calculated by offset()
+     */
+    void setAt( size_t index, bool flag=true )
+    {
+        assert( index < m_dim * m_dim * m_dim );
+        uint64_t mask = static_cast<uint64_t>( 1 ) << ( index % 64 );
+
+        if ( flag )
+        {
+            m_words[ index / 64 ] |= mask;
+        }
+        else
+        {
+            m_words[ index / 64 ] &= ~mask;
+        }
+    }
+
+    /**
+     * Clears every bit in the volume
+     */
+    void clearAll()
+    {
+        std::fill( m_words.begin(), m_words.end(), 0 );
+    }
+
+    /**
+     * Returns the number of set bits in the volume
+     */
+    size_t count() const
+    {
+        size_t total = 0;
+
+        for ( size_t i = 0; i < m_words.size(); ++i )
+        {
+            total += __builtin_popcountll( m_words[i] );
+        }
+
+        return total;
+    }
+
+    /**
+     * Returns the number of bits set in both this volume and the other,
+     * without building the intersection
+     */
+    size_t countIntersection( const Volume& other ) const
+    {
+        assert( other.m_dim == m_dim );
+        size_t total = 0;
+
+        for ( size_t i = 0; i < m_words.size(); ++i )
+        {
+            total += __builtin_popcountll( m_words[i] & other.m_words[i] );
+        }
+
+        return total;
+    }
+
+    Volume& operator &= ( const Volume& other )
+    {
+        assert( other.m_dim == m_dim );
+
+        for ( size_t i = 0; i < m_words.size(); ++i )
+        {
+            m_words[i] &= other.m_words[i];
+        }
+
+        return *this;
+    }
+
+    Volume& operator |= ( const Volume& other )
+    {
+        assert( other.m_dim == m_dim );
+
+        for ( size_t i = 0; i < m_words.size(); ++i )
+        {
+            m_words[i] |= other.m_words[i];
+        }
+
+        return *this;
+    }
+
+    /**
+     * Clears every bit that is set in the other volume
+     */
+    Volume& subtract( const Volume& other )
+    {
+        assert( other.m_dim == m_dim );
+
+        for ( size_t i = 0; i < m_words.size(); ++i )
+        {
+            m_words[i] &= ~other.m_words[i];
+        }
+
+        return *this;
+    }
+
+    /**
+     * Returns the amount of memory used to store the bits
+     */
+    size_t memoryUsed() const
+    {
+        return m_words.size() * sizeof(uint64_t);
     }
 
-private:
     inline size_t offset( size_t x, size_t y, size_t z ) const
     {
+        assert( x < m_dim && y < m_dim && z < m_dim );
         return x + y * m_dim + z * m_dim * m_dim;
     }
 
+private:
     size_t  m_dim;
-    uint8_t * m_volume;
+    std::vector<uint64_t> m_words;
+};
+
+typedef uint16_t Material;
+
+const Material AIR_MATERIAL = 0;
+const size_t CHUNK_DIM      = 16;
+const size_t CHUNK_CUBES    = CHUNK_DIM * CHUNK_DIM * CHUNK_DIM;
+
+/**
+ * A fixed size chunk of cubes, each holding a material. Which cubes are
+ * solid (not air) is always kept in a bit packed occupancy volume.
+ *
+ * While a chunk is being edited its materials are palette compressed: the
+ * chunk keeps a small list of the distinct materials it holds, and every
+ * cube stores an index into that list using only as many bits as the
+ * palette needs (0, 1, 2, 4, 8 or 16). A chunk that has gone idle can be
+ * compressed further into runs of identical materials. Reads work on a
+ * compressed chunk directly, and the first write expands it again.
+ */
+class VoxelChunk
+{
+public:
+    VoxelChunk()
+        : m_occupancy( CHUNK_DIM ),
+          m_palette( 1, AIR_MATERIAL ),
+          m_paletteCounts( 1, CHUNK_CUBES ),
+          m_indices(),
+          m_bits( 0 ),
+          m_runs()
+    {
+    }
+
+    Material get( size_t x, size_t y, size_t z ) const
+    {
+        size_t index = m_occupancy.offset( x, y, z );
+
+        if ( isCompressed() )
+        {
+            return std::upper_bound( m_runs.begin(), m_runs.end(), index,
+                                     RunEndsAfter() )->material;
+        }
+
+        return m_palette[ indexAt( index ) ];
+    }
+
+    void set( size_t x, size_t y, size_t z, Material material )
+    {
+        size_t index = m_occupancy.offset( x, y, z );
+
+        if ( isCompressed() )
+        {
+            decompress();
+        }
+
+        size_t current = indexAt( index );
+
+        if ( m_palette[current] == material )
+        {
+            return;
+        }
+
+        // Release the old entry first so it can be reused if this cube was
+        // its last user
+        m_paletteCounts[current]--;
+
+        size_t entry = paletteEntryFor( material );
+        m_paletteCounts[entry]++;
+
+        setIndexAt( index, entry );
+        m_occupancy.setAt( index, material != AIR_MATERIAL );
+    }
+
+    bool isSet( size_t x, size_t y, size_t z ) const
+    {
+        return m_occupancy.isSet( x, y, z );
+    }
+
+    /**
+     * Returns the bit packed set of solid cubes in the chunk
+     */
+    const Volume& occupancy() const
+    {
+        return m_occupancy;
+    }
+
+    bool isCompressed() const
+    {
+        return ! m_runs.empty();
+    }
+
+    /**
+     * Returns the number of bits used to store each cube's palette index.
+     * A compressed chunk has no per cube storage at all
+     */
+    size_t bitsPerCube() const
+    {
+        return m_bits;
+    }
+
+    /**
+     * Returns the number of materials in the palette, including entries
+     * that are no longer used by any cube but have not been reclaimed
+     */
+    size_t paletteSize() const
+    {
+        return m_palette.size();
+    }
+
+    /**
+     * Replaces the palette and indices with runs of identical materials.
+     * Noisy chunks can take more space as runs than as palette indices, in
+     * which case the chunk is left as it is and false is returned
+     */
+    bool compress()
+    {
+        if ( isCompressed() )
+        {
+            return true;
+        }
+
+        std::vector<Run> runs;
+        buildRuns( runs );
+
+        if ( runs.size() * sizeof(Run) >= m_indices.size() * sizeof(uint64_t) +
+                                           m_palette.size() * sizeof(Material) )
+        {
+            return false;
+        }
+
+        m_runs.swap( runs );
+
+        std::vector<Material>().swap( m_palette );
+        std::vector<uint16_t>().swap( m_paletteCounts );
+        std::vector<uint64_t>().swap( m_indices );
+        m_bits = 0;
+
+        return true;
+    }
+
+    /**
+     * Expands runs back into the palette form. The palette is rebuilt
+     * from scratch, which also drops any unused entries
+     */
+    void decompress()
+    {
+        if ( ! isCompressed() )
+        {
+            return;
+        }
+
+        std::vector<Run> runs;
+        runs.swap( m_runs );
+
+        m_palette.clear();
+        m_paletteCounts.clear();
+
+        for ( size_t i = 0; i < runs.size(); ++i )
+        {
+            if ( std::find( m_palette.begin(), m_palette.end(),
+                            runs[i].material ) == m_palette.end() )
+            {
+                m_palette.push_back( runs[i].material );
+            }
+        }
+
+        m_paletteCounts.assign( m_palette.size(), 0 );
+        m_bits = 0;
+
+        while ( ( static_cast<size_t>( 1 ) << m_bits ) < m_palette.size() )
+        {
+            m_bits = ( m_bits == 0 ? 1 : m_bits * 2 );
+        }
+
+        m_indices.assign( CHUNK_CUBES * m_bits / 64, 0 );
+        size_t begin = 0;
+
+        for ( size_t i = 0; i < runs.size(); ++i )
+        {
+            size_t entry = std::find( m_palette.begin(), m_palette.end(),
+                                      runs[i].material ) - m_palette.begin();
+
+            m_paletteCounts[entry] += runs[i].end - begin;
+
+            for ( ; begin < runs[i].end; ++begin )
+            {
+                setIndexAt( begin, entry );
+            }
+        }
+    }
+
+    /**
+     * Returns the amount of memory used by the chunk
+     */
+    size_t memoryUsed() const
+    {
+        return sizeof(*this) +
+               m_occupancy.memoryUsed() +
+               m_palette.capacity() * sizeof(Material) +
+               m_paletteCounts.capacity() * sizeof(uint16_t) +
+               m_indices.capacity() * sizeof(uint64_t) +
+               m_runs.capacity() * sizeof(Run);
+    }
+
+    /**
+     * Writes the chunk's runs out to a stream. Values are written in the
+     * machine's byte order, so the output is only meant to be read back
+     * on the same machine
+     */
+    bool write( std::ostream& stream ) const
+    {
+        std::vector<Run> runs;
+
+        if ( isCompressed() )
+        {
+            runs = m_runs;
+        }
+        else
+        {
+            buildRuns( runs );
+        }
+
+        uint32_t count = static_cast<uint32_t>( runs.size() );
+
+        stream.write( reinterpret_cast<const char*>( &count ), sizeof(count) );
+        stream.write( reinterpret_cast<const char*>( &runs[0] ),
+                      runs.size() * sizeof(Run) );
+
+        return stream.good();
+    }
+
+    /**
+     * Replaces the chunk with one written by write(). The chunk comes back
+     * compressed. Returns false, leaving the chunk untouched, if the data
+     * was truncated or malformed
+     */
+    bool read( std::istream& stream )
+    {
+        uint32_t count = 0;
+        stream.read( reinterpret_cast<char*>( &count ), sizeof(count) );
+
+        if ( ! stream || count == 0 || count > CHUNK_CUBES )
+        {
+            return false;
+        }
+
+        std::vector<Run> runs( count );
+        stream.read( reinterpret_cast<char*>( &runs[0] ), count * sizeof(Run) );
+
+        if ( ! stream )
+        {
+            return false;
+        }
+
+        for ( size_t i = 0; i < runs.size(); ++i )
+        {
+            size_t begin = ( i == 0 ? 0 : runs[i - 1].end );
+
+            if ( runs[i].end <= begin || runs[i].end > CHUNK_CUBES )
+            {
+                return false;
+            }
+        }
+
+        if ( runs.back().end != CHUNK_CUBES )
+        {
+            return false;
+        }
+
+        m_occupancy.clearAll();
+
+        for ( size_t i = 0, begin = 0; i < runs.size(); begin = runs[i++].end )
+        {
+            if ( runs[i].material != AIR_MATERIAL )
+            {
+                for ( size_t j = begin; j < runs[i].end; ++j )
+                {
+                    m_occupancy.setAt( j );
+                }
+            }
+        }
+
+        std::vector<Material>().swap( m_palette );
+        std::vector<uint16_t>().swap( m_paletteCounts );
+        std::vector<uint64_t>().swap( m_indices );
+        m_bits = 0;
+        m_runs.swap( runs );
+
+        return true;
+    }
+
+private:
+    /**
+     * A run of cubes holding the same material. Runs are stored in order,
+     * and each one stops just before the cube index given by end
+     */
+    struct Run
+    {
+        Material material;
+        uint16_t end;
+    };
+
+    struct RunEndsAfter
+    {
+        bool operator()( size_t index, const Run& run ) const
+        {
+            return index < run.end;
+        }
+    };
+
+    size_t indexAt( size_t index ) const
+    {
+        if ( m_bits == 0 )
+        {
+            return 0;
+        }
+
+        size_t perWord = 64 / m_bits;
+        uint64_t mask  = ( m_bits == 64 ? ~0ull : ( 1ull << m_bits ) - 1 );
+
+        return static_cast<size_t>(
+            ( m_indices[ index / perWord ] >> ( ( index % perWord ) * m_bits ) ) & mask );
+    }
+
+    void setIndexAt( size_t index, size_t entry )
+    {
+        size_t perWord = 64 / m_bits;
+        size_t shift   = ( index % perWord ) * m_bits;
+        uint64_t mask  = ( ( 1ull << m_bits ) - 1 ) << shift;
+
+        uint64_t& word = m_indices[ index / perWord ];
+        word = ( word & ~mask ) | ( static_cast<uint64_t>( entry ) << shift );
+    }
+
+    /**
+     * Finds the palette entry for a material, reusing an entry no cube
+     * refers to or growing the palette (and the index width) if needed
+     */
+    size_t paletteEntryFor( Material material )
+    {
+        size_t unused = m_palette.size();
+
+        for ( size_t i = 0; i < m_palette.size(); ++i )
+        {
+            if ( m_palette[i] == material )
+            {
+                return i;
+            }
+            else if ( m_paletteCounts[i] == 0 && unused == m_palette.size() )
+            {
+                unused = i;
+            }
+        }
+
+        if ( unused < m_palette.size() )
+        {
+            m_palette[unused] = material;
+            return unused;
+        }
+
+        m_palette.push_back( material );
+        m_paletteCounts.push_back( 0 );
+
+        if ( m_palette.size() > ( static_cast<size_t>( 1 ) << m_bits ) )
+        {
+            repack( m_bits == 0 ? 1 : m_bits * 2 );
+        }
+
+        return m_palette.size() - 1;
+    }
+
+    /**
+     * Rewrites every cube's palette index using a new number of bits
+     */
+    void repack( size_t bits )
+    {
+        std::vector<uint64_t> old;
+        size_t oldBits = m_bits;
+
+        old.swap( m_indices );
+        m_indices.assign( CHUNK_CUBES * bits / 64, 0 );
+        m_bits = bits;
+
+        for ( size_t i = 0; i < CHUNK_CUBES && oldBits > 0; ++i )
+        {
+            size_t perWord = 64 / oldBits;
+            size_t entry   = ( old[ i / perWord ] >> ( ( i % perWord ) * oldBits ) ) &
+                             ( ( 1ull << oldBits ) - 1 );
+
+            setIndexAt( i, entry );
+        }
+    }
+
+    void buildRuns( std::vector<Run>& runs ) const
+    {
+        runs.clear();
+
+        for ( size_t i = 0; i < CHUNK_CUBES; ++i )
+        {
+            Material material = m_palette[ indexAt( i ) ];
+
+            if ( runs.empty() || runs.back().material != material )
+            {
+                Run run = { material, 0 };
+                runs.push_back( run );
+            }
+
+            runs.back().end = static_cast<uint16_t>( i + 1 );
+        }
+    }
+
+    Volume                m_occupancy;
+    std::vector<Material> m_palette;
+    std::vector<uint16_t> m_paletteCounts;
+    std::vector<uint64_t> m_indices;
+    size_t                m_bits;
+    std::vector<Run>      m_runs;
 };
 
 template<typename T>
@@ -60,41 +596,37 @@ public:
           m_height( height ),
           m_depth( depth ),
           m_chunkArrayLength( width * height * depth ),
-          m_chunks( width * height * depth, NULL )
-    {
-    }
-
-    ~ChunkManager()
+          m_chunks( width * height * depth )
     {
-        DeletePointerContainer( m_chunks );
     }
 
     /**
      * Checks if the requested chunk is unallocated and hence null
      */
-    void isChunkNull( size_t x, size_t y, size_t z ) const
+    bool isChunkNull( size_t x, size_t y, size_t z ) const
     {
-        return m_chunks[ offset(x,y,z) ] == NULL;
+        return m_chunks[ offset(x,y,z) ].get() == NULL;
     }
 
     /**
-     * Sets the specified chunk to point to the pointer 'data'. Method
-     * requires the chunk to be null before assigning a value.
+     * Sets the specified chunk to point to the pointer 'data', taking
+     * ownership of it. Method requires the chunk to be null before
+     * assigning a value.
      */
     void set( T* data, size_t x, size_t y, size_t z )
     {
-        assert( m_chunks[ offset(x,y,z) ] != NULL );
+        assert( m_chunks[ offset(x,y,z) ].get() == NULL );
 
-        m_chunks[ offset(x,y,z) ] = data;
+        m_chunks[ offset(x,y,z) ].reset( data );
     }
-     
+
     /**
      * Returns the chunk at the requested offset (x,y,z). If the chunk
      * is unallocated, the return pointer will be NULL.
      */
-    T* get( size_t x, size_t y, size_t z )
+    T* get( size_t x, size_t y, size_t z ) const
     {
-        return m_chunks[ offset(x,y,z) ];
+        return m_chunks[ offset(x,y,z) ].get();
     }
 
     /**
@@ -102,12 +634,7 @@ public:
      */
     void destroyChunk( size_t x, size_t y, size_t z )
     {
-        size_t index = offset( x, y, z );
-
-        // Clear it, and SET IT TO NULL
-        delete m_chunks[index];
-
-        m_chunks[index] = NULL;
+        m_chunks[ offset(x,y,z) ].reset();
     }
 
     /**
@@ -134,14 +661,13 @@ public:
         return m_depth;
     }
 
-protected:
-
     /**
-     * Caclulates a chunk's index in the chunk array given its 
+     * Caclulates a chunk's index in the chunk array given its
      * (x,y,z) position
      */
-    inline size_t offset( size_t x, size_t y, size_t z )
+    inline size_t offset( size_t x, size_t y, size_t z ) const
     {
+        assert( x < m_width && y < m_height && z < m_depth );
         return x + y * m_width + z * m_width * m_height;
     }
 
@@ -158,35 +684,711 @@ private:
     /**
      * 3 dimensional chunk storage volume
      */
-    typename std::vector<T*> m_chunks;
+    typename std::vector< std::unique_ptr<T> > m_chunks;
 };
 
-class CubeData
+/**
+ * A world of cubes stored as a grid of VoxelChunks. Chunks are only
+ * allocated once something is written to them, so untouched regions are
+ * all air and cost nothing.
+ *
+ * The volume keeps a clock that the owner advances with tick(). Chunks
+ * that have not been touched for a while can be run length compressed
+ * with compressIdle(), and individual chunks can be paged out to disk.
+ * Reading or writing a paged out chunk pages it back in, and fails if the
+ * chunk cannot be read back.
+ */
+class ChunkedVolume
 {
+public:
+    ChunkedVolume( size_t chunksWide,
+                   size_t chunksHigh,
+                   size_t chunksDeep,
+                   const std::string& pageDirectory )
+        : m_chunks( chunksWide, chunksHigh, chunksDeep ),
+          m_info( chunksWide * chunksHigh * chunksDeep ),
+          m_pageDirectory( pageDirectory ),
+          m_clock( 0 )
+    {
+    }
+
+    ~ChunkedVolume()
+    {
+        // Don't leave paged out chunks behind on disk
+        for ( size_t i = 0; i < m_info.size(); ++i )
+        {
+            if ( m_info[i].pagedOut )
+            {
+                std::remove( pagePath( i ).c_str() );
+            }
+        }
+    }
+
+    /**
+     * Reads the material of a cube. Returns false, leaving material alone,
+     * if the cube's chunk is paged out and could not be read back in
+     */
+    bool get( size_t x, size_t y, size_t z, Material& material )
+    {
+        VoxelChunk * pChunk = NULL;
+
+        if ( ! chunkAt( x, y, z, false, pChunk ) )
+        {
+            return false;
+        }
+
+        material = ( pChunk != NULL ? pChunk->get( x % CHUNK_DIM, y % CHUNK_DIM, z % CHUNK_DIM )
+                                    : AIR_MATERIAL );
+        return true;
+    }
+
+    /**
+     * Checks if a cube is solid. Returns false, leaving solid alone, if the
+     * cube's chunk is paged out and could not be read back in
+     */
+    bool isSet( size_t x, size_t y, size_t z, bool& solid )
+    {
+        VoxelChunk * pChunk = NULL;
+
+        if ( ! chunkAt( x, y, z, false, pChunk ) )
+        {
+            return false;
+        }
+
+        solid = ( pChunk != NULL && pChunk->isSet( x % CHUNK_DIM, y % CHUNK_DIM, z % CHUNK_DIM ) );
+        return true;
+    }
+
+    /**
+     * Writes the material of a cube. Returns false without changing
+     * anything if the cube's chunk is paged out and could not be read back
+     * in, since writing to a fresh chunk would throw away the paged out one
+     */
+    bool set( size_t x, size_t y, size_t z, Material material )
+    {
+        VoxelChunk * pChunk = NULL;
+
+        if ( ! chunkAt( x, y, z, true, pChunk ) )
+        {
+            return false;
+        }
+
+        pChunk->set( x % CHUNK_DIM, y % CHUNK_DIM, z % CHUNK_DIM, material );
+        return true;
+    }
+
+    /**
+     * Advances the clock used to decide which chunks are idle
+     */
+    void tick()
+    {
+        m_clock++;
+    }
+
+    /**
+     * Compresses every resident chunk that has not been touched in the
+     * last idleTicks ticks. Returns the number of chunks that were
+     * compressed, which leaves out chunks too noisy to benefit
+     */
+    size_t compressIdle( size_t idleTicks )
+    {
+        size_t compressed = 0;
+
+        forEachResident( [&]( VoxelChunk& chunk, size_t index ) {
+            if ( ! chunk.isCompressed() &&
+                 m_clock - m_info[index].lastTouched >= idleTicks &&
+                 chunk.compress() )
+            {
+                compressed++;
+            }
+        } );
+
+        return compressed;
+    }
+
+    /**
+     * Writes a chunk out to the page directory and releases its memory.
+     * Returns false if the chunk was not resident or could not be written
+     */
+    bool pageOut( size_t cx, size_t cy, size_t cz )
+    {
+        VoxelChunk * pChunk = m_chunks.get( cx, cy, cz );
+        size_t index        = m_chunks.offset( cx, cy, cz );
+
+        if ( pChunk == NULL )
+        {
+            return false;
+        }
+
+        std::string path = pagePath( index );
+        std::ofstream file( path.c_str(), std::ios::binary );
+
+        // The chunk is only released once the file is closed, since a full
+        // disk may not show up until the buffered data is flushed
+        bool written = file && pChunk->write( file );
+        file.close();
+
+        if ( ! written || ! file )
+        {
+            std::remove( path.c_str() );
+            return false;
+        }
+
+        m_info[index].pagedOut   = true;
+        m_info[index].solidCount = pChunk->occupancy().count();
+        m_chunks.destroyChunk( cx, cy, cz );
+
+        return true;
+    }
+
+    /**
+     * Reads a paged out chunk back in. Returns false if the chunk was not
+     * paged out or could not be read back
+     */
+    bool pageIn( size_t cx, size_t cy, size_t cz )
+    {
+        size_t index = m_chunks.offset( cx, cy, cz );
+
+        if ( ! m_info[index].pagedOut )
+        {
+            return false;
+        }
+
+        std::string path = pagePath( index );
+        std::ifstream file( path.c_str(), std::ios::binary );
+        std::unique_ptr<VoxelChunk> chunk( new VoxelChunk );
+
+        if ( ! file || ! chunk->read( file ) )
+        {
+            return false;
+        }
+
+        file.close();
+        std::remove( path.c_str() );
+
+        m_chunks.set( chunk.release(), cx, cy, cz );
+        m_info[index].pagedOut    = false;
+        m_info[index].lastTouched = m_clock;
+
+        return true;
+    }
+
+    /**
+     * Returns the number of solid cubes in the volume, counting paged out
+     * chunks without reading them back in
+     */
+    size_t countSolid() const
+    {
+        size_t total = 0;
+
+        for ( size_t i = 0; i < m_info.size(); ++i )
+        {
+            total += ( m_info[i].pagedOut ? m_info[i].solidCount : 0 );
+        }
+
+        forEachResident( [&]( const VoxelChunk& chunk, size_t ) {
+            total += chunk.occupancy().count();
+        } );
+
+        return total;
+    }
+
+    /**
+     * Returns the memory used by resident chunks
+     */
+    size_t memoryUsed() const
+    {
+        size_t total = 0;
+
+        forEachResident( [&]( const VoxelChunk& chunk, size_t ) {
+            total += chunk.memoryUsed();
+        } );
+
+        return total;
+    }
+
+    size_t residentCount() const
+    {
+        size_t total = 0;
+        forEachResident( [&]( const VoxelChunk&, size_t ) { total++; } );
+
+        return total;
+    }
+
 private:
-    int m_type;
-    
+    struct ChunkInfo
+    {
+        ChunkInfo() : lastTouched( 0 ), pagedOut( false ), solidCount( 0 ) {}
+
+        size_t lastTouched;
+        bool   pagedOut;
+        size_t solidCount;      // only kept up to date while paged out
+    };
+
+    /**
+     * Finds the chunk holding a cube, paging it in if it had been paged
+     * out. A chunk that was never written is only created if create is set,
+     * otherwise pChunk is left NULL. Returns false if a paged out chunk could
+     * not be read back in; it stays paged out so no data is lost
+     */
+    bool chunkAt( size_t x, size_t y, size_t z, bool create, VoxelChunk *& pChunk )
+    {
+        size_t cx = x / CHUNK_DIM, cy = y / CHUNK_DIM, cz = z / CHUNK_DIM;
+        size_t index = m_chunks.offset( cx, cy, cz );
+
+        if ( m_info[index].pagedOut && ! pageIn( cx, cy, cz ) )
+        {
+            pChunk = NULL;
+            return false;
+        }
+
+        pChunk = m_chunks.get( cx, cy, cz );
+
+        if ( pChunk == NULL && create )
+        {
+            pChunk = new VoxelChunk;
+            m_chunks.set( pChunk, cx, cy, cz );
+        }
+
+        m_info[index].lastTouched = m_clock;
+        return true;
+    }
+
+    template<typename Visitor>
+    void forEachResident( Visitor visitor ) const
+    {
+        for ( size_t z = 0; z < m_chunks.depth(); ++z )
+            for ( size_t y = 0; y < m_chunks.height(); ++y )
+                for ( size_t x = 0; x < m_chunks.width(); ++x )
+                    if ( VoxelChunk * pChunk = m_chunks.get( x, y, z ) )
+                        visitor( *pChunk, m_chunks.offset( x, y, z ) );
+    }
+
+    std::string pagePath( size_t index ) const
+    {
+        std::ostringstream ss;
+        ss << m_pageDirectory << "/chunk_" << this << "_" << index << ".bin";
+
+        return ss.str();
+    }
+
+    ChunkManager<VoxelChunk> m_chunks;
+    std::vector<ChunkInfo>   m_info;
+    std::string              m_pageDirectory;
+    size_t                   m_clock;
 };
 
-class CubeStorageVolume
+/////////////////////////////////////////////////////////////////////////////
+// Unit Tests
+/////////////////////////////////////////////////////////////////////////////
+#include <googletest/googletest.h>
+#include <random>
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
 {
-public:
-    CubeStorageVolume( size_t chunkDim,
-                       size_t worldWidth,
-                       size_t worldHeight,
-                       size_t worldDepth );
+    /**
+     * Fills a chunk with a layered ground: stone, then dirt, then grass,
+     * with air above it
+     */
+    void fillGround( VoxelChunk& chunk, size_t height )
+    {
+        for ( size_t z = 0; z < CHUNK_DIM; ++z )
+            for ( size_t y = 0; y < height; ++y )
+                for ( size_t x = 0; x < CHUNK_DIM; ++x )
+                    chunk.set( x, y, z, y + 1 == height ? 3 : ( y + 4 >= height ? 2 : 1 ) );
+    }
+
+    /**
+     * Makes a fresh directory under /tmp for paged out chunks, and removes
+     * it again once the volume using it has cleaned up its files
+     */
+    class PageDirectory
+    {
+    public:
+        PageDirectory()
+        {
+            char path[] = "/tmp/volume_pages_XXXXXX";
+
+            if ( mkdtemp( path ) != NULL )
+            {
+                m_path = path;
+            }
+        }
+
+        ~PageDirectory()
+        {
+            if ( ! m_path.empty() )
+            {
+                rmdir( m_path.c_str() );
+            }
+        }
 
-    ~CubeStorageVolume();
+        const std::string& path() const { return m_path; }
+
+        /**
+         * Returns the paths of every file in the directory
+         */
+        std::vector<std::string> files() const
+        {
+            std::vector<std::string> result;
+
+            if ( DIR * pDir = opendir( m_path.c_str() ) )
+            {
+                while ( dirent * pEntry = readdir( pDir ) )
+                {
+                    if ( pEntry->d_name[0] != '.' )
+                    {
+                        result.push_back( m_path + "/" + pEntry->d_name );
+                    }
+                }
+
+                closedir( pDir );
+            }
+
+            return result;
+        }
+
+    private:
+        std::string m_path;
+    };
 
     /**
-     * Make trigger the geometry engine to rebuild a chunk. This method
-     * should set the dirty flag or something
+     * Reads a cube, failing the test if it cannot be read
      */
-    CubeData getCubeAt( size_t x, size_t y, size_t z );
-    bool setCube( const CubeData& cube, size_t x, size_t y, size_t z );
+    Material materialAt( ChunkedVolume& world, size_t x, size_t y, size_t z )
+    {
+        Material material = AIR_MATERIAL;
+        EXPECT_TRUE( world.get( x, y, z, material ) );
+
+        return material;
+    }
+}
 
-//    CubeChunk getChunk( size_t chunkId );
+TEST(Volume,IsABitPerCube)
+{
+    Volume volume( 16 );
 
-private:
- //   ChunkManager<CubeChunk> m_chunkstore;
-};
+    EXPECT_EQ( 16u * 16u * 16u / 8u, volume.memoryUsed() );
+    EXPECT_EQ( 0u, volume.count() );
+
+    volume.set( 0, 0, 0 );
+    volume.set( 15, 15, 15 );
+    volume.set( 3, 7, 9 );
+
+    EXPECT_TRUE( volume.isSet( 0, 0, 0 ) );
+    EXPECT_TRUE( volume.isSet( 3, 7, 9 ) );
+    EXPECT_FALSE( volume.isSet( 1, 0, 0 ) );
+    EXPECT_FALSE( volume.isSet( 3, 7, 8 ) );
+    EXPECT_EQ( 3u, volume.count() );
+
+    volume.clear( 3, 7, 9 );
+    EXPECT_FALSE( volume.isSet( 3, 7, 9 ) );
+    EXPECT_EQ( 2u, volume.count() );
+}
+
+TEST(Volume,BooleanOperationsMatchPerCube)
+{
+    const size_t dim = 32;
+    std::mt19937 random( 46 );
+
+    Volume a( dim ), b( dim );
+
+    for ( size_t i = 0; i < dim * dim * dim; ++i )
+    {
+        a.setAt( i, random() % 3 == 0 );
+        b.setAt( i, random() % 2 == 0 );
+    }
+
+    size_t both = 0, either = 0, onlyA = 0;
+
+    for ( size_t i = 0; i < dim * dim * dim; ++i )
+    {
+        both   += ( a.isSetAt( i ) && b.isSetAt( i ) ? 1 : 0 );
+        either += ( a.isSetAt( i ) || b.isSetAt( i ) ? 1 : 0 );
+        onlyA  += ( a.isSetAt( i ) && ! b.isSetAt( i ) ? 1 : 0 );
+    }
+
+    EXPECT_EQ( both, a.countIntersection( b ) );
+
+    Volume c = a;
+    EXPECT_EQ( both, ( c &= b ).count() );
+
+    c = a;
+    EXPECT_EQ( either, ( c |= b ).count() );
+
+    c = a;
+    EXPECT_EQ( onlyA, c.subtract( b ).count() );
+}
+
+TEST(VoxelChunk,PaletteGrowsAsMaterialsAreAdded)
+{
+    VoxelChunk chunk;
+
+    EXPECT_EQ( 0u, chunk.bitsPerCube() );
+    EXPECT_EQ( AIR_MATERIAL, chunk.get( 5, 5, 5 ) );
+
+    chunk.set( 5, 5, 5, 7 );
+    EXPECT_EQ( 1u, chunk.bitsPerCube() );
+
+    chunk.set( 6, 5, 5, 8 );
+    EXPECT_EQ( 2u, chunk.bitsPerCube() );
+
+    for ( Material m = 9; m < 30; ++m )
+    {
+        chunk.set( m % CHUNK_DIM, m / CHUNK_DIM, 0, m );
+    }
+
+    EXPECT_EQ( 8u, chunk.bitsPerCube() );
+    EXPECT_EQ( 7, chunk.get( 5, 5, 5 ) );
+    EXPECT_EQ( 8, chunk.get( 6, 5, 5 ) );
+    EXPECT_EQ( 29, chunk.get( 29 % CHUNK_DIM, 29 / CHUNK_DIM, 0 ) );
+    EXPECT_TRUE( chunk.isSet( 5, 5, 5 ) );
+    EXPECT_FALSE( chunk.isSet( 5, 6, 5 ) );
+}
+
+TEST(VoxelChunk,UnusedPaletteEntriesAreReused)
+{
+    VoxelChunk chunk;
+
+    chunk.set( 0, 0, 0, 1 );
+    chunk.set( 0, 0, 0, 2 );
+    chunk.set( 0, 0, 0, 3 );
+
+    EXPECT_EQ( 2u, chunk.paletteSize() );
+    EXPECT_EQ( 1u, chunk.bitsPerCube() );
+    EXPECT_EQ( 3, chunk.get( 0, 0, 0 ) );
+}
+
+TEST(VoxelChunk,RandomEditsMatchFlatArray)
+{
+    std::mt19937 random( 47 );
+    std::vector<Material> flat( CHUNK_CUBES, AIR_MATERIAL );
+    VoxelChunk chunk;
+
+    for ( int i = 0; i < 20000; ++i )
+    {
+        size_t x = random() % CHUNK_DIM, y = random() % CHUNK_DIM, z = random() % CHUNK_DIM;
+        Material material = static_cast<Material>( random() % ( i < 10000 ? 6 : 300 ) );
+
+        chunk.set( x, y, z, material );
+        flat[ x + y * CHUNK_DIM + z * CHUNK_DIM * CHUNK_DIM ] = material;
+
+        // Compress every so often to check reads and the expand on write
+        if ( i % 5000 == 4999 )
+        {
+            chunk.compress();
+        }
+    }
+
+    size_t solid = 0;
+
+    for ( size_t z = 0; z < CHUNK_DIM; ++z )
+        for ( size_t y = 0; y < CHUNK_DIM; ++y )
+            for ( size_t x = 0; x < CHUNK_DIM; ++x )
+            {
+                Material expected = flat[ x + y * CHUNK_DIM + z * CHUNK_DIM * CHUNK_DIM ];
+
+                ASSERT_EQ( expected, chunk.get( x, y, z ) );
+                ASSERT_EQ( expected != AIR_MATERIAL, chunk.isSet( x, y, z ) );
+                solid += ( expected != AIR_MATERIAL ? 1 : 0 );
+            }
+
+    EXPECT_EQ( solid, chunk.occupancy().count() );
+}
+
+TEST(VoxelChunk,CompressionShrinksGroundChunks)
+{
+    VoxelChunk chunk;
+    fillGround( chunk, 9 );
+
+    size_t expanded = chunk.memoryUsed();
+    EXPECT_EQ( 2u, chunk.bitsPerCube() );
+
+    EXPECT_TRUE( chunk.compress() );
+    EXPECT_TRUE( chunk.isCompressed() );
+    EXPECT_LT( chunk.memoryUsed(), expanded );
+
+    EXPECT_EQ( 1, chunk.get( 4, 0, 4 ) );
+    EXPECT_EQ( 2, chunk.get( 4, 6, 4 ) );
+    EXPECT_EQ( 3, chunk.get( 4, 8, 4 ) );
+    EXPECT_EQ( AIR_MATERIAL, chunk.get( 4, 9, 4 ) );
+
+    // Writing expands it again
+    chunk.set( 4, 9, 4, 5 );
+    EXPECT_FALSE( chunk.isCompressed() );
+    EXPECT_EQ( 5, chunk.get( 4, 9, 4 ) );
+    EXPECT_EQ( 3, chunk.get( 4, 8, 4 ) );
+}
+
+TEST(VoxelChunk,NoisyChunksStayUncompressed)
+{
+    std::mt19937 random( 48 );
+    VoxelChunk chunk;
+
+    for ( size_t i = 0; i < CHUNK_CUBES; ++i )
+    {
+        chunk.set( i % CHUNK_DIM, ( i / CHUNK_DIM ) % CHUNK_DIM, i / ( CHUNK_DIM * CHUNK_DIM ),
+                   static_cast<Material>( random() % 4 ) );
+    }
+
+    EXPECT_FALSE( chunk.compress() );
+    EXPECT_FALSE( chunk.isCompressed() );
+}
+
+TEST(VoxelChunk,WriteAndReadBack)
+{
+    VoxelChunk chunk, copy;
+    fillGround( chunk, 5 );
+
+    std::stringstream stream;
+    ASSERT_TRUE( chunk.write( stream ) );
+    ASSERT_TRUE( copy.read( stream ) );
+
+    for ( size_t z = 0; z < CHUNK_DIM; ++z )
+        for ( size_t y = 0; y < CHUNK_DIM; ++y )
+            for ( size_t x = 0; x < CHUNK_DIM; ++x )
+                ASSERT_EQ( chunk.get( x, y, z ), copy.get( x, y, z ) );
+
+    EXPECT_EQ( chunk.occupancy().count(), copy.occupancy().count() );
+
+    // Truncated data is rejected
+    std::string bytes = stream.str();
+    std::stringstream truncated( bytes.substr( 0, bytes.size() - 1 ) );
+    EXPECT_FALSE( copy.read( truncated ) );
+}
+
+TEST(ChunkedVolume,CompressesIdleChunksAndPagesToDisk)
+{
+    PageDirectory pages;
+    ASSERT_FALSE( pages.path().empty() );
+
+    ChunkedVolume world( 4, 2, 4, pages.path() );
+
+    EXPECT_EQ( AIR_MATERIAL, materialAt( world, 10, 10, 10 ) );
+    EXPECT_EQ( 0u, world.residentCount() );
+
+    for ( size_t z = 0; z < 4 * CHUNK_DIM; ++z )
+        for ( size_t x = 0; x < 4 * CHUNK_DIM; ++x )
+            for ( size_t y = 0; y < 10 + ( x / CHUNK_DIM + z / CHUNK_DIM ) % 7; ++y )
+                ASSERT_TRUE( world.set( x, y, z, y < 8 ? 1 : 2 ) );
+
+    size_t solid = world.countSolid();
+    EXPECT_EQ( 16u, world.residentCount() );
+
+    // Everything but the chunk touched after the first tick goes idle
+    world.tick();
+    world.set( 1, 1, 1, 4 );
+    world.tick();
+
+    size_t before = world.memoryUsed();
+    EXPECT_EQ( 15u, world.compressIdle( 2 ) );
+    EXPECT_LT( world.memoryUsed(), before );
+
+    ASSERT_TRUE( world.pageOut( 3, 0, 3 ) );
+    EXPECT_FALSE( world.pageOut( 3, 0, 3 ) );
+    EXPECT_EQ( 15u, world.residentCount() );
+    EXPECT_EQ( solid, world.countSolid() );
+
+    // Reading a paged out cube brings the chunk back
+    EXPECT_EQ( 2, materialAt( world, 3 * CHUNK_DIM, 9, 3 * CHUNK_DIM ) );
+    EXPECT_EQ( 16u, world.residentCount() );
+    EXPECT_EQ( solid, world.countSolid() );
+    EXPECT_EQ( 4, materialAt( world, 1, 1, 1 ) );
+}
+
+TEST(ChunkedVolume,FailedPageInKeepsThePagedOutChunk)
+{
+    PageDirectory pages;
+    ASSERT_FALSE( pages.path().empty() );
+
+    ChunkedVolume world( 2, 1, 1, pages.path() );
+
+    for ( size_t z = 0; z < CHUNK_DIM; ++z )
+        for ( size_t x = 0; x < CHUNK_DIM; ++x )
+            world.set( x, 0, z, 3 );
+
+    size_t solid = world.countSolid();
+    ASSERT_TRUE( world.pageOut( 0, 0, 0 ) );
+
+    // Hide the page file so that reading it back fails. It is the only
+    // file in the page directory
+    std::vector<std::string> pageFiles = pages.files();
+    ASSERT_EQ( 1u, pageFiles.size() );
+
+    std::string pagePath   = pageFiles[0];
+    std::string hiddenPath = pages.path() + "/hidden.bin";
+
+    ASSERT_EQ( 0, std::rename( pagePath.c_str(), hiddenPath.c_str() ) );
+
+    Material material = 7;
+    bool isSolid = false;
+
+    EXPECT_FALSE( world.get( 1, 0, 1, material ) );
+    EXPECT_EQ( 7, material );
+    EXPECT_FALSE( world.isSet( 1, 0, 1, isSolid ) );
+    EXPECT_FALSE( world.set( 1, 1, 1, 2 ) );
+
+    // No blank chunk took the paged out one's place
+    EXPECT_EQ( 0u, world.residentCount() );
+    EXPECT_EQ( solid, world.countSolid() );
+
+    // Once the file is back the chunk can be read again
+    ASSERT_EQ( 0, std::rename( hiddenPath.c_str(), pagePath.c_str() ) );
+    EXPECT_EQ( 3, materialAt( world, 1, 0, 1 ) );
+    EXPECT_TRUE( world.isSet( 1, 0, 1, isSolid ) );
+    EXPECT_TRUE( isSolid );
+    EXPECT_EQ( solid, world.countSolid() );
+}
+
+TEST(ChunkedVolume,FailedPageOutKeepsTheChunk)
+{
+    PageDirectory pages;
+    ASSERT_FALSE( pages.path().empty() );
+
+    ChunkedVolume world( 1, 1, 1, pages.path() );
+    ChunkedVolume lost( 1, 1, 1, pages.path() + "/missing" );
+
+    for ( size_t x = 0; x < CHUNK_DIM; ++x )
+    {
+        world.set( x, x, x, 2 );
+        lost.set( x, x, x, 2 );
+    }
+
+    // The page file cannot be created
+    EXPECT_FALSE( lost.pageOut( 0, 0, 0 ) );
+    EXPECT_EQ( 1u, lost.residentCount() );
+
+    // The page file is created but the data does not fit, which is only
+    // noticed once the buffered data is flushed
+    rlimit previous;
+    ASSERT_EQ( 0, getrlimit( RLIMIT_FSIZE, &previous ) );
+
+    rlimit tiny = previous;
+    tiny.rlim_cur = 16;
+
+    void (*previousHandler)( int ) = signal( SIGXFSZ, SIG_IGN );
+    ASSERT_EQ( 0, setrlimit( RLIMIT_FSIZE, &tiny ) );
+
+    bool pagedOut = world.pageOut( 0, 0, 0 );
+
+    setrlimit( RLIMIT_FSIZE, &previous );
+    signal( SIGXFSZ, previousHandler );
+
+    EXPECT_FALSE( pagedOut );
+    EXPECT_EQ( 1u, world.residentCount() );
+    EXPECT_EQ( CHUNK_DIM, world.countSolid() );
+    EXPECT_EQ( 2, materialAt( world, 5, 5, 5 ) );
+
+    // Nothing is left behind in the page directory, and paging works again
+    // once there is room
+    EXPECT_TRUE( pages.files().empty() );
+    EXPECT_TRUE( world.pageOut( 0, 0, 0 ) );
+    EXPECT_EQ( 1u, pages.files().size() );
+    EXPECT_EQ( 2, materialAt( world, 5, 5, 5 ) );
+}